@@ -40,7 +40,6 @@
 #include "datapack.h"
 #include "massert.h"
 
-#include "mainserv.h"
 #include "hddspacemgr.h"
 #include "replicator.h"
 #include "masterconn.h"
@@ -59,12 +58,10 @@ enum {
 	OP_INVAL,
 //	OP_MAINSERV,
 	OP_CHUNKOP,
-//	OP_OPEN,
-//	OP_CLOSE,
-//	OP_READ,
-//	OP_WRITE,
-	OP_SERV_READ,
-	OP_SERV_WRITE,
+	OP_OPEN,
+	OP_CLOSE,
+	OP_READ,
+	OP_WRITE,
 	OP_REPLICATE,
 	OP_GETBLOCKS,
 	OP_GETCHECKSUM,
@@ -77,7 +74,6 @@ typedef struct _chunk_op_args {
 	uint32_t version,newversion,copyversion;
 	uint32_t length;
 } chunk_op_args;
-/*
 // for OP_OPEN and OP_CLOSE
 typedef struct _chunk_oc_args {
 	uint64_t chunkid;
@@ -88,8 +84,7 @@ typedef struct _chunk_oc_args {
 typedef struct _chunk_rd_args {
 	uint64_t chunkid;
 	uint32_t version;
-	uint32_t offset,size;
-	uint16_t blocknum;
+	uint16_t blocknum,blocks;
 	uint8_t *buffer;
 	uint8_t *crcbuff;
 } chunk_rd_args;
@@ -103,14 +98,6 @@ typedef struct _chunk_wr_args {
 	const uint8_t *buffer;
 	const uint8_t *crcbuff;
 } chunk_wr_args;
-*/
-
-// for OP_SERV_READ and OP_SERV_WRITE
-typedef struct _chunk_rw_args {
-	int sock;
-	const uint8_t *packet;
-	uint32_t length;
-} chunk_rw_args;
 
 // for OP_REPLICATE
 typedef struct _chunk_rp_args {
@@ -118,6 +105,7 @@ typedef struct _chunk_rp_args {
 	uint32_t version;
 	uint32_t xormasks[4];
 	uint8_t srccnt;
+	uint8_t striped;
 } chunk_rp_args;
 
 // for OP_GETBLOCKS, OP_GETCHECKSUM and OP_GETCHECKSUMTAB
@@ -146,6 +134,7 @@ typedef struct _jobpool {
 	uint32_t workers_avail;
 	uint32_t workers_total;
 	uint32_t workers_term_waiting;
+	int32_t jobs_queued;	// jobs waiting for io_uring completion (can be temporarily negative - completion may come before worker counts it)
 	pthread_cond_t worker_term_cond;
 	pthread_mutex_t pipelock;
 	pthread_mutex_t jobslock;
@@ -200,6 +189,17 @@ static inline int job_receive_status(jobpool *jp,uint32_t *jobid,uint8_t *status
 	return 1;	// not last
 }
 
+/* callback for disk operations finished by io_uring completion thread */
+static void job_queued_done(uint8_t status,void *extra) {
+	job *jptr = (job*)extra;
+	jobpool *jp = globalpool;
+
+	zassert(pthread_mutex_lock(&(jp->jobslock)));
+	jp->jobs_queued--;
+	zassert(pthread_mutex_unlock(&(jp->jobslock)));
+	job_send_status(jp,jptr->jobid,status);
+}
+
 void* job_worker(void *arg);
 
 static uint32_t lastnotify = 0;
@@ -240,10 +240,9 @@ static inline void job_close_worker(worker *w) {
 }
 
 #define opargs ((chunk_op_args*)(jptr->args))
-// #define ocargs ((chunk_oc_args*)(jptr->args))
-// #define rdargs ((chunk_rd_args*)(jptr->args))
-// #define wrargs ((chunk_wr_args*)(jptr->args))
-#define rwargs ((chunk_rw_args*)(jptr->args))
+#define ocargs ((chunk_oc_args*)(jptr->args))
+#define rdargs ((chunk_rd_args*)(jptr->args))
+#define wrargs ((chunk_wr_args*)(jptr->args))
 #define rpargs ((chunk_rp_args*)(jptr->args))
 #define ijargs ((chunk_ij_args*)(jptr->args))
 void* job_worker(void *arg) {
@@ -252,6 +251,7 @@ void* job_worker(void *arg) {
 	job *jptr;
 	uint8_t *jptrarg;
 	uint8_t status,jstate;
+	int ret;
 	uint32_t jobid;
 	uint32_t op;
 
@@ -279,6 +279,7 @@ void* job_worker(void *arg) {
 			jstate=JSTATE_DISABLED;
 		}
 		zassert(pthread_mutex_unlock(&(jp->jobslock)));
+		ret = 0;
 		switch (op) {
 			case OP_INVAL:
 				status = ERROR_EINVAL;
@@ -300,7 +301,6 @@ void* job_worker(void *arg) {
 					status = hdd_chunkop(opargs->chunkid,opargs->version,opargs->newversion,opargs->copychunkid,opargs->copyversion,opargs->length);
 				}
 				break;
-/*
 			case OP_OPEN:
 				if (jstate==JSTATE_DISABLED) {
 					status = ERROR_NOTDONE;
@@ -319,36 +319,27 @@ void* job_worker(void *arg) {
 				if (jstate==JSTATE_DISABLED) {
 					status = ERROR_NOTDONE;
 				} else {
-					status = hdd_read(rdargs->chunkid,rdargs->version,rdargs->blocknum,rdargs->buffer,rdargs->offset,rdargs->size,rdargs->crcbuff);
+					ret = hdd_read_blocks(rdargs->chunkid,rdargs->version,rdargs->blocknum,rdargs->blocks,rdargs->buffer,rdargs->crcbuff,job_queued_done,jptr);
+					status = (ret==HDD_QUEUED)?STATUS_OK:ret;
 				}
 				break;
 			case OP_WRITE:
 				if (jstate==JSTATE_DISABLED) {
 					status = ERROR_NOTDONE;
 				} else {
-					status = hdd_write(wrargs->chunkid,wrargs->version,wrargs->blocknum,wrargs->buffer,wrargs->offset,wrargs->size,wrargs->crcbuff);
-				}
-				break;
-*/
-			case OP_SERV_READ:
-				if (jstate==JSTATE_DISABLED) {
-					status = ERROR_NOTDONE;
-				} else {
-					status = mainserv_read(rwargs->sock,rwargs->packet,rwargs->length);
-				}
-				break;
-			case OP_SERV_WRITE:
-				if (jstate==JSTATE_DISABLED) {
-					status = ERROR_NOTDONE;
-				} else {
-					status = mainserv_write(rwargs->sock,rwargs->packet,rwargs->length);
+					ret = hdd_write(wrargs->chunkid,wrargs->version,wrargs->blocknum,wrargs->buffer,wrargs->offset,wrargs->size,wrargs->crcbuff,job_queued_done,jptr);
+					status = (ret==HDD_QUEUED)?STATUS_OK:ret;
 				}
 				break;
 			case OP_REPLICATE:
 				if (jstate==JSTATE_DISABLED) {
 					status = ERROR_NOTDONE;
 				} else {
-					status = replicate(rpargs->chunkid,rpargs->version,rpargs->xormasks,rpargs->srccnt,((uint8_t*)(jptr->args))+sizeof(chunk_rp_args));
+					if (rpargs->striped) {
+						status = replicate_striped(rpargs->chunkid,rpargs->version,rpargs->srccnt,((uint8_t*)(jptr->args))+sizeof(chunk_rp_args));
+					} else {
+						status = replicate(rpargs->chunkid,rpargs->version,rpargs->xormasks,rpargs->srccnt,((uint8_t*)(jptr->args))+sizeof(chunk_rp_args));
+					}
 				}
 				break;
 			case OP_GETBLOCKS:
@@ -379,8 +370,13 @@ void* job_worker(void *arg) {
 				zassert(pthread_mutex_unlock(&(jp->jobslock)));
 				return NULL;
 		}
-		job_send_status(jp,jobid,status);
+		if (ret!=HDD_QUEUED) {
+			job_send_status(jp,jobid,status);
+		}
 		zassert(pthread_mutex_lock(&(jp->jobslock)));
+		if (ret==HDD_QUEUED) {
+			jp->jobs_queued++;
+		}
 		jp->workers_avail++;
 		if (jp->workers_avail > jp->workers_max_idle) {
 			job_close_worker(w);
@@ -441,6 +437,7 @@ void* job_pool_new(uint32_t jobs) {
 	jp->workers_avail = 0;
 	jp->workers_total = 0;
 	jp->workers_term_waiting = 0;
+	jp->jobs_queued = 0;
 	zassert(pthread_cond_init(&(jp->worker_term_cond),NULL));
 	zassert(pthread_mutex_init(&(jp->pipelock),NULL));
 	zassert(pthread_mutex_init(&(jp->jobslock),NULL));
@@ -461,7 +458,7 @@ uint32_t job_pool_jobs_count(void) {
 	jobpool* jp = globalpool;
 	uint32_t res;
 	zassert(pthread_mutex_lock(&(jp->jobslock)));
-	res = (jp->workers_total - jp->workers_avail) + queue_elements(jp->jobqueue);
+	res = (jp->workers_total - jp->workers_avail) + queue_elements(jp->jobqueue) + jp->jobs_queued;
 	zassert(pthread_mutex_unlock(&(jp->jobslock)));
 	return res;
 }
@@ -591,7 +588,7 @@ uint32_t job_chunkop(void (*callback)(uint8_t status,void *extra),void *extra,ui
 	args->length = length;
 	return job_new(jp,OP_CHUNKOP,args,callback,extra);
 }
-/*
+
 uint32_t job_open(void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version) {
 	jobpool* jp = globalpool;
 	chunk_oc_args *args;
@@ -612,7 +609,7 @@ uint32_t job_close(void (*callback)(uint8_t status,void *extra),void *extra,uint
 	return job_new(jp,OP_CLOSE,args,callback,extra);
 }
 
-uint32_t job_read(void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer,uint32_t offset,uint32_t size,uint8_t *crcbuff) {
+uint32_t job_read(void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t *buffer,uint8_t *crcbuff) {
 	jobpool* jp = globalpool;
 	chunk_rd_args *args;
 	args = malloc(sizeof(chunk_rd_args));
@@ -620,9 +617,8 @@ uint32_t job_read(void (*callback)(uint8_t status,void *extra),void *extra,uint6
 	args->chunkid = chunkid;
 	args->version = version;
 	args->blocknum = blocknum;
+	args->blocks = blocks;
 	args->buffer = buffer;
-	args->offset = offset;
-	args->size = size;
 	args->crcbuff = crcbuff;
 	return job_new(jp,OP_READ,args,callback,extra);
 }
@@ -641,29 +637,6 @@ uint32_t job_write(void (*callback)(uint8_t status,void *extra),void *extra,uint
 	args->crcbuff = crcbuff;
 	return job_new(jp,OP_WRITE,args,callback,extra);
 }
-*/
-
-uint32_t job_serv_read(void (*callback)(uint8_t status,void *extra),void *extra,int sock,const uint8_t *packet,uint32_t length) {
-	jobpool* jp = globalpool;
-	chunk_rw_args *args;
-	args = malloc(sizeof(chunk_rw_args));
-	passert(args);
-	args->sock = sock;
-	args->packet = packet;
-	args->length = length;
-	return job_new(jp,OP_SERV_READ,args,callback,extra);
-}
-
-uint32_t job_serv_write(void (*callback)(uint8_t status,void *extra),void *extra,int sock,const uint8_t *packet,uint32_t length) {
-	jobpool* jp = globalpool;
-	chunk_rw_args *args;
-	args = malloc(sizeof(chunk_rw_args));
-	passert(args);
-	args->sock = sock;
-	args->packet = packet;
-	args->length = length;
-	return job_new(jp,OP_SERV_WRITE,args,callback,extra);
-}
 
 uint32_t job_replicate_raid(void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint8_t srccnt,const uint32_t xormasks[4],const uint8_t *srcs) {
 	jobpool* jp = globalpool;
@@ -676,6 +649,7 @@ uint32_t job_replicate_raid(void (*callback)(uint8_t status,void *extra),void *e
 	args->chunkid = chunkid;
 	args->version = version;
 	args->srccnt = srccnt;
+	args->striped = 0;
 	args->xormasks[0] = xormasks[0];
 	args->xormasks[1] = xormasks[1];
 	args->xormasks[2] = xormasks[2];
@@ -695,6 +669,7 @@ uint32_t job_replicate_simple(void (*callback)(uint8_t status,void *extra),void
 	args->chunkid = chunkid;
 	args->version = version;
 	args->srccnt = 1;
+	args->striped = 1;
 	args->xormasks[0] = UINT32_C(0x88888888);
 	args->xormasks[1] = UINT32_C(0x44444444);
 	args->xormasks[2] = UINT32_C(0x22222222);
@@ -706,6 +681,26 @@ uint32_t job_replicate_simple(void (*callback)(uint8_t status,void *extra),void
 	return job_new(jp,OP_REPLICATE,args,callback,extra);
 }
 
+uint32_t job_replicate_striped(void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint8_t srccnt,const uint8_t *srcs) {
+	jobpool* jp = globalpool;
+	chunk_rp_args *args;
+	uint8_t *ptr;
+	ptr = malloc(sizeof(chunk_rp_args)+srccnt*18);
+	passert(ptr);
+	args = (chunk_rp_args*)ptr;
+	ptr += sizeof(chunk_rp_args);
+	args->chunkid = chunkid;
+	args->version = version;
+	args->srccnt = srccnt;
+	args->striped = 1;
+	args->xormasks[0] = UINT32_C(0x88888888);
+	args->xormasks[1] = UINT32_C(0x44444444);
+	args->xormasks[2] = UINT32_C(0x22222222);
+	args->xormasks[3] = UINT32_C(0x11111111);
+	memcpy(ptr,srcs,srccnt*18);
+	return job_new(jp,OP_REPLICATE,args,callback,extra);
+}
+
 uint32_t job_get_chunk_blocks(void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint8_t *blocks) {
 	jobpool* jp = globalpool;
 	chunk_ij_args *args;
@@ -769,16 +764,18 @@ void job_heavyload_test(void) {
 	jobpool* jp = globalpool;
 	uint8_t hlstatus = 0;
 	uint32_t load = 0; // make stupid gcc happy
+	uint32_t busy;
 
 	zassert(pthread_mutex_lock(&(jp->jobslock)));
-	if (jp->workers_total - jp->workers_avail > jp->workers_himark) {
+	busy = (jp->workers_total - jp->workers_avail) + jp->jobs_queued;
+	if (busy > jp->workers_himark) {
 		hlstatus = 2;
 	}
-	if (jp->workers_total - jp->workers_avail < jp->workers_lomark) {
+	if (busy < jp->workers_lomark) {
 		hlstatus = 1;
 	}
 	if (hlstatus) {
-		load = (jp->workers_total - jp->workers_avail) + queue_elements(jp->jobqueue);
+		load = busy + queue_elements(jp->jobqueue);
 	}
 	zassert(pthread_mutex_unlock(&(jp->jobslock)));
 
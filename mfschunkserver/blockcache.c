@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "MFSCommunication.h"
+#include "blockcache.h"
+#include "massert.h"
+
+#define BLOCKCACHE_SHARDS 16
+#define BLOCKCACHE_SHARDMASK (BLOCKCACHE_SHARDS-1)
+
+typedef struct cblock {
+	uint64_t chunkid;
+	uint32_t version;
+	uint32_t crc;
+	uint16_t blocknum;
+	struct cblock *hashnext;
+	struct cblock *lrunext,**lruprev;
+	uint8_t data[MFSBLOCKSIZE];
+} cblock;
+
+typedef struct cshard {
+	pthread_mutex_t lock;
+	cblock **hashtab;
+	uint32_t hashmask;
+	cblock *lruhead,**lrutail;
+	uint32_t count;
+	uint32_t maxcount;
+} cshard;
+
+static cshard *shards = NULL;
+
+static inline uint32_t blockcache_hash(uint64_t chunkid,uint16_t blocknum) {
+	uint64_t h;
+	h = (chunkid * UINT64_C(0x9E3779B97F4A7C15)) ^ ((uint64_t)blocknum * UINT64_C(0xC2B2AE3D27D4EB4F));
+	return (h>>32) ^ h;
+}
+
+static inline cshard* blockcache_shard(uint32_t hash) {
+	return shards + (hash & BLOCKCACHE_SHARDMASK);
+}
+
+static inline void blockcache_lru_remove(cshard *s,cblock *cb) {
+	if (cb->lrunext) {
+		cb->lrunext->lruprev = cb->lruprev;
+	} else {
+		s->lrutail = cb->lruprev;
+	}
+	*(cb->lruprev) = cb->lrunext;
+}
+
+static inline void blockcache_lru_append(cshard *s,cblock *cb) {
+	cb->lrunext = NULL;
+	cb->lruprev = s->lrutail;
+	*(s->lrutail) = cb;
+	s->lrutail = &(cb->lrunext);
+}
+
+static inline cblock** blockcache_find(cshard *s,uint32_t hash,uint64_t chunkid,uint32_t version,uint16_t blocknum) {
+	cblock **cbp;
+	cbp = s->hashtab + ((hash / BLOCKCACHE_SHARDS) & s->hashmask);
+	while (*cbp) {
+		if ((*cbp)->chunkid==chunkid && (*cbp)->version==version && (*cbp)->blocknum==blocknum) {
+			return cbp;
+		}
+		cbp = &((*cbp)->hashnext);
+	}
+	return cbp;
+}
+
+uint8_t blockcache_get(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buff,uint32_t *crc) {
+	uint32_t hash;
+	cshard *s;
+	cblock *cb;
+
+	if (shards==NULL) {
+		return 0;
+	}
+	hash = blockcache_hash(chunkid,blocknum);
+	s = blockcache_shard(hash);
+	zassert(pthread_mutex_lock(&(s->lock)));
+	cb = *blockcache_find(s,hash,chunkid,version,blocknum);
+	if (cb==NULL) {
+		zassert(pthread_mutex_unlock(&(s->lock)));
+		return 0;
+	}
+	blockcache_lru_remove(s,cb);
+	blockcache_lru_append(s,cb);
+	memcpy(buff,cb->data,MFSBLOCKSIZE);
+	*crc = cb->crc;
+	zassert(pthread_mutex_unlock(&(s->lock)));
+	return 1;
+}
+
+uint8_t blockcache_check(uint64_t chunkid,uint32_t version,uint16_t blocknum) {
+	uint32_t hash;
+	cshard *s;
+	uint8_t res;
+
+	if (shards==NULL) {
+		return 0;
+	}
+	hash = blockcache_hash(chunkid,blocknum);
+	s = blockcache_shard(hash);
+	zassert(pthread_mutex_lock(&(s->lock)));
+	res = (*blockcache_find(s,hash,chunkid,version,blocknum)!=NULL)?1:0;
+	zassert(pthread_mutex_unlock(&(s->lock)));
+	return res;
+}
+
+void blockcache_put(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buff,uint32_t crc) {
+	uint32_t hash;
+	cshard *s;
+	cblock *cb,**cbp;
+
+	if (shards==NULL) {
+		return;
+	}
+	hash = blockcache_hash(chunkid,blocknum);
+	s = blockcache_shard(hash);
+	zassert(pthread_mutex_lock(&(s->lock)));
+	cbp = blockcache_find(s,hash,chunkid,version,blocknum);
+	cb = *cbp;
+	if (cb!=NULL) {
+		blockcache_lru_remove(s,cb);
+	} else {
+		if (s->count < s->maxcount) {
+			cb = malloc(sizeof(cblock));
+			passert(cb);
+			s->count++;
+		} else { // reuse least recently used block
+			cb = s->lruhead;
+			blockcache_lru_remove(s,cb);
+			*blockcache_find(s,blockcache_hash(cb->chunkid,cb->blocknum),cb->chunkid,cb->version,cb->blocknum) = cb->hashnext;
+			cbp = blockcache_find(s,hash,chunkid,version,blocknum);
+		}
+		cb->chunkid = chunkid;
+		cb->version = version;
+		cb->blocknum = blocknum;
+		cb->hashnext = NULL;
+		*cbp = cb;
+	}
+	memcpy(cb->data,buff,MFSBLOCKSIZE);
+	cb->crc = crc;
+	blockcache_lru_append(s,cb);
+	zassert(pthread_mutex_unlock(&(s->lock)));
+}
+
+void blockcache_remove(uint64_t chunkid,uint32_t version,uint16_t blocknum) {
+	uint32_t hash;
+	cshard *s;
+	cblock *cb,**cbp;
+
+	if (shards==NULL) {
+		return;
+	}
+	hash = blockcache_hash(chunkid,blocknum);
+	s = blockcache_shard(hash);
+	zassert(pthread_mutex_lock(&(s->lock)));
+	cbp = blockcache_find(s,hash,chunkid,version,blocknum);
+	cb = *cbp;
+	if (cb!=NULL) {
+		*cbp = cb->hashnext;
+		blockcache_lru_remove(s,cb);
+		s->count--;
+		free(cb);
+	}
+	zassert(pthread_mutex_unlock(&(s->lock)));
+}
+
+uint8_t blockcache_enabled(void) {
+	return (shards!=NULL)?1:0;
+}
+
+void blockcache_term(void) {
+	uint32_t i;
+	cblock *cb,*ncb;
+
+	if (shards==NULL) {
+		return;
+	}
+	for (i=0 ; i<BLOCKCACHE_SHARDS ; i++) {
+		for (cb=shards[i].lruhead ; cb ; cb=ncb) {
+			ncb = cb->lrunext;
+			free(cb);
+		}
+		free(shards[i].hashtab);
+		zassert(pthread_mutex_destroy(&(shards[i].lock)));
+	}
+	free(shards);
+	shards = NULL;
+}
+
+void blockcache_init(uint64_t size) {
+	uint32_t i,maxcount,hashsize;
+
+	maxcount = size / (BLOCKCACHE_SHARDS * (uint64_t)MFSBLOCKSIZE);
+	if (maxcount==0) {
+		shards = NULL;
+		return;
+	}
+	hashsize = 1;
+	while (hashsize<maxcount) {
+		hashsize<<=1;
+	}
+	shards = malloc(sizeof(cshard)*BLOCKCACHE_SHARDS);
+	passert(shards);
+	for (i=0 ; i<BLOCKCACHE_SHARDS ; i++) {
+		zassert(pthread_mutex_init(&(shards[i].lock),NULL));
+		shards[i].hashtab = calloc(hashsize,sizeof(cblock*));
+		passert(shards[i].hashtab);
+		shards[i].hashmask = hashsize-1;
+		shards[i].lruhead = NULL;
+		shards[i].lrutail = &(shards[i].lruhead);
+		shards[i].count = 0;
+		shards[i].maxcount = maxcount;
+	}
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef _BLOCKCACHE_H_
+#define _BLOCKCACHE_H_
+
+#include <inttypes.h>
+
+/* shared cache of verified (crc checked) chunk blocks - keyed by chunkid/version/blocknum */
+
+/* returns 1 and fills buff (MFSBLOCKSIZE bytes) and crc when block is in cache */
+uint8_t blockcache_get(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buff,uint32_t *crc);
+/* returns 1 when block is in cache (doesn't change lru order) */
+uint8_t blockcache_check(uint64_t chunkid,uint32_t version,uint16_t blocknum);
+void blockcache_put(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buff,uint32_t crc);
+void blockcache_remove(uint64_t chunkid,uint32_t version,uint16_t blocknum);
+uint8_t blockcache_enabled(void);
+
+void blockcache_term(void);
+void blockcache_init(uint64_t size);
+
+#endif
@@ -36,7 +36,6 @@
 
 #include "bgjobs.h"
 #include "csserv.h"
-#include "mainserv.h"
 #include "masterconn.h"
 #include "hddspacemgr.h"
 #include "replicator.h"
@@ -78,10 +77,7 @@ void chartsdata_refresh(void) {
 	masterconn_stats(data+CHARTS_MASTERIN,data+CHARTS_MASTEROUT);
 	job_stats(&jobs);
 	data[CHARTS_LOAD]=jobs;
-	csserv_stats(data+CHARTS_CSSERVIN,data+CHARTS_CSSERVOUT);
-	mainserv_stats(&bin,&bout,&opr,&opw);
-	data[CHARTS_CSSERVIN]+=bin;
-	data[CHARTS_CSSERVOUT]+=bout;
+	csserv_stats(data+CHARTS_CSSERVIN,data+CHARTS_CSSERVOUT,&opr,&opw);
 	data[CHARTS_HLOPR]=opr;
 	data[CHARTS_HLOPW]=opw;
 	hdd_stats(&bin,&bout,&opr,&opw,&dbr,&dbw,&dopr,&dopw,data+CHARTS_RTIME,data+CHARTS_WTIME);
@@ -20,6 +20,8 @@
 
 #include "config.h"
 
+#define MMAP_ALLOC 1
+
 #include <stddef.h>
 #include <time.h>
 #include <sys/types.h>
@@ -31,6 +33,17 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#ifdef MMAP_ALLOC
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
+
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define CSSERV_ZEROCOPY 1
+#endif
 
 #include "MFSCommunication.h"
 
@@ -45,18 +58,39 @@
 #include "charts.h"
 #include "slogger.h"
 #include "bgjobs.h"
+#include "conncache.h"
+#include "crc.h"
 #include "massert.h"
 
 // connection timeout in seconds
 #define CSSERV_TIMEOUT 5
 
+// interval between NOP's sent to client when we are waiting for disk during read
+#define READ_NOPS_INTERVAL 1.0
+
+/* max number of blocks read from disk with one job and sent with one writev */
+#define READ_BATCH_BLOCKS 16
+#define READ_DATA_HDRSIZE (8+8+2+2+4+4)
+
+/* number of unused read buffers kept for next read operations */
+#define READ_BUFFERS_KEPT 32
+
+#define CONNECT_RETRIES 10
+#define CONNECT_TIMEOUT(cnt) (((cnt)%2)?(300*(1<<((cnt)>>1))):(200*(1<<((cnt)>>1))))
+
 #define MaxPacketSize CSTOCS_MAXPACKETSIZE
 
 //csserventry.mode
 enum {HEADER,DATA};
 
 //csserventry.state
-enum {IDLE,READ,WRITE,CLOSE};
+enum {IDLE,READ,WRITEINIT,WRITELAST,WRITEFWD,WRITEFINISH,FLUSHCLOSE,CLOSE,CLOSEWAIT,CLOSED};
+
+//csserventry.fwdstate
+enum {FWD_NONE,FWD_CONNECTING,FWD_CONNECTED,FWD_FAILED};
+
+//csserventry.rwmode
+enum {RW_READ,RW_WRITE};
 
 struct csserventry;
 
@@ -72,26 +106,94 @@ typedef struct idlejob {
 	uint8_t buff[1];
 } idlejob;
 
+// one CLTOCS_WRITE_DATA packet - waiting for disk write and (in the middle of chain) for status from next chunkserver
+typedef struct writejob {
+	uint32_t writeid;
+	uint16_t blocknum;
+	uint16_t offset;
+	uint32_t size;
+	const uint8_t *crcptr;
+	const uint8_t *buff;
+	uint8_t *packet;	// whole packet (with header) - also forwarded to next chunkserver
+	uint8_t hddstatus;
+	uint8_t netstatus;
+	uint8_t ack;	// 1 - written to disk ; 2 - status from next chunkserver received ; 4 - forwarded
+	uint32_t zcfirst;	// MSG_ZEROCOPY sends of this packet (kernel may still use the buffer until they are completed)
+	uint32_t zccnt;
+	uint32_t zcleft;
+	struct writejob *next;
+} writejob;
+
+#define WJOB_HDD 1
+#define WJOB_NET 2
+#define WJOB_FWD 4
+
 typedef struct packetstruct {
 	struct packetstruct *next;
 	uint8_t *startptr;
 	uint32_t bytesleft;
 	uint8_t *packet;
+	writejob *wjob;	// forwarded CLTOCS_WRITE_DATA (packet belongs to write job)
 } packetstruct;
 
+// data of current CLTOCS_READ operation
+typedef struct readbuffer {
+	uint8_t *data;
+	uint8_t crcbuff[4*READ_BATCH_BLOCKS];
+	uint8_t hdrbuff[READ_DATA_HDRSIZE*READ_BATCH_BLOCKS];
+	struct iovec iov[2*READ_BATCH_BLOCKS];
+	uint32_t iovpos,iovcnt;
+	uint16_t blocknum,blocks;
+	struct readbuffer *next;
+} readbuffer;
+
 typedef struct csserventry {
 	uint8_t state;
 	uint8_t mode;
+	uint8_t fwdmode;
+	uint8_t fwdstate;
+	uint8_t protover;
+	uint8_t chunkopen;
+	uint8_t rwmode;
+	uint8_t wjobactive;
+	uint8_t fwdzerocopy;
 
 	int sock;
-	int32_t pdescpos;
+	int fwdsock;
+	void *fdh,*fwdfdh;
+	short fdevents,fwdevents;
 	double lastread,lastwrite;
-	uint32_t activity;
+	double fwdlastwrite;
 	uint8_t hdrbuff[8];
+	uint8_t fwdhdrbuff[8];
 	packetstruct inputpacket;
+	packetstruct fwdinputpacket;
 	packetstruct *outputhead,**outputtail;
+	packetstruct *fwdoutputhead,**fwdoutputtail;
 
-	uint32_t jobid;
+	uint64_t chunkid;
+	uint32_t version;
+
+	uint32_t jobid;	// job_open or job_read
+
+	// CLTOCS_READ
+	uint32_t offset;
+	uint32_t size;
+	readbuffer *rbuff;
+
+	// CLTOCS_WRITE
+	uint8_t openstatus;
+	uint8_t wjoberror;
+	uint8_t connretrycnt;
+	uint32_t fwdip;
+	uint16_t fwdport;
+	double connstart;
+	uint32_t wjobid;
+	writejob *wjobhead,**wjobtail;
+	writejob *wjobhdd;	// first job not written to disk yet
+	writejob *wjobnet;	// first job waiting for status from next chunkserver
+	writejob *zcwaithead;	// acknowledged jobs with data still referenced by zero-copy sends
+	uint32_t zcpending;
 
 	struct idlejob *idlejobs;
 
@@ -100,28 +202,46 @@ typedef struct csserventry {
 
 static csserventry *csservhead=NULL;
 static int lsock;
-static int32_t lsockpdescpos;
+static void *lsockfdh;
+static uint8_t closepending;
+
+static readbuffer *rbufffreehead=NULL;
+static uint32_t rbufffreecnt=0;
 
 static uint32_t mylistenip;
 static uint16_t mylistenport;
 
 static uint64_t stats_bytesin=0;
 static uint64_t stats_bytesout=0;
+static uint32_t stats_hlopr=0;
+static uint32_t stats_hlopw=0;
 
 // from config
 static char *ListenHost;
 static char *ListenPort;
+static uint8_t ForwardZeroCopy;
+
+#ifdef CSSERV_ZEROCOPY
+// number of MSG_ZEROCOPY sends done on each socket (kernel numbers completions in the same way) - sockets are kept in conncache between writes
+static uint32_t *zcsendcnt = NULL;
+static uint32_t zcsendcntsize = 0;
+#endif
+
+static void csserv_update(csserventry *eptr);
 
-void csserv_stats(uint64_t *bin,uint64_t *bout) {
+void csserv_stats(uint64_t *bin,uint64_t *bout,uint32_t *hlopr,uint32_t *hlopw) {
 	*bin = stats_bytesin;
 	*bout = stats_bytesout;
+	*hlopr = stats_hlopr;
+	*hlopw = stats_hlopw;
 	stats_bytesin = 0;
 	stats_bytesout = 0;
+	stats_hlopr = 0;
+	stats_hlopw = 0;
 }
 
-uint8_t* csserv_create_packet(csserventry *eptr,uint32_t type,uint32_t size) {
+static inline packetstruct* csserv_new_outpacket(packetstruct ***tail,uint32_t type,uint32_t size,uint8_t **ptr) {
 	packetstruct *outpacket;
-	uint8_t *ptr;
 	uint32_t psize;
 
 	outpacket=(packetstruct*)malloc(sizeof(packetstruct));
@@ -130,16 +250,45 @@ uint8_t* csserv_create_packet(csserventry *eptr,uint32_t type,uint32_t size) {
 	outpacket->packet=malloc(psize);
 	passert(outpacket->packet);
 	outpacket->bytesleft = psize;
-	ptr = outpacket->packet;
-	put32bit(&ptr,type);
-	put32bit(&ptr,size);
+	*ptr = outpacket->packet;
+	put32bit(ptr,type);
+	put32bit(ptr,size);
 	outpacket->startptr = (uint8_t*)(outpacket->packet);
+	outpacket->wjob = NULL;
 	outpacket->next = NULL;
-	*(eptr->outputtail) = outpacket;
-	eptr->outputtail = &(outpacket->next);
+	**tail = outpacket;
+	*tail = &(outpacket->next);
+	return outpacket;
+}
+
+uint8_t* csserv_create_packet(csserventry *eptr,uint32_t type,uint32_t size) {
+	uint8_t *ptr;
+	csserv_new_outpacket(&(eptr->outputtail),type,size,&ptr);
+	return ptr;
+}
+
+uint8_t* csserv_create_fwd_packet(csserventry *eptr,uint32_t type,uint32_t size) {
+	uint8_t *ptr;
+	csserv_new_outpacket(&(eptr->fwdoutputtail),type,size,&ptr);
 	return ptr;
 }
 
+static inline void csserv_free_packets(packetstruct *pptr) {
+	packetstruct *paptr;
+	while (pptr) {
+		if (pptr->packet) {
+			free(pptr->packet);
+		}
+		paptr = pptr;
+		pptr = pptr->next;
+		free(paptr);
+	}
+}
+
+static inline uint8_t csserv_output_pending(csserventry *eptr) {
+	return (eptr->outputhead!=NULL || (eptr->rbuff!=NULL && eptr->rbuff->iovpos<eptr->rbuff->iovcnt))?1:0;
+}
+
 void csserv_get_version(csserventry *eptr,const uint8_t *data,uint32_t length) {
 	uint32_t msgid = 0;
 	uint8_t *ptr;
@@ -162,28 +311,735 @@ void csserv_get_version(csserventry *eptr,const uint8_t *data,uint32_t length) {
 	memcpy(ptr,vstring,strlen(vstring));
 }
 
-void csserv_iothread_finished(uint8_t status,void *e) {
+/* common for READ and WRITE */
+
+static void csserv_chunk_close(csserventry *eptr) {
+	if (eptr->chunkopen) {
+		job_close(NULL,NULL,eptr->chunkid);
+		eptr->chunkopen = 0;
+		if (eptr->rwmode==RW_READ) {
+			stats_hlopr++;
+		} else {
+			stats_hlopw++;
+		}
+	}
+}
+
+/* all jobs finished after connection has been closed - release chunk and mark entry to be freed */
+static void csserv_closewait_check(csserventry *eptr) {
+	if (eptr->jobid==0 && eptr->wjobactive==0) {
+		csserv_chunk_close(eptr);
+		eptr->state = CLOSED;
+		closepending = 1;
+	}
+}
+
+/* READ */
+
+#ifdef MMAP_ALLOC
+# define READ_BUFFER_ALLOC() mmap(NULL,READ_BATCH_BLOCKS*MFSBLOCKSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0)
+# define READ_BUFFER_FREE(ptr) munmap(ptr,READ_BATCH_BLOCKS*MFSBLOCKSIZE)
+# define READ_BUFFER_FAILED MAP_FAILED
+#else
+# define READ_BUFFER_ALLOC() malloc(READ_BATCH_BLOCKS*MFSBLOCKSIZE)
+# define READ_BUFFER_FREE(ptr) free(ptr)
+# define READ_BUFFER_FAILED NULL
+#endif
+
+static readbuffer* csserv_readbuffer_get(void) {
+	readbuffer *rb;
+	if (rbufffreehead) {
+		rb = rbufffreehead;
+		rbufffreehead = rb->next;
+		rbufffreecnt--;
+	} else {
+		rb = malloc(sizeof(readbuffer));
+		passert(rb);
+		rb->data = READ_BUFFER_ALLOC();
+		sassert(rb->data!=READ_BUFFER_FAILED);
+	}
+	rb->iovpos = 0;
+	rb->iovcnt = 0;
+	rb->next = NULL;
+	return rb;
+}
+
+static void csserv_readbuffer_release(readbuffer *rb) {
+	if (rbufffreecnt<READ_BUFFERS_KEPT) {
+		rb->next = rbufffreehead;
+		rbufffreehead = rb;
+		rbufffreecnt++;
+	} else {
+		READ_BUFFER_FREE(rb->data);
+		free(rb);
+	}
+}
+
+static void csserv_read_status(csserventry *eptr,uint8_t status) {
+	uint8_t *ptr;
+	ptr = csserv_create_packet(eptr,CSTOCL_READ_STATUS,8+1);
+	put64bit(&ptr,eptr->chunkid);
+	put8bit(&ptr,status);
+}
+
+static void csserv_read_end(csserventry *eptr,uint8_t status) {
+	csserv_chunk_close(eptr);
+	if (eptr->rbuff) {
+		csserv_readbuffer_release(eptr->rbuff);
+		eptr->rbuff = NULL;
+	}
+	csserv_read_status(eptr,status);
+	eptr->state = IDLE;
+}
+
+void csserv_read_finished(uint8_t status,void *e) {
+	csserventry *eptr = (csserventry*)e;
+	readbuffer *rb;
+	uint32_t blocksize,blockoffset,crc;
+	uint16_t b;
+	const uint8_t *rptr;
+	uint8_t *wptr;
+
+	eptr->jobid = 0;
+	if (eptr->state==CLOSEWAIT) {
+		csserv_closewait_check(eptr);
+		return;
+	}
+	if (status!=STATUS_OK) {
+		csserv_read_end(eptr,status);
+		csserv_update(eptr);
+		return;
+	}
+	// one CSTOCL_READ_DATA packet per block - headers and data are sent together with one writev
+	rb = eptr->rbuff;
+	rb->iovpos = 0;
+	rb->iovcnt = 0;
+	for (b=0 ; b<rb->blocks ; b++) {
+		blockoffset = (eptr->offset)&MFSBLOCKMASK;
+		if (((eptr->offset+eptr->size-1)>>MFSBLOCKBITS) == (uint32_t)(rb->blocknum+b)) {	// last block
+			blocksize = eptr->size;
+		} else {
+			blocksize = MFSBLOCKSIZE-blockoffset;
+		}
+		rptr = rb->crcbuff+4*b;
+		crc = get32bit(&rptr);
+		if (blocksize<MFSBLOCKSIZE) {
+			crc = mycrc32(0,rb->data+(b<<MFSBLOCKBITS)+blockoffset,blocksize);
+		}
+		wptr = rb->hdrbuff+(b*READ_DATA_HDRSIZE);
+		put32bit(&wptr,CSTOCL_READ_DATA);
+		put32bit(&wptr,8+2+2+4+4+blocksize);
+		put64bit(&wptr,eptr->chunkid);
+		put16bit(&wptr,rb->blocknum+b);
+		put16bit(&wptr,blockoffset);
+		put32bit(&wptr,blocksize);
+		put32bit(&wptr,crc);
+		rb->iov[rb->iovcnt].iov_base = rb->hdrbuff+(b*READ_DATA_HDRSIZE);
+		rb->iov[rb->iovcnt].iov_len = READ_DATA_HDRSIZE;
+		rb->iovcnt++;
+		rb->iov[rb->iovcnt].iov_base = rb->data+(b<<MFSBLOCKBITS)+blockoffset;
+		rb->iov[rb->iovcnt].iov_len = blocksize;
+		rb->iovcnt++;
+		eptr->offset += blocksize;
+		eptr->size -= blocksize;
+	}
+	csserv_update(eptr);
+}
+
+/* previous batch has been sent - read next blocks or finish */
+static void csserv_read_continue(csserventry *eptr) {
+	readbuffer *rb = eptr->rbuff;
+	uint16_t blocks;
+
+	if (eptr->size==0) {
+		csserv_read_end(eptr,STATUS_OK);
+		return;
+	}
+	rb->blocknum = (eptr->offset)>>MFSBLOCKBITS;
+	blocks = (((eptr->offset+eptr->size-1)>>MFSBLOCKBITS) - rb->blocknum) + 1;
+	if (blocks>READ_BATCH_BLOCKS) {
+		blocks = READ_BATCH_BLOCKS;
+	}
+	rb->blocks = blocks;
+	rb->iovpos = 0;
+	rb->iovcnt = 0;
+	eptr->jobid = 1;	// job can be finished before job_read returns (during exit)
+	eptr->jobid = job_read(csserv_read_finished,eptr,eptr->chunkid,eptr->version,rb->blocknum,blocks,rb->data,rb->crcbuff);
+}
+
+void csserv_read_opened(uint8_t status,void *e) {
 	csserventry *eptr = (csserventry*)e;
-	if (status==0) {
+
+	eptr->jobid = 0;
+	if (status==STATUS_OK) {
+		eptr->chunkopen = 1;
+	}
+	if (eptr->state==CLOSEWAIT) {
+		csserv_closewait_check(eptr);
+		return;
+	}
+	if (status!=STATUS_OK) {
+		csserv_read_end(eptr,status);
+	} else {
+		eptr->rbuff = csserv_readbuffer_get();
+	}
+	csserv_update(eptr);
+}
+
+void csserv_read_init(csserventry *eptr,const uint8_t *data,uint32_t length) {
+	if (length!=20 && length!=21) {
+		syslog(LOG_NOTICE,"CLTOCS_READ - wrong size (%"PRIu32"/20|21)",length);
 		eptr->state = CLOSE;
+		return;
+	}
+	if (length==21) {
+		eptr->protover = get8bit(&data);
+	} else {
+		eptr->protover = 0;
+	}
+	eptr->chunkid = get64bit(&data);
+	eptr->version = get32bit(&data);
+	eptr->offset = get32bit(&data);
+	eptr->size = get32bit(&data);
+	if (eptr->size==0) {
+		csserv_read_status(eptr,STATUS_OK);	// no bytes to read - just return STATUS_OK
+		return;
+	}
+	if (eptr->size>MFSCHUNKSIZE) {
+		csserv_read_status(eptr,ERROR_WRONGSIZE);
+		return;
+	}
+	if (eptr->offset>=MFSCHUNKSIZE || eptr->offset+eptr->size>MFSCHUNKSIZE) {
+		csserv_read_status(eptr,ERROR_WRONGOFFSET);
+		return;
+	}
+	eptr->state = READ;
+	eptr->rwmode = RW_READ;
+	eptr->jobid = 1;
+	eptr->jobid = job_open(csserv_read_opened,eptr,eptr->chunkid,eptr->version);
+}
+
+/* WRITE */
+
+static void csserv_write_status(csserventry *eptr,uint32_t writeid,uint8_t status) {
+	uint8_t *ptr;
+	ptr = csserv_create_packet(eptr,CSTOCL_WRITE_STATUS,8+4+1);
+	put64bit(&ptr,eptr->chunkid);
+	put32bit(&ptr,writeid);
+	put8bit(&ptr,status);
+}
+
+/* zero-copy forwarding of written data (MSG_ZEROCOPY) - buffer of CLTOCS_WRITE_DATA packet can't be freed until kernel reports that it doesn't need it any more */
+
+#ifdef CSSERV_ZEROCOPY
+static inline uint32_t* csserv_zc_sendcnt(int sock) {
+	uint32_t newsize;
+	if ((uint32_t)sock>=zcsendcntsize) {
+		newsize = (sock+1024)&(~1023);
+		zcsendcnt = realloc(zcsendcnt,sizeof(uint32_t)*newsize);
+		passert(zcsendcnt);
+		memset(zcsendcnt+zcsendcntsize,0,sizeof(uint32_t)*(newsize-zcsendcntsize));
+		zcsendcntsize = newsize;
+	}
+	return zcsendcnt+sock;
+}
+#endif
+
+/* new socket (fresh=1) or socket taken from conncache */
+static void csserv_fwd_zc_init(csserventry *eptr,uint8_t fresh) {
+#ifdef CSSERV_ZEROCOPY
+	int on = 1;
+	if (fresh) {
+		*csserv_zc_sendcnt(eptr->fwdsock) = 0;
+	}
+	eptr->fwdzerocopy = 0;
+	if (ForwardZeroCopy && setsockopt(eptr->fwdsock,SOL_SOCKET,SO_ZEROCOPY,&on,sizeof(on))>=0) {
+		eptr->fwdzerocopy = 1;
+	}
+#else
+	(void)fresh;
+	eptr->fwdzerocopy = 0;
+#endif
+}
+
+static inline void csserv_wjob_free(csserventry *eptr,writejob *wj) {
+	if (wj->zcleft>0) {
+		if (eptr->fwdsock>=0) {
+			wj->next = eptr->zcwaithead;
+			eptr->zcwaithead = wj;
+			return;
+		}
+		eptr->zcpending -= wj->zcleft;
+	}
+	free(wj->packet);
+	free(wj);
+}
+
+#ifdef CSSERV_ZEROCOPY
+static inline void csserv_wjob_zc_done(csserventry *eptr,writejob *wj,uint32_t lo,uint32_t hi) {
+	uint32_t first,last;
+
+	if (wj->zcleft==0) {
+		return;
+	}
+	first = wj->zcfirst;
+	last = wj->zcfirst+wj->zccnt-1;
+	if (lo>first) {
+		first = lo;
+	}
+	if (hi<last) {
+		last = hi;
+	}
+	if (first<=last) {
+		wj->zcleft -= (last-first+1);
+		eptr->zcpending -= (last-first+1);
+	}
+}
+
+static void csserv_fwd_zc_completed(csserventry *eptr) {
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *serr;
+	uint8_t control[128];
+	writejob *wj,**wjp;
+
+	for (;;) {
+		memset(&msg,0,sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(eptr->fwdsock,&msg,MSG_ERRQUEUE)<0) {
+			break;
+		}
+		for (cm=CMSG_FIRSTHDR(&msg) ; cm!=NULL ; cm=CMSG_NXTHDR(&msg,cm)) {
+			if (cm->cmsg_level!=SOL_IP || cm->cmsg_type!=IP_RECVERR) {
+				continue;
+			}
+			serr = (struct sock_extended_err*)CMSG_DATA(cm);
+			if (serr->ee_errno!=0 || serr->ee_origin!=SO_EE_ORIGIN_ZEROCOPY) {
+				continue;
+			}
+			for (wj=eptr->wjobhead ; wj ; wj=wj->next) {
+				csserv_wjob_zc_done(eptr,wj,serr->ee_info,serr->ee_data);
+			}
+			for (wj=eptr->zcwaithead ; wj ; wj=wj->next) {
+				csserv_wjob_zc_done(eptr,wj,serr->ee_info,serr->ee_data);
+			}
+		}
+	}
+	wjp = &(eptr->zcwaithead);
+	while ((wj=*wjp)!=NULL) {
+		if (wj->zcleft==0) {
+			*wjp = wj->next;
+			free(wj->packet);
+			free(wj);
+		} else {
+			wjp = &(wj->next);
+		}
+	}
+}
+#endif
+
+static void csserv_fwd_close(csserventry *eptr) {
+	writejob *wj;
+	struct linger l;
+
+	if (eptr->fwdsock>=0) {
+		if (eptr->fwdfdh) {
+			main_fd_unregister(eptr->fwdfdh);
+			eptr->fwdfdh = NULL;
+		}
+		if (eptr->zcpending>0) { // reset connection - buffers of pending zero-copy sends are freed below
+			l.l_onoff = 1;
+			l.l_linger = 0;
+			setsockopt(eptr->fwdsock,SOL_SOCKET,SO_LINGER,&l,sizeof(l));
+		}
+		tcpclose(eptr->fwdsock);
+		eptr->fwdsock = -1;
+	}
+	while ((wj=eptr->zcwaithead)!=NULL) {
+		eptr->zcwaithead = wj->next;
+		csserv_wjob_free(eptr,wj);
+	}
+	if (eptr->fwdinputpacket.packet) {
+		free(eptr->fwdinputpacket.packet);
+		eptr->fwdinputpacket.packet = NULL;
+	}
+	csserv_free_packets(eptr->fwdoutputhead);
+	eptr->fwdoutputhead = NULL;
+	eptr->fwdoutputtail = &(eptr->fwdoutputhead);
+	eptr->fwdstate = FWD_NONE;
+}
+
+static void csserv_wjobs_free(csserventry *eptr) {
+	writejob *wj,*nwj;
+	for (wj=eptr->wjobhead ; wj ; wj=nwj) {
+		nwj = wj->next;
+		csserv_wjob_free(eptr,wj);
+	}
+	eptr->wjobhead = NULL;
+	eptr->wjobtail = &(eptr->wjobhead);
+	eptr->wjobhdd = NULL;
+	eptr->wjobnet = NULL;
+}
+
+/* send statuses of finished writes (in order) */
+static void csserv_write_acks(csserventry *eptr) {
+	writejob *wj;
+	uint8_t status;
+	uint8_t needed;
+
+	needed = (eptr->state==WRITEFWD)?(WJOB_HDD|WJOB_NET|WJOB_FWD):WJOB_HDD;
+	while ((wj=eptr->wjobhead)!=NULL) {
+		if ((wj->ack & WJOB_HDD) && wj->hddstatus!=STATUS_OK) {
+			status = wj->hddstatus;
+		} else if ((wj->ack & WJOB_NET) && wj->netstatus!=STATUS_OK) {
+			status = wj->netstatus;
+		} else if ((wj->ack & needed)==needed) {
+			status = STATUS_OK;
+		} else {
+			return;
+		}
+		csserv_write_status(eptr,wj->writeid,status);
+		if (status!=STATUS_OK) {
+			eptr->wjoberror = 1;
+			eptr->state = FLUSHCLOSE;
+			return;
+		}
+		eptr->wjobhead = wj->next;
+		if (eptr->wjobhead==NULL) {
+			eptr->wjobtail = &(eptr->wjobhead);
+		}
+		csserv_wjob_free(eptr,wj);
+	}
+}
+
+static void csserv_write_next(csserventry *eptr);
+
+void csserv_write_finished(uint8_t status,void *e) {
+	csserventry *eptr = (csserventry*)e;
+	writejob *wj;
+
+	eptr->wjobactive = 0;
+	eptr->wjobid = 0;
+	if (eptr->state==CLOSEWAIT) {
+		csserv_closewait_check(eptr);
+		return;
+	}
+	wj = eptr->wjobhdd;
+	wj->hddstatus = status;
+	wj->ack |= WJOB_HDD;
+	eptr->wjobhdd = wj->next;
+	eptr->lastread = monotonic_seconds();	// don't count disk time as client inactivity
+	if (status!=STATUS_OK) {
+		eptr->wjoberror = 1;
+	}
+	if (eptr->state==WRITELAST || eptr->state==WRITEFWD) {
+		csserv_write_acks(eptr);
+		csserv_write_next(eptr);
+	}
+	csserv_update(eptr);
+}
+
+/* writes have to be done in order, so only one write job per connection is active */
+static void csserv_write_next(csserventry *eptr) {
+	writejob *wj;
+
+	if (eptr->wjobactive || eptr->wjoberror || eptr->wjobhdd==NULL) {
+		return;
+	}
+	if (eptr->state!=WRITELAST && eptr->state!=WRITEFWD) {
+		return;
+	}
+	wj = eptr->wjobhdd;
+	eptr->wjobactive = 1;
+	eptr->wjobid = job_write(csserv_write_finished,eptr,eptr->chunkid,eptr->version,wj->blocknum,wj->buff,wj->offset,wj->size,wj->crcptr);
+}
+
+/* all writes done and CLTOCS_WRITE_FINISH forwarded - back to IDLE state */
+static void csserv_write_end(csserventry *eptr) {
+	uint8_t clean;
+
+	clean = (eptr->wjobhead==NULL && eptr->wjoberror==0)?1:0;
+	csserv_chunk_close(eptr);
+	csserv_wjobs_free(eptr);
+	if (eptr->fwdsock>=0) {
+#ifdef CSSERV_ZEROCOPY
+		if (eptr->fwdzerocopy) {
+			csserv_fwd_zc_completed(eptr);
+		}
+#endif
+		// socket with zero-copy sends still in progress is not reused
+		if (clean && eptr->zcpending==0 && eptr->protover && eptr->fwdstate==FWD_CONNECTED && eptr->fwdinputpacket.packet==NULL && eptr->fwdmode==HEADER && eptr->fwdinputpacket.bytesleft==8) {
+			main_fd_unregister(eptr->fwdfdh);
+			eptr->fwdfdh = NULL;
+			conncache_insert(eptr->fwdip,eptr->fwdport,eptr->fwdsock);
+			eptr->fwdsock = -1;
+		}
+		csserv_fwd_close(eptr);
+	}
+	eptr->state = IDLE;
+}
+
+static void csserv_write_init_check(csserventry *eptr) {
+	uint8_t status;
+
+	if (eptr->state!=WRITEINIT || eptr->jobid!=0 || eptr->fwdstate==FWD_CONNECTING) {
+		return;
+	}
+	if (eptr->fwdstate==FWD_FAILED) {
+		status = ERROR_CANTCONNECT;
 	} else {
+		status = eptr->openstatus;
+	}
+	if (status!=STATUS_OK) {
+		csserv_chunk_close(eptr);
+		csserv_fwd_close(eptr);
+		csserv_write_status(eptr,0,status);
 		eptr->state = IDLE;
+		return;
+	}
+	if (eptr->fwdsock>=0) {
+		// status of this write will be sent by the last chunkserver in chain
+		eptr->state = WRITEFWD;
+	} else {
+		csserv_write_status(eptr,0,STATUS_OK);
+		eptr->state = WRITELAST;
 	}
+}
+
+void csserv_write_opened(uint8_t status,void *e) {
+	csserventry *eptr = (csserventry*)e;
+
 	eptr->jobid = 0;
-	if (eptr->inputpacket.packet) {
-		free(eptr->inputpacket.packet);
+	eptr->openstatus = status;
+	if (status==STATUS_OK) {
+		eptr->chunkopen = 1;
+	}
+	if (eptr->state==CLOSEWAIT) {
+		csserv_closewait_check(eptr);
+		return;
 	}
-	eptr->inputpacket.packet=NULL;
+	csserv_write_init_check(eptr);
+	csserv_update(eptr);
 }
 
-void csserv_read_init(csserventry *eptr,const uint8_t *data,uint32_t length) {
-	eptr->state = READ;
-	eptr->jobid = job_serv_read(csserv_iothread_finished,eptr,eptr->sock,data,length);
+void csserv_fwd_fdserve(void *udata,short revents);
+
+static void csserv_fwd_connected(csserventry *eptr) {
+	eptr->fwdstate = FWD_CONNECTED;
+	eptr->fwdmode = HEADER;
+	eptr->fwdinputpacket.bytesleft = 8;
+	eptr->fwdinputpacket.startptr = eptr->fwdhdrbuff;
+	eptr->fwdinputpacket.packet = NULL;
+	eptr->fwdlastwrite = monotonic_seconds();
+}
+
+static void csserv_fwd_connect(csserventry *eptr) {
+	int status;
+
+	while (eptr->connretrycnt<CONNECT_RETRIES) {
+		if (eptr->connretrycnt==0) {
+			eptr->fwdsock = conncache_get(eptr->fwdip,eptr->fwdport);
+			if (eptr->fwdsock>=0) {
+				csserv_fwd_zc_init(eptr,0);
+				eptr->fwdfdh = main_fd_register(eptr->fwdsock,POLLIN,csserv_fwd_fdserve,eptr);
+				eptr->fwdevents = POLLIN;
+				csserv_fwd_connected(eptr);
+				return;
+			}
+		}
+		eptr->fwdsock = tcpsocket();
+		if (eptr->fwdsock<0) {
+			mfs_errlog(LOG_WARNING,"create socket, error");
+			break;
+		}
+		csserv_fwd_zc_init(eptr,1);
+		if (tcpnonblock(eptr->fwdsock)<0) {
+			mfs_errlog(LOG_WARNING,"set nonblock, error");
+			tcpclose(eptr->fwdsock);
+			eptr->fwdsock = -1;
+			break;
+		}
+		status = tcpnumconnect(eptr->fwdsock,eptr->fwdip,eptr->fwdport);
+		if (status<0) {
+			mfs_arg_errlog(LOG_WARNING,"connect to %u.%u.%u.%u:%u failed, error",(eptr->fwdip>>24)&0xFF,(eptr->fwdip>>16)&0xFF,(eptr->fwdip>>8)&0xFF,eptr->fwdip&0xFF,eptr->fwdport);
+			tcpclose(eptr->fwdsock);
+			eptr->fwdsock = -1;
+			eptr->connretrycnt++;
+			continue;
+		}
+		if (tcpnodelay(eptr->fwdsock)<0) {
+			mfs_errlog(LOG_WARNING,"can't set TCP_NODELAY, error");
+		}
+		if (status==0) {
+			eptr->fwdfdh = main_fd_register(eptr->fwdsock,POLLIN,csserv_fwd_fdserve,eptr);
+			eptr->fwdevents = POLLIN;
+			csserv_fwd_connected(eptr);
+		} else {
+			eptr->fwdfdh = main_fd_register(eptr->fwdsock,POLLOUT,csserv_fwd_fdserve,eptr);
+			eptr->fwdevents = POLLOUT;
+			eptr->fwdstate = FWD_CONNECTING;
+			eptr->connstart = monotonic_seconds();
+		}
+		return;
+	}
+	eptr->fwdstate = FWD_FAILED;
+}
+
+static void csserv_fwd_connect_failed(csserventry *eptr) {
+	main_fd_unregister(eptr->fwdfdh);
+	eptr->fwdfdh = NULL;
+	tcpclose(eptr->fwdsock);
+	eptr->fwdsock = -1;
+	eptr->connretrycnt++;
+	csserv_fwd_connect(eptr);
 }
 
 void csserv_write_init(csserventry *eptr,const uint8_t *data,uint32_t length) {
-	eptr->state = WRITE;
-	eptr->jobid = job_serv_write(csserv_iothread_finished,eptr,eptr->sock,data,length);
+	uint8_t *ptr;
+	uint32_t hdrsize;
+
+	if (length&1) {
+		if (length<13 || ((length-13)%6)!=0) {
+			syslog(LOG_NOTICE,"CLTOCS_WRITE - wrong size (%"PRIu32"/12+N*6)",length);
+			eptr->state = CLOSE;
+			return;
+		}
+		eptr->protover = get8bit(&data);
+		hdrsize = 13;
+	} else {
+		if (length<12 || ((length-12)%6)!=0) {
+			syslog(LOG_NOTICE,"CLTOCS_WRITE - wrong size (%"PRIu32"/12+N*6)",length);
+			eptr->state = CLOSE;
+			return;
+		}
+		eptr->protover = 0;
+		hdrsize = 12;
+	}
+	eptr->chunkid = get64bit(&data);
+	eptr->version = get32bit(&data);
+	eptr->state = WRITEINIT;
+	eptr->rwmode = RW_WRITE;
+	eptr->openstatus = STATUS_OK;
+	eptr->wjoberror = 0;
+	eptr->connretrycnt = 0;
+	if (length>hdrsize) { // write and forward data
+		eptr->fwdip = get32bit(&data);
+		eptr->fwdport = get16bit(&data);
+		// rest of chain for next chunkserver - sent when connection is established
+		ptr = csserv_create_fwd_packet(eptr,CLTOCS_WRITE,length-6);
+		if (eptr->protover) {
+			put8bit(&ptr,eptr->protover);
+		}
+		put64bit(&ptr,eptr->chunkid);
+		put32bit(&ptr,eptr->version);
+		memcpy(ptr,data,length-hdrsize-6);
+		csserv_fwd_connect(eptr);
+	}
+	eptr->jobid = 1;
+	eptr->jobid = job_open(csserv_write_opened,eptr,eptr->chunkid,eptr->version);
+	csserv_write_init_check(eptr);
+}
+
+void csserv_write_data(csserventry *eptr,const uint8_t *data,uint32_t length) {
+	writejob *wj;
+	packetstruct *fwdpacket;
+	uint64_t chunkid;
+
+	if (length<8+4+2+2+4+4) {
+		syslog(LOG_NOTICE,"CLTOCS_WRITE_DATA - wrong size (%"PRIu32"/24+size)",length);
+		eptr->state = CLOSE;
+		return;
+	}
+	wj = malloc(sizeof(writejob));
+	passert(wj);
+	chunkid = get64bit(&data);
+	wj->writeid = get32bit(&data);
+	wj->blocknum = get16bit(&data);
+	wj->offset = get16bit(&data);
+	wj->size = get32bit(&data);
+	if (length!=8+4+2+2+4+4+wj->size) {
+		syslog(LOG_NOTICE,"CLTOCS_WRITE_DATA - wrong size (%"PRIu32"/24+%"PRIu32")",length,wj->size);
+		free(wj);
+		eptr->state = CLOSE;
+		return;
+	}
+	if (chunkid!=eptr->chunkid) {
+		free(wj);
+		csserv_write_status(eptr,0,ERROR_WRONGCHUNKID);
+		eptr->state = FLUSHCLOSE;
+		return;
+	}
+	// take input packet (data are written directly from it)
+	wj->packet = eptr->inputpacket.packet;
+	eptr->inputpacket.packet = NULL;
+	wj->crcptr = data;
+	wj->buff = data+4;
+	wj->hddstatus = 0xFF;
+	wj->netstatus = 0xFF;
+	wj->ack = 0;
+	wj->zcfirst = 0;
+	wj->zccnt = 0;
+	wj->zcleft = 0;
+	wj->next = NULL;
+	*(eptr->wjobtail) = wj;
+	eptr->wjobtail = &(wj->next);
+	if (eptr->wjobhdd==NULL) {
+		eptr->wjobhdd = wj;
+	}
+	if (eptr->state==WRITEFWD) {
+		if (eptr->wjobnet==NULL) {
+			eptr->wjobnet = wj;
+		}
+		fwdpacket = malloc(sizeof(packetstruct));
+		passert(fwdpacket);
+		fwdpacket->packet = NULL;
+		fwdpacket->wjob = wj;
+		fwdpacket->startptr = wj->packet;
+		fwdpacket->bytesleft = length+8;
+		fwdpacket->next = NULL;
+		*(eptr->fwdoutputtail) = fwdpacket;
+		eptr->fwdoutputtail = &(fwdpacket->next);
+	}
+	csserv_write_next(eptr);
+}
+
+void csserv_write_nop(csserventry *eptr) {
+	if (eptr->state==WRITEFWD) {
+		csserv_create_fwd_packet(eptr,ANTOAN_NOP,0);
+	}
+	csserv_create_packet(eptr,ANTOAN_NOP,0);
+}
+
+void csserv_write_finish(csserventry *eptr,const uint8_t *data,uint32_t length) {
+	const uint8_t *rptr;
+	uint64_t chunkid;
+	uint32_t version;
+	uint8_t *ptr;
+
+	if (length<12) {
+		syslog(LOG_NOTICE,"CLTOCS_WRITE_FINISH - wrong size (%"PRIu32"/12)",length);
+		eptr->state = CLOSE;
+		return;
+	}
+	rptr = data;
+	chunkid = get64bit(&rptr);
+	version = get32bit(&rptr);
+	if (chunkid!=eptr->chunkid || version!=eptr->version) {
+		csserv_write_status(eptr,0,ERROR_WRONGCHUNKID);
+		eptr->state = FLUSHCLOSE;
+		return;
+	}
+	if (eptr->state==WRITEFWD) {
+		ptr = csserv_create_fwd_packet(eptr,CLTOCS_WRITE_FINISH,length);
+		memcpy(ptr,data,length);
+	}
+	// not acknowledged writes - connection to next chunkserver can't be reused
+	if (eptr->wjobhead!=NULL) {
+		eptr->wjoberror = 1;
+	}
+	// writes not started yet are abandoned - wait only for current one and for forwarded data
+	eptr->state = WRITEFINISH;
 }
 
 /* IDLE operations */
@@ -240,10 +1096,10 @@ void csserv_idlejob_finished(uint8_t status,void *ijp) {
 		if (ij->next) {
 			ij->next->prev = ij->prev;
 		}
+		csserv_update(eptr);
 	}
 	free(ij);
 }
-
 void csserv_get_chunk_blocks(csserventry *eptr,const uint8_t *data,uint32_t length) {
 	idlejob *ij;
 
@@ -407,13 +1263,16 @@ void csserv_module_info(csserventry *eptr,const uint8_t *data,uint32_t length) {
 	put16bit(&ptr,masterconn_getmasterport());
 }
 
+/* connection management */
+
 void csserv_close(csserventry *eptr) {
 	idlejob *ij,*nij;
 
-	if (eptr->jobid>0 && (eptr->state==READ || eptr->state==WRITE)) {
-		job_pool_disable_job(eptr->jobid);
-		job_pool_change_callback(eptr->jobid,NULL,NULL);
-	}
+	main_fd_unregister(eptr->fdh);
+	eptr->fdh = NULL;
+	tcpclose(eptr->sock);
+	eptr->sock = -1;
+	csserv_fwd_close(eptr);
 
 	for (ij=eptr->idlejobs ; ij ; ij=nij) {
 		nij = ij->next;
@@ -422,11 +1281,37 @@ void csserv_close(csserventry *eptr) {
 		ij->prev = NULL;
 		ij->eptr = NULL;
 	}
+	eptr->idlejobs = NULL;
+
+	if (eptr->jobid>0) {
+		job_pool_disable_job(eptr->jobid);
+	}
+	if (eptr->wjobactive) {
+		job_pool_disable_job(eptr->wjobid);
+	}
+	// entry can't be freed before callbacks of pending jobs are called
+	eptr->state = CLOSEWAIT;
+	csserv_closewait_check(eptr);
+}
+
+static void csserv_free(csserventry *eptr) {
+	if (eptr->inputpacket.packet) {
+		free(eptr->inputpacket.packet);
+	}
+	csserv_free_packets(eptr->outputhead);
+	if (eptr->rbuff) {
+		csserv_readbuffer_release(eptr->rbuff);
+	}
+	csserv_wjobs_free(eptr);
+	free(eptr);
 }
 
 void csserv_gotpacket(csserventry *eptr,uint32_t type,const uint8_t *data,uint32_t length) {
 //	syslog(LOG_NOTICE,"packet %u:%u",type,length);
 	if (type==ANTOAN_NOP) {
+		if (eptr->state==WRITELAST || eptr->state==WRITEFWD) {
+			csserv_write_nop(eptr);
+		}
 		return;
 	}
 	if (type==ANTOAN_UNKNOWN_COMMAND) { // for future use
@@ -478,6 +1363,18 @@ void csserv_gotpacket(csserventry *eptr,uint32_t type,const uint8_t *data,uint32
 			syslog(LOG_NOTICE,"got unknown message (type:%"PRIu32")",type);
 			eptr->state = CLOSE;
 		}
+	} else if (eptr->state==WRITELAST || eptr->state==WRITEFWD) {
+		switch (type) {
+		case CLTOCS_WRITE_DATA:
+			csserv_write_data(eptr,data,length);
+			break;
+		case CLTOCS_WRITE_FINISH:
+			csserv_write_finish(eptr,data,length);
+			break;
+		default:
+			syslog(LOG_NOTICE,"got unknown message (type:%"PRIu32")",type);
+			eptr->state = CLOSE;
+		}
 	} else {
 		syslog(LOG_NOTICE,"got unknown message (type:%"PRIu32")",type);
 		eptr->state = CLOSE;
@@ -486,80 +1383,51 @@ void csserv_gotpacket(csserventry *eptr,uint32_t type,const uint8_t *data,uint32
 
 void csserv_term(void) {
 	csserventry *eptr,*eaptr;
-	packetstruct *pptr,*paptr;
+	readbuffer *rb,*rbn;
 
 	syslog(LOG_NOTICE,"closing %s:%s",ListenHost,ListenPort);
 	tcpclose(lsock);
 
 	eptr = csservhead;
 	while (eptr) {
-		tcpclose(eptr->sock);
-		if (eptr->inputpacket.packet) {
-			free(eptr->inputpacket.packet);
-		}
-		pptr = eptr->outputhead;
-		while (pptr) {
-			if (pptr->packet) {
-				free(pptr->packet);
-			}
-			paptr = pptr;
-			pptr = pptr->next;
-			free(paptr);
+		if (eptr->sock>=0) {
+			tcpclose(eptr->sock);
 		}
+		csserv_fwd_close(eptr);
 		eaptr = eptr;
 		eptr = eptr->next;
-		free(eaptr);
+		csserv_free(eaptr);
 	}
 	csservhead=NULL;
+	for (rb=rbufffreehead ; rb ; rb=rbn) {
+		rbn = rb->next;
+		READ_BUFFER_FREE(rb->data);
+		free(rb);
+	}
+	rbufffreehead = NULL;
+	rbufffreecnt = 0;
+#ifdef CSSERV_ZEROCOPY
+	if (zcsendcnt) {
+		free(zcsendcnt);
+		zcsendcnt = NULL;
+		zcsendcntsize = 0;
+	}
+#endif
 	free(ListenHost);
 	free(ListenPort);
 }
 
-void csserv_read(csserventry *eptr) {
+static inline uint8_t csserv_input_allowed(csserventry *eptr) {
+	return (eptr->state==IDLE || eptr->state==READ || eptr->state==WRITELAST || eptr->state==WRITEFWD)?1:0;
+}
+
+void csserv_read(csserventry *eptr,double now) {
 	int32_t i;
 	uint32_t type,size;
 	const uint8_t *ptr;
 
-	if (eptr->mode == HEADER) {
-		i=read(eptr->sock,eptr->inputpacket.startptr,eptr->inputpacket.bytesleft);
-		if (i==0) {
-//			syslog(LOG_NOTICE,"(read) connection closed");
-			eptr->state = CLOSE;
-			return;
-		}
-		if (i<0) {
-			if (ERRNO_ERROR) {
-				mfs_errlog_silent(LOG_NOTICE,"(read) read error");
-				eptr->state = CLOSE;
-			}
-			return;
-		}
-		stats_bytesin+=i;
-		eptr->inputpacket.startptr+=i;
-		eptr->inputpacket.bytesleft-=i;
-
-		if (eptr->inputpacket.bytesleft>0) {
-			return;
-		}
-
-		ptr = eptr->hdrbuff+4;
-		size = get32bit(&ptr);
-
-		if (size>0) {
-			if (size>MaxPacketSize) {
-				syslog(LOG_WARNING,"(read) packet too long (%"PRIu32"/%u)",size,MaxPacketSize);
-				eptr->state = CLOSE;
-				return;
-			}
-			eptr->inputpacket.packet = malloc(size);
-			passert(eptr->inputpacket.packet);
-			eptr->inputpacket.startptr = eptr->inputpacket.packet;
-		}
-		eptr->inputpacket.bytesleft = size;
-		eptr->mode = DATA;
-	}
-	if (eptr->mode == DATA) {
-		if (eptr->inputpacket.bytesleft>0) {
+	while (csserv_input_allowed(eptr)) {
+		if (eptr->mode == HEADER) {
 			i=read(eptr->sock,eptr->inputpacket.startptr,eptr->inputpacket.bytesleft);
 			if (i==0) {
 //				syslog(LOG_NOTICE,"(read) connection closed");
@@ -574,24 +1442,65 @@ void csserv_read(csserventry *eptr) {
 				return;
 			}
 			stats_bytesin+=i;
+			eptr->lastread = now;
 			eptr->inputpacket.startptr+=i;
 			eptr->inputpacket.bytesleft-=i;
 
 			if (eptr->inputpacket.bytesleft>0) {
 				return;
 			}
+
+			ptr = eptr->hdrbuff+4;
+			size = get32bit(&ptr);
+
+			if (size>MaxPacketSize) {
+				syslog(LOG_WARNING,"(read) packet too long (%"PRIu32"/%u)",size,MaxPacketSize);
+				eptr->state = CLOSE;
+				return;
+			}
+			// header is kept before data - CLTOCS_WRITE_DATA packets are forwarded as they are
+			eptr->inputpacket.packet = malloc(size+8);
+			passert(eptr->inputpacket.packet);
+			memcpy(eptr->inputpacket.packet,eptr->hdrbuff,8);
+			eptr->inputpacket.startptr = eptr->inputpacket.packet+8;
+			eptr->inputpacket.bytesleft = size;
+			eptr->mode = DATA;
 		}
-		ptr = eptr->hdrbuff;
-		type = get32bit(&ptr);
-		size = get32bit(&ptr);
+		if (eptr->mode == DATA) {
+			if (eptr->inputpacket.bytesleft>0) {
+				i=read(eptr->sock,eptr->inputpacket.startptr,eptr->inputpacket.bytesleft);
+				if (i==0) {
+//					syslog(LOG_NOTICE,"(read) connection closed");
+					eptr->state = CLOSE;
+					return;
+				}
+				if (i<0) {
+					if (ERRNO_ERROR) {
+						mfs_errlog_silent(LOG_NOTICE,"(read) read error");
+						eptr->state = CLOSE;
+					}
+					return;
+				}
+				stats_bytesin+=i;
+				eptr->lastread = now;
+				eptr->inputpacket.startptr+=i;
+				eptr->inputpacket.bytesleft-=i;
 
-		eptr->mode = HEADER;
-		eptr->inputpacket.bytesleft = 8;
-		eptr->inputpacket.startptr = eptr->hdrbuff;
+				if (eptr->inputpacket.bytesleft>0) {
+					return;
+				}
+			}
+			ptr = eptr->hdrbuff;
+			type = get32bit(&ptr);
+			size = get32bit(&ptr);
 
-		csserv_gotpacket(eptr,type,eptr->inputpacket.packet,size);
+			eptr->mode = HEADER;
+			eptr->inputpacket.bytesleft = 8;
+			eptr->inputpacket.startptr = eptr->hdrbuff;
+
+			csserv_gotpacket(eptr,type,eptr->inputpacket.packet+8,size);
 
-		if (eptr->state != READ && eptr->state != WRITE) {
+			// CLTOCS_WRITE_DATA takes the packet
 			if (eptr->inputpacket.packet) {
 				free(eptr->inputpacket.packet);
 			}
@@ -600,15 +1509,56 @@ void csserv_read(csserventry *eptr) {
 	}
 }
 
-void csserv_write(csserventry *eptr) {
+/* returns 1 when head packet has been sent entirely */
+static int csserv_write_packet(csserventry *eptr,double now) {
 	packetstruct *pack;
 	int32_t i;
-	for (;;) {
-		pack = eptr->outputhead;
-		if (pack==NULL) {
+
+	pack = eptr->outputhead;
+	i=write(eptr->sock,pack->startptr,pack->bytesleft);
+	if (i==0) {
+//		syslog(LOG_NOTICE,"(write) connection closed");
+		eptr->state = CLOSE;
+		return 0;
+	}
+	if (i<0) {
+		if (ERRNO_ERROR) {
+			mfs_errlog_silent(LOG_NOTICE,"(write) write error");
+			eptr->state = CLOSE;
+		}
+		return 0;
+	}
+	stats_bytesout+=i;
+	eptr->lastwrite = now;
+	pack->startptr+=i;
+	pack->bytesleft-=i;
+	if (pack->bytesleft>0) {
+		return 0;
+	}
+	free(pack->packet);
+	eptr->outputhead = pack->next;
+	if (eptr->outputhead==NULL) {
+		eptr->outputtail = &(eptr->outputhead);
+	}
+	free(pack);
+	return 1;
+}
+
+void csserv_write(csserventry *eptr,double now) {
+	packetstruct *pack;
+	readbuffer *rb;
+	int32_t i;
+
+	// packet already partially sent has to be finished before read data
+	pack = eptr->outputhead;
+	if (pack!=NULL && pack->startptr!=pack->packet) {
+		if (csserv_write_packet(eptr,now)==0) {
 			return;
 		}
-		i=write(eptr->sock,pack->startptr,pack->bytesleft);
+	}
+	rb = eptr->rbuff;
+	while (rb!=NULL && rb->iovpos<rb->iovcnt) {
+		i=writev(eptr->sock,rb->iov+rb->iovpos,rb->iovcnt-rb->iovpos);
 		if (i==0) {
 //			syslog(LOG_NOTICE,"(write) connection closed");
 			eptr->state = CLOSE;
@@ -622,130 +1572,513 @@ void csserv_write(csserventry *eptr) {
 			return;
 		}
 		stats_bytesout+=i;
+		eptr->lastwrite = now;
+		while (i>0) {
+			if ((size_t)i>=rb->iov[rb->iovpos].iov_len) {
+				i -= rb->iov[rb->iovpos].iov_len;
+				rb->iovpos++;
+			} else {
+				rb->iov[rb->iovpos].iov_base = ((uint8_t*)(rb->iov[rb->iovpos].iov_base)) + i;
+				rb->iov[rb->iovpos].iov_len -= i;
+				i = 0;
+			}
+		}
+	}
+	while (eptr->outputhead!=NULL) {
+		if (csserv_write_packet(eptr,now)==0) {
+			return;
+		}
+	}
+}
+
+/* connection to next chunkserver in chain */
+
+static void csserv_fwd_error(csserventry *eptr) {
+	uint8_t state = eptr->state;
+
+	csserv_fwd_close(eptr);
+	if (state==WRITEINIT) {
+		eptr->fwdstate = FWD_FAILED;
+		csserv_write_init_check(eptr);
+	} else if (state==WRITEFWD) {
+		csserv_write_status(eptr,0,ERROR_DISCONNECTED);
+		eptr->wjoberror = 1;
+		eptr->state = FLUSHCLOSE;
+	} else {
+		eptr->wjoberror = 1;
+	}
+}
+
+static void csserv_fwd_gotpacket(csserventry *eptr,uint32_t type,const uint8_t *data,uint32_t length) {
+	writejob *wj;
+	uint64_t chunkid;
+	uint32_t writeid;
+	uint8_t status;
+
+	if (type!=CSTOCL_WRITE_STATUS) { // NOP's echoed by next chunkserver etc.
+		return;
+	}
+	if (length!=8+4+1) {
+		syslog(LOG_NOTICE,"CSTOCL_WRITE_STATUS - wrong size (%"PRIu32"/13)",length);
+		eptr->state = CLOSE;
+		return;
+	}
+	if (eptr->state!=WRITEFWD) { // after CLTOCS_WRITE_FINISH statuses are not needed any more
+		return;
+	}
+	chunkid = get64bit(&data);
+	writeid = get32bit(&data);
+	status = get8bit(&data);
+	if (chunkid!=eptr->chunkid) {
+		syslog(LOG_NOTICE,"CSTOCL_WRITE_STATUS - got status for wrong chunk");
+		eptr->state = CLOSE;
+		return;
+	}
+	if (writeid==0) { // rest of chain has been opened
+		csserv_write_status(eptr,0,status);
+		if (status!=STATUS_OK) {
+			eptr->wjoberror = 1;
+			eptr->state = FLUSHCLOSE;
+		}
+		return;
+	}
+	wj = eptr->wjobnet;
+	if (wj==NULL || wj->writeid!=writeid) {
+		syslog(LOG_NOTICE,"CSTOCL_WRITE_STATUS - got unexpected status (writeid:%"PRIu32")",writeid);
+		eptr->state = CLOSE;
+		return;
+	}
+	wj->netstatus = status;
+	wj->ack |= WJOB_NET;
+	eptr->wjobnet = wj->next;
+	csserv_write_acks(eptr);
+}
+
+static void csserv_fwd_read(csserventry *eptr) {
+	int32_t i;
+	uint32_t type,size;
+	const uint8_t *ptr;
+
+	while (eptr->fwdsock>=0 && (eptr->state==WRITEFWD || eptr->state==WRITEFINISH)) {
+		if (eptr->fwdmode == HEADER) {
+			i=read(eptr->fwdsock,eptr->fwdinputpacket.startptr,eptr->fwdinputpacket.bytesleft);
+			if (i==0) {
+				csserv_fwd_error(eptr);
+				return;
+			}
+			if (i<0) {
+				if (ERRNO_ERROR) {
+					mfs_errlog_silent(LOG_NOTICE,"(fwdread) read error");
+					csserv_fwd_error(eptr);
+				}
+				return;
+			}
+			stats_bytesin+=i;
+			eptr->fwdinputpacket.startptr+=i;
+			eptr->fwdinputpacket.bytesleft-=i;
+
+			if (eptr->fwdinputpacket.bytesleft>0) {
+				return;
+			}
+
+			ptr = eptr->fwdhdrbuff+4;
+			size = get32bit(&ptr);
+
+			if (size>0) {
+				if (size>MaxPacketSize) {
+					syslog(LOG_WARNING,"(fwdread) packet too long (%"PRIu32"/%u)",size,MaxPacketSize);
+					csserv_fwd_error(eptr);
+					return;
+				}
+				eptr->fwdinputpacket.packet = malloc(size);
+				passert(eptr->fwdinputpacket.packet);
+				eptr->fwdinputpacket.startptr = eptr->fwdinputpacket.packet;
+			}
+			eptr->fwdinputpacket.bytesleft = size;
+			eptr->fwdmode = DATA;
+		}
+		if (eptr->fwdmode == DATA) {
+			if (eptr->fwdinputpacket.bytesleft>0) {
+				i=read(eptr->fwdsock,eptr->fwdinputpacket.startptr,eptr->fwdinputpacket.bytesleft);
+				if (i==0) {
+					csserv_fwd_error(eptr);
+					return;
+				}
+				if (i<0) {
+					if (ERRNO_ERROR) {
+						mfs_errlog_silent(LOG_NOTICE,"(fwdread) read error");
+						csserv_fwd_error(eptr);
+					}
+					return;
+				}
+				stats_bytesin+=i;
+				eptr->fwdinputpacket.startptr+=i;
+				eptr->fwdinputpacket.bytesleft-=i;
+
+				if (eptr->fwdinputpacket.bytesleft>0) {
+					return;
+				}
+			}
+			ptr = eptr->fwdhdrbuff;
+			type = get32bit(&ptr);
+			size = get32bit(&ptr);
+
+			eptr->fwdmode = HEADER;
+			eptr->fwdinputpacket.bytesleft = 8;
+			eptr->fwdinputpacket.startptr = eptr->fwdhdrbuff;
+
+			csserv_fwd_gotpacket(eptr,type,eptr->fwdinputpacket.packet,size);
+
+			if (eptr->fwdinputpacket.packet) {
+				free(eptr->fwdinputpacket.packet);
+			}
+			eptr->fwdinputpacket.packet=NULL;
+		}
+	}
+}
+
+static void csserv_fwd_write(csserventry *eptr,double now) {
+	packetstruct *pack;
+#ifdef CSSERV_ZEROCOPY
+	writejob *wj;
+#endif
+	int32_t i;
+	uint8_t fwddone;
+
+	fwddone = 0;
+	while ((pack=eptr->fwdoutputhead)!=NULL) {
+#ifdef CSSERV_ZEROCOPY
+		if (eptr->fwdzerocopy && pack->wjob!=NULL) {
+			i=send(eptr->fwdsock,pack->startptr,pack->bytesleft,MSG_ZEROCOPY);
+			if (i>0) {
+				wj = pack->wjob;
+				if (wj->zccnt==0) {
+					wj->zcfirst = *csserv_zc_sendcnt(eptr->fwdsock);
+				}
+				wj->zccnt++;
+				wj->zcleft++;
+				eptr->zcpending++;
+				(*csserv_zc_sendcnt(eptr->fwdsock))++;
+			} else if (i<0 && errno==ENOBUFS) { // socket option memory limit reached - copy data
+				i=write(eptr->fwdsock,pack->startptr,pack->bytesleft);
+			}
+		} else
+#endif
+		i=write(eptr->fwdsock,pack->startptr,pack->bytesleft);
+		if (i==0) {
+			csserv_fwd_error(eptr);
+			return;
+		}
+		if (i<0) {
+			if (ERRNO_ERROR) {
+				mfs_errlog_silent(LOG_NOTICE,"(fwdwrite) write error");
+				csserv_fwd_error(eptr);
+				return;
+			}
+			break;
+		}
+		stats_bytesout+=i;
+		eptr->fwdlastwrite = now;
 		pack->startptr+=i;
 		pack->bytesleft-=i;
 		if (pack->bytesleft>0) {
-			return;
+			break;
 		}
-		free(pack->packet);
-		eptr->outputhead = pack->next;
-		if (eptr->outputhead==NULL) {
-			eptr->outputtail = &(eptr->outputhead);
+		if (pack->wjob) { // packet belongs to write job
+			pack->wjob->ack |= WJOB_FWD;
+			fwddone = 1;
+		}
+		if (pack->packet) {
+			free(pack->packet);
+		}
+		eptr->fwdoutputhead = pack->next;
+		if (eptr->fwdoutputhead==NULL) {
+			eptr->fwdoutputtail = &(eptr->fwdoutputhead);
 		}
 		free(pack);
 	}
+	if (fwddone && eptr->state==WRITEFWD) {
+		csserv_write_acks(eptr);
+	}
 }
 
-void csserv_desc(struct pollfd *pdesc,uint32_t *ndesc) {
-	uint32_t pos = *ndesc;
-	csserventry *eptr;
-	pdesc[pos].fd = lsock;
-	pdesc[pos].events = POLLIN;
-	lsockpdescpos = pos;
-	pos++;
-	for (eptr=csservhead ; eptr ; eptr=eptr->next) {
-		eptr->pdescpos = -1;
-		if (eptr->state==IDLE) {
-			pdesc[pos].events = POLLIN;
-			if (eptr->outputhead!=NULL) {
-				pdesc[pos].events |= POLLOUT;
+void csserv_fwd_fdserve(void *udata,short revents) {
+	csserventry *eptr = (csserventry*)udata;
+	double now;
+
+	if (eptr->fwdsock<0) {
+		return;
+	}
+	now = monotonic_seconds();
+	if (eptr->fwdstate==FWD_CONNECTING) {
+		if (revents & (POLLOUT|POLLERR|POLLHUP)) {
+			if (tcpgetstatus(eptr->fwdsock)==0) {
+				csserv_fwd_connected(eptr);
+			} else {
+				mfs_arg_errlog_silent(LOG_WARNING,"connect to %u.%u.%u.%u:%u failed, error",(eptr->fwdip>>24)&0xFF,(eptr->fwdip>>16)&0xFF,(eptr->fwdip>>8)&0xFF,eptr->fwdip&0xFF,eptr->fwdport);
+				csserv_fwd_connect_failed(eptr);
 			}
-			eptr->pdescpos = pos;
-			pdesc[pos].fd = eptr->sock;
-			pos++;
+			csserv_write_init_check(eptr);
+		}
+		csserv_update(eptr);
+		return;
+	}
+#ifdef CSSERV_ZEROCOPY
+	// completions of zero-copy sends are reported through socket error queue
+	if ((revents & POLLERR) && eptr->fwdzerocopy) {
+		csserv_fwd_zc_completed(eptr);
+		if (tcpgetstatus(eptr->fwdsock)==0) {
+			revents &= ~POLLERR;
+		}
+	}
+#endif
+	if (revents & POLLERR) {
+		csserv_fwd_error(eptr);
+	} else {
+		if (revents & POLLIN) {
+			csserv_fwd_read(eptr);
+		} else if (revents & POLLHUP) {
+			csserv_fwd_error(eptr);
+		}
+		if (eptr->fwdsock>=0 && (revents & POLLOUT)) {
+			csserv_fwd_write(eptr,now);
 		}
 	}
-	*ndesc = pos;
+	csserv_update(eptr);
 }
 
-void csserv_serve(struct pollfd *pdesc) {
+void csserv_fdserve(void *udata,short revents) {
+	csserventry *eptr = (csserventry*)udata;
 	double now;
-	csserventry *eptr,**kptr;
-	packetstruct *pptr,*paptr;
-	int ns;
 
+	if (eptr->state>=CLOSE) {
+		return;
+	}
 	now = monotonic_seconds();
+	if (revents & POLLERR) {
+		eptr->state = CLOSE;
+	} else {
+		if (revents & POLLIN) {
+			csserv_read(eptr,now);
+		} else if (revents & POLLHUP) {
+			eptr->state = CLOSE;
+		}
+		if (eptr->state<CLOSE && (revents & POLLOUT)) {
+			csserv_write(eptr,now);
+		}
+	}
+	csserv_update(eptr);
+}
 
-	if (lsockpdescpos>=0 && (pdesc[lsockpdescpos].revents & POLLIN)) {
-		ns=tcpaccept(lsock);
-		if (ns<0) {
-			mfs_errlog_silent(LOG_NOTICE,"accept error");
-		} else {
-			tcpnonblock(ns);
-			tcpnodelay(ns);
-			eptr = malloc(sizeof(csserventry));
-			passert(eptr);
-			eptr->next = csservhead;
-			csservhead = eptr;
-			eptr->state = IDLE;
-			eptr->mode = HEADER;
-			eptr->sock = ns;
-			eptr->pdescpos = -1;
-			eptr->lastread = now;
+/* moves connection forward after any event and sets events to watch */
+static void csserv_update(csserventry *eptr) {
+	double now;
+	short events;
+
+	if (eptr->state>=CLOSE) {
+		closepending = 1;
+		return;
+	}
+	now = monotonic_seconds();
+	// new data are sent at once - POLLOUT is used only when socket buffer is full
+	if ((eptr->fdevents & POLLOUT)==0 && csserv_output_pending(eptr)) {
+		csserv_write(eptr,now);
+	}
+	if (eptr->state==READ && eptr->jobid==0 && eptr->rbuff!=NULL && eptr->rbuff->iovpos==eptr->rbuff->iovcnt) {
+		csserv_read_continue(eptr);
+		if (eptr->state==IDLE && (eptr->fdevents & POLLOUT)==0 && csserv_output_pending(eptr)) {
+			csserv_write(eptr,now);
+		}
+	}
+	if (eptr->fwdstate==FWD_CONNECTED && (eptr->fwdevents & POLLOUT)==0 && eptr->fwdoutputhead!=NULL && eptr->state!=WRITEINIT) {
+		csserv_fwd_write(eptr,now);
+	}
+	if (eptr->state==WRITEFINISH && eptr->wjobactive==0 && eptr->fwdoutputhead==NULL) {
+		csserv_write_end(eptr);
+	}
+	if (eptr->state==FLUSHCLOSE && csserv_output_pending(eptr)==0) {
+		eptr->state = CLOSE;
+	}
+	if (eptr->state>=CLOSE) {
+		closepending = 1;
+		return;
+	}
+
+	events = 0;
+	if (csserv_input_allowed(eptr)) {
+		events |= POLLIN;
+	}
+	if (csserv_output_pending(eptr)) {
+		events |= POLLOUT;
+		if ((eptr->fdevents & POLLOUT)==0) {
 			eptr->lastwrite = now;
-			eptr->inputpacket.bytesleft = 8;
-			eptr->inputpacket.startptr = eptr->hdrbuff;
-			eptr->inputpacket.packet = NULL;
-			eptr->outputhead = NULL;
-			eptr->outputtail = &(eptr->outputhead);
-			eptr->jobid = 0;
+		}
+	}
+	if (events!=eptr->fdevents) {
+		main_fd_change(eptr->fdh,events);
+		eptr->fdevents = events;
+	}
 
-			eptr->idlejobs = NULL;
+	if (eptr->fwdsock>=0 && eptr->fwdfdh!=NULL) {
+		if (eptr->fwdstate==FWD_CONNECTING) {
+			events = POLLOUT;
+		} else if (eptr->state==WRITEINIT) { // init packet is sent after chunk has been opened
+			events = 0;
+		} else {
+			events = POLLIN;
+			if (eptr->fwdoutputhead!=NULL) {
+				events |= POLLOUT;
+				if ((eptr->fwdevents & POLLOUT)==0) {
+					eptr->fwdlastwrite = now;
+				}
+			}
+		}
+		if (events!=eptr->fwdevents) {
+			main_fd_change(eptr->fwdfdh,events);
+			eptr->fwdevents = events;
 		}
 	}
+}
+
+void csserv_check_timeouts(void) {
+	csserventry *eptr;
+	double now;
 
+	now = monotonic_seconds();
 	for (eptr=csservhead ; eptr ; eptr=eptr->next) {
-		if (eptr->pdescpos>=0 && (pdesc[eptr->pdescpos].revents & (POLLERR|POLLHUP))) {
-			eptr->state = CLOSE;
-		}
-		if (eptr->pdescpos>=0 && (pdesc[eptr->pdescpos].revents & POLLIN) && eptr->state==IDLE) {
-			eptr->lastread = now;
-			csserv_read(eptr);
+		if (eptr->state>=CLOSE) {
+			continue;
 		}
-		if (eptr->state==IDLE && eptr->lastwrite+(CSSERV_TIMEOUT/3.0)<now && eptr->outputhead==NULL) {
-			csserv_create_packet(eptr,ANTOAN_NOP,0);
+		if (eptr->fwdstate==FWD_CONNECTING && eptr->connstart+(CONNECT_TIMEOUT(eptr->connretrycnt)/1000.0)<now) {
+			syslog(LOG_NOTICE,"connect to %u.%u.%u.%u:%u timed out",(eptr->fwdip>>24)&0xFF,(eptr->fwdip>>16)&0xFF,(eptr->fwdip>>8)&0xFF,eptr->fwdip&0xFF,eptr->fwdport);
+			csserv_fwd_connect_failed(eptr);
+			csserv_write_init_check(eptr);
 		}
-		if (eptr->pdescpos>=0 && (pdesc[eptr->pdescpos].revents & POLLOUT) && eptr->state==IDLE) {
-			eptr->lastwrite = now;
-			csserv_write(eptr);
+		if (eptr->fwdstate==FWD_CONNECTED && eptr->fwdoutputhead!=NULL && eptr->state!=WRITEINIT && eptr->fwdlastwrite+CSSERV_TIMEOUT<now) {
+			syslog(LOG_NOTICE,"write to %u.%u.%u.%u:%u timed out",(eptr->fwdip>>24)&0xFF,(eptr->fwdip>>16)&0xFF,(eptr->fwdip>>8)&0xFF,eptr->fwdip&0xFF,eptr->fwdport);
+			csserv_fwd_error(eptr);
 		}
-		if (eptr->state==IDLE && eptr->lastread+CSSERV_TIMEOUT<now) {
-//			syslog(LOG_NOTICE,"csserv: connection timed out");
+		if (csserv_output_pending(eptr) && eptr->lastwrite+CSSERV_TIMEOUT<now) {
 			eptr->state = CLOSE;
 		}
+		switch (eptr->state) {
+			case IDLE:
+				if (eptr->lastwrite+(CSSERV_TIMEOUT/3.0)<now && eptr->outputhead==NULL) {
+					csserv_create_packet(eptr,ANTOAN_NOP,0);
+				}
+				if (eptr->lastread+CSSERV_TIMEOUT<now) {
+//					syslog(LOG_NOTICE,"csserv: connection timed out");
+					eptr->state = CLOSE;
+				}
+				break;
+			case READ:
+				// waiting for disk - let client know that we are still alive
+				if (eptr->protover && csserv_output_pending(eptr)==0 && eptr->lastwrite+READ_NOPS_INTERVAL<now) {
+					csserv_create_packet(eptr,ANTOAN_NOP,0);
+				}
+				break;
+			case WRITELAST:
+			case WRITEFWD:
+				if (eptr->wjobactive==0 && eptr->lastread+CSSERV_TIMEOUT<now) {
+					eptr->state = CLOSE;
+				}
+				break;
+		}
+		csserv_update(eptr);
 	}
+}
 
+void csserv_disconnection_loop(void) {
+	csserventry *eptr,**kptr;
+
+	if (closepending==0) {
+		return;
+	}
+	closepending = 0;
 	kptr = &csservhead;
 	while ((eptr=*kptr)) {
 		if (eptr->state == CLOSE) {
-			tcpclose(eptr->sock);
 			csserv_close(eptr);
-			if (eptr->inputpacket.packet) {
-				free(eptr->inputpacket.packet);
-			}
-//			wptr = eptr->todolist;
-//			while (wptr) {
-//				waptr = wptr;
-//				wptr = wptr->next;
-//				free(waptr);
-//			}
-			pptr = eptr->outputhead;
-			while (pptr) {
-				if (pptr->packet) {
-					free(pptr->packet);
-				}
-				paptr = pptr;
-				pptr = pptr->next;
-				free(paptr);
-			}
+		}
+		if (eptr->state == CLOSED) {
 			*kptr = eptr->next;
-			free(eptr);
+			csserv_free(eptr);
 		} else {
 			kptr = &(eptr->next);
 		}
 	}
 }
 
+void csserv_accept(void *udata,short revents) {
+	csserventry *eptr;
+	double now;
+	int ns;
+
+	(void)udata;
+	if ((revents & POLLIN)==0) {
+		return;
+	}
+	ns=tcpaccept(lsock);
+	if (ns<0) {
+		mfs_errlog_silent(LOG_NOTICE,"accept error");
+		return;
+	}
+	now = monotonic_seconds();
+	tcpnonblock(ns);
+	tcpnodelay(ns);
+	eptr = malloc(sizeof(csserventry));
+	passert(eptr);
+	eptr->next = csservhead;
+	csservhead = eptr;
+	eptr->state = IDLE;
+	eptr->mode = HEADER;
+	eptr->fwdmode = HEADER;
+	eptr->fwdstate = FWD_NONE;
+	eptr->protover = 0;
+	eptr->chunkopen = 0;
+	eptr->rwmode = RW_READ;
+	eptr->wjobactive = 0;
+	eptr->fwdzerocopy = 0;
+	eptr->sock = ns;
+	eptr->fwdsock = -1;
+	eptr->fdh = main_fd_register(ns,POLLIN,csserv_fdserve,eptr);
+	eptr->fwdfdh = NULL;
+	eptr->fdevents = POLLIN;
+	eptr->fwdevents = 0;
+	eptr->lastread = now;
+	eptr->lastwrite = now;
+	eptr->fwdlastwrite = now;
+	eptr->inputpacket.bytesleft = 8;
+	eptr->inputpacket.startptr = eptr->hdrbuff;
+	eptr->inputpacket.packet = NULL;
+	eptr->fwdinputpacket.packet = NULL;
+	eptr->outputhead = NULL;
+	eptr->outputtail = &(eptr->outputhead);
+	eptr->fwdoutputhead = NULL;
+	eptr->fwdoutputtail = &(eptr->fwdoutputhead);
+	eptr->chunkid = 0;
+	eptr->version = 0;
+	eptr->jobid = 0;
+	eptr->offset = 0;
+	eptr->size = 0;
+	eptr->rbuff = NULL;
+	eptr->openstatus = STATUS_OK;
+	eptr->wjoberror = 0;
+	eptr->connretrycnt = 0;
+	eptr->fwdip = 0;
+	eptr->fwdport = 0;
+	eptr->connstart = 0.0;
+	eptr->wjobid = 0;
+	eptr->wjobhead = NULL;
+	eptr->wjobtail = &(eptr->wjobhead);
+	eptr->wjobhdd = NULL;
+	eptr->wjobnet = NULL;
+	eptr->zcwaithead = NULL;
+	eptr->zcpending = 0;
+
+	eptr->idlejobs = NULL;
+}
+
 uint32_t csserv_getlistenip() {
 	return mylistenip;
 }
@@ -758,7 +2091,7 @@ void csserv_reload(void) {
 	char *oldListenHost,*oldListenPort;
 	int newlsock;
 
-//	ThreadedServer = 1-ThreadedServer;
+	ForwardZeroCopy = cfg_getuint8("CSSERV_FORWARD_ZEROCOPY",1);
 
 	oldListenHost = ListenHost;
 	oldListenPort = ListenPort;
@@ -798,13 +2131,16 @@ void csserv_reload(void) {
 	mfs_arg_syslog(LOG_NOTICE,"main server module: socket address has changed, now listen on %s:%s",ListenHost,ListenPort);
 	free(oldListenHost);
 	free(oldListenPort);
+	main_fd_unregister(lsockfdh);
 	tcpclose(lsock);
 	lsock = newlsock;
+	lsockfdh = main_fd_register(lsock,POLLIN,csserv_accept,NULL);
 }
 
 int csserv_init(void) {
 	ListenHost = cfg_getstr("CSSERV_LISTEN_HOST","*");
 	ListenPort = cfg_getstr("CSSERV_LISTEN_PORT",DEFAULT_CS_DATA_PORT);
+	ForwardZeroCopy = cfg_getuint8("CSSERV_FORWARD_ZEROCOPY",1);
 
 	lsock = tcpsocket();
 	if (lsock<0) {
@@ -825,9 +2161,15 @@ int csserv_init(void) {
 	mfs_arg_syslog(LOG_NOTICE,"main server module: listen on %s:%s",ListenHost,ListenPort);
 
 	csservhead = NULL;
+	closepending = 0;
+	if (conncache_init(250)<0) {
+		return -1;
+	}
+	lsockfdh = main_fd_register(lsock,POLLIN,csserv_accept,NULL);
 	main_reload_register(csserv_reload);
 	main_destruct_register(csserv_term);
-	main_poll_register(csserv_desc,csserv_serve);
+	main_eachloop_register(csserv_disconnection_loop);
+	main_msectime_register(100,0,csserv_check_timeouts);
 
 	return 0;
 }
@@ -59,6 +59,9 @@
 #include "clocks.h"
 #include "portable.h"
 #include "sockets.h"
+#include "blockcache.h"
+#include "hdduring.h"
+#include "hddspacemgr.h"
 
 #define PRESERVE_BLOCK 1
 
@@ -66,6 +69,14 @@
 #define USE_PIO 1
 #endif
 
+/* number of blocks read ahead into block cache when sequential reading is detected */
+#define HDD_READAHEAD_BLOCKS 16
+/* max number of waiting readahead requests (new requests are dropped when queue is full) */
+#define HDD_READAHEAD_QUEUE 256
+
+/* io_uring queue depth (per folder) */
+#define HDD_URING_ENTRIES 256
+
 /* usec's to wait after last rebalance before choosing disk for new chunk */
 #define REBALANCE_GRACE_PERIOD 10000000
 
@@ -89,6 +100,14 @@
 #define CHUNKHDRSIZE (1024+4*1024)
 #define CHUNKHDRCRC 1024
 
+/* per folder chunk index ('.chunkidx') - header followed by fixed size records (every chunk keeps its record slot until it is removed from folder) */
+#define CHUNKIDXSIGNATURE "MFS CHUNK IDX2.0"
+#define CHUNKIDXHDRSIZE 32
+#define CHUNKIDXRECSIZE 24
+#define CHUNKIDXFLAG_DIRTY 1	// set while index is open for updates - cleared only by clean close (block counts are used only from clean index)
+/* seconds between index checkpoints - records are synced and checkpoint time is stored in header, data subfolders not modified since then are not scanned after crash */
+#define CHUNKIDX_CHECKPOINT_DELAY 30
+
 #define STATSHISTORY (24*60)
 
 #define LASTERRSIZE 30
@@ -153,10 +172,12 @@ typedef struct chunk {
 	uint32_t version;
 	uint16_t blocks;
 	uint16_t crcrefcount;
+	uint32_t idxslot;	// record number in folder chunk index
 	double opento;
 	double crcto;
 	unsigned crcchanged:1;
 	unsigned fsyncneeded:1;
+	unsigned idxdirty:1;	// number of blocks stored in chunk index is not valid
 #define CH_AVAIL 0
 #define CH_LOCKED 1
 #define CH_DELETED 2
@@ -171,6 +192,7 @@ typedef struct chunk {
 	uint8_t *block;
 	uint16_t blockno;	// 0xFFFF == invalid
 #endif
+	uint16_t rablock;	// next block in sequential read (readahead trigger)
 	uint8_t validattr;
 	uint8_t todel;
 //	uint32_t testtime;	// at start use max(atime,mtime) then every operation set it to current time
@@ -232,6 +254,12 @@ typedef struct folder {
 	ino_t lockinode;
 	int lfd;
 	int dumpfd;
+	int idxfd;
+	uint32_t idxslots;	// number of record slots in index
+	uint32_t *idxfree;	// slots freed by removed chunks
+	uint32_t idxfreecnt;
+	uint32_t idxfreesize;
+	double idxcheckpoint;
 	double read_corr;
 	double write_corr;
 	uint32_t read_dist;
@@ -242,6 +270,7 @@ typedef struct folder {
 	uint64_t rebalance_last_usec;
 //	double carry;
 	pthread_t scanthread;
+	hdd_uring *ring;
 	struct chunk *testhead,**testtail;
 	struct folder *next;
 } folder;
@@ -263,6 +292,7 @@ static uint32_t HDDErrorCount = 2;
 static uint32_t HDDErrorTime = 600;
 static uint64_t LeaveFree;
 static uint8_t DoFsyncBeforeClose = 0;
+static uint8_t UseIoUring = 0;
 
 /* folders data */
 static folder *folderhead = NULL;
@@ -282,7 +312,7 @@ static newchunk *newchunks = NULL;
 static uint32_t errorcounter = 0;
 static int hddspacechanged = 0;
 
-static pthread_t rebalancethread,foldersthread,delayedthread,testerthread;
+static pthread_t rebalancethread,foldersthread,delayedthread,testerthread,readaheadthread;
 static uint8_t term = 0;
 static uint8_t folderactions = 0;
 static uint8_t testerreset = 0;
@@ -308,11 +338,35 @@ static pthread_mutex_t folderlock = PTHREAD_MUTEX_INITIALIZER;
 // chunk tester
 static pthread_mutex_t testlock = PTHREAD_MUTEX_INITIALIZER;
 
+// chunk file operations in progress (oldest first) - changes they make in data subfolders can't be covered by chunk index checkpoint yet
+typedef struct _idxop {
+	uint32_t begintime;
+	struct _idxop *next,**prev;
+} idxop;
+
+static idxop *idxophead = NULL;
+static idxop **idxoptail = &idxophead;
+static pthread_mutex_t idxoplock = PTHREAD_MUTEX_INITIALIZER;
+
 #ifndef PRESERVE_BLOCK
 static pthread_key_t hdrbufferkey;
 static pthread_key_t blockbufferkey;
 #endif
 
+// readahead requests - served by readahead thread, so reads don't wait for them
+typedef struct _rarequest {
+	uint64_t chunkid;
+	uint32_t version;
+	uint16_t blocknum;
+} rarequest;
+
+static rarequest raqueue[HDD_READAHEAD_QUEUE];
+static uint32_t raqhead = 0;
+static uint32_t raqelements = 0;
+static uint8_t raterm = 0;
+static pthread_mutex_t ralock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t racond = PTHREAD_COND_INITIALIZER;
+
 /*
 static uint8_t wait_for_scan = 0;
 static uint32_t scanprogress;
@@ -876,13 +930,177 @@ static inline void hdd_add_chunk_to_test_chain(chunk *c,folder *f) {
 	f->testtail = &(c->testnext);
 }
 
+/* brackets operations which create, rename or remove chunk files (chunk index record is updated before the end of operation) */
+static inline void hdd_idxop_begin(idxop *op) {
+	zassert(pthread_mutex_lock(&idxoplock));
+	op->begintime = time(NULL);
+	op->next = NULL;
+	op->prev = idxoptail;
+	*idxoptail = op;
+	idxoptail = &(op->next);
+	zassert(pthread_mutex_unlock(&idxoplock));
+}
+
+static inline void hdd_idxop_end(idxop *op) {
+	zassert(pthread_mutex_lock(&idxoplock));
+	*(op->prev) = op->next;
+	if (op->next) {
+		op->next->prev = op->prev;
+	} else {
+		idxoptail = op->prev;
+	}
+	zassert(pthread_mutex_unlock(&idxoplock));
+}
+
+/* time of index checkpoint - all changes in data subfolders made before it are already stored in index records */
+static inline uint32_t hdd_idxop_checkpoint_time(void) {
+	uint32_t now;
+	now = time(NULL);
+	zassert(pthread_mutex_lock(&idxoplock));
+	if (idxophead!=NULL && idxophead->begintime<now) {
+		now = idxophead->begintime;
+	}
+	zassert(pthread_mutex_unlock(&idxoplock));
+	return now;
+}
+
+static inline void hdd_folder_index_unlink(folder *f) {
+	uint32_t pleng;
+	char *fname;
+	pleng = strlen(f->path);
+	fname = malloc(pleng+10);
+	passert(fname);
+	memcpy(fname,f->path,pleng);
+	memcpy(fname+pleng,".chunkidx",9);
+	fname[pleng+9] = 0;
+	unlink(fname);
+	free(fname);
+}
+
+static inline void hdd_folder_index_header(uint8_t hdr[CHUNKIDXHDRSIZE],uint32_t flags,uint32_t checkpoint) {
+	uint8_t *wptr;
+	memcpy(hdr,CHUNKIDXSIGNATURE,16);
+	wptr = hdr+16;
+	put32bit(&wptr,CHUNKIDXRECSIZE);
+	put32bit(&wptr,flags);
+	put64bit(&wptr,checkpoint);
+}
+
+static inline void hdd_folder_index_slots_clear(folder *f) {
+	if (f->idxfree) {
+		free(f->idxfree);
+	}
+	f->idxfree = NULL;
+	f->idxfreecnt = 0;
+	f->idxfreesize = 0;
+	f->idxslots = 0;
+}
+
+// folderlock:locked
+static inline void hdd_folder_index_close(folder *f) {
+	uint8_t hdr[CHUNKIDXHDRSIZE];
+	if (f->idxfd>=0) {
+		// records have to be on disk before dirty flag is cleared
+		hdd_folder_index_header(hdr,0,hdd_idxop_checkpoint_time());
+		if (fsync(f->idxfd)<0 || pwrite(f->idxfd,hdr,CHUNKIDXHDRSIZE,0)!=CHUNKIDXHDRSIZE || fsync(f->idxfd)<0) {
+			mfs_arg_errlog_silent(LOG_WARNING,"%s: chunk index write error",f->path);
+			hdd_folder_index_unlink(f);
+		}
+		close(f->idxfd);
+		f->idxfd = -1;
+	}
+}
+
+/* syncs index records and then stores checkpoint time in header (header itself is synced by next checkpoint) */
+static void hdd_folder_index_checkpoint(folder *f) {
+	uint8_t hdr[CHUNKIDXHDRSIZE];
+	uint32_t checkpoint;
+	int fd,status;
+
+	zassert(pthread_mutex_lock(&folderlock));
+	if (f->idxfd<0 || f->idxcheckpoint+CHUNKIDX_CHECKPOINT_DELAY>monotonic_seconds()) {
+		zassert(pthread_mutex_unlock(&folderlock));
+		return;
+	}
+	f->idxcheckpoint = monotonic_seconds();
+	checkpoint = hdd_idxop_checkpoint_time();
+	fd = dup(f->idxfd);	// index can be closed while it is synced
+	zassert(pthread_mutex_unlock(&folderlock));
+	if (fd<0) {
+		return;
+	}
+	status = fdatasync(fd);
+	close(fd);
+	zassert(pthread_mutex_lock(&folderlock));
+	if (status<0) {
+		mfs_arg_errlog_silent(LOG_WARNING,"%s: chunk index sync error",f->path);
+	} else if (f->idxfd>=0) {
+		hdd_folder_index_header(hdr,CHUNKIDXFLAG_DIRTY,checkpoint);
+		if (pwrite(f->idxfd,hdr,CHUNKIDXHDRSIZE,0)!=CHUNKIDXHDRSIZE) {
+			mfs_arg_errlog_silent(LOG_WARNING,"%s: chunk index write error - index disabled",f->path);
+			close(f->idxfd);
+			f->idxfd = -1;
+			hdd_folder_index_unlink(f);
+		}
+	}
+	zassert(pthread_mutex_unlock(&folderlock));
+}
+
+// folderlock:locked
+static inline void hdd_folder_index_write(folder *f,uint32_t slot,chunk *c,uint32_t newversion) {
+	uint8_t rec[CHUNKIDXRECSIZE];
+	uint8_t *wptr;
+	if (f->idxfd<0) {
+		return;
+	}
+	wptr = rec;
+	if (c==NULL) {
+		memset(rec,0,CHUNKIDXRECSIZE);
+	} else {
+		put64bit(&wptr,c->chunkid);
+		if (newversion!=0 && newversion!=c->version) {	// file is going to be renamed - keep both versions
+			put32bit(&wptr,newversion);
+			put32bit(&wptr,c->version);
+		} else {
+			put32bit(&wptr,c->version);
+			put32bit(&wptr,0);
+		}
+		put16bit(&wptr,(c->idxdirty || c->validattr==0)?0xFFFF:c->blocks);
+		put16bit(&wptr,0);
+		put32bit(&wptr,mycrc32(0,rec,CHUNKIDXRECSIZE-4));
+	}
+	if (pwrite(f->idxfd,rec,CHUNKIDXRECSIZE,CHUNKIDXHDRSIZE+((off_t)slot)*CHUNKIDXRECSIZE)!=CHUNKIDXRECSIZE) {
+		mfs_arg_errlog_silent(LOG_WARNING,"%s: chunk index write error - index disabled",f->path);
+		close(f->idxfd);
+		f->idxfd = -1;
+		hdd_folder_index_unlink(f);
+	}
+}
+
+static inline void hdd_chunk_index_update(chunk *c,uint32_t newversion) {
+	zassert(pthread_mutex_lock(&folderlock));
+	if (c->owner!=NULL) {
+		hdd_folder_index_write(c->owner,c->idxslot,c,newversion);
+	}
+	zassert(pthread_mutex_unlock(&folderlock));
+}
+
 // folderlock:locked
 static inline void hdd_remove_chunk_from_folder(chunk *c,folder *f) {
 	f->chunkcount--;
 	f->chunktab[c->ownerindx] = f->chunktab[f->chunkcount];
 	f->chunktab[c->ownerindx]->ownerindx = c->ownerindx;
+	// record slot is cleared and reused later - records of other chunks are never moved
+	hdd_folder_index_write(f,c->idxslot,NULL,0);
+	if (f->idxfreecnt==f->idxfreesize) {
+		f->idxfreesize = (f->idxfreesize==0)?1024:(f->idxfreesize*2);
+		f->idxfree = realloc(f->idxfree,sizeof(uint32_t)*f->idxfreesize);
+		passert(f->idxfree);
+	}
+	f->idxfree[f->idxfreecnt++] = c->idxslot;
 	c->owner = NULL;
 	c->ownerindx = 0;
+	c->idxslot = 0;
 }
 
 // folderlock:locked
@@ -902,6 +1120,12 @@ static inline void hdd_add_chunk_to_folder(chunk *c,folder *f) {
 	c->owner = f;
 	c->ownerindx = f->chunkcount;
 	f->chunkcount++;
+	if (f->idxfreecnt>0) {
+		c->idxslot = f->idxfree[--f->idxfreecnt];
+	} else {
+		c->idxslot = f->idxslots++;
+	}
+	hdd_folder_index_write(f,c->idxslot,c,0);
 }
 
 static inline void hdd_chunk_remove(chunk *c) {
@@ -1014,6 +1238,7 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 	uint32_t hashpos = HASHPOS(chunkid);
 	chunk *c;
 	cntcond *cc;
+	idxop op;
 	zassert(pthread_mutex_lock(&hashlock));
 	for (c=hashtab[hashpos] ; c && c->chunkid!=chunkid ; c=c->next) {}
 	if (c==NULL) {
@@ -1030,6 +1255,7 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 			c->crcto = 0.0;
 			c->crcchanged = 0;
 			c->fsyncneeded = 0;
+			c->idxdirty = 0;
 			c->fd = -1;
 			c->crc = NULL;
 			c->state = CH_LOCKED;
@@ -1039,6 +1265,7 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 			c->block = NULL;
 			c->blockno = 0xFFFF;
 #endif
+			c->rablock = 0xFFFF;
 			c->validattr = 0;
 			c->todel = 0;
 			c->testnext = NULL;
@@ -1065,8 +1292,10 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 			if (c->validattr==0) {
 				if (hdd_chunk_getattr(c)) {
 					hdd_report_damaged_chunk(c->chunkid);
+					hdd_idxop_begin(&op);
 					unlink(c->filename);
 					hdd_chunk_delete(c);
+					hdd_idxop_end(&op);
 					return NULL;
 				}
 			}
@@ -1105,6 +1334,7 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 				c->crcto = 0.0;
 				c->crcchanged = 0;
 				c->fsyncneeded = 0;
+				c->idxdirty = 0;
 				c->fd = -1;
 				c->crc = NULL;
 #ifdef PRESERVE_BLOCK
@@ -1112,6 +1342,7 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 				c->block = NULL;
 				c->blockno = 0xFFFF;
 #endif /* PRESERVE_BLOCK */
+				c->rablock = 0xFFFF;
 				c->validattr = 0;
 				c->todel = 0;
 				c->state = CH_LOCKED;
@@ -1192,6 +1423,7 @@ static chunk* hdd_chunk_create(folder *f,uint64_t chunkid,uint32_t version) {
 	sprintf(c->filename+leng,"%02X/chunk_%016"PRIX64"_%08"PRIX32".mfs",(unsigned int)(chunkid&255),chunkid,version);
 	c->blocks = 0;
 	c->validattr = 1;
+	c->idxdirty = 1;	// cleared after first crc write (or duplication) - until then index doesn't know real file length
 	f->needrefresh = 1;
 	hdd_add_chunk_to_folder(c,f);
 	zassert(pthread_mutex_lock(&testlock));
@@ -1566,7 +1798,7 @@ uint8_t hdd_senddata(folder *f,int rmflag) {
 void* hdd_folder_scan(void *arg);
 
 void hdd_check_folders(void) {
-	folder *f,**fptr;
+	folder *f,**fptr,*rmhead;
 	uint32_t i;
 	double monotonic_time;
 	uint32_t err;
@@ -1576,6 +1808,7 @@ void hdd_check_folders(void) {
 	monotonic_time = monotonic_seconds();
 
 	changed = 0;
+	rmhead = NULL;
 //	syslog(LOG_NOTICE,"check folders ...");
 
 	zassert(pthread_mutex_lock(&folderlock));
@@ -1614,6 +1847,7 @@ void hdd_check_folders(void) {
 				break;
 			}
 			if (f->toremove==0) { // 0 here means 'removed', so delete it from data structures
+				hdd_folder_index_close(f);
 				if (f->damaged) {
 					f->chunkcount = 0;
 					f->chunktabsize = 0;
@@ -1621,6 +1855,7 @@ void hdd_check_folders(void) {
 						free(f->chunktab);
 					}
 					f->chunktab = NULL;
+					hdd_folder_index_slots_clear(f);
 				} else {
 					*fptr = f->next;
 					syslog(LOG_NOTICE,"folder %s successfully removed",f->path);
@@ -1630,8 +1865,10 @@ void hdd_check_folders(void) {
 					if (f->chunktab) {
 						free(f->chunktab);
 					}
-					free(f->path);
-					free(f);
+					hdd_folder_index_slots_clear(f);
+					// freed after unlocking folders - completions of its io_uring requests may still need folderlock
+					f->next = rmhead;
+					rmhead = f;
 					testerreset = 1;
 				}
 			} else {
@@ -1700,6 +1937,13 @@ void hdd_check_folders(void) {
 		}
 	}
 	zassert(pthread_mutex_unlock(&folderlock));
+	while (rmhead) {
+		f = rmhead;
+		rmhead = f->next;
+		hdd_uring_free(f->ring);
+		free(f->path);
+		free(f);
+	}
 	if (changed) {
 		zassert(pthread_mutex_lock(&dclock));
 		hddspacechanged = 1;
@@ -1806,6 +2050,57 @@ void hdd_get_chunks_next_list_data(uint8_t *buff) {
 	}
 }
 
+typedef struct _chunkidver {
+	uint64_t chunkid;
+	uint32_t version;
+} chunkidver;
+
+static int hdd_chunkidver_cmp(const void *a,const void *b) {
+	const chunkidver *aa = (const chunkidver*)a;
+	const chunkidver *bb = (const chunkidver*)b;
+	return (aa->chunkid<bb->chunkid)?-1:(aa->chunkid>bb->chunkid)?1:0;
+}
+
+// the same list as hdd_get_chunks_next_list_data, but sorted and delta encoded (buff must have space for chunks*15 bytes) - returns number of used bytes
+uint32_t hdd_get_chunks_next_list_compact(uint8_t *buff,uint32_t chunks) {
+	uint32_t res = 0;
+	uint32_t i;
+	uint64_t prevchunkid;
+	uint8_t *wptr;
+	chunkidver *tab;
+	chunk *c;
+
+	tab = malloc(sizeof(chunkidver)*chunks);
+	passert(tab);
+	while (res<CHUNKS_CUT_COUNT && hdd_get_chunks_pos<HASHSIZE) {
+		for (c=hashtab[hdd_get_chunks_pos] ; c ; c=c->next) {
+			if (res<chunks) {
+				tab[res].chunkid = c->chunkid;
+				tab[res].version = c->version;
+				if (c->todel) {
+					tab[res].version |= 0x80000000;
+				}
+			}
+			res++;
+		}
+		hdd_get_chunks_pos++;
+	}
+	if (hdd_get_chunks_partialmode) {
+		zassert(pthread_mutex_unlock(&hashlock));
+	}
+	sassert(res==chunks);
+	qsort(tab,chunks,sizeof(chunkidver),hdd_chunkidver_cmp);
+	wptr = buff;
+	prevchunkid = 0;
+	for (i=0 ; i<chunks ; i++) {
+		putvar64bit(&wptr,tab[i].chunkid-prevchunkid);
+		putvar64bit(&wptr,(((uint64_t)(tab[i].version&0x7FFFFFFF))<<1)|(tab[i].version>>31));
+		prevchunkid = tab[i].chunkid;
+	}
+	free(tab);
+	return wptr-buff;
+}
+
 /*
 // for old register packets - deprecated
 uint32_t hdd_get_chunks_count() {
@@ -2009,6 +2304,10 @@ static inline int chunk_writecrc(chunk *c) {
 		return ERROR_IO;
 	}
 	hdd_stats_write(4096);
+	if (c->idxdirty) {
+		c->idxdirty = 0;
+		hdd_chunk_index_update(c,0);
+	}
 	return STATUS_OK;
 }
 
@@ -2475,6 +2774,11 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 		hdd_chunk_release(c);
 		return STATUS_OK;
 	}
+	if (offset==0 && size==MFSBLOCKSIZE && blockcache_get(chunkid,c->version,blocknum,buffer,&crc)) {
+		put32bit(&crcbuff,crc);
+		hdd_chunk_release(c);
+		return STATUS_OK;
+	}
 	if (offset==0 && size==MFSBLOCKSIZE) {
 #ifdef PRESERVE_BLOCK
 		if (c->blockno==blocknum) {
@@ -2517,6 +2821,7 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 			hdd_chunk_release(c);
 			return ERROR_IO;
 		}
+		blockcache_put(chunkid,c->version,blocknum,buffer,crc);
 	} else {
 #ifdef PRESERVE_BLOCK
 		if (c->blockno != blocknum) {
@@ -2592,8 +2897,313 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 	return STATUS_OK;
 }
 
-int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buffer,uint32_t offset,uint32_t size,const uint8_t *crcbuff) {
+/* checks result of reading whole blocks from disk, verifies crc's and stores blocks in block cache and crc's in crcbuff (if not NULL) */
+static int hdd_blocks_check(chunk *c,uint16_t blocknum,uint32_t blocks,uint8_t *buffer,uint8_t *crcbuff,int ret,int error,int64_t rtime) {
+	const uint8_t *rcrcptr;
+	uint32_t crc,bcrc;
+	uint32_t i;
+
+	hdd_stats_dataread(c->owner,blocks<<MFSBLOCKBITS,rtime);
+	if (ret!=(int)(blocks<<MFSBLOCKBITS)) {
+		errno = error;
+		hdd_error_occured(c);	// uses and preserves errno !!!
+		mfs_arg_errlog_silent(LOG_WARNING,"read_blocks_from_chunk: file:%s - read error",c->filename);
+		hdd_report_damaged_chunk(c->chunkid);
+		return ERROR_IO;
+	}
+	rcrcptr = (c->crc)+(4*blocknum);
+	for (i=0 ; i<blocks ; i++) {
+		crc = mycrc32(0,buffer+(i<<MFSBLOCKBITS),MFSBLOCKSIZE);
+		bcrc = get32bit(&rcrcptr);
+		if (bcrc!=crc) {
+			errno = error;
+			hdd_error_occured(c);	// uses and preserves errno !!!
+			syslog(LOG_WARNING,"read_blocks_from_chunk: file:%s - crc error",c->filename);
+			hdd_report_damaged_chunk(c->chunkid);
+			return ERROR_CRC;
+		}
+		blockcache_put(c->chunkid,c->version,blocknum+i,buffer+(i<<MFSBLOCKBITS),crc);
+		if (crcbuff!=NULL) {
+			put32bit(&crcbuff,crc);
+		}
+	}
+	return STATUS_OK;
+}
+
+/* reads whole blocks from disk with one system call, checks crc's and stores them in block cache and in crcbuff (if not NULL) */
+static int hdd_blocks_load(chunk *c,uint16_t blocknum,uint32_t blocks,uint8_t *buffer,uint8_t *crcbuff) {
+	int ret;
+	int error;
+	uint64_t ts,te;
+
+	ts = monotonic_nseconds();
+#ifdef USE_PIO
+	ret = pread(c->fd,buffer,blocks<<MFSBLOCKBITS,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS));
+#else /* USE_PIO */
+	lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS),SEEK_SET);
+	ret = read(c->fd,buffer,blocks<<MFSBLOCKBITS);
+#endif /* USE_PIO */
+	error = errno;
+	te = monotonic_nseconds();
+	return hdd_blocks_check(c,blocknum,blocks,buffer,crcbuff,ret,error,te-ts);
+}
+
+/* sequential reading - queue loading of next blocks into block cache (request is dropped when queue is full) */
+static void hdd_readahead_request(uint64_t chunkid,uint32_t version,uint16_t blocknum) {
+	rarequest *rr;
+
+	zassert(pthread_mutex_lock(&ralock));
+	if (raqelements<HDD_READAHEAD_QUEUE) {
+		rr = raqueue + ((raqhead+raqelements)%HDD_READAHEAD_QUEUE);
+		rr->chunkid = chunkid;
+		rr->version = version;
+		rr->blocknum = blocknum;
+		raqelements++;
+		zassert(pthread_cond_signal(&racond));
+	}
+	zassert(pthread_mutex_unlock(&ralock));
+}
+
+/* loads next blocks of chunk into block cache - chunks used by other threads are skipped */
+static void hdd_blocks_readahead(const rarequest *rr,uint8_t *rabuffer) {
+	chunk *c;
+	uint32_t rablocks;
+
+	c = hdd_chunk_tryfind(rr->chunkid);
+	if (c==NULL || c==CHUNKLOCKED) {
+		return;
+	}
+	if (c->version!=rr->version || rr->blocknum>=c->blocks || blockcache_check(c->chunkid,c->version,rr->blocknum)) {
+		hdd_chunk_release(c);
+		return;
+	}
+	rablocks = c->blocks - rr->blocknum;
+	if (rablocks>HDD_READAHEAD_BLOCKS) {
+		rablocks = HDD_READAHEAD_BLOCKS;
+	}
+	if (hdd_io_begin(c,0)==STATUS_OK) {
+		hdd_blocks_load(c,rr->blocknum,rablocks,rabuffer,NULL);
+		hdd_io_end(c);
+	}
+	hdd_chunk_release(c);
+}
+
+void* hdd_readahead_thread(void *arg) {
+	rarequest rr;
+	uint8_t *rabuffer;
+
+#ifdef MMAP_ALLOC
+	rabuffer = mmap(NULL,HDD_READAHEAD_BLOCKS*MFSBLOCKSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
+#else
+	rabuffer = malloc(HDD_READAHEAD_BLOCKS*MFSBLOCKSIZE);
+#endif
+	passert(rabuffer);
+	zassert(pthread_mutex_lock(&ralock));
+	for (;;) {
+		while (raqelements==0 && raterm==0) {
+			zassert(pthread_cond_wait(&racond,&ralock));
+		}
+		if (raterm) {
+			break;
+		}
+		rr = raqueue[raqhead];
+		raqhead = (raqhead+1)%HDD_READAHEAD_QUEUE;
+		raqelements--;
+		zassert(pthread_mutex_unlock(&ralock));
+		hdd_blocks_readahead(&rr,rabuffer);
+		zassert(pthread_mutex_lock(&ralock));
+	}
+	zassert(pthread_mutex_unlock(&ralock));
+#ifdef MMAP_ALLOC
+	munmap(rabuffer,HDD_READAHEAD_BLOCKS*MFSBLOCKSIZE);
+#else
+	free(rabuffer);
+#endif
+	return arg;
+}
+
+/* checks result of writing whole block to disk and updates its crc (chunk's cached block is also updated) */
+static int hdd_block_written(chunk *c,uint16_t blocknum,const uint8_t *buffer,uint32_t crc,int ret,int error) {
+	uint8_t *wcrcptr;
+
+	if (crc!=mycrc32(0,buffer,MFSBLOCKSIZE)) {
+		errno = error;
+		hdd_error_occured(c);
+		syslog(LOG_WARNING,"write_block_to_chunk: file:%s - crc error",c->filename);
+		hdd_report_damaged_chunk(c->chunkid);
+		return ERROR_CRC;
+	}
+	wcrcptr = (c->crc)+(4*blocknum);
+	put32bit(&wcrcptr,crc);
+	c->crcchanged = 1;
+	if (ret!=MFSBLOCKSIZE) {
+		if (error==0 || error==EAGAIN) {
+			error=ENOSPC;
+		}
+		errno = error;
+		hdd_error_occured(c);	// uses and preserves errno !!!
+		mfs_arg_errlog_silent(LOG_WARNING,"write_block_to_chunk: file:%s - write error",c->filename);
+		hdd_report_damaged_chunk(c->chunkid);
+		return ERROR_IO;
+	}
+#ifdef PRESERVE_BLOCK
+	memcpy(c->block,buffer,MFSBLOCKSIZE);
+	c->blockno = blocknum;
+#endif /* PRESERVE_BLOCK */
+	return STATUS_OK;
+}
+
+/* block read or write passed to folder's io_uring - chunk stays locked until the request is finished by hdd_aio_done */
+#define AIO_READ 0
+#define AIO_WRITE 1
+
+typedef struct hdd_aio {
+	chunk *c;
+	uint8_t op;
+	uint8_t readahead;
+	uint16_t blocknum;
+	uint16_t rablock;
+	uint32_t blocks;
+	uint32_t crc;
+	uint8_t *buffer;
+	const uint8_t *wbuffer;
+	uint8_t *crcbuff;
+	uint64_t ts;
+	void (*callback)(uint8_t status,void *extra);
+	void *extra;
+} hdd_aio;
+
+/* called by io_uring completion thread */
+static void hdd_aio_done(void *arg,int32_t result) {
+	hdd_aio *a = (hdd_aio*)arg;
+	chunk *c = a->c;
+	int status;
+	int ret,error;
+	uint64_t te;
+
+	te = monotonic_nseconds();
+	if (result<0) {
+		ret = -1;
+		error = -result;
+	} else {
+		ret = result;
+		error = 0;
+	}
+	if (a->op==AIO_READ) {
+		status = hdd_blocks_check(c,a->blocknum,a->blocks,a->buffer,a->crcbuff,ret,error,te-a->ts);
+		if (status==STATUS_OK) {
+			if (a->readahead) {
+				hdd_readahead_request(c->chunkid,c->version,a->rablock);
+			}
+			c->rablock = a->rablock;
+		}
+	} else {
+		hdd_stats_datawrite(c->owner,MFSBLOCKSIZE,te-a->ts);
+		status = hdd_block_written(c,a->blocknum,a->wbuffer,a->crc,ret,error);
+	}
+	hdd_chunk_release(c);
+	a->callback(status,a->extra);
+	free(a);
+}
+
+static inline hdd_aio* hdd_aio_new(chunk *c,uint8_t op,uint16_t blocknum,void (*callback)(uint8_t status,void *extra),void *extra) {
+	hdd_aio *a;
+
+	a = malloc(sizeof(hdd_aio));
+	passert(a);
+	a->c = c;
+	a->op = op;
+	a->readahead = 0;
+	a->blocknum = blocknum;
+	a->rablock = 0;
+	a->blocks = 1;
+	a->crc = 0;
+	a->buffer = NULL;
+	a->wbuffer = NULL;
+	a->crcbuff = NULL;
+	a->callback = callback;
+	a->extra = extra;
+	a->ts = monotonic_nseconds();
+	return a;
+}
+
+/* reads 'blocks' whole blocks starting from 'blocknum' (from block cache or from disk with one system call), checks all crc's and stores them in crcbuff (4*blocks bytes) */
+/* when callback is given and folder uses io_uring then disk read is only queued (HDD_QUEUED is returned) and status is passed to callback after completion */
+int hdd_read_blocks(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t *buffer,uint8_t *crcbuff,void (*callback)(uint8_t status,void *extra),void *extra) {
+	chunk *c;
+	hdd_aio *a;
+	int status;
+	uint32_t crc;
+	uint32_t rblocks,i,j;
+	uint8_t *tailcrcptr;
+	uint8_t readahead;
+
+	c = hdd_chunk_find(chunkid);
+	if (c==NULL) {
+		return ERROR_NOCHUNK;
+	}
+	if (c->version!=version && version>0) {
+		hdd_chunk_release(c);
+		return ERROR_WRONGVERSION;
+	}
+	if (blocks==0 || (uint32_t)blocknum+(uint32_t)blocks>MFSBLOCKSINCHUNK) {
+		hdd_chunk_release(c);
+		return ERROR_BNUMTOOBIG;
+	}
+	if (blocknum>=c->blocks) {
+		rblocks = 0;
+	} else if (blocknum+blocks>c->blocks) {
+		rblocks = c->blocks-blocknum;
+	} else {
+		rblocks = blocks;
+	}
+	for (i=0 ; i<rblocks ; i++) {
+		if (blockcache_get(chunkid,c->version,blocknum+i,buffer+(i<<MFSBLOCKBITS),&crc)==0) {
+			break;
+		}
+		put32bit(&crcbuff,crc);
+	}
+	if (rblocks<blocks) {
+		memset(buffer+(rblocks<<MFSBLOCKBITS),0,(blocks-rblocks)<<MFSBLOCKBITS);
+		tailcrcptr = crcbuff+4*(rblocks-i);
+		for (j=rblocks ; j<blocks ; j++) {
+			put32bit(&tailcrcptr,emptyblockcrc);
+		}
+	}
+	readahead = (rblocks>0 && blockcache_enabled() && c->rablock==blocknum && blocknum+blocks<c->blocks)?1:0;
+	if (i<rblocks) {
+		// read all remaining blocks from disk
+		if (callback!=NULL && c->owner->ring!=NULL) {
+			a = hdd_aio_new(c,AIO_READ,blocknum+i,callback,extra);
+			a->blocks = rblocks-i;
+			a->buffer = buffer+(i<<MFSBLOCKBITS);
+			a->crcbuff = crcbuff;
+			a->readahead = readahead;
+			a->rablock = blocknum+blocks;
+			if (hdd_uring_read(c->owner->ring,c->fd,a->buffer,a->blocks<<MFSBLOCKBITS,CHUNKHDRSIZE+(((uint32_t)(a->blocknum))<<MFSBLOCKBITS),a)==0) {
+				return HDD_QUEUED;
+			}
+			free(a);	// ring is full - read it here
+		}
+		status = hdd_blocks_load(c,blocknum+i,rblocks-i,buffer+(i<<MFSBLOCKBITS),crcbuff);
+		if (status!=STATUS_OK) {
+			hdd_chunk_release(c);
+			return status;
+		}
+	}
+	if (readahead) {
+		hdd_readahead_request(chunkid,c->version,blocknum+blocks);
+	}
+	c->rablock = blocknum+blocks;
+	hdd_chunk_release(c);
+	return STATUS_OK;
+}
+
+/* full block writes (when callback is given and folder uses io_uring) are only queued - HDD_QUEUED is returned and status is passed to callback after completion */
+int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buffer,uint32_t offset,uint32_t size,const uint8_t *crcbuff,void (*callback)(uint8_t status,void *extra),void *extra) {
 	chunk *c;
+	hdd_aio *a;
+	int status;
 	int ret;
 	int error;
 	uint8_t *wcrcptr;
@@ -2639,14 +3249,28 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 		hdd_chunk_release(c);
 		return ERROR_CRC;
 	}
+	blockcache_remove(chunkid,c->version,blocknum);
 	if (offset==0 && size==MFSBLOCKSIZE) {
 		if (blocknum>=c->blocks) {
+			if (c->idxdirty==0) {	// file is going to be extended - forget block count in chunk index until crc is written
+				c->idxdirty = 1;
+				hdd_chunk_index_update(c,0);
+			}
 			wcrcptr = (c->crc)+(4*(c->blocks));
 			for (i=c->blocks ; i<blocknum ; i++) {
 				put32bit(&wcrcptr,emptyblockcrc);
 			}
 			c->blocks = blocknum+1;
 		}
+		if (callback!=NULL && c->owner->ring!=NULL) {
+			a = hdd_aio_new(c,AIO_WRITE,blocknum,callback,extra);
+			a->wbuffer = buffer;
+			a->crc = crc;
+			if (hdd_uring_write(c->owner->ring,c->fd,buffer,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS),a)==0) {
+				return HDD_QUEUED;
+			}
+			free(a);	// ring is full - write it here
+		}
 		ts = monotonic_nseconds();
 #ifdef USE_PIO
 		ret = pwrite(c->fd,buffer,MFSBLOCKSIZE,CHUNKHDRSIZE+(((uint32_t)blocknum)<<MFSBLOCKBITS));
@@ -2657,32 +3281,11 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 		error = errno;
 		te = monotonic_nseconds();
 		hdd_stats_datawrite(c->owner,MFSBLOCKSIZE,te-ts);
-		if (crc!=mycrc32(0,buffer,MFSBLOCKSIZE)) {
-			errno = error;
-			hdd_error_occured(c);
-			syslog(LOG_WARNING,"write_block_to_chunk: file:%s - crc error",c->filename);
-			hdd_report_damaged_chunk(chunkid);
-			hdd_chunk_release(c);
-			return ERROR_CRC;
-		}
-		wcrcptr = (c->crc)+(4*blocknum);
-		put32bit(&wcrcptr,crc);
-		c->crcchanged = 1;
-		if (ret!=MFSBLOCKSIZE) {
-			if (error==0 || error==EAGAIN) {
-				error=ENOSPC;
-			}
-			errno = error;
-			hdd_error_occured(c);	// uses and preserves errno !!!
-			mfs_arg_errlog_silent(LOG_WARNING,"write_block_to_chunk: file:%s - write error",c->filename);
-			hdd_report_damaged_chunk(chunkid);
+		status = hdd_block_written(c,blocknum,buffer,crc,ret,error);
+		if (status!=STATUS_OK) {
 			hdd_chunk_release(c);
-			return ERROR_IO;
+			return status;
 		}
-#ifdef PRESERVE_BLOCK
-		memcpy(c->block,buffer,MFSBLOCKSIZE);
-		c->blockno = blocknum;
-#endif /* PRESERVE_BLOCK */
 	} else {
 		if (blocknum<c->blocks) {
 #ifdef PRESERVE_BLOCK
@@ -2751,6 +3354,10 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 				return ERROR_CRC;
 			}
 		} else {
+			if (c->idxdirty==0) {
+				c->idxdirty = 1;
+				hdd_chunk_index_update(c,0);
+			}
 			if (ftruncate(c->fd,CHUNKHDRSIZE+(((uint32_t)(blocknum+1))<<MFSBLOCKBITS))<0) {
 				hdd_error_occured(c);	// uses and preserves errno !!!
 				mfs_arg_errlog_silent(LOG_WARNING,"write_block_to_chunk: file:%s - ftruncate error",c->filename);
@@ -3157,9 +3764,11 @@ static int hdd_int_duplicate(uint64_t chunkid,uint32_t version,uint32_t newversi
 			passert(newfilename);
 			memcpy(newfilename,c->filename,filenameleng+1);
 			sprintf(newfilename+filenameleng-12,"%08"PRIX32".mfs",newversion);
+			hdd_chunk_index_update(oc,newversion);
 			if (rename(oc->filename,newfilename)<0) {
 				hdd_error_occured(oc);	// uses and preserves errno !!!
 				mfs_arg_errlog_silent(LOG_WARNING,"duplicate_chunk: file:%s - rename error",oc->filename);
+				hdd_chunk_index_update(oc,0);
 				free(newfilename);
 				hdd_chunk_delete(c);
 				hdd_chunk_release(oc);
@@ -3192,6 +3801,7 @@ static int hdd_int_duplicate(uint64_t chunkid,uint32_t version,uint32_t newversi
 		}
 		hdd_stats_write(4);
 		oc->version = newversion;
+		hdd_chunk_index_update(oc,0);
 	} else {
 		status = hdd_io_begin(oc,0);
 		if (status!=STATUS_OK) {
@@ -3301,8 +3911,10 @@ static int hdd_int_duplicate(uint64_t chunkid,uint32_t version,uint32_t newversi
 		return status;
 	}
 	c->blocks = oc->blocks;
+	c->idxdirty = 0;
 	zassert(pthread_mutex_lock(&folderlock));
 	c->owner->needrefresh = 1;
+	hdd_folder_index_write(c->owner,c->idxslot,c,0);
 	zassert(pthread_mutex_unlock(&folderlock));
 	hdd_chunk_release(c);
 	hdd_chunk_release(oc);
@@ -3329,9 +3941,11 @@ static int hdd_int_version(uint64_t chunkid,uint32_t version,uint32_t newversion
 		passert(newfilename);
 		memcpy(newfilename,c->filename,filenameleng+1);
 		sprintf(newfilename+filenameleng-12,"%08"PRIX32".mfs",newversion);
+		hdd_chunk_index_update(c,newversion);
 		if (rename(c->filename,newfilename)<0) {
 			hdd_error_occured(c);	// uses and preserves errno !!!
 			mfs_arg_errlog_silent(LOG_WARNING,"set_chunk_version: file:%s - rename error",c->filename);
+			hdd_chunk_index_update(c,0);
 			free(newfilename);
 			hdd_chunk_release(c);
 			return ERROR_IO;
@@ -3362,6 +3976,7 @@ static int hdd_int_version(uint64_t chunkid,uint32_t version,uint32_t newversion
 	}
 	hdd_stats_write(4);
 	c->version = newversion;
+	hdd_chunk_index_update(c,0);
 	status = hdd_io_end(c);
 	if (status!=STATUS_OK) {
 		hdd_error_occured(c);	// uses and preserves errno !!!
@@ -3403,6 +4018,8 @@ static int hdd_int_truncate(uint64_t chunkid,uint32_t version,uint32_t newversio
 		hdd_chunk_release(c);
 		return ERROR_WRONGVERSION;
 	}
+	c->idxdirty = 1;	// file length is going to change
+	hdd_chunk_index_update(c,newversion);
 	filenameleng = strlen(c->filename);
 	if (c->filename[filenameleng-13]=='_') {	// new file name format
 		newfilename = malloc(filenameleng+1);
@@ -3412,6 +4029,7 @@ static int hdd_int_truncate(uint64_t chunkid,uint32_t version,uint32_t newversio
 		if (rename(c->filename,newfilename)<0) {
 			hdd_error_occured(c);	// uses and preserves errno !!!
 			mfs_arg_errlog_silent(LOG_WARNING,"truncate_chunk: file:%s - rename error",c->filename);
+			hdd_chunk_index_update(c,0);
 			free(newfilename);
 			hdd_chunk_release(c);
 			return ERROR_IO;
@@ -3441,6 +4059,7 @@ static int hdd_int_truncate(uint64_t chunkid,uint32_t version,uint32_t newversio
 	}
 	hdd_stats_write(4);
 	c->version = newversion;
+	hdd_chunk_index_update(c,0);
 	// step 2. truncate
 	blocks = ((length+MFSBLOCKMASK)>>MFSBLOCKBITS);
 	if (blocks>c->blocks) {
@@ -3524,6 +4143,9 @@ static int hdd_int_truncate(uint64_t chunkid,uint32_t version,uint32_t newversio
 	status = hdd_io_end(c);
 	if (status!=STATUS_OK) {
 		hdd_error_occured(c);	// uses and preserves errno !!!
+	} else if (c->idxdirty) {	// crc not changed - file length is already known
+		c->idxdirty = 0;
+		hdd_chunk_index_update(c,0);
 	}
 	hdd_chunk_release(c);
 	return status;
@@ -3597,9 +4219,11 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 			passert(newfilename);
 			memcpy(newfilename,c->filename,filenameleng+1);
 			sprintf(newfilename+filenameleng-12,"%08"PRIX32".mfs",newversion);
+			hdd_chunk_index_update(oc,newversion);
 			if (rename(oc->filename,newfilename)<0) {
 				hdd_error_occured(oc);	// uses and preserves errno !!!
 				mfs_arg_errlog_silent(LOG_WARNING,"duplicate_chunk: file:%s - rename error",oc->filename);
+				hdd_chunk_index_update(oc,0);
 				free(newfilename);
 				hdd_chunk_delete(c);
 				hdd_chunk_release(oc);
@@ -3632,6 +4256,7 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 		}
 		hdd_stats_write(4);
 		oc->version = newversion;
+		hdd_chunk_index_update(oc,0);
 	} else {
 		status = hdd_io_begin(oc,0);
 		if (status!=STATUS_OK) {
@@ -3925,8 +4550,10 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 		return status;
 	}
 	c->blocks = blocks;
+	c->idxdirty = 0;
 	zassert(pthread_mutex_lock(&folderlock));
 	c->owner->needrefresh = 1;
+	hdd_folder_index_write(c->owner,c->idxslot,c,0);
 	zassert(pthread_mutex_unlock(&folderlock));
 	hdd_chunk_release(c);
 	hdd_chunk_release(oc);
@@ -3969,65 +4596,77 @@ static int hdd_int_delete(uint64_t chunkid,uint32_t version) {
 // newversion==0 && length==0                             -> delete
 // newversion==0 && length==1                             -> create
 // newversion==0 && length==2                             -> check chunk contents
-int hdd_chunkop(uint64_t chunkid,uint32_t version,uint32_t newversion,uint64_t copychunkid,uint32_t copyversion,uint32_t length) {
-	zassert(pthread_mutex_lock(&statslock));
+static int hdd_int_chunkop(uint64_t chunkid,uint32_t version,uint32_t newversion,uint64_t copychunkid,uint32_t copyversion,uint32_t length) {
 	if (newversion>0) {
 		if (length==0xFFFFFFFF) {
 			if (copychunkid==0) {
-				stats_version++;
+				return hdd_int_version(chunkid,version,newversion);
 			} else {
-				stats_duplicate++;
+				return hdd_int_duplicate(chunkid,version,newversion,copychunkid,copyversion);
 			}
 		} else if (length<=MFSCHUNKSIZE) {
 			if (copychunkid==0) {
-				stats_truncate++;
+				return hdd_int_truncate(chunkid,version,newversion,length);
 			} else {
-				stats_duptrunc++;
+				return hdd_int_duptrunc(chunkid,version,newversion,copychunkid,copyversion,length);
 			}
+		} else {
+			return ERROR_EINVAL;
 		}
 	} else {
 		if (length==0) {
-			stats_delete++;
+			return hdd_int_delete(chunkid,version);
 		} else if (length==1) {
-			stats_create++;
-		} else if (length==2) {
-			stats_test++;
+			return hdd_int_create(chunkid,version);
+		} else {
+			return ERROR_EINVAL;
 		}
 	}
-	zassert(pthread_mutex_unlock(&statslock));
+}
+
+int hdd_chunkop(uint64_t chunkid,uint32_t version,uint32_t newversion,uint64_t copychunkid,uint32_t copyversion,uint32_t length) {
+	idxop op;
+	int status;
+	zassert(pthread_mutex_lock(&statslock));
 	if (newversion>0) {
 		if (length==0xFFFFFFFF) {
 			if (copychunkid==0) {
-				return hdd_int_version(chunkid,version,newversion);
+				stats_version++;
 			} else {
-				return hdd_int_duplicate(chunkid,version,newversion,copychunkid,copyversion);
+				stats_duplicate++;
 			}
 		} else if (length<=MFSCHUNKSIZE) {
 			if (copychunkid==0) {
-				return hdd_int_truncate(chunkid,version,newversion,length);
+				stats_truncate++;
 			} else {
-				return hdd_int_duptrunc(chunkid,version,newversion,copychunkid,copyversion,length);
+				stats_duptrunc++;
 			}
-		} else {
-			return ERROR_EINVAL;
 		}
 	} else {
 		if (length==0) {
-			return hdd_int_delete(chunkid,version);
+			stats_delete++;
 		} else if (length==1) {
-			return hdd_int_create(chunkid,version);
+			stats_create++;
 		} else if (length==2) {
-			return hdd_int_test(chunkid,version);
-		} else {
-			return ERROR_EINVAL;
+			stats_test++;
 		}
 	}
+	zassert(pthread_mutex_unlock(&statslock));
+	if (newversion==0 && length==2) {
+		return hdd_int_test(chunkid,version);
+	}
+	// chunk files are created, renamed or removed here
+	hdd_idxop_begin(&op);
+	status = hdd_int_chunkop(chunkid,version,newversion,copychunkid,copyversion,length);
+	hdd_idxop_end(&op);
+	return status;
 }
 
 chunk* hdd_random_chunk(folder *f) {
 	uint32_t try;
 	uint32_t pos;
 	chunk *c;
+	idxop op;
 	zassert(pthread_mutex_lock(&folderlock));
 	zassert(pthread_mutex_lock(&hashlock));
 	if (f->chunkcount>0) {
@@ -4041,8 +4680,10 @@ chunk* hdd_random_chunk(folder *f) {
 				if (c->validattr==0) {
 					if (hdd_chunk_getattr(c)) {
 						hdd_report_damaged_chunk(c->chunkid);
+						hdd_idxop_begin(&op);
 						unlink(c->filename);
 						hdd_chunk_delete(c);
+						hdd_idxop_end(&op);
 					} else {
 						return c;
 					}
@@ -4273,6 +4914,7 @@ void* hdd_rebalance_thread(void *arg) {
 	uint8_t rebalance_is_on;
 	double rebalance_finished;
 	double monotonic_time;
+	idxop op;
 	uint32_t perc;
 	uint64_t st,en;
 
@@ -4479,7 +5121,9 @@ void* hdd_rebalance_thread(void *arg) {
 				zassert(pthread_mutex_unlock(&dclock));
 			}
 			st = monotonic_useconds();
+			hdd_idxop_begin(&op);
 			(void)hdd_int_move(fsrc,fdst);
+			hdd_idxop_end(&op);
 			en = monotonic_useconds();
 			zassert(pthread_mutex_lock(&folderlock));
 			fsrc->rebalance_in_progress = 0;
@@ -4772,6 +5416,10 @@ static inline void hdd_add_chunk(folder *f,const char *fullname,uint64_t chunkid
 		}
 	}
 	if (c->filename!=NULL) {	// already have this chunk
+		if (strcmp(c->filename,fullname)==0) {	// the same file listed twice (chunk index after crash) - ignore it
+			hdd_chunk_release(c);
+			return;
+		}
 		if (version <= c->version) {	// current chunk is older
 			if (todel<2) { // this is R/W fs?
 				unlink(fullname); // if yes then remove file
@@ -4950,6 +5598,256 @@ static inline int hdd_folder_fastscan(folder *f,char *fullname,uint16_t plen,uin
 	return 0;
 }
 
+static inline int hdd_folder_indexscan(folder *f,char *fullname,uint16_t plen,uint8_t todel) {
+	struct stat sb;
+	int fd;
+	DIR *dd;
+	struct dirent *de,*destorage;
+	uint8_t *idxbuff;
+	const uint8_t *rptr;
+	uint64_t chunkid;
+	uint64_t checkpoint;
+	uint32_t version,oldversion;
+	uint32_t i,reccnt,chunkcnt,rescancnt;
+	uint32_t tcheckcnt;
+	uint16_t blocks;
+	uint16_t subf,untrusted;
+	uint8_t clean,scanterm;
+	uint8_t trusted[256];
+
+	memcpy(fullname+plen,".chunkidx",9);
+	fullname[plen+9]='\0';
+
+	fd = open(fullname,O_RDONLY);
+	if (fd<0) {
+		return -1;
+	}
+	if (fstat(fd,&sb)<0) {
+		close(fd);
+		return -1;
+	}
+	if (sb.st_size<CHUNKIDXHDRSIZE || ((sb.st_size-CHUNKIDXHDRSIZE)%CHUNKIDXRECSIZE)!=0) {
+		syslog(LOG_NOTICE,"scanning folder %s: wrong size of .chunkidx - fallback to standard scan",f->path);
+		close(fd);
+		unlink(fullname);
+		return -1;
+	}
+	idxbuff = mmap(NULL,sb.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (idxbuff==MAP_FAILED) {
+		return -1;
+	}
+	// index is rebuilt after scan, so remove it now - if we crash in the meantime then standard scan will be used
+	unlink(fullname);
+	reccnt = (sb.st_size-CHUNKIDXHDRSIZE)/CHUNKIDXRECSIZE;
+
+	rptr = idxbuff+16;
+	if (memcmp(idxbuff,CHUNKIDXSIGNATURE,16)!=0 || get32bit(&rptr)!=CHUNKIDXRECSIZE) {
+		syslog(LOG_NOTICE,"scanning folder %s: wrong header in .chunkidx - fallback to standard scan",f->path);
+		munmap(idxbuff,sb.st_size);
+		return -1;
+	}
+	clean = (get32bit(&rptr)&CHUNKIDXFLAG_DIRTY)?0:1;
+	checkpoint = get64bit(&rptr);
+	for (i=0 ; i<reccnt ; i++) {
+		rptr = idxbuff+CHUNKIDXHDRSIZE+i*CHUNKIDXRECSIZE;
+		if (get64bit(&rptr)==0) {	// empty slot
+			continue;
+		}
+		rptr += CHUNKIDXRECSIZE-12;
+		if (get32bit(&rptr)!=mycrc32(0,idxbuff+CHUNKIDXHDRSIZE+i*CHUNKIDXRECSIZE,CHUNKIDXRECSIZE-4)) {
+			syslog(LOG_NOTICE,"scanning folder %s: data malformed in .chunkidx - fallback to standard scan",f->path);
+			munmap(idxbuff,sb.st_size);
+			return -1;
+		}
+	}
+
+	// records describe only data subfolders not modified since checkpoint (one second margin for time granularity) - other subfolders have to be scanned
+	untrusted = 0;
+	for (subf=0 ; subf<256 ; subf++) {
+		fullname[plen]="0123456789ABCDEF"[(subf>>4)&0xF];
+		fullname[plen+1]="0123456789ABCDEF"[subf&0xF];
+		fullname[plen+2]=0;
+		if (lstat(fullname,&sb)<0) {
+			munmap(idxbuff,(CHUNKIDXHDRSIZE+(size_t)reccnt*CHUNKIDXRECSIZE));
+			return -1;
+		}
+		if ((uint64_t)(sb.st_mtime)+1 < checkpoint && (uint64_t)(sb.st_ctime)+1 < checkpoint) {
+			trusted[subf] = 1;
+		} else {
+			trusted[subf] = 0;
+			untrusted++;
+		}
+	}
+
+	chunkcnt = 0;
+	for (i=0 ; i<reccnt ; i++) {
+		rptr = idxbuff+CHUNKIDXHDRSIZE+i*CHUNKIDXRECSIZE;
+		chunkid = get64bit(&rptr);
+		version = get32bit(&rptr);
+		oldversion = get32bit(&rptr);
+		blocks = get16bit(&rptr);
+		if (chunkid==0 || trusted[chunkid&255]==0) {
+			continue;
+		}
+		sprintf(fullname+plen,"%02X/chunk_%016"PRIX64"_%08"PRIX32".mfs",(unsigned int)(chunkid&255),chunkid,version);
+		if (oldversion!=0) {	// version change was in progress - check which file exists
+			if (stat(fullname,&sb)<0) {
+				sprintf(fullname+plen,"%02X/chunk_%016"PRIX64"_%08"PRIX32".mfs",(unsigned int)(chunkid&255),chunkid,oldversion);
+				if (stat(fullname,&sb)<0) {
+					continue;
+				}
+				version = oldversion;
+			}
+			blocks = 0xFFFF;
+		}
+		hdd_add_chunk(f,fullname,chunkid,version,clean?blocks:0xFFFF,todel);
+		chunkcnt++;
+	}
+	munmap(idxbuff,(CHUNKIDXHDRSIZE+(size_t)reccnt*CHUNKIDXRECSIZE));
+
+	rescancnt = 0;
+	if (untrusted>0) {
+		/* size of name added to size of structure because on some os'es d_name has size of 1 byte */
+		destorage = (struct dirent*)malloc(sizeof(struct dirent)+pathconf(f->path,_PC_NAME_MAX)+1);
+		passert(destorage);
+		scanterm = 0;
+		tcheckcnt = 0;
+		for (subf=0 ; subf<256 && scanterm==0 ; subf++) {
+			if (trusted[subf]) {
+				continue;
+			}
+			fullname[plen]="0123456789ABCDEF"[(subf>>4)&0xF];
+			fullname[plen+1]="0123456789ABCDEF"[subf&0xF];
+			fullname[plen+2]='/';
+			fullname[plen+3]='\0';
+			dd = opendir(fullname);
+			if (dd) {
+				while (readdir_r(dd,destorage,&de)==0 && de!=NULL && scanterm==0) {
+					if (hdd_check_filename(de->d_name,&chunkid,&version)<0) {
+						continue;
+					}
+					memcpy(fullname+plen+3,de->d_name,36);
+					hdd_add_chunk(f,fullname,chunkid,version,0xFFFF,todel);
+					rescancnt++;
+					tcheckcnt++;
+					if (tcheckcnt>=1000) {
+						zassert(pthread_mutex_lock(&folderlock));
+						if (f->scanstate==SCST_SCANTERMINATE) {
+							scanterm = 1;
+						}
+						zassert(pthread_mutex_unlock(&folderlock));
+						tcheckcnt = 0;
+					}
+				}
+				closedir(dd);
+			}
+		}
+		free(destorage);
+	}
+
+	memcpy(fullname+plen,".chunkdb",8);	// '.chunkdb' is older than index
+	fullname[plen+8]='\0';
+	unlink(fullname);
+
+	if (untrusted>0) {
+		syslog(LOG_NOTICE,"scanning folder %s: .chunkidx used (%"PRIu32" chunks, %s) - %"PRIu16" data subfolders modified after index checkpoint rescanned (%"PRIu32" chunks)",f->path,chunkcnt,clean?"clean":"not closed properly",untrusted,rescancnt);
+	} else {
+		syslog(LOG_NOTICE,"scanning folder %s: .chunkidx used (%"PRIu32" chunks, %s) - full scan don't needed",f->path,chunkcnt,clean?"clean":"not closed properly");
+	}
+	return 0;
+}
+
+static inline void hdd_folder_index_create(folder *f) {
+	uint32_t pleng;
+	uint32_t i,j,chunkcount;
+	char *fname_src,*fname_dst;
+	uint8_t *buff,*wptr;
+	chunk *c;
+	int fd;
+	int status;
+	uint8_t installed;
+
+	pleng = strlen(f->path);
+	fname_src = malloc(pleng+14);
+	fname_dst = malloc(pleng+10);
+	passert(fname_src);
+	passert(fname_dst);
+	memcpy(fname_src,f->path,pleng);
+	memcpy(fname_src+pleng,".tmp_chunkidx",13);
+	fname_src[pleng+13] = 0;
+	memcpy(fname_dst,f->path,pleng);
+	memcpy(fname_dst+pleng,".chunkidx",9);
+	fname_dst[pleng+9] = 0;
+
+	fd = open(fname_src,O_RDWR | O_TRUNC | O_CREAT,0666);
+	if (fd<0) {
+		mfs_arg_errlog(LOG_NOTICE,"%s: open error",fname_src);
+		free(fname_src);
+		free(fname_dst);
+		return;
+	}
+	buff = malloc(CHUNKIDXRECSIZE*1024);
+	passert(buff);
+	// index is installed already open for updates (synced below before rename) - checkpoint is taken before chunk table is dumped
+	hdd_folder_index_header(buff,CHUNKIDXFLAG_DIRTY,hdd_idxop_checkpoint_time());
+	status = (write(fd,buff,CHUNKIDXHDRSIZE)==CHUNKIDXHDRSIZE)?0:-1;
+	// dump whole chunk table and from now on update new index incrementally (also when it is being synced)
+	zassert(pthread_mutex_lock(&folderlock));
+	chunkcount = f->chunkcount;
+	f->idxslots = chunkcount;
+	f->idxfreecnt = 0;
+	for (i=0 ; i<chunkcount && status==0 ; i+=j) {
+		wptr = buff;
+		for (j=0 ; j<1024 && i+j<chunkcount ; j++) {
+			c = f->chunktab[i+j];
+			c->idxslot = i+j;
+			put64bit(&wptr,c->chunkid);
+			put32bit(&wptr,c->version);
+			put32bit(&wptr,0);
+			put16bit(&wptr,(c->idxdirty || c->validattr==0)?0xFFFF:c->blocks);
+			put16bit(&wptr,0);
+			put32bit(&wptr,mycrc32(0,wptr-(CHUNKIDXRECSIZE-4),CHUNKIDXRECSIZE-4));
+		}
+		if (write(fd,buff,j*CHUNKIDXRECSIZE)!=(ssize_t)(j*CHUNKIDXRECSIZE)) {
+			status = -1;
+		}
+	}
+	if (status==0) {
+		f->idxfd = fd;
+		f->idxcheckpoint = monotonic_seconds();
+		installed = 1;
+	} else {
+		installed = 0;
+	}
+	zassert(pthread_mutex_unlock(&folderlock));
+	free(buff);
+	if (status==0) {
+		status = fsync(fd);
+	}
+	zassert(pthread_mutex_lock(&folderlock));
+	if (status==0 && f->idxfd==fd) {
+		if (rename(fname_src,fname_dst)<0) {
+			status = -1;
+		}
+	} else {
+		status = -1;
+	}
+	if (status<0) {
+		mfs_arg_errlog_silent(LOG_WARNING,"%s: can't create chunk index",f->path);
+		if (f->idxfd==fd) {
+			f->idxfd = -1;
+			close(fd);
+		} else if (installed==0) {
+			close(fd);
+		} // else descriptor has been already closed after write error
+		unlink(fname_src);
+	}
+	zassert(pthread_mutex_unlock(&folderlock));
+	free(fname_src);
+	free(fname_dst);
+}
+
 void* hdd_folder_scan(void *arg) {
 	folder *f = (folder*)arg;
 	DIR *dd;
@@ -4985,7 +5883,11 @@ void* hdd_folder_scan(void *arg) {
 		mkdir(fullname,0755);
 	}
 
-	if (hdd_folder_fastscan(f,fullname,plen,todel)<0) {
+	zassert(pthread_mutex_lock(&folderlock));
+	hdd_folder_index_close(f);
+	zassert(pthread_mutex_unlock(&folderlock));
+
+	if (hdd_folder_indexscan(f,fullname,plen,todel)<0 && hdd_folder_fastscan(f,fullname,plen,todel)<0) {
 
 		fullname[plen++]='_';
 		fullname[plen++]='_';
@@ -5097,6 +5999,13 @@ void* hdd_folder_scan(void *arg) {
 
 	hdd_testshuffle(f);
 
+	zassert(pthread_mutex_lock(&folderlock));
+	scanterm = (f->scanstate==SCST_SCANTERMINATE)?1:0;
+	zassert(pthread_mutex_unlock(&folderlock));
+	if (scanterm==0 && todel<2) {
+		hdd_folder_index_create(f);
+	}
+
 	zassert(pthread_mutex_lock(&folderlock));
 	if (f->scanstate==SCST_SCANTERMINATE) {
 		syslog(LOG_NOTICE,"scanning folder %s: interrupted",f->path);
@@ -5110,8 +6019,16 @@ void* hdd_folder_scan(void *arg) {
 }
 
 void* hdd_folders_thread(void *arg) {
+	folder *f,*fhead;
 	for (;;) {
 		hdd_check_folders();
+		// folders are unlinked and freed only by hdd_check_folders (new ones are added at head), so list can be walked here without folderlock
+		zassert(pthread_mutex_lock(&folderlock));
+		fhead = folderhead;
+		zassert(pthread_mutex_unlock(&folderlock));
+		for (f=fhead ; f ; f=f->next) {
+			hdd_folder_index_checkpoint(f);
+		}
 		zassert(pthread_mutex_lock(&termlock));
 		if (term) {
 			zassert(pthread_mutex_unlock(&termlock));
@@ -5164,6 +6081,16 @@ void hdd_term(void) {
 		zassert(pthread_join(foldersthread,NULL));
 		zassert(pthread_join(rebalancethread,NULL));
 		zassert(pthread_join(delayedthread,NULL));
+		zassert(pthread_mutex_lock(&ralock));
+		raterm = 1;
+		zassert(pthread_cond_signal(&racond));
+		zassert(pthread_mutex_unlock(&ralock));
+		zassert(pthread_join(readaheadthread,NULL));
+	}
+	// finish all pending io_uring requests (completions release their chunks)
+	for (f=folderhead ; f ; f=f->next) {
+		hdd_uring_free(f->ring);
+		f->ring = NULL;
 	}
 	zassert(pthread_mutex_lock(&folderlock));
 	i = 0;
@@ -5239,12 +6166,14 @@ void hdd_term(void) {
 		if (f->scanstate==SCST_WORKING && f->toremove==0) {
 			hdd_folder_dump_chunkdb_end(f);
 		}
+		hdd_folder_index_close(f);
 		if (f->lfd>=0) {
 			close(f->lfd);
 		}
 		if (f->chunktab) {
 			free(f->chunktab);
 		}
+		hdd_folder_index_slots_clear(f);
 		free(f->path);
 		free(f);
 	}
@@ -5279,6 +6208,7 @@ void hdd_term(void) {
 		dmcn = dmc->next;
 		free(dmc);
 	}
+	blockcache_term();
 }
 
 int hdd_size_parse(const char *str,uint64_t *ret) {
@@ -5640,6 +6570,7 @@ int hdd_parseline(char *hddcfgline) {
 				f->chunkcount = 0;
 				f->chunktabsize = 0;
 				f->chunktab = NULL;
+				hdd_folder_index_slots_clear(f);
 				hdd_stats_clear(&(f->cstat));
 				hdd_stats_clear(&(f->monotonic));
 				for (l=0 ; l<STATSHISTORY ; l++) {
@@ -5714,6 +6645,13 @@ int hdd_parseline(char *hddcfgline) {
 	f->lockinode = sb.st_ino;
 	f->lfd = lfd;
 	f->dumpfd = -1;
+	f->idxfd = -1;
+	f->idxslots = 0;
+	f->idxfree = NULL;
+	f->idxfreecnt = 0;
+	f->idxfreesize = 0;
+	f->idxcheckpoint = 0.0;
+	f->ring = (UseIoUring)?hdd_uring_new(HDD_URING_ENTRIES,hdd_aio_done):NULL;
 	f->testhead = NULL;
 	f->testtail = &(f->testhead);
 //	f->carry = (double)(random()&0x7FFFFFFF)/(double)(0x7FFFFFFF);
@@ -5869,6 +6807,7 @@ int hdd_late_init(void) {
 	zassert(main_minthread_create(&foldersthread,0,hdd_folders_thread,NULL));
 	zassert(main_minthread_create(&rebalancethread,0,hdd_rebalance_thread,NULL));
 	zassert(main_minthread_create(&delayedthread,0,hdd_delayed_thread,NULL));
+	zassert(main_minthread_create(&readaheadthread,0,hdd_readahead_thread,NULL));
 	return 0;
 }
 
@@ -5876,6 +6815,8 @@ int hdd_init(void) {
 	uint32_t hp;
 	folder *f;
 	char *LeaveFreeStr;
+	char *BlockCacheStr;
+	uint64_t BlockCacheSize;
 
 	// this routine is called at the beginning from the main thread so no locks are necessary here
 	for (hp=0 ; hp<HASHSIZE ; hp++) {
@@ -5896,6 +6837,16 @@ int hdd_init(void) {
 
 	emptyblockcrc = mycrc32_zeroblock(0,MFSBLOCKSIZE);
 
+	BlockCacheStr = cfg_getstr("HDD_BLOCK_CACHE_SIZE","128MiB");
+	if (hdd_size_parse(BlockCacheStr,&BlockCacheSize)<0) {
+		fprintf(stderr,"hdd space manager: HDD_BLOCK_CACHE_SIZE parse error - using default (128MiB)\n");
+		BlockCacheSize = 0x8000000;
+	}
+	free(BlockCacheStr);
+	blockcache_init(BlockCacheSize);
+
+	UseIoUring = cfg_getuint8("HDD_IO_URING",0);
+
 	LeaveFreeStr = cfg_getstr("HDD_LEAVE_SPACE_DEFAULT","256MiB");
 	if (hdd_size_parse(LeaveFreeStr,&LeaveFree)<0) {
 		fprintf(stderr,"hdd space manager: HDD_LEAVE_SPACE_DEFAULT parse error - using default (256MiB)\n");
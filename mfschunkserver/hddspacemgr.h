@@ -48,6 +48,7 @@ void hdd_get_chunks_begin(uint8_t partialmode);
 void hdd_get_chunks_end(void);
 uint32_t hdd_get_chunks_next_list_count();
 void hdd_get_chunks_next_list_data(uint8_t *buff);
+uint32_t hdd_get_chunks_next_list_compact(uint8_t *buff,uint32_t chunks);
 //uint32_t hdd_get_chunks_count();
 //void hdd_get_chunks_data(uint8_t *buff);
 
@@ -60,7 +61,10 @@ void hdd_get_space(uint64_t *usedspace,uint64_t *totalspace,uint32_t *chunkcount
 int hdd_open(uint64_t chunkid,uint32_t version);
 int hdd_close(uint64_t chunkid);
 int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer,uint32_t offset,uint32_t size,uint8_t *crcbuff);
-int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buffer,uint32_t offset,uint32_t size,const uint8_t *crcbuff);
+/* returned by hdd_read_blocks and hdd_write when disk i/o has been passed to io_uring - status will be given to the callback (called from other thread) */
+#define HDD_QUEUED (-1)
+int hdd_read_blocks(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t *buffer,uint8_t *crcbuff,void (*callback)(uint8_t status,void *extra),void *extra);
+int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buffer,uint32_t offset,uint32_t size,const uint8_t *crcbuff,void (*callback)(uint8_t status,void *extra),void *extra);
 
 /* chunk info */
 // int hdd_check_version(uint64_t chunkid,uint32_t version);
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_SYSCALL_H)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define USE_IO_URING 1
+#endif
+#endif
+
+#include "hdduring.h"
+#include "massert.h"
+#include "slogger.h"
+#include "main.h"
+#include "portable.h"
+
+#ifdef USE_IO_URING
+
+struct hdd_uring {
+	int fd;
+	uint32_t entries;
+	uint32_t inflight;
+	uint8_t term;
+	void (*done)(void *arg,int32_t result);
+	// submission queue
+	void *sqptr;
+	size_t sqsize;
+	uint32_t *sqhead;
+	uint32_t *sqtail;
+	uint32_t sqmask;
+	uint32_t *sqarray;
+	struct io_uring_sqe *sqes;
+	// completion queue
+	void *cqptr;
+	size_t cqsize;
+	uint32_t *cqhead;
+	uint32_t *cqtail;
+	uint32_t cqmask;
+	struct io_uring_cqe *cqes;
+	pthread_mutex_t lock;
+	pthread_t reaper;
+};
+
+static inline int hdd_uring_enter(int fd,uint32_t tosubmit,uint32_t mincomplete,uint32_t flags) {
+	return syscall(__NR_io_uring_enter,fd,tosubmit,mincomplete,flags,NULL,0);
+}
+
+/* completion thread - finishes requests (calls 'done') in order of their completion */
+static void* hdd_uring_reaper(void *arg) {
+	hdd_uring *r = (hdd_uring*)arg;
+	struct io_uring_cqe *cqe;
+	void *reqarg;
+	int32_t result;
+	uint32_t head,tail,cnt;
+
+	for (;;) {
+		head = *(r->cqhead);
+		tail = __atomic_load_n(r->cqtail,__ATOMIC_ACQUIRE);
+		if (head==tail) {
+			if (hdd_uring_enter(r->fd,0,1,IORING_ENTER_GETEVENTS)<0 && errno!=EINTR) {
+				mfs_errlog(LOG_ERR,"io_uring: io_uring_enter error");
+				portable_usleep(10000);
+			}
+			continue;
+		}
+		cnt = 0;
+		while (head!=tail) {
+			cqe = r->cqes + (head & r->cqmask);
+			reqarg = (void*)(uintptr_t)(cqe->user_data);
+			result = cqe->res;
+			head++;
+			__atomic_store_n(r->cqhead,head,__ATOMIC_RELEASE);
+			if (reqarg!=NULL) {
+				r->done(reqarg,result);
+			}
+			cnt++;
+		}
+		zassert(pthread_mutex_lock(&(r->lock)));
+		r->inflight -= cnt;
+		if (r->term && r->inflight==0) {
+			zassert(pthread_mutex_unlock(&(r->lock)));
+			return arg;
+		}
+		zassert(pthread_mutex_unlock(&(r->lock)));
+	}
+	return arg;
+}
+
+hdd_uring* hdd_uring_new(uint32_t entries,void (*done)(void *arg,int32_t result)) {
+	struct io_uring_params p;
+	hdd_uring *r;
+	uint8_t *sqptr,*cqptr;
+	int fd;
+
+	memset(&p,0,sizeof(p));
+	fd = syscall(__NR_io_uring_setup,entries,&p);
+	if (fd<0) {
+		mfs_errlog(LOG_WARNING,"io_uring: setup error");
+		return NULL;
+	}
+	// IORING_OP_READ/IORING_OP_WRITE appeared together with IORING_FEAT_RW_CUR_POS (linux 5.6)
+	if ((p.features & IORING_FEAT_NODROP)==0 || (p.features & IORING_FEAT_RW_CUR_POS)==0) {
+		syslog(LOG_WARNING,"io_uring: kernel too old (no support for read/write operations)");
+		close(fd);
+		return NULL;
+	}
+	r = malloc(sizeof(hdd_uring));
+	passert(r);
+	memset(r,0,sizeof(hdd_uring));
+	r->fd = fd;
+	r->entries = p.sq_entries;
+	r->done = done;
+	r->sqsize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	r->cqsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cqsize > r->sqsize) {
+			r->sqsize = r->cqsize;
+		}
+		r->cqsize = 0;
+	}
+	r->sqptr = mmap(NULL,r->sqsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQ_RING);
+	if (r->sqptr==MAP_FAILED) {
+		mfs_errlog(LOG_WARNING,"io_uring: mmap error");
+		close(fd);
+		free(r);
+		return NULL;
+	}
+	if (r->cqsize) {
+		r->cqptr = mmap(NULL,r->cqsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_CQ_RING);
+		if (r->cqptr==MAP_FAILED) {
+			mfs_errlog(LOG_WARNING,"io_uring: mmap error");
+			munmap(r->sqptr,r->sqsize);
+			close(fd);
+			free(r);
+			return NULL;
+		}
+	} else {
+		r->cqptr = r->sqptr;
+	}
+	r->sqes = mmap(NULL,p.sq_entries * sizeof(struct io_uring_sqe),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQES);
+	if (r->sqes==MAP_FAILED) {
+		mfs_errlog(LOG_WARNING,"io_uring: mmap error");
+		if (r->cqsize) {
+			munmap(r->cqptr,r->cqsize);
+		}
+		munmap(r->sqptr,r->sqsize);
+		close(fd);
+		free(r);
+		return NULL;
+	}
+	sqptr = r->sqptr;
+	cqptr = r->cqptr;
+	r->sqhead = (uint32_t*)(sqptr + p.sq_off.head);
+	r->sqtail = (uint32_t*)(sqptr + p.sq_off.tail);
+	r->sqmask = *(uint32_t*)(sqptr + p.sq_off.ring_mask);
+	r->sqarray = (uint32_t*)(sqptr + p.sq_off.array);
+	r->cqhead = (uint32_t*)(cqptr + p.cq_off.head);
+	r->cqtail = (uint32_t*)(cqptr + p.cq_off.tail);
+	r->cqmask = *(uint32_t*)(cqptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe*)(cqptr + p.cq_off.cqes);
+	zassert(pthread_mutex_init(&(r->lock),NULL));
+	zassert(main_minthread_create(&(r->reaper),0,hdd_uring_reaper,r));
+	return r;
+}
+
+/* puts request into submission queue and passes it to the kernel (ring lock must be held), returns -1 when request was rejected */
+static int hdd_uring_queue(hdd_uring *r,uint8_t op,int fd,const void *buff,uint32_t leng,uint64_t offset,void *arg) {
+	struct io_uring_sqe *sqe;
+	uint32_t tail;
+	int e;
+
+	tail = *(r->sqtail);
+	sqe = r->sqes + (tail & r->sqmask);
+	memset(sqe,0,sizeof(struct io_uring_sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buff;
+	sqe->len = leng;
+	sqe->off = offset;
+	sqe->user_data = (uint64_t)(uintptr_t)arg;
+	r->sqarray[tail & r->sqmask] = tail & r->sqmask;
+	__atomic_store_n(r->sqtail,tail+1,__ATOMIC_RELEASE);
+	do {
+		e = hdd_uring_enter(r->fd,1,0,0);
+	} while (e<0 && errno==EINTR);
+	if (e<1) {
+		// kernel didn't take request - withdraw it
+		__atomic_store_n(r->sqtail,tail,__ATOMIC_RELEASE);
+		return -1;
+	}
+	r->inflight++;
+	return 0;
+}
+
+static int hdd_uring_submit(hdd_uring *r,uint8_t op,int fd,const void *buff,uint32_t leng,uint64_t offset,void *arg) {
+	int ret;
+
+	zassert(pthread_mutex_lock(&(r->lock)));
+	if (r->term || r->inflight>=r->entries) {
+		ret = -1;
+	} else {
+		ret = hdd_uring_queue(r,op,fd,buff,leng,offset,arg);
+	}
+	zassert(pthread_mutex_unlock(&(r->lock)));
+	return ret;
+}
+
+void hdd_uring_free(hdd_uring *r) {
+	if (r==NULL) {
+		return;
+	}
+	// nop request wakes up completion thread, which exits after all pending requests are finished
+	zassert(pthread_mutex_lock(&(r->lock)));
+	while (r->inflight>=r->entries || hdd_uring_queue(r,IORING_OP_NOP,-1,NULL,0,0,NULL)<0) {
+		zassert(pthread_mutex_unlock(&(r->lock)));
+		portable_usleep(1000);
+		zassert(pthread_mutex_lock(&(r->lock)));
+	}
+	r->term = 1;
+	zassert(pthread_mutex_unlock(&(r->lock)));
+	zassert(pthread_join(r->reaper,NULL));
+	munmap(r->sqes,r->entries * sizeof(struct io_uring_sqe));
+	if (r->cqsize) {
+		munmap(r->cqptr,r->cqsize);
+	}
+	munmap(r->sqptr,r->sqsize);
+	close(r->fd);
+	zassert(pthread_mutex_destroy(&(r->lock)));
+	free(r);
+}
+
+int hdd_uring_read(hdd_uring *r,int fd,void *buff,uint32_t leng,uint64_t offset,void *arg) {
+	return hdd_uring_submit(r,IORING_OP_READ,fd,buff,leng,offset,arg);
+}
+
+int hdd_uring_write(hdd_uring *r,int fd,const void *buff,uint32_t leng,uint64_t offset,void *arg) {
+	return hdd_uring_submit(r,IORING_OP_WRITE,fd,buff,leng,offset,arg);
+}
+
+#else /* USE_IO_URING */
+
+hdd_uring* hdd_uring_new(uint32_t entries,void (*done)(void *arg,int32_t result)) {
+	(void)entries;
+	(void)done;
+	syslog(LOG_WARNING,"io_uring: not supported on this platform - using synchronous i/o");
+	return NULL;
+}
+
+void hdd_uring_free(hdd_uring *r) {
+	(void)r;
+}
+
+int hdd_uring_read(hdd_uring *r,int fd,void *buff,uint32_t leng,uint64_t offset,void *arg) {
+	(void)r;
+	(void)fd;
+	(void)buff;
+	(void)leng;
+	(void)offset;
+	(void)arg;
+	return -1;
+}
+
+int hdd_uring_write(hdd_uring *r,int fd,const void *buff,uint32_t leng,uint64_t offset,void *arg) {
+	(void)r;
+	(void)fd;
+	(void)buff;
+	(void)leng;
+	(void)offset;
+	(void)arg;
+	return -1;
+}
+
+#endif /* USE_IO_URING */
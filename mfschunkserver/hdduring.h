@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef _HDDURING_H_
+#define _HDDURING_H_
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+/* io_uring based asynchronous disk i/o (one ring per data folder) */
+/* read/write functions only queue the request and return 0 (or -1 when the ring is full or not usable - caller should then do synchronous i/o) */
+/* 'done' callback given to hdd_uring_new is called with request's 'arg' and result (number of bytes or -errno) from the ring's completion thread */
+
+typedef struct hdd_uring hdd_uring;
+
+hdd_uring* hdd_uring_new(uint32_t entries,void (*done)(void *arg,int32_t result));
+void hdd_uring_free(hdd_uring *r);
+
+int hdd_uring_read(hdd_uring *r,int fd,void *buff,uint32_t leng,uint64_t offset,void *arg);
+int hdd_uring_write(hdd_uring *r,int fd,const void *buff,uint32_t leng,uint64_t offset,void *arg);
+
+#endif
@@ -28,8 +28,8 @@
 #include "random.h"
 #include "hddspacemgr.h"
 #include "masterconn.h"
+#include "replicator.h"
 #include "csserv.h"
-#include "mainserv.h"
 #include "chartsdata.h"
 
 #define STR_AUX(x) #x
@@ -49,9 +49,9 @@ struct {
 } RunTab[]={
 	{rnd_init,"random generator"},
 	{hdd_init,"hdd space manager"},
-	{mainserv_init,"main server threads"},
+	{replicator_init,"replicator"},
 	{job_init,"jobs manager"},
-	{csserv_init,"main server acceptor"},	/* it has to be before "masterconn" */
+	{csserv_init,"main server module"},	/* it has to be before "masterconn" */
 	{masterconn_init,"master connection module"},
 	{chartsdata_init,"charts module"},
 	{(runfn)0,"****"}
@@ -117,6 +117,8 @@ typedef struct masterconn {
 	uint8_t masteraddrvalid;
 	uint8_t registerstate;
 	uint8_t new_register_mode;
+	uint8_t compactchunks;		// master accepts compact (sorted, delta encoded) chunk lists
+	uint8_t chunkssent;		// at least one CHUNKS packet has been sent during this registration
 	uint8_t hlstatus;
 //	uint8_t accepted;
 } masterconn;
@@ -394,18 +396,40 @@ void masterconn_sendchunksinfo(masterconn *eptr) {
 }
 
 void masterconn_sendnextchunks(masterconn *eptr) {
-	uint8_t *buff;
-	uint32_t chunks;
+	uint8_t *buff,*cbuff;
+	uint32_t chunks,cleng;
 	chunks = hdd_get_chunks_next_list_count();
-	if (chunks==0) {
-		hdd_get_chunks_end();
+	if (chunks==0 && eptr->chunkssent==0) {
+		// empty list - only to get flags from master, so features can be announced in END packet
 		buff = masterconn_create_attached_packet(eptr,CSTOMA_REGISTER,1);
-		put8bit(&buff,62);
+		put8bit(&buff,61);
+		eptr->chunkssent = 1;
+	} else if (chunks==0) {
+		hdd_get_chunks_end();
+		if (eptr->compactchunks) {
+			buff = masterconn_create_attached_packet(eptr,CSTOMA_REGISTER,1+2);
+			put8bit(&buff,62);
+			put16bit(&buff,CSTOMA_REGISTER_FEATURE_STRIPEDREPLICATE);
+		} else {
+			buff = masterconn_create_attached_packet(eptr,CSTOMA_REGISTER,1);
+			put8bit(&buff,62);
+		}
 		eptr->registerstate = REGISTERED;
+	} else if (eptr->compactchunks) {
+		cbuff = malloc(chunks*15);
+		passert(cbuff);
+		cleng = hdd_get_chunks_next_list_compact(cbuff,chunks);
+		buff = masterconn_create_attached_packet(eptr,CSTOMA_REGISTER,1+4+cleng);
+		put8bit(&buff,63);
+		put32bit(&buff,chunks);
+		memcpy(buff,cbuff,cleng);
+		free(cbuff);
+		eptr->chunkssent = 1;
 	} else {
 		buff = masterconn_create_attached_packet(eptr,CSTOMA_REGISTER,1+chunks*(8+4));
 		put8bit(&buff,61);
 		hdd_get_chunks_next_list_data(buff);
+		eptr->chunkssent = 1;
 	}
 }
 
@@ -425,6 +449,9 @@ void masterconn_master_ack(masterconn *eptr,const uint8_t *data,uint32_t length)
 		if (length>=5) {
 			eptr->masterversion = get32bit(&data);
 		}
+		if (length==7) {
+			eptr->compactchunks = (get16bit(&data) & MATOCS_MASTER_ACK_FLAG_COMPACTCHUNKS)?1:0;
+		}
 		if (length>=9) {
 			if (Timeout==0) {
 				eptr->timeout = get16bit(&data);
@@ -879,7 +906,7 @@ void masterconn_replicate(masterconn *eptr,const uint8_t *data,uint32_t length)
 	uint8_t *ptr;
 	void *packet;
 
-	if (!(length==18 || (length>=28+18 && length<=28+8*18 && (length-28)%18==0))) {
+	if (!(length==18 || (length>=12+18 && length<=12+100*18 && (length-12)%18==0) || (length>=28+18 && length<=28+8*18 && (length-28)%18==0))) {
 		syslog(LOG_NOTICE,"MATOCS_REPLICATE - wrong size (%"PRIu32"/18|12+n*18[n:1..100]|28+n*18[n:1..8])",length);
 		eptr->mode = KILL;
 		return;
@@ -895,6 +922,8 @@ void masterconn_replicate(masterconn *eptr,const uint8_t *data,uint32_t length)
 		port = get16bit(&data);
 //		syslog(LOG_NOTICE,"start job replication (%08"PRIX64":%04"PRIX32":%04"PRIX32":%02"PRIX16")",chunkid,version,ip,port);
 		job_replicate_simple(masterconn_replicationfinished,packet,chunkid,version,ip,port);
+	} else if ((length-12)%18==0) {
+		job_replicate_striped(masterconn_replicationfinished,packet,chunkid,version,(length-12)/18,data);
 	} else {
 		xormasks[0] = get32bit(&data);
 		xormasks[1] = get32bit(&data);
@@ -1093,6 +1122,8 @@ void masterconn_connected(masterconn *eptr) {
 	eptr->outputtail = &(eptr->outputhead);
 	eptr->conncnt++;
 	eptr->masterversion = 0;
+	eptr->compactchunks = 0;
+	eptr->chunkssent = 0;
 	eptr->hlstatus = 0;
 	eptr->registerstate = UNREGISTERED;
 
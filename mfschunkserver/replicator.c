@@ -38,11 +38,14 @@
 #include "hddspacemgr.h"
 #include "sockets.h"
 #include "crc.h"
+#include "gf256.h"
 #include "slogger.h"
 #include "datapack.h"
 #include "massert.h"
 #include "mfsstrerr.h"
 #include "clocks.h"
+#include "pcqueue.h"
+#include "main.h"
 
 #include "replicator.h"
 
@@ -52,8 +55,19 @@
 
 #define MAX_RECV_PACKET_SIZE (20+MFSBLOCKSIZE)
 
+// striped replication - blocks requested from one source at once and blocks waiting for the writer thread
+#define STRIPE_BLOCKS 64
+#define WRITE_QUEUE_BLOCKS 32
+#define POLLMSECTO 1000
+
 typedef enum {IDLE,CONNECTING,HEADER,DATA} modetype;
 
+// striped replication: state of a source
+enum {RS_UNUSED,RS_READY,RS_SEND,RS_RECV,RS_FAILED};
+
+// striped replication: writer thread operations
+enum {WOP_DATA,WOP_EXIT};
+
 typedef struct _repsrc {
 	int sock;
 	modetype mode;
@@ -70,13 +84,26 @@ typedef struct _repsrc {
 	uint16_t port;
 
 	uint32_t crcsums[4];
+
+	uint8_t rstate;
+	uint16_t rnext,rend;	// striped replication: next expected block and end of requested range
+	uint64_t lastio;
 } repsrc;
 
+typedef struct _repwriter {
+	uint64_t chunkid;
+	void *queue;
+	uint8_t status;
+	pthread_mutex_t lock;
+	pthread_t thread_id;
+} repwriter;
+
 typedef struct _replication {
 	uint64_t chunkid;
 	uint32_t version;
 
 	uint8_t *xorbuff;
+	const uint8_t **xorsrcs;
 
 	uint8_t created,opened;
 	uint8_t srccnt;
@@ -112,54 +139,9 @@ static inline void replicator_bytesout(uint64_t bytes) {
 	zassert(pthread_mutex_unlock(&statslock));
 }
 
-static void xordata(uint8_t *dst,const uint8_t *src,uint32_t leng) {
-	uint32_t *dst4;
-	const uint32_t *src4;
-#define XOR_ONE_BYTE (*dst++)^=(*src++)
-#define XOR_FOUR_BYTES (*dst4++)^=(*src4++)
-	if (((unsigned long)dst&3)==((unsigned long)src&3)) {
-		while (leng && ((unsigned long)src & 3)) {
-			XOR_ONE_BYTE;
-			leng--;
-		}
-		dst4 = (uint32_t*)dst;
-		src4 = (const uint32_t*)src;
-		while (leng>=32) {
-			XOR_FOUR_BYTES;
-			XOR_FOUR_BYTES;
-			XOR_FOUR_BYTES;
-			XOR_FOUR_BYTES;
-			XOR_FOUR_BYTES;
-			XOR_FOUR_BYTES;
-			XOR_FOUR_BYTES;
-			XOR_FOUR_BYTES;
-			leng-=32;
-		}
-		while (leng>=4) {
-			XOR_FOUR_BYTES;
-			leng-=4;
-		}
-		src = (const uint8_t*)src4;
-		dst = (uint8_t*)dst4;
-		if (leng) do {
-			XOR_ONE_BYTE;
-		} while (--leng);
-	} else {
-		while (leng>=8) {
-			XOR_ONE_BYTE;
-			XOR_ONE_BYTE;
-			XOR_ONE_BYTE;
-			XOR_ONE_BYTE;
-			XOR_ONE_BYTE;
-			XOR_ONE_BYTE;
-			XOR_ONE_BYTE;
-			XOR_ONE_BYTE;
-			leng-=8;
-		}
-		if (leng>0) do {
-			XOR_ONE_BYTE;
-		} while (--leng);
-	}
+int replicator_init(void) {
+	gf256_init();
+	return 0;
 }
 
 static int rep_read(repsrc *rs) {
@@ -424,134 +406,119 @@ static void rep_cleanup(replication *r) {
 	if (r->xorbuff) {
 		free(r->xorbuff);
 	}
+	if (r->xorsrcs) {
+		free(r->xorsrcs);
+	}
 }
 
-/* srcs: srccnt * (chunkid:64 version:32 ip:32 port:16) */
-uint8_t replicate(uint64_t chunkid,uint32_t version,const uint32_t xormasks[4],uint8_t srccnt,const uint8_t *srcs) {
-	replication r;
-	uint8_t status,i,j,vbuffs,first;
-	uint16_t b,blocks;
-	uint32_t xcrc[4],crc;
-	uint32_t codeindex,codeword;
-	uint8_t *wptr;
+/* connect to all sources, create and open destination chunk and ask sources for their block counts */
+static uint8_t rep_prepare(replication *r,uint64_t chunkid,uint32_t version,uint8_t srccnt,const uint8_t *srcs,uint16_t *blocks) {
+	uint8_t status,i;
 	const uint8_t *rptr;
+	uint8_t *wptr;
 	int s;
 
-	if (srccnt==0) {
-		return ERROR_EINVAL;
-	}
-
-//	syslog(LOG_NOTICE,"replication begin (chunkid:%08"PRIX64",version:%04"PRIX32",srccnt:%"PRIu8")",chunkid,version,srccnt);
-
-	pthread_mutex_lock(&statslock);
-	stats_repl++;
-	pthread_mutex_unlock(&statslock);
-
 // init replication structure
-	r.chunkid = chunkid;
-	r.version = version;
-	r.srccnt = 0;
-	r.created = 0;
-	r.opened = 0;
-	r.fds = malloc(sizeof(struct pollfd)*srccnt);
-	passert(r.fds);
-	r.repsources = malloc(sizeof(repsrc)*srccnt);
-	passert(r.repsources);
-	if (srccnt>1) {
-		r.xorbuff = malloc(MFSBLOCKSIZE+4);
-		passert(r.xorbuff);
-	} else {
-		r.xorbuff = NULL;
-	}
+	r->chunkid = chunkid;
+	r->version = version;
+	r->srccnt = 0;
+	r->created = 0;
+	r->opened = 0;
+	r->fds = malloc(sizeof(struct pollfd)*srccnt);
+	passert(r->fds);
+	r->repsources = malloc(sizeof(repsrc)*srccnt);
+	passert(r->repsources);
+	r->xorbuff = NULL;
+	r->xorsrcs = NULL;
 // create chunk
 	status = hdd_create(chunkid,0);
 	if (status!=STATUS_OK) {
 		syslog(LOG_NOTICE,"replicator: hdd_create status: %s",mfsstrerr(status));
-		rep_cleanup(&r);
+		rep_cleanup(r);
 		return status;
 	}
-	r.created = 1;
+	r->created = 1;
 // init sources
-	r.srccnt = srccnt;
+	r->srccnt = srccnt;
 	for (i=0 ; i<srccnt ; i++) {
-		r.repsources[i].chunkid = get64bit(&srcs);
-		r.repsources[i].version = get32bit(&srcs);
-		r.repsources[i].ip = get32bit(&srcs);
-		r.repsources[i].port = get16bit(&srcs);
-		r.repsources[i].sock = -1;
-		r.repsources[i].packet = NULL;
+		r->repsources[i].chunkid = get64bit(&srcs);
+		r->repsources[i].version = get32bit(&srcs);
+		r->repsources[i].ip = get32bit(&srcs);
+		r->repsources[i].port = get16bit(&srcs);
+		r->repsources[i].sock = -1;
+		r->repsources[i].packet = NULL;
 	}
 // connect
 	for (i=0 ; i<srccnt ; i++) {
 		s = tcpsocket();
 		if (s<0) {
 			mfs_errlog_silent(LOG_NOTICE,"replicator: socket error");
-			rep_cleanup(&r);
+			rep_cleanup(r);
 			return ERROR_CANTCONNECT;
 		}
-		r.repsources[i].sock = s;
-		r.fds[i].fd = s;
+		r->repsources[i].sock = s;
+		r->fds[i].fd = s;
 		if (tcpnonblock(s)<0) {
 			mfs_errlog_silent(LOG_NOTICE,"replicator: nonblock error");
-			rep_cleanup(&r);
+			rep_cleanup(r);
 			return ERROR_CANTCONNECT;
 		}
-		s = tcpnumconnect(s,r.repsources[i].ip,r.repsources[i].port);
+		s = tcpnumconnect(s,r->repsources[i].ip,r->repsources[i].port);
 		if (s<0) {
 			mfs_errlog_silent(LOG_NOTICE,"replicator: connect error");
-			rep_cleanup(&r);
+			rep_cleanup(r);
 			return ERROR_CANTCONNECT;
 		}
 		if (s==0) {
-			r.repsources[i].mode = IDLE;
+			r->repsources[i].mode = IDLE;
 		} else {
-			r.repsources[i].mode = CONNECTING;
+			r->repsources[i].mode = CONNECTING;
 		}
 	}
-	if (rep_wait_for_connection(&r,CONNMSECTO)<0) {
-		rep_cleanup(&r);
+	if (rep_wait_for_connection(r,CONNMSECTO)<0) {
+		rep_cleanup(r);
 		return ERROR_CANTCONNECT;
 	}
 // disable Nagle
 	for (i=0 ; i<srccnt ; i++) {
-		tcpnodelay(r.repsources[i].sock);
+		tcpnodelay(r->repsources[i].sock);
 	}
 // open chunk
 	status = hdd_open(chunkid,0);
 	if (status!=STATUS_OK) {
 		syslog(LOG_NOTICE,"replicator: hdd_open status: %s",mfsstrerr(status));
-		rep_cleanup(&r);
+		rep_cleanup(r);
 		return status;
 	}
-	r.opened = 1;
+	r->opened = 1;
 // get block numbers
 	for (i=0 ; i<srccnt ; i++) {
-		wptr = rep_create_packet(r.repsources+i,ANTOCS_GET_CHUNK_BLOCKS,8+4);
+		wptr = rep_create_packet(r->repsources+i,ANTOCS_GET_CHUNK_BLOCKS,8+4);
 		if (wptr==NULL) {
 			syslog(LOG_NOTICE,"replicator: out of memory");
-			rep_cleanup(&r);
+			rep_cleanup(r);
 			return ERROR_OUTOFMEMORY;
 		}
-		put64bit(&wptr,r.repsources[i].chunkid);
-		put32bit(&wptr,r.repsources[i].version);
+		put64bit(&wptr,r->repsources[i].chunkid);
+		put32bit(&wptr,r->repsources[i].version);
 	}
 // send packet
-	if (rep_send_all_packets(&r,SENDMSECTO)<0) {
-		rep_cleanup(&r);
+	if (rep_send_all_packets(r,SENDMSECTO)<0) {
+		rep_cleanup(r);
 		return ERROR_DISCONNECTED;
 	}
 // receive answers
 	for (i=0 ; i<srccnt ; i++) {
-		r.repsources[i].mode = HEADER;
-		r.repsources[i].startptr = r.repsources[i].hdrbuff;
-		r.repsources[i].bytesleft = 8;
+		r->repsources[i].mode = HEADER;
+		r->repsources[i].startptr = r->repsources[i].hdrbuff;
+		r->repsources[i].bytesleft = 8;
 	}
-	if (rep_receive_all_packets(&r,RECVMSECTO)<0) {
-		rep_cleanup(&r);
+	if (rep_receive_all_packets(r,RECVMSECTO)<0) {
+		rep_cleanup(r);
 		return ERROR_DISCONNECTED;
 	}
 // get # of blocks
-	blocks = 0;
+	*blocks = 0;
 	for (i=0 ; i<srccnt ; i++) {
 		uint32_t type,size;
 		uint64_t pchid;
@@ -559,40 +526,95 @@ uint8_t replicate(uint64_t chunkid,uint32_t version,const uint32_t xormasks[4],u
 		uint16_t pblocks;
 		uint8_t pstatus;
 		uint32_t ip;
-		rptr = r.repsources[i].hdrbuff;
+		rptr = r->repsources[i].hdrbuff;
 		type = get32bit(&rptr);
 		size = get32bit(&rptr);
-		rptr = r.repsources[i].packet;
-		ip = r.repsources[i].ip;
+		rptr = r->repsources[i].packet;
+		ip = r->repsources[i].ip;
 		if (rptr==NULL || type!=CSTOAN_CHUNK_BLOCKS || size!=15) {
-			syslog(LOG_WARNING,"replicator,get # of blocks: got wrong answer (type:0x%08"PRIX32"/size:0x%08"PRIX32") from (%u.%u.%u.%u:%04"PRIX16")",type,size,(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,r.repsources[i].port);
-			rep_cleanup(&r);
+			syslog(LOG_WARNING,"replicator,get # of blocks: got wrong answer (type:0x%08"PRIX32"/size:0x%08"PRIX32") from (%u.%u.%u.%u:%04"PRIX16")",type,size,(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,r->repsources[i].port);
+			rep_cleanup(r);
 			return ERROR_DISCONNECTED;
 		}
 		pchid = get64bit(&rptr);
 		pver = get32bit(&rptr);
 		pblocks = get16bit(&rptr);
 		pstatus = get8bit(&rptr);
-		if (pchid!=r.repsources[i].chunkid) {
-			syslog(LOG_WARNING,"replicator,get # of blocks: got wrong answer (chunk_status:chunkid:%"PRIX64"/%"PRIX64") from (%u.%u.%u.%u:%04"PRIX16")",pchid,r.repsources[i].chunkid,(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,r.repsources[i].port);
-			rep_cleanup(&r);
+		if (pchid!=r->repsources[i].chunkid) {
+			syslog(LOG_WARNING,"replicator,get # of blocks: got wrong answer (chunk_status:chunkid:%"PRIX64"/%"PRIX64") from (%u.%u.%u.%u:%04"PRIX16")",pchid,r->repsources[i].chunkid,(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,r->repsources[i].port);
+			rep_cleanup(r);
 			return ERROR_WRONGCHUNKID;
 		}
-		if (pver!=r.repsources[i].version) {
-			syslog(LOG_WARNING,"replicator,get # of blocks: got wrong answer (chunk_status:version:%"PRIX32"/%"PRIX32") from (%u.%u.%u.%u:%04"PRIX16")",pver,r.repsources[i].version,(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,r.repsources[i].port);
-			rep_cleanup(&r);
+		if (pver!=r->repsources[i].version) {
+			syslog(LOG_WARNING,"replicator,get # of blocks: got wrong answer (chunk_status:version:%"PRIX32"/%"PRIX32") from (%u.%u.%u.%u:%04"PRIX16")",pver,r->repsources[i].version,(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,r->repsources[i].port);
+			rep_cleanup(r);
 			return ERROR_WRONGVERSION;
 		}
 		if (pstatus!=STATUS_OK) {
-			syslog(LOG_NOTICE,"replicator,get # of blocks: got status: %s from (%u.%u.%u.%u:%04"PRIX16")",mfsstrerr(pstatus),(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,r.repsources[i].port);
-			rep_cleanup(&r);
+			syslog(LOG_NOTICE,"replicator,get # of blocks: got status: %s from (%u.%u.%u.%u:%04"PRIX16")",mfsstrerr(pstatus),(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,r->repsources[i].port);
+			rep_cleanup(r);
 			return pstatus;
 		}
-		r.repsources[i].blocks = pblocks;
-		if (pblocks>blocks) {
-			blocks=pblocks;
+		r->repsources[i].blocks = pblocks;
+		if (pblocks>*blocks) {
+			*blocks=pblocks;
 		}
 	}
+	return STATUS_OK;
+}
+
+/* close chunk, change version and release everything */
+static uint8_t rep_finish(replication *r) {
+	uint8_t status;
+
+	status = hdd_close(r->chunkid);
+	if (status!=STATUS_OK) {
+		syslog(LOG_NOTICE,"replicator: hdd_close status: %s",mfsstrerr(status));
+		rep_cleanup(r);
+		return status;
+	}
+	r->opened = 0;
+	status = hdd_version(r->chunkid,0,r->version);
+	if (status!=STATUS_OK) {
+		syslog(LOG_NOTICE,"replicator: hdd_version status: %s",mfsstrerr(status));
+		rep_cleanup(r);
+		return status;
+	}
+	r->created = 0;
+	rep_cleanup(r);
+	return STATUS_OK;
+}
+
+/* srcs: srccnt * (chunkid:64 version:32 ip:32 port:16) */
+uint8_t replicate(uint64_t chunkid,uint32_t version,const uint32_t xormasks[4],uint8_t srccnt,const uint8_t *srcs) {
+	replication r;
+	uint8_t status,i,j,vbuffs;
+	uint16_t b,blocks;
+	uint32_t xcrc[4],crc;
+	uint32_t codeindex,codeword,xcnt;
+	uint8_t *wptr;
+	const uint8_t *rptr;
+
+	if (srccnt==0) {
+		return ERROR_EINVAL;
+	}
+
+//	syslog(LOG_NOTICE,"replication begin (chunkid:%08"PRIX64",version:%04"PRIX32",srccnt:%"PRIu8")",chunkid,version,srccnt);
+
+	pthread_mutex_lock(&statslock);
+	stats_repl++;
+	pthread_mutex_unlock(&statslock);
+
+	status = rep_prepare(&r,chunkid,version,srccnt,srcs,&blocks);
+	if (status!=STATUS_OK) {
+		return status;
+	}
+	if (srccnt>1) {
+		r.xorbuff = malloc(MFSBLOCKSIZE+4);
+		passert(r.xorbuff);
+		r.xorsrcs = malloc(sizeof(const uint8_t*)*srccnt*4);
+		passert(r.xorsrcs);
+	}
 // create read request
 	for (i=0 ; i<srccnt ; i++) {
 		if (r.repsources[i].blocks>0) {
@@ -713,7 +735,7 @@ uint8_t replicate(uint64_t chunkid,uint32_t version,const uint32_t xormasks[4],u
 			for (i=0 ; i<srccnt ; i++) {
 				if (r.repsources[i].mode!=IDLE) {
 					rptr = r.repsources[i].packet;
-					status = hdd_write(chunkid,0,b,rptr+20,0,MFSBLOCKSIZE,rptr+16);
+					status = hdd_write(chunkid,0,b,rptr+20,0,MFSBLOCKSIZE,rptr+16,NULL,NULL);
 					if (status!=STATUS_OK) {
 						syslog(LOG_WARNING,"replicator: write status: %s",mfsstrerr(status));
 						rep_cleanup(&r);
@@ -742,24 +764,27 @@ uint8_t replicate(uint64_t chunkid,uint32_t version,const uint32_t xormasks[4],u
 			crc = mycrc32_zeroblock(0,MFSBLOCKSIZE/4);
 			for (codeindex=0 ; codeindex<4 ; codeindex++) {
 				codeword = xormasks[codeindex];
-				first = 1;
+				xcnt = 0;
 				for (i=0 ; i<srccnt ; i++) {
 					for (j=0 ; j<4 ; j++) {
 						if (r.repsources[i].mode!=IDLE && (codeword&UINT32_C(0x80000000))) {
 							rptr = r.repsources[i].packet;
 							rptr += 16;
-							if (first) {
-								memcpy(r.xorbuff+4+codeindex*MFSBLOCKSIZE/4,rptr+4+j*MFSBLOCKSIZE/4,MFSBLOCKSIZE/4);
-								first = 0;
+							r.xorsrcs[xcnt] = rptr+4+j*MFSBLOCKSIZE/4;
+							if (xcnt==0) {
 								xcrc[codeindex] = r.repsources[i].crcsums[j];
 							} else {
-								xordata(r.xorbuff+4+codeindex*MFSBLOCKSIZE/4,rptr+4+j*MFSBLOCKSIZE/4,MFSBLOCKSIZE/4);
 								xcrc[codeindex] ^= r.repsources[i].crcsums[j] ^ crc;
 							}
+							xcnt++;
 						}
 						codeword>>=1;
 					}
 				}
+				if (xcnt==0) {
+					xcrc[codeindex] = crc;
+				}
+				gf256_xormulti(r.xorbuff+4+codeindex*MFSBLOCKSIZE/4,r.xorsrcs,xcnt,MFSBLOCKSIZE/4);
 			}
 			crc = mycrc32_combine(mycrc32_combine(xcrc[0],xcrc[1],MFSBLOCKSIZE/4),mycrc32_combine(xcrc[2],xcrc[3],MFSBLOCKSIZE/4),MFSBLOCKSIZE/2);
 			wptr = r.xorbuff;
@@ -781,7 +806,7 @@ uint8_t replicate(uint64_t chunkid,uint32_t version,const uint32_t xormasks[4],u
 						memcpy(r.xorbuff+4,rptr+4,MFSBLOCKSIZE);
 						first=0;
 					} else {
-						xordata(r.xorbuff+4,rptr+4,MFSBLOCKSIZE);
+						gf256_xor(r.xorbuff+4,rptr+4,MFSBLOCKSIZE);
 					}
 					crc = get32bit(&rptr);
 					if (crc!=mycrc32(0,rptr,MFSBLOCKSIZE)) {
@@ -795,7 +820,7 @@ uint8_t replicate(uint64_t chunkid,uint32_t version,const uint32_t xormasks[4],u
 			wptr = r.xorbuff;
 			put32bit(&wptr,xcrc);
 */
-			status = hdd_write(chunkid,0,b,r.xorbuff+4,0,MFSBLOCKSIZE,r.xorbuff);
+			status = hdd_write(chunkid,0,b,r.xorbuff+4,0,MFSBLOCKSIZE,r.xorbuff,NULL,NULL);
 			if (status!=STATUS_OK) {
 				syslog(LOG_WARNING,"replicator: xor write status: %s",mfsstrerr(status));
 				rep_cleanup(&r);
@@ -852,21 +877,285 @@ uint8_t replicate(uint64_t chunkid,uint32_t version,const uint32_t xormasks[4],u
 			}
 		}
 	}
-// close chunk and change version
-	status = hdd_close(chunkid);
+	return rep_finish(&r);
+}
+
+static void* rep_writer_thread(void *arg) {
+	repwriter *w = (repwriter*)arg;
+	uint32_t b,op,leng;
+	uint8_t *data;
+	uint8_t status,wstatus;
+
+	wstatus = STATUS_OK;
+	for (;;) {
+		queue_get(w->queue,&b,&op,&data,&leng);
+		if (op==WOP_EXIT) {
+			return NULL;
+		}
+		// after an error just release buffers - receiving side will notice the status and stop
+		if (wstatus==STATUS_OK) {
+			status = hdd_write(w->chunkid,0,b,data+20,0,MFSBLOCKSIZE,data+16,NULL,NULL);
+			if (status!=STATUS_OK) {
+				syslog(LOG_WARNING,"replicator: write status: %s",mfsstrerr(status));
+				wstatus = status;
+				zassert(pthread_mutex_lock(&(w->lock)));
+				w->status = status;
+				zassert(pthread_mutex_unlock(&(w->lock)));
+			}
+		}
+		free(data);
+	}
+}
+
+static uint8_t rep_writer_status(repwriter *w) {
+	uint8_t status;
+	zassert(pthread_mutex_lock(&(w->lock)));
+	status = w->status;
+	zassert(pthread_mutex_unlock(&(w->lock)));
+	return status;
+}
+
+static void rep_writer_start(repwriter *w,uint64_t chunkid) {
+	w->chunkid = chunkid;
+	w->queue = queue_new(WRITE_QUEUE_BLOCKS*(20+MFSBLOCKSIZE));
+	w->status = STATUS_OK;
+	zassert(pthread_mutex_init(&(w->lock),NULL));
+	zassert(main_minthread_create(&(w->thread_id),0,rep_writer_thread,w));
+}
+
+/* waits until all queued blocks are written */
+static uint8_t rep_writer_stop(repwriter *w) {
+	queue_put(w->queue,0,WOP_EXIT,NULL,0);
+	zassert(pthread_join(w->thread_id,NULL));
+	queue_delete(w->queue);
+	zassert(pthread_mutex_destroy(&(w->lock)));
+	return w->status;
+}
+
+static void rep_source_failed(replication *r,uint8_t i,uint16_t *retfirst,uint16_t *retend,uint8_t *retcnt) {
+	repsrc *rs = r->repsources+i;
+	if (rs->rnext<rs->rend) {	// give back what is left from this range
+		retfirst[*retcnt] = rs->rnext;
+		retend[*retcnt] = rs->rend;
+		(*retcnt)++;
+	}
+	rs->rnext = rs->rend = 0;
+	tcpclose(rs->sock);
+	rs->sock = -1;
+	r->fds[i].fd = -1;
+	rs->rstate = RS_FAILED;
+}
+
+/* returns 1 when source is still usable */
+static int rep_striped_packet(replication *r,repwriter *w,uint8_t i) {
+	repsrc *rs = r->repsources+i;
+	uint32_t type,size,ip;
+	uint64_t pchid;
+	uint16_t pblocknum,poffset;
+	uint32_t psize;
+	uint8_t pstatus;
+	const uint8_t *rptr;
+
+	rptr = rs->hdrbuff;
+	type = get32bit(&rptr);
+	size = get32bit(&rptr);
+	rptr = rs->packet;
+	ip = rs->ip;
+	rs->mode = HEADER;
+	rs->startptr = rs->hdrbuff;
+	rs->bytesleft = 8;
+	if (rptr==NULL) {
+		syslog(LOG_WARNING,"replicator,read chunks: got empty packet (type:0x%08"PRIX32") from (%u.%u.%u.%u:%04"PRIX16")",type,(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,rs->port);
+		return 0;
+	}
+	if (type==CSTOCL_READ_DATA && size==20+MFSBLOCKSIZE) {
+		pchid = get64bit(&rptr);
+		pblocknum = get16bit(&rptr);
+		poffset = get16bit(&rptr);
+		psize = get32bit(&rptr);
+		if (pchid!=rs->chunkid || pblocknum!=rs->rnext || poffset!=0 || psize!=MFSBLOCKSIZE) {
+			syslog(LOG_WARNING,"replicator,read chunks: got wrong answer (read_data:chunkid:%"PRIX64"/%"PRIX64",blocknum:%"PRIu16"/%"PRIu16",offset:%"PRIu16",size:%"PRIu32") from (%u.%u.%u.%u:%04"PRIX16")",pchid,rs->chunkid,pblocknum,rs->rnext,poffset,psize,(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,rs->port);
+			return 0;
+		}
+		// writer thread takes the packet
+		queue_put(w->queue,pblocknum,WOP_DATA,rs->packet,size);
+		rs->packet = NULL;
+		rs->rnext++;
+		return 1;
+	} else if (type==CSTOCL_READ_STATUS && size==9) {
+		pchid = get64bit(&rptr);
+		pstatus = get8bit(&rptr);
+		if (pchid!=rs->chunkid) {
+			syslog(LOG_WARNING,"replicator,read chunks: got wrong answer (read_status:chunkid:%"PRIX64"/%"PRIX64") from (%u.%u.%u.%u:%04"PRIX16")",pchid,rs->chunkid,(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,rs->port);
+			return 0;
+		}
+		if (pstatus!=STATUS_OK) {
+			syslog(LOG_NOTICE,"replicator,read chunks: got status: %s from (%u.%u.%u.%u:%04"PRIX16")",mfsstrerr(pstatus),(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,rs->port);
+			return 0;
+		}
+		if (rs->rnext!=rs->rend) {
+			syslog(LOG_WARNING,"replicator,read chunks: got unexpected ok status from (%u.%u.%u.%u:%04"PRIX16")",(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,rs->port);
+			return 0;
+		}
+		rs->rstate = RS_READY;
+		return 1;
+	}
+	syslog(LOG_WARNING,"replicator,read chunks: got wrong answer (type:0x%08"PRIX32"/size:0x%08"PRIX32") from (%u.%u.%u.%u:%04"PRIX16")",type,size,(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,rs->port);
+	return 0;
+}
+
+/* srcs: srccnt * (chunkid:64 version:32 ip:32 port:16) */
+uint8_t replicate_striped(uint64_t chunkid,uint32_t version,uint8_t srccnt,const uint8_t *srcs) {
+	replication r;
+	repwriter w;
+	repsrc *rs;
+	uint8_t status,i,active,retcnt;
+	uint16_t blocks,stripe,nextblock,rfirst,rend;
+	uint16_t *retfirst,*retend;
+	uint8_t *wptr;
+	uint64_t now;
+	int res;
+
+	if (srccnt==0) {
+		return ERROR_EINVAL;
+	}
+
+	pthread_mutex_lock(&statslock);
+	stats_repl++;
+	pthread_mutex_unlock(&statslock);
+
+	status = rep_prepare(&r,chunkid,version,srccnt,srcs,&blocks);
 	if (status!=STATUS_OK) {
-		syslog(LOG_NOTICE,"replicator: hdd_close status: %s",mfsstrerr(status));
-		rep_cleanup(&r);
 		return status;
 	}
-	r.opened = 0;
-	status = hdd_version(chunkid,0,version);
+// only sources with complete chunk can be used for any range
+	for (i=0 ; i<srccnt ; i++) {
+		rs = r.repsources+i;
+		rs->rstate = (rs->blocks==blocks)?RS_READY:RS_UNUSED;
+		rs->rnext = rs->rend = 0;
+		rs->mode = IDLE;
+		r.fds[i].fd = (rs->rstate==RS_READY)?rs->sock:-1;
+	}
+// with one source read whole chunk at once, otherwise split it into ranges given to sources as they become free
+	stripe = (srccnt==1)?blocks:STRIPE_BLOCKS;
+	nextblock = 0;
+	retfirst = malloc(sizeof(uint16_t)*srccnt*2);
+	passert(retfirst);
+	retend = retfirst+srccnt;
+	retcnt = 0;
+	rep_writer_start(&w,chunkid);
+	status = STATUS_OK;
+	now = monotonic_useconds();
+	for (;;) {
+// give ranges to ready sources
+		active = 0;
+		for (i=0 ; i<srccnt ; i++) {
+			rs = r.repsources+i;
+			if (rs->rstate==RS_READY) {
+				if (retcnt>0) {
+					retcnt--;
+					rfirst = retfirst[retcnt];
+					rend = retend[retcnt];
+				} else if (nextblock<blocks) {
+					rfirst = nextblock;
+					rend = (blocks-nextblock>stripe)?nextblock+stripe:blocks;
+					nextblock = rend;
+				} else {
+					rfirst = rend = 0;
+				}
+				if (rfirst<rend) {
+					wptr = rep_create_packet(rs,CLTOCS_READ,8+4+4+4);
+					put64bit(&wptr,rs->chunkid);
+					put32bit(&wptr,rs->version);
+					put32bit(&wptr,((uint32_t)rfirst)<<MFSBLOCKBITS);
+					put32bit(&wptr,((uint32_t)(rend-rfirst))<<MFSBLOCKBITS);
+					rs->rnext = rfirst;
+					rs->rend = rend;
+					rs->rstate = RS_SEND;
+					rs->lastio = now;
+				}
+			}
+			if (rs->rstate==RS_SEND || rs->rstate==RS_RECV) {
+				r.fds[i].events = (rs->rstate==RS_SEND)?POLLOUT:POLLIN;
+				active++;
+			} else {
+				r.fds[i].events = 0;
+			}
+		}
+		if (active==0) {
+			if (retcnt>0 || nextblock<blocks) {
+				syslog(LOG_NOTICE,"replicator: no sources left for chunk %016"PRIX64,chunkid);
+				status = ERROR_DISCONNECTED;
+			}
+			break;
+		}
+		status = rep_writer_status(&w);
+		if (status!=STATUS_OK) {
+			break;
+		}
+		res = poll(r.fds,srccnt,POLLMSECTO);
+		if (res<0) {
+			if (errno!=EINTR && ERRNO_ERROR) {
+				mfs_errlog_silent(LOG_NOTICE,"replicator: poll error");
+				status = ERROR_DISCONNECTED;
+				break;
+			}
+			continue;
+		}
+		now = monotonic_useconds();
+		for (i=0 ; i<srccnt ; i++) {
+			rs = r.repsources+i;
+			if (rs->rstate!=RS_SEND && rs->rstate!=RS_RECV) {
+				continue;
+			}
+			if (r.fds[i].revents & (POLLHUP|POLLERR|POLLNVAL)) {
+				if ((r.fds[i].revents & POLLIN)==0) {
+					syslog(LOG_NOTICE,"replicator: connection lost");
+					rep_source_failed(&r,i,retfirst,retend,&retcnt);
+					continue;
+				}
+			}
+			if (rs->rstate==RS_SEND && (r.fds[i].revents & POLLOUT)) {
+				if (rep_write(rs)<0) {
+					rep_source_failed(&r,i,retfirst,retend,&retcnt);
+					continue;
+				}
+				rs->lastio = now;
+				if (rs->bytesleft==0) {
+					rs->rstate = RS_RECV;
+					rs->mode = HEADER;
+					rs->startptr = rs->hdrbuff;
+					rs->bytesleft = 8;
+				}
+			} else if (rs->rstate==RS_RECV && (r.fds[i].revents & POLLIN)) {
+				rs->lastio = now;
+				while (rs->rstate==RS_RECV) {
+					if (rep_read(rs)<0) {
+						rep_source_failed(&r,i,retfirst,retend,&retcnt);
+						break;
+					}
+					if (rs->bytesleft>0) {	// no more data for now
+						break;
+					}
+					if (rep_striped_packet(&r,&w,i)==0) {
+						rep_source_failed(&r,i,retfirst,retend,&retcnt);
+						break;
+					}
+				}
+			}
+			if ((rs->rstate==RS_SEND || rs->rstate==RS_RECV) && now > rs->lastio + RECVMSECTO*UINT64_C(1000)) {
+				syslog(LOG_NOTICE,"replicator: receive timed out");
+				rep_source_failed(&r,i,retfirst,retend,&retcnt);
+			}
+		}
+	}
+	free(retfirst);
+	if (rep_writer_stop(&w)!=STATUS_OK && status==STATUS_OK) {
+		status = w.status;
+	}
 	if (status!=STATUS_OK) {
-		syslog(LOG_NOTICE,"replicator: hdd_version status: %s",mfsstrerr(status));
 		rep_cleanup(&r);
 		return status;
 	}
-	r.created = 0;
-	rep_cleanup(&r);
-	return STATUS_OK;
+	return rep_finish(&r);
 }
@@ -415,6 +415,7 @@
 #define SNAPSHOT_MODE_CAN_OVERWRITE 1
 #define SNAPSHOT_MODE_CPLIKE_ATTR 2
 #define SNAPSHOT_MODE_FORCE_REMOVAL 4
+#define SNAPSHOT_MODE_LAZY 8
 #define SNAPSHOT_MODE_DELETE 0x80
 
 // flags: "flags" fileld in "CLTOMA_FUSE_AQUIRE"
@@ -487,13 +488,18 @@
 #define ANTOMA_REGISTER (PROTO_BASE+50)
 // rver:8
 // 	rver==1:
-// 		( rver:8 ) version:32 timeout:16
+// 		( rver:8 ) version:32 timeout:16 [ flags:8 ]
+// 	rver==2:
+// 		( rver:8 ) version:32 timeout:16 minversion:64 [ flags:8 ]
+// flags (intr. in version 3.0.40):
+#define ANTOMA_REGISTER_FLAG_BINCHANGES 0x01
 
 // 0x0033
 #define MATOAN_METACHANGES_LOG (PROTO_BASE+51)
 // maxsize=250000
 // 0xFF:8 version:64 logdata:string ( N*[ char:8 ] ) = LOG_DATA
 // 0xAA:8 version:64 logdata:string ( N*[ char:8 ] ) = LOG_DATA with ack (intr. in version 3.0.10)
+// 0xBB:8 version:64 logdata:binary ( N*[ byte:8 ] ) = binary LOG_DATA (only when metalogger registered with ANTOMA_REGISTER_FLAG_BINCHANGES)
 // 0x55:8 = LOG_ROTATE
 
 
@@ -551,6 +557,11 @@
 //		( rver:8 ) N*[chunkid:64 version:32]
 //	rver==62:	// version 6 / END
 //		( rver:8 ) -
+//		( rver:8 ) features:16 (sent only when master acknowledged CHUNKS packet with MATOCS_MASTER_ACK_FLAG_COMPACTCHUNKS)
+#define CSTOMA_REGISTER_FEATURE_STRIPEDREPLICATE 0x0001
+//	rver==63:	// version 6 / CHUNKS (compact - sent only when master acknowledged previous CHUNKS packet with MATOCS_MASTER_ACK_FLAG_COMPACTCHUNKS)
+//		( rver:8 ) chunks:32 chunks*[ chunkiddelta:var64 versiontd:var64 ]
+//		chunks sorted by chunkid, chunkiddelta = chunkid - previous chunkid (first chunk: chunkid), versiontd = (version<<1) | todelflag, var64 - see putvar64bit
 
 // 0x0065
 #define CSTOMA_SPACE (PROTO_BASE+101)
@@ -578,6 +589,8 @@
 // atype:8 master_version:32
 // atype:8 master_version:32 tcptimeout:16 csid:16
 // atype:8 master_version:32 tcptimeout:16 csid:16 metadataid:64 (both versions >= 2.0.33)
+// atype:8 master_version:32 flags:16 (answer for register CHUNKS packet - chunkserver version >= 3.0.39)
+#define MATOCS_MASTER_ACK_FLAG_COMPACTCHUNKS 0x0001
 
 // 0x0069
 #define CSTOMA_CHUNK_LOST (PROTO_BASE+105)
@@ -634,6 +647,8 @@
 //  chunkid:64 version:32 ip:32 port:16
 // raid copy (make new chunk as XOR of different parts of couple of chunks - using xormasks)
 //  chunkid:64 version:32 4 * [ xormask:32 ] N * [chunkid:64 version:32 ip:32 port:16]
+// striped copy (read different block ranges from couple of identical copies at once - only chunkservers registered with CSTOMA_REGISTER_FEATURE_STRIPEDREPLICATE)
+//  chunkid:64 version:32 N * [chunkid:64 version:32 ip:32 port:16]
 
 // 0x0097
 #define CSTOMA_REPLICATE (PROTO_BASE+151)
@@ -999,6 +1014,7 @@
 #define CLTOMA_FUSE_READ_CHUNK (PROTO_BASE+432)
 // msgid:32 inode:32 chunkindx:32 - version < 3.0.4
 // msgid:32 inode:32 chunkindx:32 canmodatime:8
+// canmodatime|0x80 - client wants to keep chunk data in its persistent cache
 
 // 0x01B1
 #define MATOCL_FUSE_READ_CHUNK (PROTO_BASE+433)
@@ -1007,6 +1023,7 @@
 // msgid:32 length:64 chunkid:64 version:32 N*[ ip:32 port:16 ]
 // msgid:32 protocolid:8 length:64 chunkid:64 version:32 N*[ ip:32 port:16 cs_ver:32 ] (master and client both versions >= 1.7.32 - protocolid==1)
 // msgid:32 protocolid:8 length:64 chunkid:64 version:32 N*[ ip:32 port:16 cs_ver:32 labelmask:32 ] (master and client both versions >= 3.0.10 - protocolid==2)
+// protocolid|0x80 - chunk data may be cached by client (next modification of this chunk will change its version)
 
 // 0x01B2
 #define CLTOMA_FUSE_WRITE_CHUNK (PROTO_BASE+434)
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "binlog.h"
+#include "crc.h"
+#include "datapack.h"
+
+static inline uint32_t binlog_crc(uint64_t version,const uint8_t *data,uint32_t leng) {
+	uint8_t vbuff[8],*wptr;
+	wptr = vbuff;
+	put64bit(&wptr,version);
+	return mycrc32(mycrc32(0,vbuff,8),data,leng);
+}
+
+int binlog_isbinary(int fd) {
+	uint8_t hdr[BINLOG_HEADER_SIZE];
+	if (pread(fd,hdr,BINLOG_HEADER_SIZE,0)!=BINLOG_HEADER_SIZE) {
+		return 0;
+	}
+	return (memcmp(hdr,BINLOG_HEADER,BINLOG_HEADER_SIZE)==0)?1:0;
+}
+
+int binlog_writeheader(FILE *fd) {
+	if (fwrite(BINLOG_HEADER,1,BINLOG_HEADER_SIZE,fd)!=BINLOG_HEADER_SIZE) {
+		return -1;
+	}
+	return 0;
+}
+
+// buff must have at least leng+BINLOG_RECORD_OVERHEAD bytes
+uint32_t binlog_packrecord(uint8_t *buff,uint64_t version,const uint8_t *data,uint32_t leng) {
+	uint8_t *wptr;
+
+	wptr = buff;
+	put32bit(&wptr,leng);
+	put64bit(&wptr,version);
+	memcpy(wptr,data,leng);
+	wptr += leng;
+	put32bit(&wptr,binlog_crc(version,data,leng));
+	put32bit(&wptr,leng);
+	return leng+BINLOG_RECORD_OVERHEAD;
+}
+
+int binlog_writerecord(FILE *fd,uint64_t version,const uint8_t *data,uint32_t leng) {
+	uint8_t hdr[12],trl[8],*wptr;
+
+	wptr = hdr;
+	put32bit(&wptr,leng);
+	put64bit(&wptr,version);
+	wptr = trl;
+	put32bit(&wptr,binlog_crc(version,data,leng));
+	put32bit(&wptr,leng);
+	if (fwrite(hdr,1,12,fd)!=12 || fwrite(data,1,leng,fd)!=leng || fwrite(trl,1,8,fd)!=8) {
+		return -1;
+	}
+	return 0;
+}
+
+// returns: 1 - record read ; 0 - end of file ; -1 - damaged or truncated record
+int binlog_readrecord(FILE *fd,uint64_t *version,uint8_t *buff,uint32_t buffsize,uint32_t *leng) {
+	uint8_t hdr[12],trl[8];
+	const uint8_t *rptr;
+	size_t r;
+	uint32_t l;
+
+	r = fread(hdr,1,12,fd);
+	if (r==0) {
+		return 0;
+	}
+	if (r!=12) {
+		return -1;
+	}
+	rptr = hdr;
+	l = get32bit(&rptr);
+	*version = get64bit(&rptr);
+	if (l>buffsize) {
+		return -1;
+	}
+	if (fread(buff,1,l,fd)!=l || fread(trl,1,8,fd)!=8) {
+		return -1;
+	}
+	rptr = trl;
+	if (get32bit(&rptr)!=binlog_crc(*version,buff,l) || get32bit(&rptr)!=l) {
+		return -1;
+	}
+	*leng = l;
+	return 1;
+}
+
+uint64_t binlog_findfirstversion(int fd) {
+	uint8_t hdr[12];
+	const uint8_t *rptr;
+	uint32_t leng;
+
+	if (pread(fd,hdr,12,BINLOG_HEADER_SIZE)!=12) {
+		return 0;
+	}
+	rptr = hdr;
+	leng = get32bit(&rptr);
+	if (leng>BINLOG_MAXRECORDSIZE) {
+		return 0;
+	}
+	return get64bit(&rptr);
+}
+
+// reads and checks record at given position ; returns record size or 0 when record is not valid
+static uint32_t binlog_checkrecord(int fd,uint64_t pos,uint64_t fsize,uint8_t *buff,uint64_t *version) {
+	const uint8_t *rptr;
+	uint32_t leng;
+
+	if (pos+BINLOG_RECORD_OVERHEAD>fsize) {
+		return 0;
+	}
+	if (pread(fd,buff,12,pos)!=12) {
+		return 0;
+	}
+	rptr = buff;
+	leng = get32bit(&rptr);
+	*version = get64bit(&rptr);
+	if (leng>BINLOG_MAXRECORDSIZE || pos+leng+BINLOG_RECORD_OVERHEAD>fsize) {
+		return 0;
+	}
+	if (pread(fd,buff,leng+8,pos+12)!=(ssize_t)(leng+8)) {
+		return 0;
+	}
+	rptr = buff+leng;
+	if (get32bit(&rptr)!=binlog_crc(*version,buff,leng) || get32bit(&rptr)!=leng) {
+		return 0;
+	}
+	return leng+BINLOG_RECORD_OVERHEAD;
+}
+
+// returns version of last valid record ; validsize is set to position of the end of this record
+uint64_t binlog_findlastversion(int fd,uint64_t *validsize) {
+	struct stat st;
+	uint8_t *buff;
+	uint8_t trl[4];
+	const uint8_t *rptr;
+	uint64_t fsize,pos,version,lastversion;
+	uint32_t leng,rsize;
+
+	*validsize = 0;
+	if (fstat(fd,&st)<0 || st.st_size<BINLOG_HEADER_SIZE) {
+		return 0;
+	}
+	fsize = st.st_size;
+	*validsize = BINLOG_HEADER_SIZE;
+	buff = malloc(BINLOG_MAXRECORDSIZE+12);
+	if (buff==NULL) {
+		return 0;
+	}
+	// fast path - file ends with complete record
+	if (fsize>=BINLOG_HEADER_SIZE+BINLOG_RECORD_OVERHEAD && pread(fd,trl,4,fsize-4)==4) {
+		rptr = trl;
+		leng = get32bit(&rptr);
+		if (leng<=BINLOG_MAXRECORDSIZE && fsize>=(uint64_t)BINLOG_HEADER_SIZE+leng+BINLOG_RECORD_OVERHEAD) {
+			pos = fsize-leng-BINLOG_RECORD_OVERHEAD;
+			if (binlog_checkrecord(fd,pos,fsize,buff,&version)>0) {
+				*validsize = fsize;
+				free(buff);
+				return version;
+			}
+		}
+	}
+	// garbage at the end of file - scan whole file
+	lastversion = 0;
+	pos = BINLOG_HEADER_SIZE;
+	while ((rsize=binlog_checkrecord(fd,pos,fsize,buff,&version))>0) {
+		lastversion = version;
+		pos += rsize;
+	}
+	*validsize = pos;
+	free(buff);
+	return lastversion;
+}
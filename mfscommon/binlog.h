@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef _BINLOG_H_
+#define _BINLOG_H_
+
+#include <stdio.h>
+#include <inttypes.h>
+
+// binary changelog file:
+//   header: "MFSL 1.0"
+//   N * [ leng:32 version:64 data:lengB crc:32 leng:32 ]
+// crc covers version and data, trailing leng allows to find last record without scanning whole file
+#define BINLOG_HEADER "MFSL 1.0"
+#define BINLOG_HEADER_SIZE 8
+#define BINLOG_RECORD_OVERHEAD (4+8+4+4)
+#define BINLOG_MAXRECORDSIZE 1000000
+
+int binlog_isbinary(int fd);
+int binlog_writeheader(FILE *fd);
+uint32_t binlog_packrecord(uint8_t *buff,uint64_t version,const uint8_t *data,uint32_t leng);
+int binlog_writerecord(FILE *fd,uint64_t version,const uint8_t *data,uint32_t leng);
+int binlog_readrecord(FILE *fd,uint64_t *version,uint8_t *buff,uint32_t buffsize,uint32_t *leng);
+uint64_t binlog_findfirstversion(int fd);
+uint64_t binlog_findlastversion(int fd,uint64_t *validsize);
+
+#endif
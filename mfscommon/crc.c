@@ -26,6 +26,25 @@
 #include <stdlib.h>
 #include "MFSCommunication.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#define CRC_PCLMUL 1
+#define CRC_TARGET __attribute__((target("sse2,pclmul")))
+#elif defined(__aarch64__) && defined(__GNUC__) && defined(HAVE_GETAUXVAL) && !defined(WORDS_BIGENDIAN)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_PMULL
+#define HWCAP_PMULL (1<<4)
+#endif
+#define CRC_PMULL 1
+#ifdef __clang__
+#define CRC_TARGET __attribute__((target("crypto")))
+#else
+#define CRC_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+
 /* original crc32 code
 uint32_t* crc32_reference_generate(void) {
 	uint32_t *res;
@@ -78,6 +97,209 @@ static uint32_t crc_table[8][256];
 static uint32_t crc_table[256];
 #endif
 
+/* carry-less multiplication (PCLMULQDQ / PMULL) folding - see "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009) */
+
+#define CRC_FOLD_MINLENG 64
+
+#if defined(CRC_PCLMUL) || defined(CRC_PMULL)
+/* constants for reflected CRC_POLY: k1=x^(4*128+32), k2=x^(4*128-32), k3=x^(128+32), k4=x^(128-32), k5=x^64 (all mod P, reflected) , P' and mu for Barrett reduction */
+static const uint64_t crc_k1k2[2] __attribute__((aligned(16))) = {UINT64_C(0x0154442bd4),UINT64_C(0x01c6e41596)};
+static const uint64_t crc_k3k4[2] __attribute__((aligned(16))) = {UINT64_C(0x01751997d0),UINT64_C(0x00ccaa009e)};
+static const uint64_t crc_k5k0[2] __attribute__((aligned(16))) = {UINT64_C(0x0163cd6124),UINT64_C(0x0000000000)};
+static const uint64_t crc_poly[2] __attribute__((aligned(16))) = {UINT64_C(0x01db710641),UINT64_C(0x01f7011641)};
+#endif
+
+#ifdef CRC_PCLMUL
+#define CRC_FOLD_KERNEL "pclmulqdq"
+
+/* crc is the internal (inverted) state ; leng >= 64 and (leng%16)==0 */
+static CRC_TARGET uint32_t crc_fold(uint32_t crc,const uint8_t *block,uint32_t leng) {
+	__m128i x0,x1,x2,x3,x4,x5,x6,x7,x8,y5,y6,y7,y8;
+
+	x1 = _mm_loadu_si128((const __m128i*)(block+0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(block+0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(block+0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(block+0x30));
+	x1 = _mm_xor_si128(x1,_mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i*)crc_k1k2);
+	block += 64;
+	leng -= 64;
+
+	/* fold by 4 x 128 bits */
+	while (leng>=64) {
+		x5 = _mm_clmulepi64_si128(x1,x0,0x00);
+		x6 = _mm_clmulepi64_si128(x2,x0,0x00);
+		x7 = _mm_clmulepi64_si128(x3,x0,0x00);
+		x8 = _mm_clmulepi64_si128(x4,x0,0x00);
+		x1 = _mm_clmulepi64_si128(x1,x0,0x11);
+		x2 = _mm_clmulepi64_si128(x2,x0,0x11);
+		x3 = _mm_clmulepi64_si128(x3,x0,0x11);
+		x4 = _mm_clmulepi64_si128(x4,x0,0x11);
+		y5 = _mm_loadu_si128((const __m128i*)(block+0x00));
+		y6 = _mm_loadu_si128((const __m128i*)(block+0x10));
+		y7 = _mm_loadu_si128((const __m128i*)(block+0x20));
+		y8 = _mm_loadu_si128((const __m128i*)(block+0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1,x5),y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2,x6),y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3,x7),y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4,x8),y8);
+		block += 64;
+		leng -= 64;
+	}
+
+	/* fold 4 x 128 bits into 128 bits */
+	x0 = _mm_load_si128((const __m128i*)crc_k3k4);
+	x5 = _mm_clmulepi64_si128(x1,x0,0x00);
+	x1 = _mm_clmulepi64_si128(x1,x0,0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1,x2),x5);
+	x5 = _mm_clmulepi64_si128(x1,x0,0x00);
+	x1 = _mm_clmulepi64_si128(x1,x0,0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1,x3),x5);
+	x5 = _mm_clmulepi64_si128(x1,x0,0x00);
+	x1 = _mm_clmulepi64_si128(x1,x0,0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1,x4),x5);
+
+	/* fold remaining 128-bit blocks */
+	while (leng>=16) {
+		x2 = _mm_loadu_si128((const __m128i*)block);
+		x5 = _mm_clmulepi64_si128(x1,x0,0x00);
+		x1 = _mm_clmulepi64_si128(x1,x0,0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1,x2),x5);
+		block += 16;
+		leng -= 16;
+	}
+
+	/* 128 bits -> 64 bits */
+	x2 = _mm_clmulepi64_si128(x1,x0,0x10);
+	x3 = _mm_setr_epi32(~0,0,~0,0);
+	x1 = _mm_srli_si128(x1,8);
+	x1 = _mm_xor_si128(x1,x2);
+	x0 = _mm_loadl_epi64((const __m128i*)crc_k5k0);
+	x2 = _mm_srli_si128(x1,4);
+	x1 = _mm_and_si128(x1,x3);
+	x1 = _mm_clmulepi64_si128(x1,x0,0x00);
+	x1 = _mm_xor_si128(x1,x2);
+
+	/* Barrett reduction 64 bits -> 32 bits */
+	x0 = _mm_load_si128((const __m128i*)crc_poly);
+	x2 = _mm_and_si128(x1,x3);
+	x2 = _mm_clmulepi64_si128(x2,x0,0x10);
+	x2 = _mm_and_si128(x2,x3);
+	x2 = _mm_clmulepi64_si128(x2,x0,0x00);
+	x1 = _mm_xor_si128(x1,x2);
+
+	return _mm_cvtsi128_si32(_mm_srli_si128(x1,4));
+}
+
+/* 64-bit carry-less product of two 32-bit (reflected) polynomials */
+static inline CRC_TARGET uint64_t crc_clmul32(uint32_t a,uint32_t b) {
+	return _mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_cvtsi32_si128(a),_mm_cvtsi32_si128(b),0x00));
+}
+
+static int crc_fold_supported(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2");
+}
+#endif
+
+#ifdef CRC_PMULL
+#define CRC_FOLD_KERNEL "pmull"
+
+#define CRC_CLMUL_00(a,b) vreinterpretq_u64_p128(vmull_p64((poly64_t)vgetq_lane_u64(a,0),(poly64_t)vgetq_lane_u64(b,0)))
+#define CRC_CLMUL_11(a,b) vreinterpretq_u64_p128(vmull_p64((poly64_t)vgetq_lane_u64(a,1),(poly64_t)vgetq_lane_u64(b,1)))
+#define CRC_CLMUL_10(a,b) vreinterpretq_u64_p128(vmull_p64((poly64_t)vgetq_lane_u64(a,0),(poly64_t)vgetq_lane_u64(b,1)))
+#define CRC_LOAD(p) vreinterpretq_u64_u8(vld1q_u8(p))
+#define CRC_SHR_BYTES(a,n) vreinterpretq_u64_u8(vextq_u8(vreinterpretq_u8_u64(a),vdupq_n_u8(0),(n)))
+
+/* crc is the internal (inverted) state ; leng >= 64 and (leng%16)==0 */
+static CRC_TARGET uint32_t crc_fold(uint32_t crc,const uint8_t *block,uint32_t leng) {
+	uint64x2_t x0,x1,x2,x3,x4,x5,x6,x7,x8;
+
+	x1 = CRC_LOAD(block+0x00);
+	x2 = CRC_LOAD(block+0x10);
+	x3 = CRC_LOAD(block+0x20);
+	x4 = CRC_LOAD(block+0x30);
+	x1 = veorq_u64(x1,vsetq_lane_u64((uint64_t)crc,vdupq_n_u64(0),0));
+	x0 = vld1q_u64(crc_k1k2);
+	block += 64;
+	leng -= 64;
+
+	/* fold by 4 x 128 bits */
+	while (leng>=64) {
+		x5 = CRC_CLMUL_00(x1,x0);
+		x6 = CRC_CLMUL_00(x2,x0);
+		x7 = CRC_CLMUL_00(x3,x0);
+		x8 = CRC_CLMUL_00(x4,x0);
+		x1 = CRC_CLMUL_11(x1,x0);
+		x2 = CRC_CLMUL_11(x2,x0);
+		x3 = CRC_CLMUL_11(x3,x0);
+		x4 = CRC_CLMUL_11(x4,x0);
+		x1 = veorq_u64(veorq_u64(x1,x5),CRC_LOAD(block+0x00));
+		x2 = veorq_u64(veorq_u64(x2,x6),CRC_LOAD(block+0x10));
+		x3 = veorq_u64(veorq_u64(x3,x7),CRC_LOAD(block+0x20));
+		x4 = veorq_u64(veorq_u64(x4,x8),CRC_LOAD(block+0x30));
+		block += 64;
+		leng -= 64;
+	}
+
+	/* fold 4 x 128 bits into 128 bits */
+	x0 = vld1q_u64(crc_k3k4);
+	x5 = CRC_CLMUL_00(x1,x0);
+	x1 = CRC_CLMUL_11(x1,x0);
+	x1 = veorq_u64(veorq_u64(x1,x2),x5);
+	x5 = CRC_CLMUL_00(x1,x0);
+	x1 = CRC_CLMUL_11(x1,x0);
+	x1 = veorq_u64(veorq_u64(x1,x3),x5);
+	x5 = CRC_CLMUL_00(x1,x0);
+	x1 = CRC_CLMUL_11(x1,x0);
+	x1 = veorq_u64(veorq_u64(x1,x4),x5);
+
+	/* fold remaining 128-bit blocks */
+	while (leng>=16) {
+		x2 = CRC_LOAD(block);
+		x5 = CRC_CLMUL_00(x1,x0);
+		x1 = CRC_CLMUL_11(x1,x0);
+		x1 = veorq_u64(veorq_u64(x1,x2),x5);
+		block += 16;
+		leng -= 16;
+	}
+
+	/* 128 bits -> 64 bits */
+	x2 = CRC_CLMUL_10(x1,x0);
+	x3 = vdupq_n_u64(UINT64_C(0xFFFFFFFF));
+	x1 = CRC_SHR_BYTES(x1,8);
+	x1 = veorq_u64(x1,x2);
+	x0 = vld1q_u64(crc_k5k0);
+	x2 = CRC_SHR_BYTES(x1,4);
+	x1 = vandq_u64(x1,x3);
+	x1 = CRC_CLMUL_00(x1,x0);
+	x1 = veorq_u64(x1,x2);
+
+	/* Barrett reduction 64 bits -> 32 bits */
+	x0 = vld1q_u64(crc_poly);
+	x2 = vandq_u64(x1,x3);
+	x2 = CRC_CLMUL_10(x2,x0);
+	x2 = vandq_u64(x2,x3);
+	x2 = CRC_CLMUL_00(x2,x0);
+	x1 = veorq_u64(x1,x2);
+
+	return vgetq_lane_u32(vreinterpretq_u32_u64(x1),1);
+}
+
+/* 64-bit carry-less product of two 32-bit (reflected) polynomials */
+static inline CRC_TARGET uint64_t crc_clmul32(uint32_t a,uint32_t b) {
+	return vgetq_lane_u64(vreinterpretq_u64_p128(vmull_p64((poly64_t)a,(poly64_t)b)),0);
+}
+
+static int crc_fold_supported(void) {
+	return (getauxval(AT_HWCAP) & HWCAP_PMULL)?1:0;
+}
+#endif
+
+#ifdef CRC_FOLD_KERNEL
+static uint8_t crc_fold_enabled = 0;
+#endif
+
 void crc_generate_main_tables(void) {
 	uint32_t c,poly,i;
 #ifdef FASTCRC
@@ -127,6 +349,19 @@ uint32_t mycrc32(uint32_t crc,const uint8_t *block,uint32_t leng) {
 	const uint32_t *block4;
 	uint32_t next;
 #endif
+#ifdef CRC_FOLD_KERNEL
+	uint32_t fleng;
+
+	if (crc_fold_enabled && leng>=CRC_FOLD_MINLENG) {
+		fleng = leng & ~UINT32_C(15);
+		crc = crc_fold(crc^0xFFFFFFFF,block,fleng)^0xFFFFFFFF;
+		block += fleng;
+		leng -= fleng;
+		if (leng==0) {
+			return crc;
+		}
+	}
+#endif
 
 #ifdef FASTCRC
 #ifdef WORDS_BIGENDIAN
@@ -248,9 +483,56 @@ static void crc_generate_combine_tables(void) {
 	}
 }
 
+#ifdef CRC_FOLD_KERNEL
+static uint32_t crc_x16n_table[8][16];
+
+/* a*b mod P (reflected) - carry-less product reduced by table driven shift of the high part */
+static inline CRC_TARGET uint32_t crc_multmodp(uint32_t a,uint32_t b) {
+	uint64_t v;
+	uint32_t l;
+
+	v = crc_clmul32(a,b)<<1;
+	l = v;
+	return (v>>32) ^ crc_table[3][l&0xFF] ^ crc_table[2][(l>>8)&0xFF] ^ crc_table[1][(l>>16)&0xFF] ^ crc_table[0][l>>24];
+}
+
+/* crc1 * x^(8*leng2) mod P - one multiplication per non zero nibble of leng2 */
+static CRC_TARGET uint32_t crc_zeroexpand_clmul(uint32_t crc1,uint32_t leng2) {
+	uint8_t i;
+
+	i=0;
+	while (leng2) {
+		if (leng2&0xF) {
+			crc1 = crc_multmodp(crc_x16n_table[i][leng2&0xF],crc1);
+		}
+		i++;
+		leng2>>=4;
+	}
+	return crc1;
+}
+
+/* x16n[i][k] = x^(8*k*16^i) mod P ; must be called only when crc_fold_supported() */
+static CRC_TARGET void crc_generate_x16n_table(void) {
+	uint32_t i,k;
+
+	for (i=0 ; i<8 ; i++) {
+		crc_x16n_table[i][0] = UINT32_C(1)<<31; // x^0
+		crc_x16n_table[i][1] = (i==0) ? UINT32_C(1)<<(31-8) : crc_multmodp(crc_x16n_table[i-1][15],crc_x16n_table[i-1][1]);
+		for (k=2 ; k<16 ; k++) {
+			crc_x16n_table[i][k] = crc_multmodp(crc_x16n_table[i][k-1],crc_x16n_table[i][1]);
+		}
+	}
+}
+#endif
+
 uint32_t mycrc32_combine(uint32_t crc1, uint32_t crc2, uint32_t leng2) {
 	uint8_t i;
 
+#ifdef CRC_FOLD_KERNEL
+	if (crc_fold_enabled) {
+		return crc_zeroexpand_clmul(crc1,leng2)^crc2;
+	}
+#endif
 	/* add leng2 zeros to crc1 */
 	i=0;
 	while (leng2) {
@@ -267,7 +549,36 @@ uint32_t mycrc32_combine(uint32_t crc1, uint32_t crc2, uint32_t leng2) {
 	return crc1^crc2;
 }
 
+uint8_t mycrc32_hwaccel(uint8_t enable) {
+#ifdef CRC_FOLD_KERNEL
+	crc_fold_enabled = (enable && crc_fold_supported())?1:0;
+	return crc_fold_enabled;
+#else
+	(void)enable;
+	return 0;
+#endif
+}
+
+const char* mycrc32_kernel(void) {
+#ifdef CRC_FOLD_KERNEL
+	if (crc_fold_enabled) {
+		return CRC_FOLD_KERNEL;
+	}
+#endif
+#ifdef FASTCRC
+	return "slicing-by-8";
+#else
+	return "table";
+#endif
+}
+
 void mycrc32_init(void) {
 	crc_generate_main_tables();
 	crc_generate_combine_tables();
+#ifdef CRC_FOLD_KERNEL
+	if (crc_fold_supported()) {
+		crc_generate_x16n_table();
+	}
+#endif
+	mycrc32_hwaccel(1);
 }
@@ -28,6 +28,10 @@ uint32_t mycrc32_combine(uint32_t crc1, uint32_t crc2, uint32_t leng2);
 #define mycrc32_zeroexpanded(crc,block,leng,zeros) mycrc32_zeroblock(mycrc32((crc),(block),(leng)),(zeros))
 #define mycrc32_xorblocks(crc,crcblock1,crcblock2,leng) ((crcblock1)^(crcblock2)^mycrc32_zeroblock(crc,leng))
 
+/* enable/disable carry-less multiplication kernels (if supported by cpu) - returns 1 when they are in use */
+uint8_t mycrc32_hwaccel(uint8_t enable);
+const char* mycrc32_kernel(void);
+
 void mycrc32_init(void);
 
 #endif
@@ -154,4 +154,31 @@ static inline uint8_t get8bit(const uint8_t **ptr) {
 	return t8;
 }
 
+/* variable length numbers - 7 bits per byte (least significant first), highest bit set in all bytes except last one ; up to 10 bytes */
+
+static inline void putvar64bit(uint8_t **ptr,uint64_t val) {
+	while (val>=0x80) {
+		**ptr = (val&0x7F)|0x80;
+		(*ptr)++;
+		val >>= 7;
+	}
+	**ptr = val;
+	(*ptr)++;
+}
+
+static inline uint64_t getvar64bit(const uint8_t **ptr) {
+	uint64_t val;
+	uint8_t shift;
+	val = 0;
+	shift = 0;
+	while ((*ptr)[0]&0x80) {
+		val |= ((uint64_t)((*ptr)[0]&0x7F))<<shift;
+		shift += 7;
+		(*ptr)++;
+	}
+	val |= ((uint64_t)((*ptr)[0]))<<shift;
+	(*ptr)++;
+	return val;
+}
+
 #endif
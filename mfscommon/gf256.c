@@ -0,0 +1,549 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "gf256.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define GF_X86 1
+#define GF_TARGET_SSSE3 __attribute__((target("sse2,ssse3")))
+#define GF_TARGET_AVX2 __attribute__((target("avx2")))
+#define GF_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#elif defined(__aarch64__) && defined(__GNUC__)
+#include <arm_neon.h>
+#define GF_NEON 1
+#endif
+
+#define GF_POLY 0x11D
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+/* gf_nib[c][0..15] = c*i ; gf_nib[c][16..31] = c*(i<<4) - split tables for byte shuffle kernels */
+static uint8_t gf_nib[256][32] __attribute__((aligned(64)));
+
+typedef struct _gf_kernel {
+	const char *name;
+	void (*xorfn)(uint8_t *dst,const uint8_t *src,uint32_t leng);
+	void (*xormultifn)(uint8_t *dst,const uint8_t * const *srcs,uint32_t srccnt,uint32_t leng);
+	void (*muladdfn)(uint8_t *dst,const uint8_t *src,uint8_t c,uint32_t leng);
+} gf_kernel;
+
+/* portable code */
+
+static inline uint64_t gf_load64(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v,p,8);
+	return v;
+}
+
+static inline void gf_store64(uint8_t *p,uint64_t v) {
+	memcpy(p,&v,8);
+}
+
+static void gf_xor_generic(uint8_t *dst,const uint8_t *src,uint32_t leng) {
+	while (leng>=32) {
+		gf_store64(dst,gf_load64(dst)^gf_load64(src));
+		gf_store64(dst+8,gf_load64(dst+8)^gf_load64(src+8));
+		gf_store64(dst+16,gf_load64(dst+16)^gf_load64(src+16));
+		gf_store64(dst+24,gf_load64(dst+24)^gf_load64(src+24));
+		dst += 32;
+		src += 32;
+		leng -= 32;
+	}
+	while (leng>=8) {
+		gf_store64(dst,gf_load64(dst)^gf_load64(src));
+		dst += 8;
+		src += 8;
+		leng -= 8;
+	}
+	while (leng>0) {
+		*dst++ ^= *src++;
+		leng--;
+	}
+}
+
+static void gf_xormulti_generic_tail(uint8_t *dst,const uint8_t * const *srcs,uint32_t srccnt,uint32_t pos,uint32_t leng) {
+	uint32_t i;
+	uint8_t v;
+	while (pos<leng) {
+		v = srcs[0][pos];
+		for (i=1 ; i<srccnt ; i++) {
+			v ^= srcs[i][pos];
+		}
+		dst[pos] = v;
+		pos++;
+	}
+}
+
+static void gf_xormulti_generic(uint8_t *dst,const uint8_t * const *srcs,uint32_t srccnt,uint32_t leng) {
+	uint32_t i,pos;
+	uint64_t v0,v1;
+	for (pos=0 ; pos+16<=leng ; pos+=16) {
+		v0 = gf_load64(srcs[0]+pos);
+		v1 = gf_load64(srcs[0]+pos+8);
+		for (i=1 ; i<srccnt ; i++) {
+			v0 ^= gf_load64(srcs[i]+pos);
+			v1 ^= gf_load64(srcs[i]+pos+8);
+		}
+		gf_store64(dst+pos,v0);
+		gf_store64(dst+pos+8,v1);
+	}
+	gf_xormulti_generic_tail(dst,srcs,srccnt,pos,leng);
+}
+
+static void gf_muladd_generic(uint8_t *dst,const uint8_t *src,uint8_t c,uint32_t leng) {
+	const uint8_t *lo = gf_nib[c];
+	const uint8_t *hi = gf_nib[c]+16;
+	while (leng>=4) {
+		dst[0] ^= lo[src[0]&0xF] ^ hi[src[0]>>4];
+		dst[1] ^= lo[src[1]&0xF] ^ hi[src[1]>>4];
+		dst[2] ^= lo[src[2]&0xF] ^ hi[src[2]>>4];
+		dst[3] ^= lo[src[3]&0xF] ^ hi[src[3]>>4];
+		dst += 4;
+		src += 4;
+		leng -= 4;
+	}
+	while (leng>0) {
+		*dst++ ^= lo[*src&0xF] ^ hi[*src>>4];
+		src++;
+		leng--;
+	}
+}
+
+static const gf_kernel gf_kernel_generic = {"generic",gf_xor_generic,gf_xormulti_generic,gf_muladd_generic};
+
+#ifdef GF_X86
+
+/* SSE2 / SSSE3 */
+
+static GF_TARGET_SSSE3 void gf_xor_sse(uint8_t *dst,const uint8_t *src,uint32_t leng) {
+	__m128i x0,x1,x2,x3;
+	while (leng>=64) {
+		x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(dst+0x00)),_mm_loadu_si128((const __m128i*)(src+0x00)));
+		x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(dst+0x10)),_mm_loadu_si128((const __m128i*)(src+0x10)));
+		x2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(dst+0x20)),_mm_loadu_si128((const __m128i*)(src+0x20)));
+		x3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(dst+0x30)),_mm_loadu_si128((const __m128i*)(src+0x30)));
+		_mm_storeu_si128((__m128i*)(dst+0x00),x0);
+		_mm_storeu_si128((__m128i*)(dst+0x10),x1);
+		_mm_storeu_si128((__m128i*)(dst+0x20),x2);
+		_mm_storeu_si128((__m128i*)(dst+0x30),x3);
+		dst += 64;
+		src += 64;
+		leng -= 64;
+	}
+	while (leng>=16) {
+		_mm_storeu_si128((__m128i*)dst,_mm_xor_si128(_mm_loadu_si128((const __m128i*)dst),_mm_loadu_si128((const __m128i*)src)));
+		dst += 16;
+		src += 16;
+		leng -= 16;
+	}
+	gf_xor_generic(dst,src,leng);
+}
+
+static GF_TARGET_SSSE3 void gf_xormulti_sse(uint8_t *dst,const uint8_t * const *srcs,uint32_t srccnt,uint32_t leng) {
+	uint32_t i,pos;
+	__m128i x0,x1,x2,x3;
+	for (pos=0 ; pos+64<=leng ; pos+=64) {
+		x0 = _mm_loadu_si128((const __m128i*)(srcs[0]+pos+0x00));
+		x1 = _mm_loadu_si128((const __m128i*)(srcs[0]+pos+0x10));
+		x2 = _mm_loadu_si128((const __m128i*)(srcs[0]+pos+0x20));
+		x3 = _mm_loadu_si128((const __m128i*)(srcs[0]+pos+0x30));
+		for (i=1 ; i<srccnt ; i++) {
+			x0 = _mm_xor_si128(x0,_mm_loadu_si128((const __m128i*)(srcs[i]+pos+0x00)));
+			x1 = _mm_xor_si128(x1,_mm_loadu_si128((const __m128i*)(srcs[i]+pos+0x10)));
+			x2 = _mm_xor_si128(x2,_mm_loadu_si128((const __m128i*)(srcs[i]+pos+0x20)));
+			x3 = _mm_xor_si128(x3,_mm_loadu_si128((const __m128i*)(srcs[i]+pos+0x30)));
+		}
+		_mm_storeu_si128((__m128i*)(dst+pos+0x00),x0);
+		_mm_storeu_si128((__m128i*)(dst+pos+0x10),x1);
+		_mm_storeu_si128((__m128i*)(dst+pos+0x20),x2);
+		_mm_storeu_si128((__m128i*)(dst+pos+0x30),x3);
+	}
+	gf_xormulti_generic_tail(dst,srcs,srccnt,pos,leng);
+}
+
+static GF_TARGET_SSSE3 void gf_muladd_ssse3(uint8_t *dst,const uint8_t *src,uint8_t c,uint32_t leng) {
+	__m128i lo,hi,mask,x0,x1,l0,l1,h0,h1;
+	lo = _mm_load_si128((const __m128i*)(gf_nib[c]));
+	hi = _mm_load_si128((const __m128i*)(gf_nib[c]+16));
+	mask = _mm_set1_epi8(0x0F);
+	while (leng>=32) {
+		x0 = _mm_loadu_si128((const __m128i*)(src+0x00));
+		x1 = _mm_loadu_si128((const __m128i*)(src+0x10));
+		l0 = _mm_shuffle_epi8(lo,_mm_and_si128(x0,mask));
+		l1 = _mm_shuffle_epi8(lo,_mm_and_si128(x1,mask));
+		h0 = _mm_shuffle_epi8(hi,_mm_and_si128(_mm_srli_epi64(x0,4),mask));
+		h1 = _mm_shuffle_epi8(hi,_mm_and_si128(_mm_srli_epi64(x1,4),mask));
+		x0 = _mm_xor_si128(_mm_xor_si128(l0,h0),_mm_loadu_si128((const __m128i*)(dst+0x00)));
+		x1 = _mm_xor_si128(_mm_xor_si128(l1,h1),_mm_loadu_si128((const __m128i*)(dst+0x10)));
+		_mm_storeu_si128((__m128i*)(dst+0x00),x0);
+		_mm_storeu_si128((__m128i*)(dst+0x10),x1);
+		dst += 32;
+		src += 32;
+		leng -= 32;
+	}
+	gf_muladd_generic(dst,src,c,leng);
+}
+
+static const gf_kernel gf_kernel_sse = {"sse2/ssse3",gf_xor_sse,gf_xormulti_sse,gf_muladd_ssse3};
+
+/* AVX2 */
+
+static GF_TARGET_AVX2 void gf_xor_avx2(uint8_t *dst,const uint8_t *src,uint32_t leng) {
+	__m256i y0,y1,y2,y3;
+	while (leng>=128) {
+		y0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(dst+0x00)),_mm256_loadu_si256((const __m256i*)(src+0x00)));
+		y1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(dst+0x20)),_mm256_loadu_si256((const __m256i*)(src+0x20)));
+		y2 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(dst+0x40)),_mm256_loadu_si256((const __m256i*)(src+0x40)));
+		y3 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(dst+0x60)),_mm256_loadu_si256((const __m256i*)(src+0x60)));
+		_mm256_storeu_si256((__m256i*)(dst+0x00),y0);
+		_mm256_storeu_si256((__m256i*)(dst+0x20),y1);
+		_mm256_storeu_si256((__m256i*)(dst+0x40),y2);
+		_mm256_storeu_si256((__m256i*)(dst+0x60),y3);
+		dst += 128;
+		src += 128;
+		leng -= 128;
+	}
+	while (leng>=32) {
+		_mm256_storeu_si256((__m256i*)dst,_mm256_xor_si256(_mm256_loadu_si256((const __m256i*)dst),_mm256_loadu_si256((const __m256i*)src)));
+		dst += 32;
+		src += 32;
+		leng -= 32;
+	}
+	gf_xor_generic(dst,src,leng);
+}
+
+static GF_TARGET_AVX2 void gf_xormulti_avx2(uint8_t *dst,const uint8_t * const *srcs,uint32_t srccnt,uint32_t leng) {
+	uint32_t i,pos;
+	__m256i y0,y1,y2,y3;
+	for (pos=0 ; pos+128<=leng ; pos+=128) {
+		y0 = _mm256_loadu_si256((const __m256i*)(srcs[0]+pos+0x00));
+		y1 = _mm256_loadu_si256((const __m256i*)(srcs[0]+pos+0x20));
+		y2 = _mm256_loadu_si256((const __m256i*)(srcs[0]+pos+0x40));
+		y3 = _mm256_loadu_si256((const __m256i*)(srcs[0]+pos+0x60));
+		for (i=1 ; i<srccnt ; i++) {
+			y0 = _mm256_xor_si256(y0,_mm256_loadu_si256((const __m256i*)(srcs[i]+pos+0x00)));
+			y1 = _mm256_xor_si256(y1,_mm256_loadu_si256((const __m256i*)(srcs[i]+pos+0x20)));
+			y2 = _mm256_xor_si256(y2,_mm256_loadu_si256((const __m256i*)(srcs[i]+pos+0x40)));
+			y3 = _mm256_xor_si256(y3,_mm256_loadu_si256((const __m256i*)(srcs[i]+pos+0x60)));
+		}
+		_mm256_storeu_si256((__m256i*)(dst+pos+0x00),y0);
+		_mm256_storeu_si256((__m256i*)(dst+pos+0x20),y1);
+		_mm256_storeu_si256((__m256i*)(dst+pos+0x40),y2);
+		_mm256_storeu_si256((__m256i*)(dst+pos+0x60),y3);
+	}
+	gf_xormulti_generic_tail(dst,srcs,srccnt,pos,leng);
+}
+
+static GF_TARGET_AVX2 void gf_muladd_avx2(uint8_t *dst,const uint8_t *src,uint8_t c,uint32_t leng) {
+	__m256i lo,hi,mask,y0,y1,l0,l1,h0,h1;
+	lo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)(gf_nib[c])));
+	hi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)(gf_nib[c]+16)));
+	mask = _mm256_set1_epi8(0x0F);
+	while (leng>=64) {
+		y0 = _mm256_loadu_si256((const __m256i*)(src+0x00));
+		y1 = _mm256_loadu_si256((const __m256i*)(src+0x20));
+		l0 = _mm256_shuffle_epi8(lo,_mm256_and_si256(y0,mask));
+		l1 = _mm256_shuffle_epi8(lo,_mm256_and_si256(y1,mask));
+		h0 = _mm256_shuffle_epi8(hi,_mm256_and_si256(_mm256_srli_epi64(y0,4),mask));
+		h1 = _mm256_shuffle_epi8(hi,_mm256_and_si256(_mm256_srli_epi64(y1,4),mask));
+		y0 = _mm256_xor_si256(_mm256_xor_si256(l0,h0),_mm256_loadu_si256((const __m256i*)(dst+0x00)));
+		y1 = _mm256_xor_si256(_mm256_xor_si256(l1,h1),_mm256_loadu_si256((const __m256i*)(dst+0x20)));
+		_mm256_storeu_si256((__m256i*)(dst+0x00),y0);
+		_mm256_storeu_si256((__m256i*)(dst+0x20),y1);
+		dst += 64;
+		src += 64;
+		leng -= 64;
+	}
+	gf_muladd_generic(dst,src,c,leng);
+}
+
+static const gf_kernel gf_kernel_avx2 = {"avx2",gf_xor_avx2,gf_xormulti_avx2,gf_muladd_avx2};
+
+/* AVX-512 */
+
+static GF_TARGET_AVX512 void gf_xor_avx512(uint8_t *dst,const uint8_t *src,uint32_t leng) {
+	__m512i z0,z1,z2,z3;
+	while (leng>=256) {
+		z0 = _mm512_xor_si512(_mm512_loadu_si512((const void*)(dst+0x00)),_mm512_loadu_si512((const void*)(src+0x00)));
+		z1 = _mm512_xor_si512(_mm512_loadu_si512((const void*)(dst+0x40)),_mm512_loadu_si512((const void*)(src+0x40)));
+		z2 = _mm512_xor_si512(_mm512_loadu_si512((const void*)(dst+0x80)),_mm512_loadu_si512((const void*)(src+0x80)));
+		z3 = _mm512_xor_si512(_mm512_loadu_si512((const void*)(dst+0xC0)),_mm512_loadu_si512((const void*)(src+0xC0)));
+		_mm512_storeu_si512((void*)(dst+0x00),z0);
+		_mm512_storeu_si512((void*)(dst+0x40),z1);
+		_mm512_storeu_si512((void*)(dst+0x80),z2);
+		_mm512_storeu_si512((void*)(dst+0xC0),z3);
+		dst += 256;
+		src += 256;
+		leng -= 256;
+	}
+	while (leng>=64) {
+		_mm512_storeu_si512((void*)dst,_mm512_xor_si512(_mm512_loadu_si512((const void*)dst),_mm512_loadu_si512((const void*)src)));
+		dst += 64;
+		src += 64;
+		leng -= 64;
+	}
+	gf_xor_generic(dst,src,leng);
+}
+
+static GF_TARGET_AVX512 void gf_xormulti_avx512(uint8_t *dst,const uint8_t * const *srcs,uint32_t srccnt,uint32_t leng) {
+	uint32_t i,pos;
+	__m512i z0,z1,z2,z3;
+	for (pos=0 ; pos+256<=leng ; pos+=256) {
+		z0 = _mm512_loadu_si512((const void*)(srcs[0]+pos+0x00));
+		z1 = _mm512_loadu_si512((const void*)(srcs[0]+pos+0x40));
+		z2 = _mm512_loadu_si512((const void*)(srcs[0]+pos+0x80));
+		z3 = _mm512_loadu_si512((const void*)(srcs[0]+pos+0xC0));
+		for (i=1 ; i<srccnt ; i++) {
+			z0 = _mm512_xor_si512(z0,_mm512_loadu_si512((const void*)(srcs[i]+pos+0x00)));
+			z1 = _mm512_xor_si512(z1,_mm512_loadu_si512((const void*)(srcs[i]+pos+0x40)));
+			z2 = _mm512_xor_si512(z2,_mm512_loadu_si512((const void*)(srcs[i]+pos+0x80)));
+			z3 = _mm512_xor_si512(z3,_mm512_loadu_si512((const void*)(srcs[i]+pos+0xC0)));
+		}
+		_mm512_storeu_si512((void*)(dst+pos+0x00),z0);
+		_mm512_storeu_si512((void*)(dst+pos+0x40),z1);
+		_mm512_storeu_si512((void*)(dst+pos+0x80),z2);
+		_mm512_storeu_si512((void*)(dst+pos+0xC0),z3);
+	}
+	gf_xormulti_generic_tail(dst,srcs,srccnt,pos,leng);
+}
+
+static GF_TARGET_AVX512 void gf_muladd_avx512(uint8_t *dst,const uint8_t *src,uint8_t c,uint32_t leng) {
+	__m512i lo,hi,mask,z0,z1,l0,l1,h0,h1;
+	lo = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i*)(gf_nib[c])));
+	hi = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i*)(gf_nib[c]+16)));
+	mask = _mm512_set1_epi8(0x0F);
+	while (leng>=128) {
+		z0 = _mm512_loadu_si512((const void*)(src+0x00));
+		z1 = _mm512_loadu_si512((const void*)(src+0x40));
+		l0 = _mm512_shuffle_epi8(lo,_mm512_and_si512(z0,mask));
+		l1 = _mm512_shuffle_epi8(lo,_mm512_and_si512(z1,mask));
+		h0 = _mm512_shuffle_epi8(hi,_mm512_and_si512(_mm512_srli_epi64(z0,4),mask));
+		h1 = _mm512_shuffle_epi8(hi,_mm512_and_si512(_mm512_srli_epi64(z1,4),mask));
+		z0 = _mm512_xor_si512(_mm512_xor_si512(l0,h0),_mm512_loadu_si512((const void*)(dst+0x00)));
+		z1 = _mm512_xor_si512(_mm512_xor_si512(l1,h1),_mm512_loadu_si512((const void*)(dst+0x40)));
+		_mm512_storeu_si512((void*)(dst+0x00),z0);
+		_mm512_storeu_si512((void*)(dst+0x40),z1);
+		dst += 128;
+		src += 128;
+		leng -= 128;
+	}
+	gf_muladd_generic(dst,src,c,leng);
+}
+
+static const gf_kernel gf_kernel_avx512 = {"avx512",gf_xor_avx512,gf_xormulti_avx512,gf_muladd_avx512};
+
+#define GF_LEVELS 4
+
+static const gf_kernel *gf_kernels[GF_LEVELS] = {&gf_kernel_generic,&gf_kernel_sse,&gf_kernel_avx2,&gf_kernel_avx512};
+
+static uint8_t gf_level_supported(uint8_t level) {
+	__builtin_cpu_init();
+	switch (level) {
+		case 0:
+			return 1;
+		case 1:
+			return (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("ssse3"))?1:0;
+		case 2:
+			return __builtin_cpu_supports("avx2")?1:0;
+		case 3:
+			return (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))?1:0;
+	}
+	return 0;
+}
+
+#elif defined(GF_NEON)
+
+/* NEON (always present on aarch64) */
+
+static void gf_xor_neon(uint8_t *dst,const uint8_t *src,uint32_t leng) {
+	uint8x16_t x0,x1,x2,x3;
+	while (leng>=64) {
+		x0 = veorq_u8(vld1q_u8(dst+0x00),vld1q_u8(src+0x00));
+		x1 = veorq_u8(vld1q_u8(dst+0x10),vld1q_u8(src+0x10));
+		x2 = veorq_u8(vld1q_u8(dst+0x20),vld1q_u8(src+0x20));
+		x3 = veorq_u8(vld1q_u8(dst+0x30),vld1q_u8(src+0x30));
+		vst1q_u8(dst+0x00,x0);
+		vst1q_u8(dst+0x10,x1);
+		vst1q_u8(dst+0x20,x2);
+		vst1q_u8(dst+0x30,x3);
+		dst += 64;
+		src += 64;
+		leng -= 64;
+	}
+	while (leng>=16) {
+		vst1q_u8(dst,veorq_u8(vld1q_u8(dst),vld1q_u8(src)));
+		dst += 16;
+		src += 16;
+		leng -= 16;
+	}
+	gf_xor_generic(dst,src,leng);
+}
+
+static void gf_xormulti_neon(uint8_t *dst,const uint8_t * const *srcs,uint32_t srccnt,uint32_t leng) {
+	uint32_t i,pos;
+	uint8x16_t x0,x1,x2,x3;
+	for (pos=0 ; pos+64<=leng ; pos+=64) {
+		x0 = vld1q_u8(srcs[0]+pos+0x00);
+		x1 = vld1q_u8(srcs[0]+pos+0x10);
+		x2 = vld1q_u8(srcs[0]+pos+0x20);
+		x3 = vld1q_u8(srcs[0]+pos+0x30);
+		for (i=1 ; i<srccnt ; i++) {
+			x0 = veorq_u8(x0,vld1q_u8(srcs[i]+pos+0x00));
+			x1 = veorq_u8(x1,vld1q_u8(srcs[i]+pos+0x10));
+			x2 = veorq_u8(x2,vld1q_u8(srcs[i]+pos+0x20));
+			x3 = veorq_u8(x3,vld1q_u8(srcs[i]+pos+0x30));
+		}
+		vst1q_u8(dst+pos+0x00,x0);
+		vst1q_u8(dst+pos+0x10,x1);
+		vst1q_u8(dst+pos+0x20,x2);
+		vst1q_u8(dst+pos+0x30,x3);
+	}
+	gf_xormulti_generic_tail(dst,srcs,srccnt,pos,leng);
+}
+
+static void gf_muladd_neon(uint8_t *dst,const uint8_t *src,uint8_t c,uint32_t leng) {
+	uint8x16_t lo,hi,mask,x0,x1;
+	lo = vld1q_u8(gf_nib[c]);
+	hi = vld1q_u8(gf_nib[c]+16);
+	mask = vdupq_n_u8(0x0F);
+	while (leng>=32) {
+		x0 = vld1q_u8(src+0x00);
+		x1 = vld1q_u8(src+0x10);
+		x0 = veorq_u8(vqtbl1q_u8(lo,vandq_u8(x0,mask)),vqtbl1q_u8(hi,vshrq_n_u8(x0,4)));
+		x1 = veorq_u8(vqtbl1q_u8(lo,vandq_u8(x1,mask)),vqtbl1q_u8(hi,vshrq_n_u8(x1,4)));
+		vst1q_u8(dst+0x00,veorq_u8(x0,vld1q_u8(dst+0x00)));
+		vst1q_u8(dst+0x10,veorq_u8(x1,vld1q_u8(dst+0x10)));
+		dst += 32;
+		src += 32;
+		leng -= 32;
+	}
+	gf_muladd_generic(dst,src,c,leng);
+}
+
+static const gf_kernel gf_kernel_neon = {"neon",gf_xor_neon,gf_xormulti_neon,gf_muladd_neon};
+
+#define GF_LEVELS 2
+
+static const gf_kernel *gf_kernels[GF_LEVELS] = {&gf_kernel_generic,&gf_kernel_neon};
+
+static uint8_t gf_level_supported(uint8_t level) {
+	return (level<GF_LEVELS)?1:0;
+}
+
+#else
+
+#define GF_LEVELS 1
+
+static const gf_kernel *gf_kernels[GF_LEVELS] = {&gf_kernel_generic};
+
+static uint8_t gf_level_supported(uint8_t level) {
+	return (level==0)?1:0;
+}
+
+#endif
+
+static const gf_kernel *gf_current = &gf_kernel_generic;
+
+uint8_t gf256_mul(uint8_t a,uint8_t b) {
+	if (a==0 || b==0) {
+		return 0;
+	}
+	return gf_exp[gf_log[a]+gf_log[b]];
+}
+
+uint8_t gf256_inv(uint8_t a) {
+	if (a==0) {
+		return 0;
+	}
+	return gf_exp[255-gf_log[a]];
+}
+
+void gf256_xor(uint8_t *dst,const uint8_t *src,uint32_t leng) {
+	gf_current->xorfn(dst,src,leng);
+}
+
+void gf256_xormulti(uint8_t *dst,const uint8_t * const *srcs,uint32_t srccnt,uint32_t leng) {
+	if (srccnt==0) {
+		memset(dst,0,leng);
+	} else if (srccnt==1) {
+		if (dst!=srcs[0]) {
+			memcpy(dst,srcs[0],leng);
+		}
+	} else {
+		gf_current->xormultifn(dst,srcs,srccnt,leng);
+	}
+}
+
+void gf256_muladd(uint8_t *dst,const uint8_t *src,uint8_t c,uint32_t leng) {
+	if (c==0) {
+		return;
+	} else if (c==1) {
+		gf_current->xorfn(dst,src,leng);
+	} else {
+		gf_current->muladdfn(dst,src,c,leng);
+	}
+}
+
+uint8_t gf256_hwaccel(uint8_t maxlevel) {
+	uint8_t level;
+	level = (maxlevel<GF_LEVELS)?maxlevel:GF_LEVELS-1;
+	while (level>0 && gf_level_supported(level)==0) {
+		level--;
+	}
+	gf_current = gf_kernels[level];
+	return level;
+}
+
+const char* gf256_kernel(void) {
+	return gf_current->name;
+}
+
+void gf256_init(void) {
+	uint32_t i,j,x;
+
+	x = 1;
+	for (i=0 ; i<255 ; i++) {
+		gf_exp[i] = x;
+		gf_exp[i+255] = x;
+		gf_log[x] = i;
+		x <<= 1;
+		if (x&0x100) {
+			x ^= GF_POLY;
+		}
+	}
+	gf_exp[510] = gf_exp[0];
+	gf_exp[511] = gf_exp[1];
+	gf_log[0] = 0;
+	for (i=0 ; i<256 ; i++) {
+		for (j=0 ; j<16 ; j++) {
+			gf_nib[i][j] = gf256_mul(i,j);
+			gf_nib[i][j+16] = gf256_mul(i,j<<4);
+		}
+	}
+	gf256_hwaccel(255);
+}
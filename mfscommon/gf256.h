@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef _GF256_H_
+#define _GF256_H_
+#include <inttypes.h>
+
+/* GF(2^8) with polynomial x^8+x^4+x^3+x^2+1 (0x11D) */
+uint8_t gf256_mul(uint8_t a,uint8_t b);
+uint8_t gf256_inv(uint8_t a);
+
+/* dst ^= src */
+void gf256_xor(uint8_t *dst,const uint8_t *src,uint32_t leng);
+/* dst = srcs[0] ^ srcs[1] ^ ... ^ srcs[srccnt-1] (srccnt>=1) */
+void gf256_xormulti(uint8_t *dst,const uint8_t * const *srcs,uint32_t srccnt,uint32_t leng);
+/* dst ^= c * src */
+void gf256_muladd(uint8_t *dst,const uint8_t *src,uint8_t c,uint32_t leng);
+
+/* select the best kernel not above given level (0 - portable code) - returns level in use */
+uint8_t gf256_hwaccel(uint8_t maxlevel);
+const char* gf256_kernel(void);
+
+void gf256_init(void);
+
+#endif
@@ -46,6 +46,11 @@
 #  include <sys/prctl.h>
 #endif
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE)
+#  include <sys/epoll.h>
+#  define MFS_USE_EPOLL 1
+#endif
+
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/types.h>
@@ -145,6 +150,27 @@ typedef struct pollentry {
 static pollentry *pollhead=NULL;
 
 
+typedef struct fdentry {
+	int fd;
+	short events;
+	short revents;
+	int32_t pdescpos;
+	uint32_t tabpos;
+	void (*serve)(void *,short);
+	void *udata;
+	struct fdentry *next;
+} fdentry;
+
+static fdentry **fdtab=NULL;
+static uint32_t fdtabsize=0;
+static uint32_t fdtabcount=0;
+static fdentry *fdfreehead=NULL;	// unregistered entries - freed after all events from current loop are served
+#ifdef MFS_USE_EPOLL
+#define EPOLL_MAXEVENTS 1024
+static int epollfd=-2;
+#endif
+
+
 typedef struct eloopentry {
 	void (*fun)(void);
 	struct eloopentry *next;
@@ -237,6 +263,119 @@ void main_poll_register (void (*desc)(struct pollfd *,uint32_t *),void (*serve)(
 	pollhead = aux;
 }
 
+#ifdef MFS_USE_EPOLL
+static inline uint32_t main_fd_epollevents(short events) {
+	uint32_t res = 0;
+	if (events & POLLIN) {
+		res |= EPOLLIN;
+	}
+	if (events & POLLOUT) {
+		res |= EPOLLOUT;
+	}
+	return res;
+}
+
+static inline short main_fd_pollevents(uint32_t events) {
+	short res = 0;
+	if (events & EPOLLIN) {
+		res |= POLLIN;
+	}
+	if (events & EPOLLOUT) {
+		res |= POLLOUT;
+	}
+	if (events & EPOLLERR) {
+		res |= POLLERR;
+	}
+	if (events & EPOLLHUP) {
+		res |= POLLHUP;
+	}
+	return res;
+}
+
+static inline void main_fd_epollinit(void) {
+	if (epollfd==-2) {
+		epollfd = epoll_create(1024);
+		if (epollfd<0) {
+			mfs_errlog(LOG_WARNING,"epoll_create error - using poll");
+			epollfd = -1;
+		} else {
+			fcntl(epollfd,F_SETFD,FD_CLOEXEC);
+		}
+	}
+}
+#endif
+
+void* main_fd_register (int fd,short events,void (*serve)(void *,short),void *udata) {
+	fdentry *aux=(fdentry*)malloc(sizeof(fdentry));
+	passert(aux);
+	aux->fd = fd;
+	aux->events = events;
+	aux->revents = 0;
+	aux->pdescpos = -1;
+	aux->serve = serve;
+	aux->udata = udata;
+	aux->next = NULL;
+	if (fdtabcount>=fdtabsize) {
+		fdtabsize = (fdtabsize==0)?256:fdtabsize*2;
+		fdtab = realloc(fdtab,sizeof(fdentry*)*fdtabsize);
+		passert(fdtab);
+	}
+	aux->tabpos = fdtabcount;
+	fdtab[fdtabcount++] = aux;
+#ifdef MFS_USE_EPOLL
+	main_fd_epollinit();
+	if (epollfd>=0) {
+		struct epoll_event ev;
+		memset(&ev,0,sizeof(ev));
+		ev.events = main_fd_epollevents(events);
+		ev.data.ptr = aux;
+		if (epoll_ctl(epollfd,EPOLL_CTL_ADD,fd,&ev)<0) {
+			mfs_errlog(LOG_WARNING,"epoll_ctl (add) error");
+		}
+	}
+#endif
+	return aux;
+}
+
+void main_fd_change (void *fdh,short events) {
+	fdentry *aux = (fdentry*)fdh;
+	if (aux->events==events) {
+		return;
+	}
+	aux->events = events;
+#ifdef MFS_USE_EPOLL
+	if (epollfd>=0) {
+		struct epoll_event ev;
+		memset(&ev,0,sizeof(ev));
+		ev.events = main_fd_epollevents(events);
+		ev.data.ptr = aux;
+		if (epoll_ctl(epollfd,EPOLL_CTL_MOD,aux->fd,&ev)<0) {
+			mfs_errlog(LOG_WARNING,"epoll_ctl (mod) error");
+		}
+	}
+#endif
+}
+
+void main_fd_unregister (void *fdh) {
+	fdentry *aux = (fdentry*)fdh;
+#ifdef MFS_USE_EPOLL
+	if (epollfd>=0) {
+		struct epoll_event ev;
+		memset(&ev,0,sizeof(ev));
+		epoll_ctl(epollfd,EPOLL_CTL_DEL,aux->fd,&ev);
+	}
+#endif
+	fdtabcount--;
+	if (aux->tabpos<fdtabcount) {
+		fdtab[aux->tabpos] = fdtab[fdtabcount];
+		fdtab[aux->tabpos]->tabpos = aux->tabpos;
+	}
+	aux->fd = -1;
+	aux->serve = NULL;
+	aux->next = fdfreehead;
+	fdfreehead = aux;
+}
+
 void main_eachloop_register (void (*fun)(void)) {
 	eloopentry *aux=(eloopentry*)malloc(sizeof(eloopentry));
 	passert(aux);
@@ -339,6 +478,7 @@ void free_all_registered_entries(void) {
 	rlentry *re,*ren;
 	inentry *ie,*ien;
 	pollentry *pe,*pen;
+	fdentry *fe,*fen;
 	eloopentry *ee,*een;
 	timeentry *te,*ten;
 
@@ -372,6 +512,26 @@ void free_all_registered_entries(void) {
 		free(pe);
 	}
 
+	for (fe = fdfreehead ; fe ; fe = fen) {
+		fen = fe->next;
+		free(fe);
+	}
+	fdfreehead = NULL;
+	while (fdtabcount>0) {
+		free(fdtab[--fdtabcount]);
+	}
+	if (fdtab!=NULL) {
+		free(fdtab);
+		fdtab = NULL;
+	}
+	fdtabsize = 0;
+#ifdef MFS_USE_EPOLL
+	if (epollfd>=0) {
+		close(epollfd);
+	}
+	epollfd = -2;
+#endif
+
 	for (ee = eloophead ; ee ; ee = een) {
 		een = ee->next;
 		free(ee);
@@ -422,6 +582,79 @@ void main_keep_alive(void) {
 	}
 }
 
+// fds registered by main_fd_register - on Linux they are kept in epoll set, so only active ones are visited
+static inline uint32_t main_fd_desc(struct pollfd *pdesc,uint32_t ndesc) {
+	uint32_t i;
+#ifdef MFS_USE_EPOLL
+	if (epollfd>=0) {
+		if (fdtabcount>0) {
+			pdesc[ndesc].fd = epollfd;
+			pdesc[ndesc].events = POLLIN;
+			pdesc[ndesc].revents = 0;
+			ndesc++;
+		}
+		return ndesc;
+	}
+#endif
+	for (i=0 ; i<fdtabcount ; i++) {
+		if (ndesc<MFSMAXFILES) {
+			pdesc[ndesc].fd = fdtab[i]->fd;
+			pdesc[ndesc].events = fdtab[i]->events;
+			pdesc[ndesc].revents = 0;
+			fdtab[i]->pdescpos = ndesc;
+			ndesc++;
+		} else {
+			fdtab[i]->pdescpos = -1;
+		}
+	}
+	return ndesc;
+}
+
+static inline void main_fd_serve(struct pollfd *pdesc,uint32_t fdpos) {
+	fdentry *fe;
+	uint32_t i;
+	short revents;
+#ifdef MFS_USE_EPOLL
+	struct epoll_event evtab[EPOLL_MAXEVENTS];
+	int n;
+
+	if (epollfd>=0) {
+		if (fdtabcount>0 && (pdesc[fdpos].revents & POLLIN)) {
+			n = epoll_wait(epollfd,evtab,EPOLL_MAXEVENTS,0);
+			if (n<0 && errno!=EINTR) {
+				mfs_errlog_silent(LOG_WARNING,"epoll_wait error");
+			}
+			for (i=0 ; n>0 && i<(uint32_t)n ; i++) {
+				fe = (fdentry*)(evtab[i].data.ptr);
+				if (fe->serve!=NULL) {
+					fe->serve(fe->udata,main_fd_pollevents(evtab[i].events));
+				}
+			}
+		}
+	} else
+#endif
+	{
+		for (i=0 ; i<fdtabcount ; i++) {
+			fe = fdtab[i];
+			fe->revents = (fe->pdescpos>=0)?pdesc[fe->pdescpos].revents:0;
+			fe->pdescpos = -1;
+		}
+		// callbacks can unregister entries, so table can change while serving them
+		for (i=0 ; i<fdtabcount ; i++) {
+			fe = fdtab[i];
+			if (fe->revents) {
+				revents = fe->revents;
+				fe->revents = 0;
+				fe->serve(fe->udata,revents);
+			}
+		}
+	}
+	while ((fe = fdfreehead)!=NULL) {
+		fdfreehead = fe->next;
+		free(fe);
+	}
+}
+
 void mainloop() {
 	uint64_t prevtime = 0;
 	struct timeval tv;
@@ -434,6 +667,7 @@ void mainloop() {
 	inentry *init;
 	struct pollfd pdesc[MFSMAXFILES];
 	uint32_t ndesc;
+	uint32_t fdpos;
 	int i;
 	int t,r;
 
@@ -444,6 +678,8 @@ void mainloop() {
 		pdesc[0].fd = signalpipe[0];
 		pdesc[0].events = POLLIN;
 		pdesc[0].revents = 0;
+		fdpos = ndesc;
+		ndesc = main_fd_desc(pdesc,ndesc);
 		for (pollit = pollhead ; pollit != NULL ; pollit = pollit->next) {
 			pollit->desc(pdesc,&ndesc);
 		}
@@ -490,6 +726,7 @@ void mainloop() {
 			for (pollit = pollhead ; pollit != NULL ; pollit = pollit->next) {
 				pollit->serve(pdesc);
 			}
+			main_fd_serve(pdesc,fdpos);
 		}
 		for (eloopit = eloophead ; eloopit != NULL ; eloopit = eloopit->next) {
 			eloopit->fun();
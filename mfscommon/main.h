@@ -40,6 +40,9 @@ void main_info_register (void (*fun)(void));
 void main_chld_register (pid_t pid,void (*fun)(int));
 void main_keepalive_register (void (*fun)(void));
 void main_poll_register (void (*desc)(struct pollfd *,uint32_t *),void (*serve)(struct pollfd *));
+void* main_fd_register (int fd,short events,void (*serve)(void *,short),void *udata);
+void main_fd_change (void *fdh,short events);
+void main_fd_unregister (void *fdh);
 void main_eachloop_register (void (*fun)(void));
 void* main_msectime_register (uint32_t mseconds,uint32_t offset,void (*fun)(void));
 int main_msectime_change(void* x,uint32_t mseconds,uint32_t offset);
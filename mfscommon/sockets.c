@@ -27,6 +27,7 @@
 #include <sys/un.h>
 #include <sys/poll.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -279,6 +280,78 @@ static inline int32_t streamtowrite(int sock,const void *buff,uint32_t leng,uint
 	return sent;
 }
 
+static inline int32_t streamtowritev(int sock,struct iovec *iov,int iovcnt,uint32_t msecto) {
+	uint32_t sent=0;
+	int32_t i;
+	struct pollfd pfd;
+	double s,c;
+	uint32_t msecpassed;
+
+	s = 0.0;
+	pfd.fd = sock;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	while (iovcnt>0 && iov->iov_len==0) {
+		iov++;
+		iovcnt--;
+	}
+	while (iovcnt>0) {
+#ifdef HAVE_WRITEV
+		i = writev(sock,iov,iovcnt);
+#else
+		i = write(sock,iov->iov_base,iov->iov_len);
+#endif
+		if (i==0) {
+			return 0;
+		}
+		if (i>0) {
+			sent += i;
+			// skip sent data - iov is modified !!!
+			while (iovcnt>0 && (size_t)i>=iov->iov_len) {
+				i -= iov->iov_len;
+				iov++;
+				iovcnt--;
+			}
+			if (iovcnt>0) {
+				iov->iov_base = ((uint8_t*)(iov->iov_base))+i;
+				iov->iov_len -= i;
+			}
+		} else if (ERRNO_ERROR) {
+			return -1;
+		}
+		if (iovcnt==0) {
+			break;
+		}
+		if (s==0.0) {
+			s = monotonic_seconds();
+			msecpassed = 0;
+		} else {
+			c = monotonic_seconds();
+			msecpassed = (c-s)*1000.0;
+			if (msecpassed>=msecto) {
+				errno = ETIMEDOUT;
+				return -1;
+			}
+		}
+		pfd.revents = 0;
+		if (poll(&pfd,1,msecto-msecpassed)<0) {
+			if (errno!=EINTR) {
+				return -1;
+			} else {
+				continue;
+			}
+		}
+		if (pfd.revents & (POLLHUP|POLLERR)) {
+			return -1;
+		}
+		if ((pfd.revents & POLLOUT)==0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+	}
+	return sent;
+}
+
 static inline int32_t streamtoforward(int srcsock,int dstsock,void *buff,uint32_t leng,uint32_t rcvd,uint32_t sent,uint32_t msecto) {
 	int32_t i;
 	struct pollfd pfd[2];
@@ -710,6 +783,10 @@ int32_t tcptowrite(int sock,const void *buff,uint32_t leng,uint32_t msecto) {
 	return streamtowrite(sock,buff,leng,msecto);
 }
 
+int32_t tcptowritev(int sock,struct iovec *iov,int iovcnt,uint32_t msecto) {
+	return streamtowritev(sock,iov,iovcnt,msecto);
+}
+
 int32_t tcptoforward(int srcsock,int dstsock,void *buff,uint32_t leng,uint32_t rcvd,uint32_t sent,uint32_t msecto) {
 	return streamtoforward(srcsock,dstsock,buff,leng,rcvd,sent,msecto);
 }
@@ -23,6 +23,7 @@
 
 #include <inttypes.h>
 #include <errno.h>
+#include <sys/uio.h>
 
 #ifdef EWOULDBLOCK
 #  define ERRNO_ERROR (errno!=EAGAIN && errno!=EWOULDBLOCK)
@@ -51,6 +52,7 @@ int tcpnumlisten(int sock,uint32_t ip,uint16_t port,uint16_t queue);
 int tcpstrlisten(int sock,const char *hostname,const char *service,uint16_t queue);
 int32_t tcptoread(int sock,void *buff,uint32_t leng,uint32_t msecto);
 int32_t tcptowrite(int sock,const void *buff,uint32_t leng,uint32_t msecto);
+int32_t tcptowritev(int sock,struct iovec *iov,int iovcnt,uint32_t msecto);
 int32_t tcptoforward(int srcsock,int dstsock,void *buff,uint32_t leng,uint32_t rcvd,uint32_t sent,uint32_t msecto);
 int tcptoaccept(int sock,uint32_t msecto);
 int tcpaccept(int lsock);
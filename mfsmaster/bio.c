@@ -99,6 +99,68 @@ bio* bio_socket_open(int socket,uint8_t direction,uint32_t buffersize,uint32_t m
 	return b;
 }
 
+// memory bio (write only) - data are collected in growing buffer and taken by bio_mem_release
+bio* bio_mem_open(uint32_t buffersize) {
+	bio *b;
+	b = malloc(sizeof(bio));
+	passert(b);
+	b->buff = malloc(buffersize);
+	passert(b->buff);
+	b->size = buffersize;
+	b->leng = 0;
+	b->pos = 0;
+	b->msecto = 0;
+	b->fileposition = 0;
+	b->direction = BIO_WRITE;
+	b->type = 2;
+	b->error = 0;
+	b->eof = 0;
+	b->fd = -1;
+	return b;
+}
+
+uint32_t bio_mem_release(bio *b,uint8_t **buff) {
+	uint32_t leng;
+	if (b->type!=2) {
+		*buff = NULL;
+		return 0;
+	}
+	*buff = b->buff;
+	leng = b->leng;
+	b->fileposition += leng;
+	b->buff = malloc(b->size);
+	passert(b->buff);
+	b->leng = 0;
+	b->pos = 0;
+	return leng;
+}
+
+static inline int64_t bio_mem_write(bio *b,const uint8_t *src,uint64_t len) {
+	uint64_t newsize;
+	if (b->error) {
+		return -1;
+	}
+	if ((uint64_t)(b->pos)+len > b->size) {
+		newsize = b->size;
+		while ((uint64_t)(b->pos)+len > newsize) {
+			newsize *= 2;
+		}
+		if (newsize>UINT32_C(0x80000000)) {
+			b->error = 1;
+			return -1;
+		}
+		b->buff = realloc(b->buff,newsize);
+		passert(b->buff);
+		b->size = newsize;
+	}
+	memcpy(b->buff+b->pos,src,len);
+	b->pos += len;
+	if (b->pos>b->leng) {
+		b->leng = b->pos;
+	}
+	return len;
+}
+
 static inline int32_t bio_internal_write(bio *b,const uint8_t *buff,uint32_t leng) {
 	int32_t ret;
 	if (b->type==0) {
@@ -143,6 +205,9 @@ static inline int bio_flush(bio *b) {
 	if (b->direction==BIO_READ || b->error) {
 		return -1;
 	}
+	if (b->type==2) {
+		return 0;
+	}
 	if (b->leng>0) {
 		bio_internal_write(b,b->buff,b->leng);
 		b->leng = 0;
@@ -166,6 +231,9 @@ static inline int bio_fill(bio *b) {
 }
 
 uint64_t bio_file_position(bio *b) {
+	if (b->type==2) {
+		return b->fileposition + b->pos;
+	}
 	if (b->type!=0) {
 		return 0;
 	}
@@ -255,6 +323,9 @@ int64_t bio_write(bio *b,const void *vsrc,uint64_t len) {
 	if (b->direction==BIO_READ || b->error) {
 		return -1;
 	}
+	if (b->type==2) {
+		return bio_mem_write(b,src,len);
+	}
 	if (len>=b->size) {
 		if (bio_flush(b)<0) {
 			return -1;
@@ -303,6 +374,20 @@ int64_t bio_write(bio *b,const void *vsrc,uint64_t len) {
 
 int8_t bio_seek(bio *b,int64_t offset,int whence) {
 	int64_t p;
+	if (b->type==2) { // only data not released yet can be reached
+		if (whence==SEEK_CUR) {
+			p = b->fileposition + b->pos + offset;
+		} else if (whence==SEEK_SET) {
+			p = offset;
+		} else {
+			p = b->fileposition + b->leng + offset;
+		}
+		if (p<(int64_t)(b->fileposition) || p>(int64_t)(b->fileposition + b->leng)) {
+			return -1;
+		}
+		b->pos = p - b->fileposition;
+		return 0;
+	}
 	if (b->type!=0) {
 		return -1;
 	}
@@ -347,7 +432,7 @@ void bio_skip(bio *b,uint64_t len) {
 			}
 			return;
 		} else {
-			bio_seek(b,len,SEEK_CUR);
+			bio_seek(b,len-(b->leng-b->pos),SEEK_CUR); // descriptor is already after buffered data
 		}
 	}
 }
@@ -370,7 +455,7 @@ void bio_close(bio *b) {
 	}
 	if (b->type==0) {
 		close(b->fd);
-	} else {
+	} else if (b->type==1) {
 		tcpclose(b->fd);
 	}
 	free(b->buff);
@@ -29,6 +29,8 @@ enum {BIO_READ,BIO_WRITE};
 
 bio* bio_file_open(const char *fname,uint8_t direction,uint32_t buffersize);
 bio* bio_socket_open(int socket,uint8_t direction,uint32_t buffersize,uint32_t msecto);
+bio* bio_mem_open(uint32_t buffersize);
+uint32_t bio_mem_release(bio *b,uint8_t **buff);
 uint64_t bio_file_position(bio *b);
 uint64_t bio_file_size(bio *b);
 int64_t bio_read(bio *b,void *dst,uint64_t len);
@@ -29,11 +29,19 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 
 #include "changelog.h"
 #include "metadata.h"
+#include "binlog.h"
+#include "datapack.h"
 #include "massert.h"
+#include "clocks.h"
+#include "slogger.h"
 
 #include "main.h"
 #include "matomlserv.h"
@@ -41,8 +49,59 @@
 
 #define MAXLOGLINESIZE 200000U
 #define MAXLOGNUMBER 1000U
+#define MAXBINRECSIZE 1024U
+#define MAXBINTEXTSIZE 4096U
+#define CHLOG_RING_SIZE (16U*1024U*1024U)
+#define CHLOG_RING_MASK (CHLOG_RING_SIZE-1)
+
+enum {CHLOG_SYNC_NONE,CHLOG_SYNC_BATCH,CHLOG_SYNC_INTERVAL};
+
 static uint32_t BackLogsNumber;
-static FILE *currentfd;
+static uint8_t BinaryChangelog;
+static uint8_t SyncMode;
+static uint32_t SyncInterval;
+static int currentfd;
+static uint8_t currentbinary;
+
+// records are written to a byte ring by the main thread (single producer) and saved by the writer thread (single consumer)
+// head is modified only by producer, tail only by consumer - lock is taken only when one side has to wake up the other one
+static uint8_t *ringbuff;
+static volatile uint64_t ringhead;
+static volatile uint64_t ringtail;
+static volatile uint8_t writerwaiting;
+static volatile uint8_t producerwaiting;
+static uint8_t writerexit;
+static uint8_t writerrunning;
+static int writerfd;
+static pthread_mutex_t wlock;
+static pthread_cond_t wcond;
+static pthread_cond_t pcond;
+static pthread_t writerthread;
+
+// binary record arguments: 'B' - 8bit, 'H' - 16bit, 'L' - 32bit, 'Q' - 64bit, 'N' - name (nleng:8 name:nlengB), ':' - results follow
+typedef struct _chlog_opdesc {
+	const char *name;
+	const char *args;
+} chlog_opdesc;
+
+static const chlog_opdesc chlog_ops[CHLOP_COUNT] = {
+	{NULL,NULL},
+	{"ACCESS","L"},
+	{"ATTR","LHLLLL"},
+	{"CREATE","LNBHHLLL:L"},
+	{"UNLINK","LN:L"},
+	{"MOVE","LNLN:L"},
+	{"LINK","LLN"},
+	{"LENGTH","LQB"},
+	{"WRITE","LLBB:Q"},
+	{"UNLOCK","Q"},
+	{"TRUNC","LL:Q"},
+	{"ACQUIRE","LL"},
+	{"RELEASE","LL"},
+	{"INCVERSION","Q"},
+	{"CHUNKADD","QLL"},
+	{"CHUNKDEL","QL"}
+};
 
 
 #define OLD_CHANGES_BLOCK_SIZE 5000
@@ -155,12 +214,196 @@ uint64_t changelog_get_minversion(void) {
 	return old_changes_head->minversion;
 }
 
+static void changelog_writeall(int fd,struct iovec *iov,int iovcnt) {
+	static uint8_t errlogged = 0;
+	ssize_t r;
+
+	while (iovcnt>0) {
+		r = writev(fd,iov,iovcnt);
+		if (r<0) {
+			if (errno==EINTR) {
+				continue;
+			}
+			if (errlogged==0) {
+				mfs_errlog(LOG_WARNING,"error writing changelog - some changes were lost");
+				errlogged = 1;
+			}
+			return;
+		}
+		while (iovcnt>0 && (size_t)r>=iov->iov_len) {
+			r -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt>0) {
+			iov->iov_base = ((uint8_t*)(iov->iov_base)) + r;
+			iov->iov_len -= r;
+		}
+	}
+	errlogged = 0;
+}
+
+static void* changelog_writer(void *arg) {
+	struct iovec iov[2];
+	struct timespec ts;
+	struct timeval tv;
+	uint64_t head,tail,now,lastsync,waitusec;
+	uint32_t pos,leng;
+	uint8_t dirty;
+	int fd;
+
+	dirty = 0;
+	lastsync = monotonic_useconds();
+	zassert(pthread_mutex_lock(&wlock));
+	while (1) {
+		writerwaiting = 1;
+		__sync_synchronize();
+		head = ringhead;
+		tail = ringtail;
+		if (head==tail) {
+			if (writerexit) {
+				break;
+			}
+			if (dirty && SyncMode==CHLOG_SYNC_INTERVAL) {
+				now = monotonic_useconds();
+				waitusec = (uint64_t)SyncInterval*1000;
+				if (now >= lastsync + waitusec) {
+					if (writerfd>=0) {
+						fsync(writerfd);
+					}
+					dirty = 0;
+					lastsync = now;
+				} else {
+					waitusec = lastsync + waitusec - now;
+					gettimeofday(&tv,NULL);
+					ts.tv_sec = tv.tv_sec + waitusec / 1000000;
+					ts.tv_nsec = (tv.tv_usec + (waitusec % 1000000)) * 1000;
+					while (ts.tv_nsec >= 1000000000) {
+						ts.tv_sec ++;
+						ts.tv_nsec -= 1000000000;
+					}
+					pthread_cond_timedwait(&wcond,&wlock,&ts);
+				}
+			} else {
+				dirty = 0;
+				zassert(pthread_cond_wait(&wcond,&wlock));
+			}
+			continue;
+		}
+		writerwaiting = 0;
+		fd = writerfd;
+		zassert(pthread_mutex_unlock(&wlock));
+
+		// one writev for everything collected since last batch
+		pos = tail & CHLOG_RING_MASK;
+		leng = head - tail;
+		iov[0].iov_base = ringbuff + pos;
+		if (pos + leng > CHLOG_RING_SIZE) {
+			iov[0].iov_len = CHLOG_RING_SIZE - pos;
+			iov[1].iov_base = ringbuff;
+			iov[1].iov_len = leng - iov[0].iov_len;
+		} else {
+			iov[0].iov_len = leng;
+		}
+		if (fd>=0) {
+			changelog_writeall(fd,iov,(pos + leng > CHLOG_RING_SIZE)?2:1);
+			if (SyncMode==CHLOG_SYNC_BATCH) {
+				fsync(fd);
+			} else if (SyncMode==CHLOG_SYNC_INTERVAL) {
+				now = monotonic_useconds();
+				if (now >= lastsync + (uint64_t)SyncInterval*1000) {
+					fsync(fd);
+					dirty = 0;
+					lastsync = now;
+				} else {
+					dirty = 1;
+				}
+			}
+		}
+
+		zassert(pthread_mutex_lock(&wlock));
+		__sync_synchronize();
+		ringtail = head;
+		if (producerwaiting) {
+			zassert(pthread_cond_signal(&pcond));
+		}
+	}
+	if (dirty && writerfd>=0) {
+		fsync(writerfd);
+	}
+	zassert(pthread_mutex_unlock(&wlock));
+	return arg;
+}
+
+static void changelog_put(const uint8_t *data,uint32_t leng) {
+	uint32_t pos,l;
+
+	if (writerrunning==0) {
+		struct iovec iov;
+		iov.iov_base = (void*)data;
+		iov.iov_len = leng;
+		changelog_writeall(currentfd,&iov,1);
+		return;
+	}
+	if (CHLOG_RING_SIZE - (ringhead - ringtail) < leng) {
+		zassert(pthread_mutex_lock(&wlock));
+		producerwaiting = 1;
+		while (CHLOG_RING_SIZE - (ringhead - ringtail) < leng) {
+			zassert(pthread_cond_wait(&pcond,&wlock));
+		}
+		producerwaiting = 0;
+		zassert(pthread_mutex_unlock(&wlock));
+	}
+	pos = ringhead & CHLOG_RING_MASK;
+	l = CHLOG_RING_SIZE - pos;
+	if (l>=leng) {
+		memcpy(ringbuff+pos,data,leng);
+	} else {
+		memcpy(ringbuff+pos,data,l);
+		memcpy(ringbuff,data+l,leng-l);
+	}
+	__sync_synchronize();
+	ringhead += leng;
+	__sync_synchronize();
+	if (writerwaiting) {
+		zassert(pthread_mutex_lock(&wlock));
+		zassert(pthread_cond_signal(&wcond));
+		zassert(pthread_mutex_unlock(&wlock));
+	}
+}
+
+static void changelog_setwriterfd(int fd) {
+	if (writerrunning) {
+		zassert(pthread_mutex_lock(&wlock));
+		writerfd = fd;
+		zassert(pthread_mutex_unlock(&wlock));
+	} else {
+		writerfd = fd;
+	}
+}
+
+void changelog_flush(void) {
+	if (writerrunning==0) {
+		return;
+	}
+	zassert(pthread_mutex_lock(&wlock));
+	while (ringtail!=ringhead) {
+		producerwaiting = 1;
+		zassert(pthread_cond_signal(&wcond));
+		zassert(pthread_cond_wait(&pcond,&wlock));
+	}
+	producerwaiting = 0;
+	zassert(pthread_mutex_unlock(&wlock));
+}
+
 void changelog_rotate() {
 	char logname1[100],logname2[100];
 	uint32_t i;
-	if (currentfd) {
-		fclose(currentfd);
-		currentfd=NULL;
+	if (currentfd>=0) {
+		changelog_flush();
+		changelog_setwriterfd(-1);
+		close(currentfd);
+		currentfd=-1;
 	}
 	if (BackLogsNumber>0) {
 		for (i=BackLogsNumber ; i>0 ; i--) {
@@ -174,18 +417,182 @@ void changelog_rotate() {
 	matomlserv_broadcast_logrotate();
 }
 
-void changelog_mr(uint64_t version,const char *data) {
-	if (currentfd==NULL) {
-		currentfd = fopen("changelog.0.mfs","a");
-		if (!currentfd) {
-			syslog(LOG_NOTICE,"lost MFS change %"PRIu64": %s",version,data);
+static inline int changelog_bprintf(char *buff,uint32_t buffsize,uint32_t *pos,const char *format,...) {
+	va_list ap;
+	int r;
+	va_start(ap,format);
+	r = vsnprintf(buff+*pos,buffsize-*pos,format,ap);
+	va_end(ap);
+	if (r<0 || (uint32_t)r>=buffsize-*pos) {
+		return -1;
+	}
+	*pos += r;
+	return 0;
+}
+
+int changelog_bin_check(const uint8_t *data,uint32_t leng) {
+	const char *spec;
+	uint32_t pos;
+	uint8_t opcode;
+
+	if (leng<5) {
+		return -1;
+	}
+	opcode = data[0];
+	if (opcode==0 || opcode>=CHLOP_COUNT) {
+		return -1;
+	}
+	pos = 5;
+	for (spec = chlog_ops[opcode].args ; *spec ; spec++) {
+		switch (*spec) {
+			case 'B':
+				pos += 1;
+				break;
+			case 'H':
+				pos += 2;
+				break;
+			case 'L':
+				pos += 4;
+				break;
+			case 'Q':
+				pos += 8;
+				break;
+			case 'N':
+				if (pos>=leng) {
+					return -1;
+				}
+				pos += 1 + data[pos];
+				break;
+		}
+		if (pos>leng) {
+			return -1;
 		}
 	}
+	return (pos==leng)?0:-1;
+}
+
+uint32_t changelog_bin_to_text(const uint8_t *data,uint32_t leng,char *buff,uint32_t buffsize) {
+	const char *spec;
+	const uint8_t *rptr;
+	uint32_t pos;
+	uint8_t opcode,nleng,first,results;
+	uint32_t ts;
 
-	if (currentfd) {
-		fprintf(currentfd,"%"PRIu64": %s\n",version,data);
-		fflush(currentfd);
+	if (changelog_bin_check(data,leng)<0 || buffsize==0) {
+		return 0;
+	}
+	rptr = data;
+	opcode = get8bit(&rptr);
+	ts = get32bit(&rptr);
+	pos = 0;
+	if (changelog_bprintf(buff,buffsize,&pos,"%"PRIu32"|%s(",ts,chlog_ops[opcode].name)<0) {
+		return 0;
+	}
+	first = 1;
+	results = 0;
+	for (spec = chlog_ops[opcode].args ; *spec ; spec++) {
+		if (*spec==':') {
+			if (changelog_bprintf(buff,buffsize,&pos,"):")<0) {
+				return 0;
+			}
+			first = 1;
+			results = 1;
+			continue;
+		}
+		if (first==0 && changelog_bprintf(buff,buffsize,&pos,",")<0) {
+			return 0;
+		}
+		first = 0;
+		switch (*spec) {
+			case 'B':
+				if (changelog_bprintf(buff,buffsize,&pos,"%"PRIu8,get8bit(&rptr))<0) {
+					return 0;
+				}
+				break;
+			case 'H':
+				if (changelog_bprintf(buff,buffsize,&pos,"%"PRIu16,get16bit(&rptr))<0) {
+					return 0;
+				}
+				break;
+			case 'L':
+				if (changelog_bprintf(buff,buffsize,&pos,"%"PRIu32,get32bit(&rptr))<0) {
+					return 0;
+				}
+				break;
+			case 'Q':
+				if (changelog_bprintf(buff,buffsize,&pos,"%"PRIu64,get64bit(&rptr))<0) {
+					return 0;
+				}
+				break;
+			case 'N':
+				nleng = get8bit(&rptr);
+				if (changelog_bprintf(buff,buffsize,&pos,"%s",changelog_escape_name(nleng,rptr))<0) {
+					return 0;
+				}
+				rptr += nleng;
+				break;
+		}
+	}
+	if (results==0 && changelog_bprintf(buff,buffsize,&pos,")")<0) {
+		return 0;
 	}
+	return pos+1;
+}
+
+static void changelog_write(uint64_t version,const uint8_t *data,uint32_t leng) {
+	static char textbuff[MAXBINTEXTSIZE];
+	static uint8_t writebuff[MAXLOGLINESIZE+BINLOG_RECORD_OVERHEAD+32];
+	const char *text;
+	struct stat st;
+	uint8_t hdr[BINLOG_HEADER_SIZE];
+	uint32_t wleng;
+	int r;
+
+	if (CHLOP_ISBINARY(data)) {
+		if (changelog_bin_to_text(data,leng,textbuff,MAXBINTEXTSIZE)==0) {
+			strcpy(textbuff,"(damaged binary record)");
+		}
+		text = textbuff;
+	} else {
+		text = (const char*)data;
+	}
+	if (currentfd<0) {
+		currentfd = open("changelog.0.mfs",O_WRONLY | O_CREAT | O_APPEND,0666);
+		if (currentfd<0) {
+			syslog(LOG_NOTICE,"lost MFS change %"PRIu64": %s",version,text);
+			return;
+		}
+		changelog_setwriterfd(currentfd);
+		// format of existing file is never changed - new setting is used after rotation
+		if (fstat(currentfd,&st)<0 || st.st_size==0) {
+			currentbinary = BinaryChangelog;
+			if (currentbinary) {
+				memcpy(hdr,BINLOG_HEADER,BINLOG_HEADER_SIZE);
+				changelog_put(hdr,BINLOG_HEADER_SIZE);
+			}
+		} else {
+			currentbinary = binlog_isbinary(currentfd);
+		}
+	}
+
+	if (currentbinary) {
+		if (leng+BINLOG_RECORD_OVERHEAD > sizeof(writebuff)) {
+			syslog(LOG_NOTICE,"lost MFS change %"PRIu64": %s (record too long)",version,text);
+			return;
+		}
+		wleng = binlog_packrecord(writebuff,version,data,leng);
+	} else {
+		r = snprintf((char*)writebuff,sizeof(writebuff),"%"PRIu64": %s\n",version,text);
+		if (r<0) {
+			return;
+		}
+		wleng = r;
+		if (wleng>=sizeof(writebuff)) {
+			wleng = sizeof(writebuff)-1;
+			writebuff[wleng-1] = '\n';
+		}
+	}
+	changelog_put(writebuff,wleng);
 }
 
 void changelog(const char *format,...) {
@@ -205,21 +612,64 @@ void changelog(const char *format,...) {
 		leng++;
 	}
 
-	changelog_mr(version,printbuff);
-//	if (currentfd==NULL) {
-//		currentfd = fopen("changelog.0.mfs","a");
-//		if (!currentfd) {
-//			syslog(LOG_NOTICE,"lost MFS change %"PRIu64": %s",version,printbuff);
-//		}
-//	}
-//
-//	if (currentfd) {
-//		fprintf(currentfd,"%"PRIu64": %s\n",version,printbuff);
-//		fflush(currentfd);
-//	}
+	changelog_write(version,(uint8_t*)printbuff,leng);
 	changelog_store_logstring(version,(uint8_t*)printbuff,leng);
 }
 
+void changelog_op(uint8_t opcode,uint32_t ts,...) {
+	static uint8_t binbuff[MAXBINRECSIZE];
+	static char printbuff[MAXBINTEXTSIZE];
+	const char *spec;
+	const uint8_t *name;
+	uint8_t *wptr;
+	uint32_t nleng,leng;
+	uint64_t version;
+	va_list ap;
+
+	massert(opcode>0 && opcode<CHLOP_COUNT,"wrong changelog opcode");
+	wptr = binbuff;
+	put8bit(&wptr,opcode);
+	put32bit(&wptr,ts);
+	va_start(ap,ts);
+	for (spec = chlog_ops[opcode].args ; *spec ; spec++) {
+		switch (*spec) {
+			case 'B':
+				put8bit(&wptr,va_arg(ap,unsigned int));
+				break;
+			case 'H':
+				put16bit(&wptr,va_arg(ap,unsigned int));
+				break;
+			case 'L':
+				put32bit(&wptr,va_arg(ap,uint32_t));
+				break;
+			case 'Q':
+				put64bit(&wptr,va_arg(ap,uint64_t));
+				break;
+			case 'N':
+				nleng = va_arg(ap,uint32_t);
+				name = va_arg(ap,const uint8_t*);
+				massert(nleng<256,"name too long for binary changelog record");
+				put8bit(&wptr,nleng);
+				memcpy(wptr,name,nleng);
+				wptr += nleng;
+				break;
+		}
+	}
+	va_end(ap);
+	leng = wptr - binbuff;
+
+	version = meta_version_inc();
+
+	if (BinaryChangelog) {
+		changelog_write(version,binbuff,leng);
+		changelog_store_logstring(version,binbuff,leng);
+	} else {
+		leng = changelog_bin_to_text(binbuff,leng,printbuff,MAXBINTEXTSIZE);
+		changelog_write(version,(uint8_t*)printbuff,leng);
+		changelog_store_logstring(version,(uint8_t*)printbuff,leng);
+	}
+}
+
 char* changelog_escape_name(uint32_t nleng,const uint8_t *name) {
 	static char *escname[2]={NULL,NULL};
 	static uint32_t escnamesize[2]={0,0};
@@ -263,6 +713,16 @@ void changelog_reload(void) {
 		syslog(LOG_WARNING,"BACK_LOGS value too big !!!");
 		BackLogsNumber = MAXLOGLINESIZE;
 	}
+	BinaryChangelog = cfg_getuint8("CHANGELOG_BINARY",0)?1:0;
+	SyncMode = cfg_getuint8("CHANGELOG_SYNC_MODE",0);
+	if (SyncMode>CHLOG_SYNC_INTERVAL) {
+		syslog(LOG_WARNING,"CHANGELOG_SYNC_MODE: unknown mode (%"PRIu8") - using 0 (no sync)",SyncMode);
+		SyncMode = CHLOG_SYNC_NONE;
+	}
+	SyncInterval = cfg_getuint32("CHANGELOG_SYNC_INTERVAL",1000);
+	if (SyncInterval==0) {
+		SyncInterval = 1;
+	}
 	ChangelogSecondsToRemember = cfg_getuint16("CHANGELOG_PRESERVE_SECONDS",600);
 	if (ChangelogSecondsToRemember>3600) {
 		syslog(LOG_WARNING,"Number of seconds of change logs to be preserved in master is too big (%"PRIu16") - decreasing to 3600 seconds",ChangelogSecondsToRemember);
@@ -270,19 +730,63 @@ void changelog_reload(void) {
 	}
 }
 
+void changelog_term(void) {
+	if (writerrunning) {
+		changelog_flush();
+		zassert(pthread_mutex_lock(&wlock));
+		writerexit = 1;
+		zassert(pthread_cond_signal(&wcond));
+		zassert(pthread_mutex_unlock(&wlock));
+		zassert(pthread_join(writerthread,NULL));
+		writerrunning = 0;
+		zassert(pthread_cond_destroy(&pcond));
+		zassert(pthread_cond_destroy(&wcond));
+		zassert(pthread_mutex_destroy(&wlock));
+		free(ringbuff);
+		ringbuff = NULL;
+	}
+}
+
 int changelog_init(void) {
 	BackLogsNumber = cfg_getuint32("BACK_LOGS",50);
 	if (BackLogsNumber>MAXLOGNUMBER) {
 		fprintf(stderr,"BACK_LOGS value too big !!!");
 		return -1;
 	}
+	BinaryChangelog = cfg_getuint8("CHANGELOG_BINARY",0)?1:0;
+	SyncMode = cfg_getuint8("CHANGELOG_SYNC_MODE",0);
+	if (SyncMode>CHLOG_SYNC_INTERVAL) {
+		fprintf(stderr,"CHANGELOG_SYNC_MODE: unknown mode (%"PRIu8")\n",SyncMode);
+		return -1;
+	}
+	SyncInterval = cfg_getuint32("CHANGELOG_SYNC_INTERVAL",1000);
+	if (SyncInterval==0) {
+		SyncInterval = 1;
+	}
 	ChangelogSecondsToRemember = cfg_getuint16("CHANGELOG_PRESERVE_SECONDS",600);
 	if (ChangelogSecondsToRemember>3600) {
 		syslog(LOG_WARNING,"Number of seconds of change logs to be preserved in master is too big (%"PRIu16") - decreasing to 3600 seconds",ChangelogSecondsToRemember);
 		ChangelogSecondsToRemember=3600;
 	}
+	currentfd = -1;
+	writerfd = -1;
+	ringbuff = malloc(CHLOG_RING_SIZE);
+	passert(ringbuff);
+	ringhead = 0;
+	ringtail = 0;
+	writerwaiting = 0;
+	producerwaiting = 0;
+	writerexit = 0;
+	zassert(pthread_mutex_init(&wlock,NULL));
+	zassert(pthread_cond_init(&wcond,NULL));
+	zassert(pthread_cond_init(&pcond,NULL));
+	if (main_minthread_create(&writerthread,0,changelog_writer,NULL)<0) {
+		fprintf(stderr,"can't create changelog writer thread\n");
+		return -1;
+	}
+	writerrunning = 1;
 	main_reload_register(changelog_reload);
-	currentfd = NULL;
+	main_destruct_register(changelog_term);
 	return 0;
 }
 
@@ -296,6 +800,11 @@ uint64_t changelog_findfirstversion(const char *fname) {
 	if (fd<0) {
 		return 0;
 	}
+	if (binlog_isbinary(fd)) {
+		fv = binlog_findfirstversion(fd);
+		close(fd);
+		return fv;
+	}
 	s = read(fd,buff,50);
 	close(fd);
 	if (s<=0) {
@@ -326,6 +835,11 @@ uint64_t changelog_findlastversion(const char *fname) {
 	if (fd<0) {
 		return 0;
 	}
+	if (binlog_isbinary(fd)) {
+		lv = binlog_findlastversion(fd,&size);
+		close(fd);
+		return lv;
+	}
 	fstat(fd,&st);
 	size = st.st_size;
 	memset(buff,0,32);
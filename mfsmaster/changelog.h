@@ -26,8 +26,34 @@
 uint32_t changelog_get_old_changes(uint64_t version,void (*sendfn)(void *,uint64_t,uint8_t *,uint32_t),void *userdata,uint32_t limit);
 uint64_t changelog_get_minversion(void);
 
+// binary change records (opcode:8 ts:32 args) - opcode is always below '0' (text records start with timestamp)
+enum {
+	CHLOP_ACCESS=1,
+	CHLOP_ATTR,
+	CHLOP_CREATE,
+	CHLOP_UNLINK,
+	CHLOP_MOVE,
+	CHLOP_LINK,
+	CHLOP_LENGTH,
+	CHLOP_WRITE,
+	CHLOP_UNLOCK,
+	CHLOP_TRUNC,
+	CHLOP_ACQUIRE,
+	CHLOP_RELEASE,
+	CHLOP_INCVERSION,
+	CHLOP_CHUNKADD,
+	CHLOP_CHUNKDEL,
+	CHLOP_COUNT
+};
+
+#define CHLOP_ISBINARY(data) ((data)[0]<'0')
+
 void changelog_rotate(void);
-void changelog_mr(uint64_t version,const char *data);
+void changelog_flush(void);
+
+void changelog_op(uint8_t opcode,uint32_t ts,...);
+int changelog_bin_check(const uint8_t *data,uint32_t leng);
+uint32_t changelog_bin_to_text(const uint8_t *data,uint32_t leng,char *buff,uint32_t buffsize);
 
 #ifdef __printflike
 void changelog(const char *format,...) __printflike(1, 2);
@@ -19,8 +19,6 @@
  */
 
 #define BUCKETS_MMAP_ALLOC 1
-#define HASHTAB_PREALLOC 1
-#define CHUNKHASH_MOVEFACTOR 5
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -35,6 +33,9 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "MFSCommunication.h"
 
@@ -66,11 +67,19 @@
 #define NEWCHUNKDELAY 150
 #define LOSTCHUNKDELAY 50
 
-#define HASHTAB_LOBITS 24
-#define HASHTAB_HISIZE (0x80000000>>(HASHTAB_LOBITS))
-#define HASHTAB_LOSIZE (1<<HASHTAB_LOBITS)
-#define HASHTAB_MASK (HASHTAB_LOSIZE-1)
-#define HASHTAB_MOVEFACTOR 5
+// chunk index - open addressing, slots are probed in groups (control byte of used slot has 7 bits of hash)
+#define CHUNKHASH_GROUP 16
+#define CHUNKHASH_EMPTY 0x00
+#define CHUNKHASH_DELETED 0x01
+#define CHUNKHASH_USED 0x80
+#define CHUNKHASH_TAG(hash) (CHUNKHASH_USED|((hash)>>25))
+#define CHUNKHASH_INITSIZE 0x10000
+// table is rehashed incrementally - number of old table groups moved on every insert and in every jobs loop tick
+#define CHUNKHASH_MOVEFACTOR 4
+#define CHUNKHASH_LOOPMOVEFACTOR 1024
+
+/* distance (in chunks) of hash table prefetches while merging chunk lists from chunkservers */
+#define CHUNK_PREFETCH_DIST 16
 
 // #define DISCLOOPRATIO 0x400
 
@@ -164,7 +173,6 @@ typedef struct chunk {
 	uint32_t fcount;
 	slist *slisthead;
 	uint32_t *ftab;
-	struct chunk *next;
 } chunk;
 
 /*
@@ -178,14 +186,35 @@ typedef struct _chunk_bucket {
 static chunk_bucket *cbhead = NULL;
 static chunk *chfreehead = NULL;
 */
-static chunk **chunkhashtab[HASHTAB_HISIZE];
-static uint32_t chunkrehashpos;
-static uint32_t chunkhashsize;
-static uint32_t chunkhashelem;
+typedef struct _chunkhashgroup {
+	uint8_t ctrl[CHUNKHASH_GROUP];
+	chunk *slot[CHUNKHASH_GROUP];
+} chunkhashgroup;
+
+static chunkhashgroup *chunkhashtab;
+static uint32_t chunkhashsize;		// number of slots
+static uint32_t chunkhashelem;		// used slots (in both tables)
+static uint32_t chunkhashdeleted;	// deleted slots (they are reused, but they don't end probing)
+static chunkhashgroup *chunkhashold;	// previous table - during rehash its chunks are moved to current table
+static uint32_t chunkhasholdsize;	// number of slots in previous table (0 - rehash is not in progress)
+static uint32_t chunkhasholdelem;	// chunks not moved yet
+static uint32_t chunkrehashpos;		// next group of previous table to move
+
+// incremental metadata store (see chunk_bgstore_*)
+static uint8_t chunkbgphase = 0;	// 0 - not active ; 1 - only modified chunks are stored (as pre-images) ; 2 - storing chunk section
+static uint64_t chunkbgnextid;
+static uint32_t chunkbgnow;
+static uint32_t chunkbgpos;
+static uint8_t *chunkbgmap;
+static bio *chunkbgfd;
+
+static void chunk_bgstore_rest(void);
 
 static uint64_t nextchunkid=1;
 #define LOCKTIMEOUT 120
 
+#define REPLICATION_MAX_SOURCES 8
+
 #define UNUSED_DELETE_TIMEOUT (86400*7)
 
 typedef struct _csopchunk {
@@ -251,6 +280,7 @@ static uint32_t DangerMaxLeng=1000000;
 
 static double MaxWriteRepl[4];
 static double MaxReadRepl[4];
+static uint8_t ReplicationSources;
 static uint32_t MaxDelSoftLimit;
 static uint32_t MaxDelHardLimit;
 static double TmpMaxDelFrac;
@@ -407,187 +437,401 @@ CREATE_BUCKET_ALLOCATOR(slist,slist,5000)
 CREATE_BUCKET_ALLOCATOR(chunk,chunk,20000)
 
 void chunk_get_memusage(uint64_t allocated[3],uint64_t used[3]) {
-	allocated[0] = sizeof(chunk*)*chunkrehashpos;
-	used[0] = sizeof(chunk*)*chunkhashelem;
+	allocated[0] = sizeof(chunkhashgroup)*((chunkhasholdsize+chunkhashsize)/CHUNKHASH_GROUP);
+	used[0] = (sizeof(chunkhashgroup)/CHUNKHASH_GROUP)*chunkhashelem;
 	chunk_getusage(allocated+1,used+1);
 	slist_getusage(allocated+2,used+2);
 }
 
-/*
-static inline uint32_t chunk_calc_hash_size(uint32_t elements) {
-	uint32_t res=1;
-	while (elements) {
-		elements>>=1;
-		res<<=1;
-	}
-	if (res==0) {
-		res = UINT32_C(0x80000000);
-	}
-	if (res<HASHTAB_LOSIZE) {
-		return HASHTAB_LOSIZE;
-	}
-	return res;
+static inline chunkhashgroup* chunk_hash_alloc(uint32_t size) {
+	chunkhashgroup *tab;
+	// all zeros means all slots are empty, so fresh table doesn't have to be initialized (pages are mapped on first use)
+#ifdef HAVE_MMAP
+	tab = mmap(NULL,sizeof(chunkhashgroup)*(size/CHUNKHASH_GROUP),PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
+#else
+	tab = calloc(size/CHUNKHASH_GROUP,sizeof(chunkhashgroup));
+#endif
+	passert(tab);
+	return tab;
+}
+
+static inline void chunk_hash_free(chunkhashgroup *tab,uint32_t size) {
+#ifdef HAVE_MMAP
+	munmap(tab,sizeof(chunkhashgroup)*(size/CHUNKHASH_GROUP));
+#else
+	(void)size;
+	free(tab);
+#endif
 }
-*/
 
 static inline void chunk_hash_init(void) {
-	uint16_t i;
 	chunkhashsize = 0;
 	chunkhashelem = 0;
+	chunkhashdeleted = 0;
+	chunkhashtab = NULL;
+	chunkhasholdsize = 0;
+	chunkhasholdelem = 0;
 	chunkrehashpos = 0;
-	for (i=0 ; i<HASHTAB_HISIZE ; i++) {
-		chunkhashtab[i] = NULL;
-	}
+	chunkhashold = NULL;
 }
 
 static inline void chunk_hash_cleanup(void) {
-	uint16_t i;
-	chunkhashelem = 0;
-	chunkhashsize = 0;
-	chunkrehashpos = 0;
-	for (i=0 ; i<HASHTAB_HISIZE ; i++) {
-		if (chunkhashtab[i]!=NULL) {
-#ifdef HAVE_MMAP
-			munmap(chunkhashtab[i],sizeof(chunk*)*HASHTAB_LOSIZE);
+	if (chunkhashsize>0) {
+		chunk_hash_free(chunkhashtab,chunkhashsize);
+	}
+	if (chunkhasholdsize>0) {
+		chunk_hash_free(chunkhashold,chunkhasholdsize);
+	}
+	chunk_hash_init();
+}
+
+// number of positions - during rehash positions of old table go first
+static inline uint32_t chunk_hash_positions(void) {
+	return chunkhasholdsize+chunkhashsize;
+}
+
+static inline chunk* chunk_hash_get(uint32_t pos) {
+	if (pos<chunkhasholdsize) {
+		return chunkhashold[pos/CHUNKHASH_GROUP].slot[pos%CHUNKHASH_GROUP];
+	}
+	pos -= chunkhasholdsize;
+	return chunkhashtab[pos/CHUNKHASH_GROUP].slot[pos%CHUNKHASH_GROUP];
+}
+
+// returns bitmask of slots in group with given control byte
+static inline uint32_t chunk_hash_match(const chunkhashgroup *g,uint8_t cb) {
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(g->ctrl)),_mm_set1_epi8(cb)));
 #else
-			free(chunkhashtab[i]);
+	uint32_t i,m;
+	m = 0;
+	for (i=0 ; i<CHUNKHASH_GROUP ; i++) {
+		if (g->ctrl[i]==cb) {
+			m |= (1<<i);
+		}
+	}
+	return m;
 #endif
+}
+
+// returns bitmask of free (empty or deleted) slots in group
+static inline uint32_t chunk_hash_match_free(const chunkhashgroup *g) {
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(g->ctrl))) ^ ((1<<CHUNKHASH_GROUP)-1);
+#else
+	uint32_t i,m;
+	m = 0;
+	for (i=0 ; i<CHUNKHASH_GROUP ; i++) {
+		if ((g->ctrl[i]&CHUNKHASH_USED)==0) {
+			m |= (1<<i);
 		}
-		chunkhashtab[i] = NULL;
 	}
+	return m;
+#endif
 }
 
-static inline void chunk_hash_rehash(void) {
-	uint16_t i;
-	chunkrehashpos = chunkhashsize;
-	chunkhashsize *= 2;
-	for (i=(chunkhashsize>>HASHTAB_LOBITS)/2 ; i<chunkhashsize>>HASHTAB_LOBITS ; i++) {
-#ifdef HAVE_MMAP
-		chunkhashtab[i] = mmap(NULL,sizeof(chunk*)*HASHTAB_LOSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
+static inline uint32_t chunk_hash_firstbit(uint32_t m) {
+#ifdef __GNUC__
+	return __builtin_ctz(m);
 #else
-		chunkhashtab[i] = malloc(sizeof(chunk*)*HASHTAB_LOSIZE);
+	uint32_t i;
+	for (i=0 ; (m&1)==0 ; i++) {
+		m>>=1;
+	}
+	return i;
 #endif
-		passert(chunkhashtab[i]);
+}
+
+// puts chunk into first free slot of its probe sequence in current table (chunk can't be in table)
+static inline void chunk_hash_insert(chunk *c) {
+	uint32_t hash,g,step,m,s,groups;
+
+	groups = chunkhashsize/CHUNKHASH_GROUP;
+	hash = hash32(c->chunkid);
+	g = hash & (groups-1);
+	step = 0;
+	while ((m = chunk_hash_match_free(chunkhashtab+g))==0) {
+		step++;
+		g = (g+step) & (groups-1);
 	}
+	s = chunk_hash_firstbit(m);
+	if (chunkhashtab[g].ctrl[s]==CHUNKHASH_DELETED) {
+		chunkhashdeleted--;
+	}
+	chunkhashtab[g].ctrl[s] = CHUNKHASH_TAG(hash);
+	chunkhashtab[g].slot[s] = c;
 }
 
-static inline void chunk_hash_move(void) {
-	uint32_t hash;
-	uint32_t mask;
-	uint32_t moved=0;
-	chunk **chptr,**chptralt,*c;
-	mask = chunkhashsize-1;
-	do {
-		if (chunkrehashpos>=chunkhashsize) { // rehash complete
-			chunkrehashpos = chunkhashsize;
-			return;
-		}
-		chptr = chunkhashtab[(chunkrehashpos - (chunkhashsize/2)) >> HASHTAB_LOBITS] + (chunkrehashpos & HASHTAB_MASK);
-		chptralt = chunkhashtab[chunkrehashpos >> HASHTAB_LOBITS] + (chunkrehashpos & HASHTAB_MASK);
-		*chptralt = NULL;
-		while ((c=*chptr)!=NULL) {
-			hash = hash32(c->chunkid) & mask;
-			if (hash==chunkrehashpos) {
-				*chptralt = c;
-				*chptr = c->next;
-				chptralt = &(c->next);
-				c->next = NULL;
-			} else {
-				chptr = &(c->next);
+// rehash is finished - old table is released and its positions disappear
+static inline void chunk_hash_rehash_end(void) {
+	uint32_t oldsize;
+
+	oldsize = chunkhasholdsize;
+	chunk_hash_free(chunkhashold,chunkhasholdsize);
+	chunkhashold = NULL;
+	chunkhasholdsize = 0;
+	chunkhasholdelem = 0;
+	chunkrehashpos = 0;
+	// loops over table continue from the same chunk (chunks from old table have been moved, so they start again)
+	discserverspos = (discserverspos>=oldsize)?discserverspos-oldsize:0;
+	jobshpos = (jobshpos>=oldsize)?jobshpos-oldsize:0;
+	if (chunkbgphase==2) {
+		chunkbgpos = (chunkbgpos>=oldsize)?chunkbgpos-oldsize:0;
+	}
+}
+
+// moves chunks from next 'groups' groups of old table to current table
+static inline void chunk_hash_move(uint32_t groups) {
+	chunkhashgroup *g;
+	uint32_t s;
+
+	while (groups>0 && chunkrehashpos<chunkhasholdsize/CHUNKHASH_GROUP) {
+		g = chunkhashold + chunkrehashpos;
+		for (s=0 ; s<CHUNKHASH_GROUP ; s++) {
+			if (g->slot[s]!=NULL) {
+				chunk_hash_insert(g->slot[s]);
+				g->slot[s] = NULL;
+				// deleted (not empty) - chunks placed further in old table have to be still reachable
+				g->ctrl[s] = CHUNKHASH_DELETED;
+				chunkhasholdelem--;
 			}
-			moved++;
 		}
 		chunkrehashpos++;
-	} while (moved<CHUNKHASH_MOVEFACTOR);
+		groups--;
+	}
+	if (chunkrehashpos>=chunkhasholdsize/CHUNKHASH_GROUP) {
+		chunk_hash_rehash_end();
+	}
+}
+
+// called on every insert and from jobs loop - positions can't change while chunk section is being stored
+static inline void chunk_hash_rehash_step(uint32_t groups) {
+	if (chunkhasholdsize>0 && chunkbgphase!=2) {
+		chunk_hash_move(groups);
+	}
+}
+
+// starts moving all chunks to new table (in small steps)
+static inline void chunk_hash_rehash(uint32_t newsize) {
+	if (chunkhasholdsize>0) { // previous rehash still in progress (very unlikely) - finish it now
+		if (chunkbgphase==2) { // positions will change - store all chunks that haven't been stored yet
+			chunk_bgstore_rest();
+		}
+		chunk_hash_move(UINT32_MAX);
+		if (chunkbgphase==2) {
+			chunkbgpos = chunk_hash_positions();
+		}
+	}
+	// current table becomes old one - it keeps its positions, so loops over table don't have to start again
+	chunkhashold = chunkhashtab;
+	chunkhasholdsize = chunkhashsize;
+	chunkhasholdelem = chunkhashelem;
+	chunkrehashpos = 0;
+	chunkhashtab = chunk_hash_alloc(newsize);
+	chunkhashsize = newsize;
+	chunkhashdeleted = 0;
+}
+
+// returns position of chunk in given table or UINT32_MAX when chunk is not there
+static inline uint32_t chunk_hash_tabpos(const chunkhashgroup *tab,uint32_t groups,const chunk *c) {
+	uint32_t hash,g,step,m,s;
+
+	hash = hash32(c->chunkid);
+	g = hash & (groups-1);
+	step = 0;
+	for (;;) {
+		m = chunk_hash_match(tab+g,CHUNKHASH_TAG(hash));
+		while (m) {
+			s = chunk_hash_firstbit(m);
+			if (tab[g].slot[s]==c) {
+				return g*CHUNKHASH_GROUP+s;
+			}
+			m &= m-1;
+		}
+		if (chunk_hash_match(tab+g,CHUNKHASH_EMPTY)) {
+			return UINT32_MAX;
+		}
+		step++;
+		if (step>=groups) {
+			return UINT32_MAX;
+		}
+		g = (g+step) & (groups-1);
+	}
+}
+
+// returns position of chunk (chunk has to be in one of tables)
+static inline uint32_t chunk_hash_pos(const chunk *c) {
+	uint32_t pos;
+
+	pos = chunk_hash_tabpos(chunkhashtab,chunkhashsize/CHUNKHASH_GROUP,c);
+	if (pos!=UINT32_MAX) {
+		return pos+chunkhasholdsize;
+	}
+	pos = chunk_hash_tabpos(chunkhashold,chunkhasholdsize/CHUNKHASH_GROUP,c);
+	sassert(pos!=UINT32_MAX);
+	return pos;
+}
+
+static inline chunk* chunk_hash_tabfind(const chunkhashgroup *tab,uint32_t groups,uint64_t chunkid) {
+	uint32_t hash,g,step,m;
+	chunk *c;
+
+	hash = hash32(chunkid);
+	g = hash & (groups-1);
+	step = 0;
+	for (;;) {
+		m = chunk_hash_match(tab+g,CHUNKHASH_TAG(hash));
+		while (m) {
+			c = tab[g].slot[chunk_hash_firstbit(m)];
+			if (c->chunkid==chunkid) {
+				return c;
+			}
+			m &= m-1;
+		}
+		if (chunk_hash_match(tab+g,CHUNKHASH_EMPTY)) {
+			return NULL;
+		}
+		step++;
+		if (step>=groups) {
+			return NULL;
+		}
+		g = (g+step) & (groups-1);
+	}
 }
 
 static inline chunk* chunk_hash_find(uint64_t chunkid) {
 	chunk *c;
-	uint32_t hash;
 
 	if (chunkhashsize==0) {
 		return NULL;
 	}
-	hash = hash32(chunkid) & (chunkhashsize-1);
-	if (chunkrehashpos<chunkhashsize) {
-		chunk_hash_move();
-		if (hash >= chunkrehashpos) {
-			hash -= chunkhashsize/2;
-		}
+	c = chunk_hash_tabfind(chunkhashtab,chunkhashsize/CHUNKHASH_GROUP,chunkid);
+	if (c==NULL && chunkhasholdelem>0) {
+		c = chunk_hash_tabfind(chunkhashold,chunkhasholdsize/CHUNKHASH_GROUP,chunkid);
+	}
+	return c;
+}
+
+static inline void chunk_hash_prefetch(uint64_t chunkid) {
+#ifdef __GNUC__
+	uint32_t g;
+	if (chunkhashsize>0) {
+		g = hash32(chunkid) & (chunkhashsize/CHUNKHASH_GROUP-1);
+		__builtin_prefetch(chunkhashtab[g].ctrl);
+		__builtin_prefetch(chunkhashtab[g].slot);
+		__builtin_prefetch(chunkhashtab[g].slot+(CHUNKHASH_GROUP/2));
 	}
-	for (c=chunkhashtab[hash>>HASHTAB_LOBITS][hash&HASHTAB_MASK] ; c ; c=c->next) {
-		if (c->chunkid==chunkid) {
-			return c;
+#else
+	(void)chunkid;
+#endif
+}
+
+// prefetches records pointed by slots with matching control byte in home group (group should be prefetched earlier) - records are not accessed here
+static inline void chunk_hash_prefetch_record(uint64_t chunkid) {
+#ifdef __GNUC__
+	uint32_t hash,g,m;
+	if (chunkhashsize>0) {
+		hash = hash32(chunkid);
+		g = hash & (chunkhashsize/CHUNKHASH_GROUP-1);
+		m = chunk_hash_match(chunkhashtab+g,CHUNKHASH_TAG(hash));
+		while (m) {
+			__builtin_prefetch(chunkhashtab[g].slot[chunk_hash_firstbit(m)]);
+			m &= m-1;
 		}
 	}
-	return NULL;
+#else
+	(void)chunkid;
+#endif
 }
 
 static inline void chunk_hash_delete(chunk *c) {
-	chunk **chptr,*cit;
-	uint32_t hash;
+	uint32_t pos;
+	uint8_t inold;
+	chunkhashgroup *g;
 
 	if (chunkhashsize==0) {
 		return;
 	}
-	hash = hash32(c->chunkid) & (chunkhashsize-1);
-	if (chunkrehashpos<chunkhashsize) {
-		chunk_hash_move();
-		if (hash >= chunkrehashpos) {
-			hash -= chunkhashsize/2;
-		}
+	pos = chunk_hash_pos(c);
+	inold = (pos<chunkhasholdsize)?1:0;
+	if (inold) {
+		g = chunkhashold + pos/CHUNKHASH_GROUP;
+		chunkhasholdelem--;
+	} else {
+		pos -= chunkhasholdsize;
+		g = chunkhashtab + pos/CHUNKHASH_GROUP;
 	}
-	chptr = chunkhashtab[hash>>HASHTAB_LOBITS] + (hash&HASHTAB_MASK);
-	while ((cit=*chptr)!=NULL) {
-		if (cit==c) {
-			*chptr = c->next;
-			chunkhashelem--;
-			return;
+	g->slot[pos%CHUNKHASH_GROUP] = NULL;
+	// no probe sequence went through group with empty slot, so slot can be marked as empty
+	if (chunk_hash_match(g,CHUNKHASH_EMPTY)) {
+		g->ctrl[pos%CHUNKHASH_GROUP] = CHUNKHASH_EMPTY;
+	} else {
+		g->ctrl[pos%CHUNKHASH_GROUP] = CHUNKHASH_DELETED;
+		if (inold==0) {
+			chunkhashdeleted++;
 		}
-		chptr = &(cit->next);
 	}
+	chunkhashelem--;
 }
 
 static inline void chunk_hash_add(chunk *c) {
-	uint16_t i;
-	uint32_t hash;
-
 	if (chunkhashsize==0) {
-		chunkhashsize = HASHTAB_LOSIZE; //chunk_calc_hash_size(maxnodeid);
-		chunkrehashpos = chunkhashsize;
-		chunkhashelem = 0;
-		for (i=0 ; i<chunkhashsize>>HASHTAB_LOBITS ; i++) {
-#ifdef HAVE_MMAP
-			chunkhashtab[i] = mmap(NULL,sizeof(chunk*)*HASHTAB_LOSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
-#else
-			chunkhashtab[i] = malloc(sizeof(chunk*)*HASHTAB_LOSIZE);
-#endif
-			passert(chunkhashtab[i]);
-			memset(chunkhashtab[i],0,sizeof(chunk*));
-			if (chunkhashtab[i][0]==NULL) {
-				memset(chunkhashtab[i],0,sizeof(chunk*)*HASHTAB_LOSIZE);
-			} else {
-				for (hash=0 ; hash<HASHTAB_LOSIZE ; hash++) {
-					chunkhashtab[i][hash] = NULL;
-				}
-			}
+		chunkhashtab = chunk_hash_alloc(CHUNKHASH_INITSIZE);
+		chunkhashsize = CHUNKHASH_INITSIZE;
+	} else {
+		chunk_hash_rehash_step(CHUNKHASH_MOVEFACTOR);
+		// chunks still waiting in old table are not counted - there is always place for them in current table
+		if ((chunkhashelem-chunkhasholdelem+chunkhashdeleted+1)*8 > chunkhashsize*7) {
+			// double size when table is more than half full, otherwise only remove deleted slots
+			chunk_hash_rehash((chunkhashelem*2>=chunkhashsize)?chunkhashsize*2:chunkhashsize);
 		}
 	}
-	hash = hash32(c->chunkid) & (chunkhashsize-1);
-	if (chunkrehashpos<chunkhashsize) {
-		chunk_hash_move();
-		if (hash >= chunkrehashpos) {
-			hash -= chunkhashsize/2;
+	chunk_hash_insert(c);
+	chunkhashelem++;
+}
+
+#define CHUNKFSIZE 17
+#define CHUNKCNT 1000
+
+static inline void chunk_store_record(chunk *c,uint8_t **ptr,uint32_t now) {
+	uint32_t lockedto;
+	put64bit(ptr,c->chunkid);
+	put32bit(ptr,c->version);
+	lockedto = c->lockedto;
+	if (lockedto<now) {
+		lockedto = 0;
+	}
+	put32bit(ptr,lockedto);
+	put8bit(ptr,c->archflag);
+}
+
+// returns 1 if chunk hasn't been stored yet (and marks it as stored)
+static inline uint8_t chunk_bgstore_check(uint64_t chunkid) {
+	if (chunkid>=chunkbgnextid || (chunkbgmap[chunkid>>3]&(1<<(chunkid&7)))) {
+		return 0;
+	}
+	chunkbgmap[chunkid>>3] |= (1<<(chunkid&7));
+	return 1;
+}
+
+// call before any change of stored chunk data (version,lockedto,archflag) and before chunk removal
+static inline void chunk_bgstore_keep(chunk *c) {
+	uint8_t rec[CHUNKFSIZE],*ptr;
+	if (chunkbgphase>0 && (chunkbgphase==1 || chunk_hash_pos(c)>=chunkbgpos) && chunk_bgstore_check(c->chunkid)) {
+		ptr = rec;
+		chunk_store_record(c,&ptr,chunkbgnow);
+		if (bio_write(chunkbgfd,rec,CHUNKFSIZE)!=CHUNKFSIZE) {
+			syslog(LOG_NOTICE,"write error");
 		}
-		c->next = chunkhashtab[hash>>HASHTAB_LOBITS][hash&HASHTAB_MASK];
-		chunkhashtab[hash>>HASHTAB_LOBITS][hash&HASHTAB_MASK] = c;
-		chunkhashelem++;
-	} else {
-		c->next = chunkhashtab[hash>>HASHTAB_LOBITS][hash&HASHTAB_MASK];
-		chunkhashtab[hash>>HASHTAB_LOBITS][hash&HASHTAB_MASK] = c;
-		chunkhashelem++;
-		if (chunkhashelem>chunkhashsize) {
-			chunk_hash_rehash();
+	}
+}
+
+// stores all chunks that haven't been stored yet - called before chunk table is resized during storing chunk section
+static void chunk_bgstore_rest(void) {
+	uint32_t i;
+	for (i=chunkbgpos ; i<chunk_hash_positions() ; i++) {
+		if (chunk_hash_get(i)!=NULL) {
+			chunk_bgstore_keep(chunk_hash_get(i));
 		}
 	}
 }
@@ -619,6 +863,9 @@ chunk* chunk_new(uint64_t chunkid) {
 	newchunk->ftab = NULL;
 	lastchunkid = chunkid;
 	lastchunkptr = newchunk;
+	if (chunkbgphase>0 && chunkid<chunkbgnextid) { // chunks created during store are not stored
+		chunkbgmap[chunkid>>3] |= (1<<(chunkid&7));
+	}
 	chunk_hash_add(newchunk);
 	// labelset_state_change(0,0,0,c->lsetid,c->archflag,c->regularvalidcopies); - not needed since lsetid==0 , archflag==0 and regularvalidcopies==0
 	return newchunk;
@@ -641,6 +888,7 @@ chunk* chunk_find(uint64_t chunkid) {
 }
 
 void chunk_delete(chunk* c) {
+	chunk_bgstore_keep(c);
 	if (lastchunkptr==c) {
 		lastchunkid=0;
 		lastchunkptr=NULL;
@@ -981,8 +1229,9 @@ void chunk_emergency_increase_version(chunk *c) {
 	if (i>0) {	// should always be true !!!
 		c->interrupted = 0;
 		c->operation = SET_VERSION;
+		chunk_bgstore_keep(c);
 		c->version++;
-		changelog("%"PRIu32"|INCVERSION(%"PRIu64")",(uint32_t)main_time(),c->chunkid);
+		changelog_op(CHLOP_INCVERSION,main_time(),c->chunkid);
 	} else {
 		matoclserv_chunk_status(c->chunkid,ERROR_CHUNKLOST);
 	}
@@ -1024,7 +1273,7 @@ static inline int chunk_remove_diconnected_chunks(chunk *c) {
 		return 0;
 	}
 	if (c->slisthead==NULL && c->fcount==0 && c->ondangerlist==0 && ((csdb_getdisconnecttime()+RemoveDelayDisconnect)<main_time())) {
-		changelog("%"PRIu32"|CHUNKDEL(%"PRIu64",%"PRIu32")",main_time(),c->chunkid,c->version);
+		changelog_op(CHLOP_CHUNKDEL,main_time(),c->chunkid,c->version);
 		chunk_delete(c);
 		return 1;
 	}
@@ -1042,6 +1291,7 @@ static inline int chunk_remove_diconnected_chunks(chunk *c) {
 		if (opfinished) {
 			if (c->operation==REPLICATE) {
 				c->operation = NONE;
+				chunk_bgstore_keep(c);
 				c->lockedto = 0;
 				matoclserv_chunk_unlocked(c->chunkid,c);
 			} else {
@@ -1189,6 +1439,7 @@ static inline int chunk_delete_file_int(chunk *c,uint8_t lsetid,uint32_t delete_
 		chunk_state_change(oldlsetid,c->lsetid,c->archflag,c->archflag,c->allvalidcopies,c->allvalidcopies,c->regularvalidcopies,c->regularvalidcopies);
 	}
 	if (c->fcount==0 && delete_timeout>0) {
+		chunk_bgstore_keep(c);
 		c->lockedto = (uint32_t)main_time()+delete_timeout;
 	}
 	return STATUS_OK;
@@ -1292,6 +1543,7 @@ int chunk_unlock(uint64_t chunkid) {
 	if (c==NULL) {
 		return ERROR_NOCHUNK;
 	}
+	chunk_bgstore_keep(c);
 	c->lockedto = 0;
 	chunk_write_counters(c,0);
 	matoclserv_chunk_unlocked(c->chunkid,c);
@@ -1339,6 +1591,7 @@ int chunk_univ_archflag(uint64_t chunkid,uint8_t archflag,uint32_t *archflagchan
 	}
 	if (archflag != c->archflag) {
 		chunk_state_change(c->lsetid,c->lsetid,c->archflag,archflag,c->allvalidcopies,c->allvalidcopies,c->regularvalidcopies,c->regularvalidcopies);
+		chunk_bgstore_keep(c);
 		c->archflag = archflag;
 		chunk_priority_queue_check(c,1);
 		(*archflagchanged)++;
@@ -1380,6 +1633,7 @@ chunkfloop chunk_fileloop_task(uint64_t chunkid,uint8_t lsetid,uint8_t aftereof,
 	}
 	if (archflag==1 && c->archflag==0) {
 		chunk_state_change(c->lsetid,c->lsetid,c->archflag,archflag,c->allvalidcopies,c->allvalidcopies,c->regularvalidcopies,c->regularvalidcopies);
+		chunk_bgstore_keep(c);
 		c->archflag = archflag;
 		chunk_priority_queue_check(c,1);
 		aflagchg = 1;
@@ -1407,6 +1661,14 @@ int chunk_read_check(uint32_t ts,uint64_t chunkid) {
 	return STATUS_OK;
 }
 
+void chunk_client_cached(uint64_t chunkid) {
+	chunk *c;
+	c = chunk_find(chunkid);
+	if (c!=NULL) {
+		c->needverincrease = 1; // client keeps this data keyed by chunkid+version, so next modification has to change version
+	}
+}
+
 int chunk_univ_multi_modify(uint32_t ts,uint8_t mr,uint64_t *nchunkid,uint64_t ochunkid,uint8_t lsetid,uint8_t *opflag) {
 	uint16_t csids[MAXCSCOUNT];
 	static void **chosen = NULL;
@@ -1531,6 +1793,7 @@ int chunk_univ_multi_modify(uint32_t ts,uint8_t mr,uint64_t *nchunkid,uint64_t o
 					if (i>0) {
 						c->interrupted = 0;
 						c->operation = SET_VERSION;
+						chunk_bgstore_keep(c);
 						c->version++;
 						*opflag = 1;
 					} else {
@@ -1548,6 +1811,7 @@ int chunk_univ_multi_modify(uint32_t ts,uint8_t mr,uint64_t *nchunkid,uint64_t o
 					return ERROR_MISMATCH;
 				}
 				if (*opflag) {
+					chunk_bgstore_keep(c);
 					c->version++;
 				}
 			}
@@ -1625,6 +1889,7 @@ int chunk_univ_multi_modify(uint32_t ts,uint8_t mr,uint64_t *nchunkid,uint64_t o
 		}
 	}
 
+	chunk_bgstore_keep(c);
 	c->lockedto = ts+LOCKTIMEOUT;
 	chunk_write_counters(c,1);
 	return STATUS_OK;
@@ -1700,6 +1965,7 @@ int chunk_univ_multi_truncate(uint32_t ts,uint8_t mr,uint64_t *nchunkid,uint64_t
 			if (i>0) {
 				c->interrupted = 0;
 				c->operation = TRUNCATE;
+				chunk_bgstore_keep(c);
 				c->version++;
 			} else {
 				if (csstable) {
@@ -1712,6 +1978,7 @@ int chunk_univ_multi_truncate(uint32_t ts,uint8_t mr,uint64_t *nchunkid,uint64_t
 			if (*nchunkid != ochunkid) {
 				return ERROR_MISMATCH;
 			}
+			chunk_bgstore_keep(c);
 			c->version++;
 		}
 	} else {
@@ -1786,6 +2053,7 @@ int chunk_univ_multi_truncate(uint32_t ts,uint8_t mr,uint64_t *nchunkid,uint64_t
 		}
 	}
 
+	chunk_bgstore_keep(c);
 	c->lockedto=ts+LOCKTIMEOUT;
 	return STATUS_OK;
 }
@@ -1844,6 +2112,7 @@ int chunk_repair(uint8_t lsetid,uint64_t ochunkid,uint32_t *nversion) {
 		c->allvalidcopies = 0;
 		c->regularvalidcopies = 0;
 	}
+	chunk_bgstore_keep(c);
 	c->version = bestversion;
 	for (s=c->slisthead ; s ; s=s->next) {
 		if (s->version==bestversion && cstab[s->csid].valid) {
@@ -2059,14 +2328,13 @@ static inline void chunk_mfr_state_check(chunk *c) {
 	}
 }
 
-void chunk_server_has_chunk(uint16_t csid,uint64_t chunkid,uint32_t version) {
-	chunk *c;
+// 'c' is result of chunk_find(chunkid)
+static void chunk_server_has_found_chunk(uint16_t csid,chunk *c,uint64_t chunkid,uint32_t version) {
 	slist *s;
 
 	cstab[csid].newchunkdelay = NEWCHUNKDELAY;
 	csreceivingchunks |= 2;
 
-	c = chunk_find(chunkid);
 	if (c) {
 		if (chunk_remove_diconnected_chunks(c)) {
 			c = NULL;
@@ -2086,7 +2354,7 @@ void chunk_server_has_chunk(uint16_t csid,uint64_t chunkid,uint32_t version) {
 		c = chunk_new(chunkid);
 		c->version = version;
 		c->lockedto = (uint32_t)main_time()+UNUSED_DELETE_TIMEOUT;
-		changelog("%"PRIu32"|CHUNKADD(%"PRIu64",%"PRIu32",%"PRIu32")",main_time(),c->chunkid,c->version,c->lockedto);
+		changelog_op(CHLOP_CHUNKADD,main_time(),c->chunkid,c->version,c->lockedto);
 	}
 	for (s=c->slisthead ; s ; s=s->next) {
 		if (s->csid==csid) {
@@ -2127,6 +2395,28 @@ void chunk_server_has_chunk(uint16_t csid,uint64_t chunkid,uint32_t version) {
 	}
 }
 
+void chunk_server_has_chunk(uint16_t csid,uint64_t chunkid,uint32_t version) {
+	chunk_server_has_found_chunk(csid,chunk_find(chunkid),chunkid,version);
+}
+
+// lists sent by chunkservers during registration - hash groups are prefetched CHUNK_PREFETCH_DIST chunks ahead and chunk records half of that ahead
+void chunk_server_has_chunks(uint16_t csid,const uint64_t *chunkids,const uint32_t *versions,uint32_t cnt) {
+	uint32_t i;
+
+	for (i=0 ; i<cnt && i<CHUNK_PREFETCH_DIST ; i++) {
+		chunk_hash_prefetch(chunkids[i]);
+	}
+	for (i=0 ; i<cnt ; i++) {
+		if (i+CHUNK_PREFETCH_DIST<cnt) {
+			chunk_hash_prefetch(chunkids[i+CHUNK_PREFETCH_DIST]);
+		}
+		if (i+CHUNK_PREFETCH_DIST/2<cnt) {
+			chunk_hash_prefetch_record(chunkids[i+CHUNK_PREFETCH_DIST/2]);
+		}
+		chunk_server_has_found_chunk(csid,chunk_find(chunkids[i]),chunkids[i],versions[i]);
+	}
+}
+
 void chunk_damaged(uint16_t csid,uint64_t chunkid) {
 	chunk *c;
 	slist *s;
@@ -2143,7 +2433,7 @@ void chunk_damaged(uint16_t csid,uint64_t chunkid) {
 		}
 		c = chunk_new(chunkid);
 		c->version = 0;
-		changelog("%"PRIu32"|CHUNKADD(%"PRIu64",%"PRIu32",%"PRIu32")",main_time(),c->chunkid,c->version,c->lockedto);
+		changelog_op(CHLOP_CHUNKADD,main_time(),c->chunkid,c->version,c->lockedto);
 	}
 	for (s=c->slisthead ; s ; s=s->next) {
 		if (s->csid==csid) {
@@ -2210,7 +2500,7 @@ void chunk_lost(uint16_t csid,uint64_t chunkid) {
 		}
 	}
 	if (c->slisthead==NULL && c->fcount==0 && c->ondangerlist==0 && ((csdb_getdisconnecttime()+RemoveDelayDisconnect)<main_time())) {
-		changelog("%"PRIu32"|CHUNKDEL(%"PRIu64",%"PRIu32")",main_time(),c->chunkid,c->version);
+		changelog_op(CHLOP_CHUNKDEL,main_time(),c->chunkid,c->version);
 		chunk_delete(c);
 	} else {
 		chunk_priority_queue_check(c,1);
@@ -2334,7 +2624,7 @@ void chunk_server_disconnected(uint16_t csid) {
 
 void chunk_server_disconnection_loop(void) {
 	uint32_t i;
-	chunk *c,*cn;
+	chunk *c;
 	discserv *ds;
 	uint64_t startutime,currutime;
 
@@ -2343,12 +2633,12 @@ void chunk_server_disconnection_loop(void) {
 		currutime = startutime;
 		while (startutime+10000>currutime) {
 			for (i=0 ; i<1000 ; i++) {
-				if (discserverspos<chunkrehashpos) {
-					for (c=chunkhashtab[discserverspos>>HASHTAB_LOBITS][discserverspos&HASHTAB_MASK] ; c ; c=cn ) {
-						cn = c->next;
+				if (discserverspos<chunk_hash_positions()) {
+					c = chunk_hash_get(discserverspos);
+					discserverspos++;
+					if (c!=NULL) {
 						chunk_remove_diconnected_chunks(c);
 					}
-					discserverspos++;
 				} else {
 					while (discservers) {
 						ds = discservers;
@@ -2405,7 +2695,7 @@ void chunk_got_delete_status(uint16_t csid,uint64_t chunkid,uint8_t status) {
 		}
 	}
 	if (c->slisthead==NULL && c->fcount==0 && c->ondangerlist==0 && ((csdb_getdisconnecttime()+RemoveDelayDisconnect)<main_time())) {
-		changelog("%"PRIu32"|CHUNKDEL(%"PRIu64",%"PRIu32")",main_time(),c->chunkid,c->version);
+		changelog_op(CHLOP_CHUNKDEL,main_time(),c->chunkid,c->version);
 		chunk_delete(c);
 	}
 }
@@ -2449,6 +2739,7 @@ void chunk_got_replicate_status(uint16_t csid,uint64_t chunkid,uint32_t version,
 			}
 		}
 		c->operation = NONE;
+		chunk_bgstore_keep(c);
 		c->lockedto = 0;
 		matoclserv_chunk_unlocked(c->chunkid,c);
 	} else { // low priority replication
@@ -2646,8 +2937,25 @@ void chunk_store_info(uint8_t *buff) {
 
 //jobs state: jobshpos
 
+/* chosen source goes first, other copies of the same kind that can still be read from are added as stripe sources */
+static inline uint8_t chunk_replication_sources(chunk *c,uint16_t srccsid,uint8_t valid,uint32_t lclass,uint32_t now,void **srcptrs) {
+	slist *s;
+	uint8_t srccnt;
+
+	srcptrs[0] = cstab[srccsid].ptr;
+	srccnt = 1;
+	for (s=c->slisthead ; s && srccnt<ReplicationSources ; s=s->next) {
+		if (s->csid!=srccsid && s->valid==valid && matocsserv_replication_read_counter(cstab[s->csid].ptr,now)<MaxReadRepl[lclass]) {
+			srcptrs[srccnt++] = cstab[s->csid].ptr;
+		}
+	}
+	return srccnt;
+}
+
 void chunk_do_jobs(chunk *c,uint16_t scount,uint16_t fullservers,uint32_t now,uint8_t extrajob) {
 	slist *s;
+	void *srcptrs[REPLICATION_MAX_SOURCES];
+	uint8_t srccnt;
 	static uint16_t *dcsids = NULL;
 	static uint16_t dservcount;
 //	static uint16_t *bcsids;
@@ -2869,6 +3177,7 @@ void chunk_do_jobs(chunk *c,uint16_t scount,uint16_t fullservers,uint32_t now,ui
 				}
 				if (bestversion>0 && ((bestversion+1)==c->version || c->version+1==bestversion)) {
 					syslog(LOG_WARNING,"chunk %016"PRIX64" has only invalid copies (%"PRIu32") - fixing it",c->chunkid,wvc+tdw);
+					chunk_bgstore_keep(c);
 					c->version = bestversion;
 					for (s=c->slisthead ; s ; s=s->next) {
 						if (s->version==bestversion && cstab[s->csid].valid) {
@@ -2964,6 +3273,7 @@ void chunk_do_jobs(chunk *c,uint16_t scount,uint16_t fullservers,uint32_t now,ui
 				}
 			}
 			c->operation = NONE;
+			chunk_bgstore_keep(c);
 			c->lockedto = 0;
 			matoclserv_chunk_unlocked(c->chunkid,c);
 		}
@@ -3290,12 +3600,14 @@ void chunk_do_jobs(chunk *c,uint16_t scount,uint16_t fullservers,uint32_t now,ui
 							if (srccsid!=MAXCSCOUNT) {
 								stats_replications++;
 								// high priority replication
-								if (matocsserv_send_replicatechunk(cstab[servers[i]].ptr,c->chunkid,c->version,cstab[srccsid].ptr)<0) {
+								srccnt = chunk_replication_sources(c,srccsid,(rgvc>0)?VALID:TDVALID,lclass,now,srcptrs);
+								if (matocsserv_send_replicatechunk_striped(cstab[servers[i]].ptr,c->chunkid,c->version,srccnt,srcptrs)<0) {
 									syslog(LOG_WARNING,"chunk %016"PRIX64"_%08"PRIX32": error sending replicate command",c->chunkid,c->version);
 									return;
 								}
 								chunk_addopchunk(servers[i],c->chunkid);
 								c->operation = REPLICATE;
+								chunk_bgstore_keep(c);
 								c->lockedto = now+LOCKTIMEOUT;
 								s = slist_malloc();
 								s->csid = servers[i];
@@ -3347,12 +3659,14 @@ void chunk_do_jobs(chunk *c,uint16_t scount,uint16_t fullservers,uint32_t now,ui
 							if (srccsid!=MAXCSCOUNT) {
 								stats_replications++;
 								// high priority replication
-								if (matocsserv_send_replicatechunk(cstab[rcsids[i]].ptr,c->chunkid,c->version,cstab[srccsid].ptr)<0) {
+								srccnt = chunk_replication_sources(c,srccsid,(rgvc>0)?VALID:TDVALID,lclass,now,srcptrs);
+								if (matocsserv_send_replicatechunk_striped(cstab[rcsids[i]].ptr,c->chunkid,c->version,srccnt,srcptrs)<0) {
 									syslog(LOG_WARNING,"chunk %016"PRIX64"_%08"PRIX32": error sending replicate command",c->chunkid,c->version);
 									return;
 								}
 								chunk_addopchunk(rcsids[i],c->chunkid);
 								c->operation = REPLICATE;
+								chunk_bgstore_keep(c);
 								c->lockedto = now+LOCKTIMEOUT;
 								s = slist_malloc();
 								s->csid = rcsids[i];
@@ -3580,12 +3894,13 @@ void chunk_jobs_main(void) {
 	uint32_t i,j,l,h,t,lc,hashsteps;
 	uint16_t scount,csid;
 	uint16_t fullservers;
-	chunk *c,*cn;
+	chunk *c;
 	uint32_t now;
 #ifdef MFSDEBUG
 	static uint32_t lastsecond=0;
 #endif
 
+	chunk_hash_rehash_step(CHUNKHASH_LOOPMOVEFACTOR);
 	chunk_server_disconnection_loop();
 	chunk_server_check_delays();
 
@@ -3598,7 +3913,7 @@ void chunk_jobs_main(void) {
 
 	scount = matocsserv_servers_count();
 
-	if (scount==0 || chunkrehashpos==0) {
+	if (scount==0 || chunk_hash_positions()==0) {
 		return;
 	}
 
@@ -3653,9 +3968,9 @@ void chunk_jobs_main(void) {
 
 	// then serve standard chunks
 	lc = 0;
-	hashsteps = 1+((chunkrehashpos)/(LoopTimeMin*TICKSPERSECOND));
+	hashsteps = 1+(chunk_hash_positions()/(LoopTimeMin*TICKSPERSECOND));
 	for (i=0 ; i<hashsteps && lc<HashCPTMax ; i++) {
-		if (jobshpos>=chunkrehashpos) {
+		if (jobshpos>=chunk_hash_positions()) {
 			chunk_do_jobs(NULL,JOBS_EVERYLOOP,0,now,0);	// every loop tasks
 			jobshpos=0;
 			for (csid = csusedhead ; csid < MAXCSCOUNT ; csid = cstab[csid].next) {
@@ -3675,17 +3990,15 @@ void chunk_jobs_main(void) {
 				}
 			}
 		} else {
-			c = chunkhashtab[jobshpos>>HASHTAB_LOBITS][jobshpos&HASHTAB_MASK];
-			while (c) {
-				cn = c->next;
+			c = chunk_hash_get(jobshpos);
+			if (c!=NULL) {
 				if (c->slisthead==NULL && c->fcount==0 && c->ondangerlist==0 && ((csdb_getdisconnecttime()+RemoveDelayDisconnect)<main_time())) {
-					changelog("%"PRIu32"|CHUNKDEL(%"PRIu64",%"PRIu32")",main_time(),c->chunkid,c->version);
+					changelog_op(CHLOP_CHUNKDEL,main_time(),c->chunkid,c->version);
 					chunk_delete(c);
 				} else {
 					chunk_do_jobs(c,scount,fullservers,now,0);
 					lc++;
 				}
-				c = cn;
 			}
 			jobshpos++;
 		}
@@ -3694,16 +4007,14 @@ void chunk_jobs_main(void) {
 
 /* ---- */
 
-#define CHUNKFSIZE 17
-#define CHUNKCNT 1000
 /*
 void chunk_text_dump(FILE *fd) {
 	chunk *c;
 	uint32_t i,lockedto,now;
 	now = main_time();
 
-	for (i=0 ; i<chunkrehashpos ; i++) {
-		for (c=chunkhashtab[i>>HASHTAB_LOBITS][i&HASHTAB_MASK] ; c ; c=c->next) {
+	for (i=0 ; i<chunk_hash_positions() ; i++) {
+		if ((c=chunk_hash_get(i))!=NULL) {
 			lockedto = c->lockedto;
 			if (lockedto<now) {
 				lockedto = 0;
@@ -3768,13 +4079,9 @@ uint8_t chunk_store(bio *fd) {
 	uint8_t hdr[8];
 	uint8_t storebuff[CHUNKFSIZE*CHUNKCNT];
 	uint8_t *ptr;
-	uint8_t archflag;
 	uint32_t i,j;
 	chunk *c;
-// chunkdata
-	uint64_t chunkid;
-	uint32_t version;
-	uint32_t lockedto,now;
+	uint32_t now;
 
 	if (fd==NULL) {
 		return 0x11;
@@ -3787,19 +4094,9 @@ uint8_t chunk_store(bio *fd) {
 	}
 	j=0;
 	ptr = storebuff;
-	for (i=0 ; i<chunkrehashpos ; i++) {
-		for (c=chunkhashtab[i>>HASHTAB_LOBITS][i&HASHTAB_MASK] ; c ; c=c->next) {
-			chunkid = c->chunkid;
-			put64bit(&ptr,chunkid);
-			version = c->version;
-			put32bit(&ptr,version);
-			lockedto = c->lockedto;
-			if (lockedto<now) {
-				lockedto = 0;
-			}
-			put32bit(&ptr,lockedto);
-			archflag = c->archflag;
-			put8bit(&ptr,archflag);
+	for (i=0 ; i<chunk_hash_positions() ; i++) {
+		if ((c=chunk_hash_get(i))!=NULL) {
+			chunk_store_record(c,&ptr,now);
 			j++;
 			if (j==CHUNKCNT) {
 				if (bio_write(fd,storebuff,CHUNKFSIZE*CHUNKCNT)!=(CHUNKFSIZE*CHUNKCNT)) {
@@ -3818,6 +4115,83 @@ uint8_t chunk_store(bio *fd) {
 	return 0;
 }
 
+void chunk_bgstore_start(bio *prefd) {
+	chunkbgnextid = nextchunkid;
+	chunkbgnow = main_time();
+	chunkbgmap = calloc((nextchunkid>>3)+1,1);
+	passert(chunkbgmap);
+	chunkbgfd = prefd;
+	chunkbgpos = 0;
+	chunkbgphase = 1;
+}
+
+int chunk_bgstore_chunks_begin(bio *fd) {
+	uint8_t hdr[8];
+	uint8_t *ptr;
+
+	ptr = hdr;
+	put64bit(&ptr,chunkbgnextid);
+	if (bio_write(fd,hdr,8)!=8) {
+		return -1;
+	}
+	chunkbgfd = fd;
+	chunkbgpos = 0;
+	chunkbgphase = 2;
+	return 0;
+}
+
+// stores chunks from next 'buckets' hash buckets - returns 1 when all chunks have been stored
+uint8_t chunk_bgstore_chunks(uint32_t buckets) {
+	uint8_t storebuff[CHUNKFSIZE*CHUNKCNT];
+	uint8_t *ptr;
+	uint32_t i,j,end;
+	chunk *c;
+
+	end = chunkbgpos + buckets;
+	if (end>chunk_hash_positions() || end<chunkbgpos) {
+		end = chunk_hash_positions();
+	}
+	j=0;
+	ptr = storebuff;
+	for (i=chunkbgpos ; i<end ; i++) {
+		if ((c=chunk_hash_get(i))!=NULL) {
+			if (chunk_bgstore_check(c->chunkid)) {
+				chunk_store_record(c,&ptr,chunkbgnow);
+				j++;
+				if (j==CHUNKCNT) {
+					if (bio_write(chunkbgfd,storebuff,CHUNKFSIZE*CHUNKCNT)!=(CHUNKFSIZE*CHUNKCNT)) {
+						syslog(LOG_NOTICE,"write error");
+					}
+					j=0;
+					ptr = storebuff;
+				}
+			}
+		}
+	}
+	chunkbgpos = end;
+	if (chunkbgpos>=chunk_hash_positions()) {
+		memset(ptr,0,CHUNKFSIZE); // end marker
+		j++;
+	}
+	if (j>0) {
+		if (bio_write(chunkbgfd,storebuff,CHUNKFSIZE*j)!=(CHUNKFSIZE*j)) {
+			syslog(LOG_NOTICE,"write error");
+		}
+	}
+	return (chunkbgpos>=chunk_hash_positions())?1:0;
+}
+
+// finishes (or aborts) incremental store
+void chunk_bgstore_end(void) {
+	if (chunkbgphase==0) {
+		return;
+	}
+	free(chunkbgmap);
+	chunkbgmap = NULL;
+	chunkbgfd = NULL;
+	chunkbgphase = 0;
+}
+
 void chunk_cleanup(void) {
 	uint32_t i,j;
 	discserv *ds;
@@ -3922,6 +4296,19 @@ int chunk_parse_rep_list(char *strlist,double *replist) {
 	return -1;
 }
 
+static uint8_t chunk_get_replication_sources_cfg(void) {
+	uint32_t srcs;
+
+	srcs = cfg_getuint32("CHUNKS_REPLICATION_SOURCES",3);
+	if (srcs<1) {
+		srcs = 1;
+	}
+	if (srcs>REPLICATION_MAX_SOURCES) {
+		srcs = REPLICATION_MAX_SOURCES;
+	}
+	return srcs;
+}
+
 void chunk_term(void) {
 	chunk_priority_queue_check(NULL,1); // free tabs
 	chunk_do_jobs(NULL,JOBS_TERM,0,main_time(),0); // free tabs
@@ -3985,6 +4372,7 @@ void chunk_reload(void) {
 			syslog(LOG_NOTICE,"read replication limit in old format - change limits to new format");
 	}
 	free(repstr);
+	ReplicationSources = chunk_get_replication_sources_cfg();
 /*
 	repl = cfg_getuint32("CHUNKS_WRITE_REP_LIMIT",2);
 	if (repl>0) {
@@ -4115,6 +4503,7 @@ int chunk_strinit(void) {
 			fprintf(stderr,"read replication limit in old format - change limits to new format\n");
 	}
 	free(repstr);
+	ReplicationSources = chunk_get_replication_sources_cfg();
 /*
 	MaxWriteRepl = cfg_getuint32("CHUNKS_WRITE_REP_LIMIT",2);
 	MaxReadRepl = cfg_getuint32("CHUNKS_READ_REP_LIMIT",10);
@@ -67,6 +67,7 @@ int chunk_univ_archflag(uint64_t chunkid,uint8_t archflag,uint32_t *archflagchan
 chunkfloop chunk_fileloop_task(uint64_t chunkid,uint8_t lsetid,uint8_t aftereof,uint8_t archflag);
 
 int chunk_read_check(uint32_t ts,uint64_t chunkid);
+void chunk_client_cached(uint64_t chunkid);
 int chunk_multi_modify(uint64_t *nchunkid,uint64_t ochunkid,uint8_t lsetid,uint8_t *opflag);
 int chunk_multi_truncate(uint64_t *nchunkid,uint64_t ochunkid,uint32_t length,uint8_t lsetid);
 //int chunk_multi_reinitialize(uint64_t chunkid);
@@ -85,6 +86,7 @@ uint8_t chunk_get_mfrstatus(uint16_t csid);
 uint16_t chunk_server_connected(void *ptr);
 
 void chunk_server_has_chunk(uint16_t csid,uint64_t chunkid,uint32_t version);
+void chunk_server_has_chunks(uint16_t csid,const uint64_t *chunkids,const uint32_t *versions,uint32_t cnt);
 void chunk_damaged(uint16_t csid,uint64_t chunkid);
 void chunk_lost(uint16_t csid,uint64_t chunkid);
 void chunk_server_register_end(uint16_t csid);
@@ -115,6 +117,10 @@ void chunk_get_memusage(uint64_t allocated[3],uint64_t used[3]);
 
 int chunk_load(bio *fd,uint8_t mver);
 uint8_t chunk_store(bio *fd);
+void chunk_bgstore_start(bio *prefd);
+int chunk_bgstore_chunks_begin(bio *fd);
+uint8_t chunk_bgstore_chunks(uint32_t buckets);
+void chunk_bgstore_end(void);
 void chunk_cleanup(void);
 void chunk_newfs(void);
 int chunk_strinit(void);
@@ -39,6 +39,7 @@
 #include <sys/stat.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <pthread.h>
 #ifdef HAVE_SYS_MMAN_H
 #include <sys/mman.h>
 #endif
@@ -65,6 +66,7 @@
 #include "main.h"
 #include "changelog.h"
 #include "buckets.h"
+#include "pcqueue.h"
 #include "clocks.h"
 #include "labelsets.h"
 #include "missinglog.h"
@@ -232,6 +234,63 @@ static uint32_t fsinfo_loopend=0;
 
 static uint32_t test_start_time;
 
+// set while read-only operations are executed by many threads - nothing (including hash tables) can be modified then
+static uint8_t fs_readonly_phase=0;
+
+static uint32_t LoadThreads;
+
+// incremental metadata store (see fsnodes_bgstore_*) - node hash table can't be rehashed then
+static uint8_t fsbgphase = 0;	// 0 - not active ; 1 - storing nodes ; 2 - storing edges
+static uint32_t fsbgmaxnodeid;
+static uint64_t fsbgnextedgeid;
+static uint32_t fsbgpos;
+static uint8_t *fsbgnodemap;
+static uint8_t *fsbgedgemap;
+static bio *fsbgnodefd;
+static bio *fsbgedgefd;
+
+// lazy snapshots (see fsnodes_lazysnap_*) - directory 'dstid' is a snapshot of directory 'srcid', but its children haven't been copied yet
+typedef struct _lazysnapjob {	// parameters of snapshot operation - shared by all its pending directories
+	uint32_t ts;
+	uint32_t uid;
+	uint32_t gids;
+	uint32_t *gid;
+	uint16_t cumask;
+	uint8_t smode;
+	uint8_t sesflags;
+	uint32_t refcnt;
+	uint32_t storeid;
+	struct _lazysnapjob *next,**prev;
+} lazysnapjob;
+
+typedef struct _lazysnap {
+	uint32_t srcid;
+	uint32_t dstid;
+	lazysnapjob *job;
+	statsrecord vstats;	// statistics of not copied objects (accounted in dst and its parents)
+	struct _lazysnap *snext,**sprev;	// hash by srcid
+	struct _lazysnap *dnext,**dprev;	// hash by dstid
+	struct _lazysnap *next,**prev;	// creation order
+} lazysnap;
+
+#define LAZYSNAP_HASHSIZE 65536
+#define LAZYSNAP_HASH(id) (hash32(id)&(LAZYSNAP_HASHSIZE-1))
+#define LAZYSNAP_STEP_USEC 10000
+
+static lazysnap *lazysnapsrchash[LAZYSNAP_HASHSIZE];
+static lazysnap *lazysnapdsthash[LAZYSNAP_HASHSIZE];
+static lazysnap *lazysnaphead = NULL;
+static lazysnap **lazysnaptail = &lazysnaphead;
+static lazysnapjob *lazysnapjobhead = NULL;
+static uint32_t lazysnapcnt = 0;
+static uint8_t lazysnapactive = 0;	// pending directories can be copied on demand (not while metadata is being restored)
+static uint8_t lazysnapbusy = 0;	// copying in progress
+
+static void fsnodes_lazysnap_cow_node(fsnode *p);
+static void fsnodes_lazysnap_cow_children(fsnode *p);
+static void fsnodes_lazysnap_materialize(fsnode *p);
+static void fsnodes_lazysnap_forget(uint32_t id);
+
 static uint32_t stats_statfs=0;
 static uint32_t stats_getattr=0;
 static uint32_t stats_setattr=0;
@@ -288,6 +347,8 @@ CREATE_BUCKET_ALLOCATOR(freenode,freenode,5000)
 
 CREATE_BUCKET_ALLOCATOR(quotanode,quotanode,500)
 
+CREATE_BUCKET_ALLOCATOR(lazysnap,lazysnap,1000)
+
 #define fsnode_dir_malloc() fsnode_malloc(0)
 #define fsnode_file_malloc() fsnode_malloc(1)
 #define fsnode_symlink_malloc() fsnode_malloc(2)
@@ -352,30 +413,37 @@ static inline void fsnode_cleanup(void) {
 	fsnode_used=0;
 }
 
-static inline fsnode* fsnode_malloc(uint8_t indx) {
+// takes new element from first bucket on the list (heads and counters are also given by node loader threads - see fsnode_arena)
+static inline fsnode* fsnode_bucket_malloc(fsnode_bucket **nrbhead,uint8_t indx,uint64_t *allocated) {
 	fsnode_bucket *nrb;
 	fsnode *ret;
-	sassert(indx<NODE_MAX_INDX);
-	if (nrbfreeheads[indx]) {
-		ret = nrbfreeheads[indx];
-		nrbfreeheads[indx] = ret->next;
-		fsnode_used += nrelemsize[indx];
-		return ret;
-	}
-	if (nrbheads[indx]==NULL || nrbheads[indx]->firstfree + nrelemsize[indx] > nrbucketsize[indx]) {
+	if ((*nrbhead)==NULL || (*nrbhead)->firstfree + nrelemsize[indx] > nrbucketsize[indx]) {
 #ifdef BUCKETS_MMAP_ALLOC
 		nrb = (fsnode_bucket*)mmap(NULL,offsetof(fsnode_bucket,bucket)+nrbucketsize[indx],PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
 #else
-		nrb = (fsnode_bucket*)malloc(offsetof(fsnode_bucket)+nrbucketsize[indx]);
+		nrb = (fsnode_bucket*)malloc(offsetof(fsnode_bucket,bucket)+nrbucketsize[indx]);
 #endif
 		passert(nrb);
-		nrb->next = nrbheads[indx];
+		nrb->next = *nrbhead;
 		nrb->firstfree = 0;
-		nrbheads[indx] = nrb;
-		fsnode_allocated += (offsetof(fsnode_bucket,bucket)+nrbucketsize[indx]);
+		*nrbhead = nrb;
+		*allocated += (offsetof(fsnode_bucket,bucket)+nrbucketsize[indx]);
+	}
+	ret = (fsnode*)(((*nrbhead)->bucket) + ((*nrbhead)->firstfree));
+	(*nrbhead)->firstfree += nrelemsize[indx];
+	return ret;
+}
+
+static inline fsnode* fsnode_malloc(uint8_t indx) {
+	fsnode *ret;
+	sassert(indx<NODE_MAX_INDX);
+	if (nrbfreeheads[indx]) {
+		ret = nrbfreeheads[indx];
+		nrbfreeheads[indx] = ret->next;
+		fsnode_used += nrelemsize[indx];
+		return ret;
 	}
-	ret = (fsnode*)((nrbheads[indx]->bucket) + (nrbheads[indx]->firstfree));
-	nrbheads[indx]->firstfree += nrelemsize[indx];
+	ret = fsnode_bucket_malloc(nrbheads+indx,indx,&fsnode_allocated);
 	fsnode_used += nrelemsize[indx];
 	return ret;
 }
@@ -536,31 +604,37 @@ static inline void symlink_cleanup(void) {
 	symlink_used = 0;
 }
 
-static inline uint8_t* symlink_malloc(uint16_t pathleng) {
+static inline uint8_t* symlink_bucket_malloc(symlink_bucket **stbhead,uint16_t indx,uint64_t *allocated) {
 	symlink_bucket *stb;
 	uint8_t *ret;
-	uint16_t indx = SYMLINK_REC_INDX(pathleng);
-	sassert(indx<SYMLINK_MAX_INDX);
-	if (stbfreeheads[indx]) {
-		ret = stbfreeheads[indx];
-		stbfreeheads[indx] = *((uint8_t**)ret);
-		symlink_used += SYMLINK_REC_SIZE(indx);
-		return ret;
-	}
-	if (stbheads[indx]==NULL || stbheads[indx]->firstfree + SYMLINK_REC_SIZE(indx) > stbucketsize[indx]) {
+	if ((*stbhead)==NULL || (*stbhead)->firstfree + SYMLINK_REC_SIZE(indx) > stbucketsize[indx]) {
 #ifdef BUCKETS_MMAP_ALLOC
 		stb = (symlink_bucket*)mmap(NULL,offsetof(symlink_bucket,bucket)+stbucketsize[indx],PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
 #else
 		stb = (symlink_bucket*)malloc(offsetof(symlink_bucket,bucket)+stbucketsize[indx]);
 #endif
 		passert(stb);
-		stb->next = stbheads[indx];
+		stb->next = *stbhead;
 		stb->firstfree = 0;
-		stbheads[indx] = stb;
-		symlink_allocated += (offsetof(symlink_bucket,bucket)+stbucketsize[indx]);
+		*stbhead = stb;
+		*allocated += (offsetof(symlink_bucket,bucket)+stbucketsize[indx]);
+	}
+	ret = (uint8_t*)(((*stbhead)->bucket) + ((*stbhead)->firstfree));
+	(*stbhead)->firstfree += SYMLINK_REC_SIZE(indx);
+	return ret;
+}
+
+static inline uint8_t* symlink_malloc(uint16_t pathleng) {
+	uint8_t *ret;
+	uint16_t indx = SYMLINK_REC_INDX(pathleng);
+	sassert(indx<SYMLINK_MAX_INDX);
+	if (stbfreeheads[indx]) {
+		ret = stbfreeheads[indx];
+		stbfreeheads[indx] = *((uint8_t**)ret);
+		symlink_used += SYMLINK_REC_SIZE(indx);
+		return ret;
 	}
-	ret = (uint8_t*)((stbheads[indx]->bucket) + (stbheads[indx]->firstfree));
-	stbheads[indx]->firstfree += SYMLINK_REC_SIZE(indx);
+	ret = symlink_bucket_malloc(stbheads+indx,indx,&symlink_allocated);
 	symlink_used += SYMLINK_REC_SIZE(indx);
 	return ret;
 }
@@ -630,31 +704,36 @@ static inline void chunktab_cleanup(void) {
 	chunktab_used = 0;
 }
 
-static inline uint64_t* chunktab_indx_malloc(uint8_t indx) {
+static inline uint64_t* chunktab_bucket_malloc(chunktab_bucket **ctbhead,uint8_t indx,uint64_t *allocated) {
 	chunktab_bucket *ctb;
 	uint64_t *ret;
-	if (ctbfreeheads[indx]) {
-		ret = ctbfreeheads[indx];
-		ctbfreeheads[indx] = *((uint64_t**)ret);
-		return ret;
-	}
-	if (ctbheads[indx]==NULL || ctbheads[indx]->firstfree + chunktabsize[indx] > ctbucketsize[indx]) {
+	if ((*ctbhead)==NULL || (*ctbhead)->firstfree + chunktabsize[indx] > ctbucketsize[indx]) {
 #ifdef BUCKETS_MMAP_ALLOC
 		ctb = (chunktab_bucket*)mmap(NULL,(offsetof(chunktab_bucket,bucket)+ctbucketsize[indx]),PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
 #else
 		ctb = (chunktab_bucket*)malloc(offsetof(chunktab_bucket,bucket)+ctbucketsize[indx]);
 #endif
 		passert(ctb);
-		ctb->next = ctbheads[indx];
+		ctb->next = *ctbhead;
 		ctb->firstfree = 0;
-		ctbheads[indx] = ctb;
-		chunktab_allocated += (offsetof(chunktab_bucket,bucket)+ctbucketsize[indx]);
+		*ctbhead = ctb;
+		*allocated += (offsetof(chunktab_bucket,bucket)+ctbucketsize[indx]);
 	}
-	ret = (uint64_t*)((ctbheads[indx]->bucket) + (ctbheads[indx]->firstfree));
-	ctbheads[indx]->firstfree += chunktabsize[indx];
+	ret = (uint64_t*)(((*ctbhead)->bucket) + ((*ctbhead)->firstfree));
+	(*ctbhead)->firstfree += chunktabsize[indx];
 	return ret;
 }
 
+static inline uint64_t* chunktab_indx_malloc(uint8_t indx) {
+	uint64_t *ret;
+	if (ctbfreeheads[indx]) {
+		ret = ctbfreeheads[indx];
+		ctbfreeheads[indx] = *((uint64_t**)ret);
+		return ret;
+	}
+	return chunktab_bucket_malloc(ctbheads+indx,indx,&chunktab_allocated);
+}
+
 static inline void chunktab_indx_free(uint64_t *chunktab,uint8_t indx) {
 	*((uint64_t**)chunktab) = ctbfreeheads[indx];
 	ctbfreeheads[indx] = chunktab;
@@ -714,6 +793,113 @@ static inline void chunktab_getusage(uint64_t *allocated,uint64_t *used) {
 	*used = chunktab_used;
 }
 
+
+
+/* private allocators of node loader thread (nodes, symlink paths and chunk tables) - their buckets are moved to global lists after load */
+typedef struct _fsnode_arena {
+	fsnode_bucket *nrbheads[NODE_MAX_INDX];
+	symlink_bucket *stbheads[SYMLINK_MAX_INDX];
+	chunktab_bucket *ctbheads[CHUNKTAB_MAX_INDX];
+	uint64_t fsnode_allocated,fsnode_used;
+	uint64_t symlink_allocated,symlink_used;
+	uint64_t chunktab_allocated,chunktab_used;
+} fsnode_arena;
+
+static inline void fsnode_arena_init(fsnode_arena *a) {
+	uint32_t i;
+	for (i=0 ; i<NODE_MAX_INDX ; i++) {
+		a->nrbheads[i] = NULL;
+	}
+	for (i=0 ; i<SYMLINK_MAX_INDX ; i++) {
+		a->stbheads[i] = NULL;
+	}
+	for (i=0 ; i<CHUNKTAB_MAX_INDX ; i++) {
+		a->ctbheads[i] = NULL;
+	}
+	a->fsnode_allocated = 0;
+	a->fsnode_used = 0;
+	a->symlink_allocated = 0;
+	a->symlink_used = 0;
+	a->chunktab_allocated = 0;
+	a->chunktab_used = 0;
+}
+
+static inline fsnode* fsnode_arena_malloc(fsnode_arena *a,uint8_t indx) {
+	sassert(indx<NODE_MAX_INDX);
+	a->fsnode_used += nrelemsize[indx];
+	return fsnode_bucket_malloc(a->nrbheads+indx,indx,&(a->fsnode_allocated));
+}
+
+static inline uint8_t* symlink_arena_malloc(fsnode_arena *a,uint16_t pathleng) {
+	uint16_t indx = SYMLINK_REC_INDX(pathleng);
+	sassert(indx<SYMLINK_MAX_INDX);
+	a->symlink_used += SYMLINK_REC_SIZE(indx);
+	return symlink_bucket_malloc(a->stbheads+indx,indx,&(a->symlink_allocated));
+}
+
+static inline uint64_t* chunktab_arena_malloc(fsnode_arena *a,uint32_t chunks) {
+	uint8_t indx = CHUNKTAB_REC_INDX(chunks);
+	if (chunks==0 || indx>=CHUNKTAB_MAX_INDX) {
+		return NULL;
+	}
+	a->chunktab_used += CHUNKTAB_ELEMENT_SIZE(chunks);
+	return chunktab_bucket_malloc(a->ctbheads+indx,indx,&(a->chunktab_allocated));
+}
+
+// arena buckets are put after first global bucket (global allocators still take new elements from it)
+static inline void fsnode_arena_merge(fsnode_arena *a) {
+	fsnode_bucket *nrb;
+	symlink_bucket *stb;
+	chunktab_bucket *ctb;
+	uint32_t i;
+	for (i=0 ; i<NODE_MAX_INDX ; i++) {
+		if (a->nrbheads[i]==NULL) {
+			continue;
+		}
+		if (nrbheads[i]==NULL) {
+			nrbheads[i] = a->nrbheads[i];
+		} else {
+			for (nrb=a->nrbheads[i] ; nrb->next ; nrb=nrb->next) {}
+			nrb->next = nrbheads[i]->next;
+			nrbheads[i]->next = a->nrbheads[i];
+		}
+		a->nrbheads[i] = NULL;
+	}
+	for (i=0 ; i<SYMLINK_MAX_INDX ; i++) {
+		if (a->stbheads[i]==NULL) {
+			continue;
+		}
+		if (stbheads[i]==NULL) {
+			stbheads[i] = a->stbheads[i];
+		} else {
+			for (stb=a->stbheads[i] ; stb->next ; stb=stb->next) {}
+			stb->next = stbheads[i]->next;
+			stbheads[i]->next = a->stbheads[i];
+		}
+		a->stbheads[i] = NULL;
+	}
+	for (i=0 ; i<CHUNKTAB_MAX_INDX ; i++) {
+		if (a->ctbheads[i]==NULL) {
+			continue;
+		}
+		if (ctbheads[i]==NULL) {
+			ctbheads[i] = a->ctbheads[i];
+		} else {
+			for (ctb=a->ctbheads[i] ; ctb->next ; ctb=ctb->next) {}
+			ctb->next = ctbheads[i]->next;
+			ctbheads[i]->next = a->ctbheads[i];
+		}
+		a->ctbheads[i] = NULL;
+	}
+	fsnode_allocated += a->fsnode_allocated;
+	fsnode_used += a->fsnode_used;
+	symlink_allocated += a->symlink_allocated;
+	symlink_used += a->symlink_used;
+	chunktab_allocated += a->chunktab_allocated;
+	chunktab_used += a->chunktab_used;
+	fsnode_arena_init(a);
+}
+
 void fs_get_memusage(uint64_t allocated[8],uint64_t used[8]) {
 	allocated[0] = sizeof(fsedge*)*edgerehashpos;
 	used[0] = sizeof(fsedge*)*edgehashelem;
@@ -935,7 +1121,9 @@ static inline fsedge* fsnodes_edge_find(fsnode *node,uint16_t nleng,const uint8_
 	hashval = fsnodes_hash(node->id,nleng,name);
 	hash = hashval & (edgehashsize-1);
 	if (edgerehashpos<edgehashsize) {
-		fsnodes_edge_hash_move();
+		if (fs_readonly_phase==0) {
+			fsnodes_edge_hash_move();
+		}
 		if (hash >= edgerehashpos) {
 			hash -= edgehashsize/2;
 		}
@@ -1019,6 +1207,9 @@ static inline void fsnodes_edge_add(fsedge *e) {
 }
 
 static inline int fsnodes_nameisused(fsnode *node,uint16_t nleng,const uint8_t *name) {
+	if (lazysnapcnt>0) {
+		fsnodes_lazysnap_materialize(node);
+	}
 	return (fsnodes_edge_find(node,nleng,name))?1:0;
 }
 
@@ -1026,6 +1217,9 @@ static inline fsedge* fsnodes_lookup(fsnode *node,uint16_t nleng,const uint8_t *
 	if (node->type!=TYPE_DIRECTORY) {
 		return NULL;
 	}
+	if (lazysnapcnt>0) {
+		fsnodes_lazysnap_materialize(node);
+	}
 	return fsnodes_edge_find(node,nleng,name);
 }
 
@@ -1109,7 +1303,9 @@ static inline fsnode* fsnodes_node_find(uint32_t id) {
 	}
 	hash = hash32(id) & (nodehashsize-1);
 	if (noderehashpos<nodehashsize) {
-		fsnodes_node_hash_move();
+		if (fs_readonly_phase==0 && fsbgphase==0) {
+			fsnodes_node_hash_move();
+		}
 		if (hash >= noderehashpos) {
 			hash -= nodehashsize/2;
 		}
@@ -1131,7 +1327,9 @@ static inline void fsnodes_node_delete(fsnode *p) {
 	}
 	hash = hash32(p->id) & (nodehashsize-1);
 	if (noderehashpos<nodehashsize) {
-		fsnodes_node_hash_move();
+		if (fsbgphase==0) {
+			fsnodes_node_hash_move();
+		}
 		if (hash >= noderehashpos) {
 			hash -= nodehashsize/2;
 		}
@@ -1147,34 +1345,42 @@ static inline void fsnodes_node_delete(fsnode *p) {
 	}
 }
 
-static inline void fsnodes_node_add(fsnode *p) {
+static inline void fsnodes_node_hash_alloc(void) {
 	uint16_t i;
 	uint32_t hash;
 
-	if (nodehashsize==0) {
-		nodehashsize = fsnodes_calc_hash_size(hashelements);
-		noderehashpos = nodehashsize;
-		nodehashelem = 0;
-		for (i=0 ; i<nodehashsize>>HASHTAB_LOBITS ; i++) {
+	nodehashsize = fsnodes_calc_hash_size(hashelements);
+	noderehashpos = nodehashsize;
+	nodehashelem = 0;
+	for (i=0 ; i<nodehashsize>>HASHTAB_LOBITS ; i++) {
 #ifdef HAVE_MMAP
-			nodehashtab[i] = mmap(NULL,sizeof(fsnode*)*HASHTAB_LOSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
+		nodehashtab[i] = mmap(NULL,sizeof(fsnode*)*HASHTAB_LOSIZE,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
 #else
-			nodehashtab[i] = malloc(sizeof(fsnode*)*HASHTAB_LOSIZE);
+		nodehashtab[i] = malloc(sizeof(fsnode*)*HASHTAB_LOSIZE);
 #endif
-			passert(nodehashtab[i]);
-			memset(nodehashtab[i],0,sizeof(fsnode*));
-			if (nodehashtab[i][0]==NULL) {
-				memset(nodehashtab[i],0,sizeof(fsnode*)*HASHTAB_LOSIZE);
-			} else {
-				for (hash=0 ; hash<HASHTAB_LOSIZE ; hash++) {
-					nodehashtab[i][hash] = NULL;
-				}
+		passert(nodehashtab[i]);
+		memset(nodehashtab[i],0,sizeof(fsnode*));
+		if (nodehashtab[i][0]==NULL) {
+			memset(nodehashtab[i],0,sizeof(fsnode*)*HASHTAB_LOSIZE);
+		} else {
+			for (hash=0 ; hash<HASHTAB_LOSIZE ; hash++) {
+				nodehashtab[i][hash] = NULL;
 			}
 		}
 	}
+}
+
+static inline void fsnodes_node_add(fsnode *p) {
+	uint32_t hash;
+
+	if (nodehashsize==0) {
+		fsnodes_node_hash_alloc();
+	}
 	hash = hash32(p->id) & (nodehashsize-1);
 	if (noderehashpos<nodehashsize) {
-		fsnodes_node_hash_move();
+		if (fsbgphase==0) {
+			fsnodes_node_hash_move();
+		}
 		if (hash >= noderehashpos) {
 			hash -= nodehashsize/2;
 		}
@@ -1185,7 +1391,7 @@ static inline void fsnodes_node_add(fsnode *p) {
 		p->next = nodehashtab[hash>>HASHTAB_LOBITS][hash&HASHTAB_MASK];
 		nodehashtab[hash>>HASHTAB_LOBITS][hash&HASHTAB_MASK] = p;
 		nodehashelem++;
-		if (nodehashelem>nodehashsize) {
+		if (nodehashelem>nodehashsize && fsbgphase==0) {
 			fsnodes_node_hash_rehash();
 		}
 	}
@@ -1270,6 +1476,76 @@ static inline void fsnodes_keep_alive_check(void) {
 	}
 }
 
+/* incremental (fork-less) metadata store - see meta_bgstore_* in metadata.c */
+/* nodes and edges are stored in time slices from the main loop ; every object which is going to be modified (or removed) */
+/* before its slice has been stored is written immediately in its original form (pre-image), so stored file reflects */
+/* exactly the state from the moment when the store has been started - node hash table is not rehashed in the meantime */
+
+static inline void fs_storenode(fsnode *f,bio *fd);
+static inline void fs_storeedge(fsedge *e,bio *fd);
+
+static inline uint32_t fsnodes_node_hash_pos(uint32_t id) {
+	uint32_t hash;
+	hash = hash32(id) & (nodehashsize-1);
+	if (noderehashpos<nodehashsize && hash >= noderehashpos) {
+		hash -= nodehashsize/2;
+	}
+	return hash;
+}
+
+// returns 1 if object hasn't been stored yet (and marks it as stored)
+static inline uint8_t fsnodes_bgstore_check(uint8_t *map,uint32_t id) {
+	if (id>fsbgmaxnodeid || (map[id>>3]&(1<<(id&7)))) {
+		return 0;
+	}
+	map[id>>3] |= (1<<(id&7));
+	return 1;
+}
+
+// call before any modification of stored node attributes and before node removal
+static inline void fsnodes_bgstore_node(fsnode *p) {
+	if (lazysnapcnt>0) {
+		fsnodes_lazysnap_cow_node(p);
+	}
+	if (fsbgphase==1 && fsnodes_node_hash_pos(p->id)>=fsbgpos && fsnodes_bgstore_check(fsbgnodemap,p->id)) {
+		fs_storenode(p,fsbgnodefd);
+	}
+}
+
+// edges are stored by parent (children of directory) - trash and sustained edges (without parent) by child
+static inline void fsnodes_bgstore_edgelist(fsnode *p) {
+	fsedge *e;
+	if (p->type==TYPE_DIRECTORY) {
+		for (e=p->data.ddata.children ; e ; e=e->nextchild) {
+			fs_storeedge(e,fsbgedgefd);
+		}
+	} else {
+		for (e=p->parents ; e ; e=e->nextparent) {
+			if (e->parent==NULL) {
+				fs_storeedge(e,fsbgedgefd);
+			}
+		}
+	}
+}
+
+// call before any change in list of children (directories) or in detached (trash/sustained) edge (other objects)
+static inline void fsnodes_bgstore_edges(fsnode *p) {
+	if (lazysnapcnt>0) {
+		fsnodes_lazysnap_cow_children(p);
+	}
+	if (fsbgphase>0 && (fsbgphase==1 || fsnodes_node_hash_pos(p->id)>=fsbgpos) && fsnodes_bgstore_check(fsbgedgemap,p->id)) {
+		fsnodes_bgstore_edgelist(p);
+	}
+}
+
+// objects created during store are not stored at all
+static inline void fsnodes_bgstore_newnode(uint32_t id) {
+	if (fsbgphase>0 && id<=fsbgmaxnodeid) {
+		fsbgnodemap[id>>3] |= (1<<(id&7));
+		fsbgedgemap[id>>3] |= (1<<(id&7));
+	}
+}
+
 static inline uint8_t fsnodes_type_convert(uint8_t type) {
 	switch (type) {
 		case DISP_TYPE_FILE:
@@ -1935,6 +2211,18 @@ static inline void fsnodes_fill_attr(fsnode *node,fsnode *parent,uint32_t uid,ui
 
 static inline void fsnodes_remove_edge(uint32_t ts,fsedge *e) {
 	statsrecord sr;
+	if (fsbgphase) {
+		if (e->parent) {
+			fsnodes_bgstore_node(e->parent);
+			fsnodes_bgstore_edges(e->parent);
+		}
+		if (e->child) {
+			fsnodes_bgstore_node(e->child);
+			if (e->child->type!=TYPE_DIRECTORY) {
+				fsnodes_bgstore_edges(e->child);
+			}
+		}
+	}
 	if (e->parent) {
 		fsnodes_edgeid_remove(e);
 		fsnodes_get_stats(e->child,&sr);
@@ -1967,6 +2255,9 @@ static inline void fsnodes_link(uint32_t ts,fsnode *parent,fsnode *child,uint16_
 	fsedge *e;
 	statsrecord sr;
 
+	fsnodes_bgstore_node(parent);
+	fsnodes_bgstore_edges(parent);
+	fsnodes_bgstore_node(child);
 	e = fsedge_malloc(nleng);
 	passert(e);
 	if (nextedgeid<EDGEID_MAX) {
@@ -2006,6 +2297,9 @@ static inline void fsnodes_link(uint32_t ts,fsnode *parent,fsnode *child,uint16_
 
 static inline fsnode* fsnodes_create_node(uint32_t ts,fsnode* node,uint16_t nleng,const uint8_t *name,uint8_t type,uint16_t mode,uint16_t cumask,uint32_t uid,uint32_t gid,uint8_t copysgid) {
 	fsnode *p;
+	if (lazysnapcnt>0) { // pending snapshots have to be copied before new inode number is taken
+		fsnodes_lazysnap_cow_children(node);
+	}
 	switch (type) {
 		case TYPE_DIRECTORY:
 			p = fsnode_dir_malloc();
@@ -2034,6 +2328,7 @@ static inline fsnode* fsnodes_create_node(uint32_t ts,fsnode* node,uint16_t nlen
 		filenodes++;
 	}
 	p->id = fsnodes_get_next_id();
+	fsnodes_bgstore_newnode(p->id);
 	p->xattrflag = 0;
 	p->aclpermflag = 0;
 	p->acldefflag = 0;
@@ -2399,6 +2694,8 @@ static inline uint8_t fsnodes_appendchunks(uint32_t ts,fsnode *dstobj,fsnode *sr
 	if (srcchunks==0) {
 		return STATUS_OK;
 	}
+	fsnodes_bgstore_node(dstobj);
+	fsnodes_bgstore_node(srcobj);
 	dstchunks=dstobj->data.fdata.chunks;
 	while (dstchunks>0 && dstobj->data.fdata.chunktab[dstchunks-1]==0) {
 		dstchunks--;
@@ -2458,6 +2755,7 @@ static inline void fsnodes_changefilelsetid(fsnode *obj,uint8_t lsetid) {
 	statsrecord psr,nsr;
 	fsedge *e;
 
+	fsnodes_bgstore_node(obj);
 	fsnodes_get_stats(obj,&psr);
 	nsr = psr;
 	nsr.realsize = labelset_get_keepmax_goal(lsetid) * nsr.size;
@@ -2479,6 +2777,7 @@ static inline void fsnodes_setlength(fsnode *obj,uint64_t length) {
 	uint64_t chunkid;
 	fsedge *e;
 	statsrecord psr,nsr;
+	fsnodes_bgstore_node(obj);
 	fsnodes_get_stats(obj,&psr);
 
 	if (obj->type==TYPE_TRASH) {
@@ -2527,11 +2826,15 @@ static inline void fsnodes_remove_node(uint32_t ts,fsnode *toremove) {
 	if (toremove->parents!=NULL) {
 		return;
 	}
+	fsnodes_bgstore_node(toremove);
 	fsnodes_node_delete(toremove);
 	nodes--;
 	if (toremove->type==TYPE_DIRECTORY) {
 		dirnodes--;
 		fsnodes_delete_quotanode(toremove);
+		if (lazysnapcnt>0) {
+			fsnodes_lazysnap_forget(toremove->id);
+		}
 	}
 	if (toremove->type==TYPE_FILE || toremove->type==TYPE_TRASH || toremove->type==TYPE_SUSTAINED) {
 		uint32_t i;
@@ -2667,6 +2970,7 @@ static inline int fsnodes_purge(uint32_t ts,fsnode *p) {
 	fsedge *e;
 	e = p->parents;
 
+	fsnodes_bgstore_node(p);
 	if (p->type==TYPE_TRASH) {
 		trashspace -= p->data.fdata.length;
 		trashnodes--;
@@ -2771,6 +3075,8 @@ static inline uint8_t fsnodes_undel(uint32_t ts,fsnode *node) {
 				return ERROR_EEXIST;
 			}
 			// remove from trash and link to new parent
+			fsnodes_bgstore_node(node);
+			fsnodes_bgstore_edges(node);
 			node->type = TYPE_FILE;
 			node->ctime = ts;
 			fsnodes_link(ts,p,node,partleng,path);
@@ -2823,6 +3129,7 @@ static inline void fsnodes_getgoal_recursive(fsnode *node,uint8_t gmode,uint32_t
 //		}
 		dgtab[node->lsetid]++;
 		if (gmode==GMODE_RECURSIVE) {
+			fsnodes_lazysnap_materialize(node);
 			for (e = node->data.ddata.children ; e ; e=e->nextchild) {
 				fsnodes_getgoal_recursive(e->child,gmode,fgtab,dgtab);
 			}
@@ -2883,6 +3190,7 @@ static inline void fsnodes_gettrashtime_recursive(fsnode *node,uint8_t gmode,bst
 	} else if (node->type==TYPE_DIRECTORY) {
 		fsnodes_bst_add(bstrootdirs,node->trashtime);
 		if (gmode==GMODE_RECURSIVE) {
+			fsnodes_lazysnap_materialize(node);
 			for (e = node->data.ddata.children ; e ; e=e->nextchild) {
 				fsnodes_gettrashtime_recursive(e->child,gmode,bstrootfiles,bstrootdirs);
 			}
@@ -2899,6 +3207,7 @@ static inline void fsnodes_geteattr_recursive(fsnode *node,uint8_t gmode,uint32_
 	} else {
 		deattrtab[(node->flags)]++;
 		if (gmode==GMODE_RECURSIVE) {
+			fsnodes_lazysnap_materialize(node);
 			for (e = node->data.ddata.children ; e ; e=e->nextchild) {
 				fsnodes_geteattr_recursive(e->child,gmode,feattrtab,deattrtab);
 			}
@@ -2938,6 +3247,7 @@ static inline void fsnodes_getarch_recursive(fsnode *node,uint64_t *archchunks,u
 		(*archchunks) += archived;
 		(*notarchchunks) += notarchived;
 	} else if (node->type==TYPE_DIRECTORY) {
+		fsnodes_lazysnap_materialize(node);
 		for (e = node->data.ddata.children ; e ; e=e->nextchild) {
 			fsnodes_getarch_recursive(e->child,archchunks,notarchchunks,archinodes,partinodes,notarchinodes);
 		}
@@ -2952,6 +3262,7 @@ static inline uint64_t fsnodes_setgoal_recursive_test_quota(fsnode *node,uint32_
 	fsnodes_keep_alive_check();
 	if (node->type==TYPE_DIRECTORY && recursive) {
 		rs = 0;
+		fsnodes_lazysnap_materialize(node);
 		for (e = node->data.ddata.children ; e ; e=e->nextchild) {
 			if (fsnodes_setgoal_recursive_test_quota(e->child,uid,goal,2,&rs)) {
 				return 1;
@@ -3029,6 +3340,7 @@ static inline void fsnodes_setgoal_recursive(fsnode *node,uint32_t ts,uint32_t u
 				break;
 			}
 			if (set) {
+				fsnodes_bgstore_node(node);
 				if (node->type!=TYPE_DIRECTORY) {
 					fsnodes_changefilelsetid(node,lsetid);
 					(*sinodes)++;
@@ -3044,6 +3356,7 @@ static inline void fsnodes_setgoal_recursive(fsnode *node,uint32_t ts,uint32_t u
 			}
 		}
 		if (node->type==TYPE_DIRECTORY && (smode&SMODE_RMASK)) {
+			fsnodes_lazysnap_materialize(node);
 			for (e = node->data.ddata.children ; e ; e=e->nextchild) {
 				fsnodes_setgoal_recursive(e->child,ts,uid,lsetid,smode,admin,sinodes,ncinodes,nsinodes);
 			}
@@ -3060,6 +3373,7 @@ static inline void fsnodes_settrashtime_recursive(fsnode *node,uint32_t ts,uint3
 		if ((node->flags&EATTR_NOOWNER)==0 && uid!=0 && node->uid!=uid) {
 			(*nsinodes)++;
 		} else {
+			fsnodes_bgstore_node(node);
 			set=0;
 			switch (smode&SMODE_TMASK) {
 			case SMODE_SET:
@@ -3089,6 +3403,7 @@ static inline void fsnodes_settrashtime_recursive(fsnode *node,uint32_t ts,uint3
 			}
 		}
 		if (node->type==TYPE_DIRECTORY && (smode&SMODE_RMASK)) {
+			fsnodes_lazysnap_materialize(node);
 			for (e = node->data.ddata.children ; e ; e=e->nextchild) {
 				fsnodes_settrashtime_recursive(e->child,ts,uid,trashtime,smode,sinodes,ncinodes,nsinodes);
 			}
@@ -3104,6 +3419,7 @@ static inline void fsnodes_seteattr_recursive(fsnode *node,uint32_t ts,uint32_t
 	if ((node->flags&EATTR_NOOWNER)==0 && uid!=0 && node->uid!=uid) {
 		(*nsinodes)++;
 	} else {
+		fsnodes_bgstore_node(node);
 		seattr = eattr;
 		if (node->type!=TYPE_DIRECTORY) {
 			node->flags &= ~(EATTR_NOECACHE);
@@ -3131,6 +3447,7 @@ static inline void fsnodes_seteattr_recursive(fsnode *node,uint32_t ts,uint32_t
 		}
 	}
 	if (node->type==TYPE_DIRECTORY && (smode&SMODE_RMASK)) {
+		fsnodes_lazysnap_materialize(node);
 		for (e = node->data.ddata.children ; e ; e=e->nextchild) {
 			fsnodes_seteattr_recursive(e->child,ts,uid,eattr,smode,sinodes,ncinodes,nsinodes);
 		}
@@ -3161,17 +3478,173 @@ static inline void fsnodes_chgarch_recursive(fsnode *node,uint32_t ts,uint32_t u
 			(*chgchunks) += aflagchanged;
 			(*notchgchunks) += (allchunks - aflagchanged);
 			if (cmd==ARCHCTL_CLR) {
+				fsnodes_bgstore_node(node);
 				node->ctime = ts;
 			}
 		}
 	}
 	if (node->type==TYPE_DIRECTORY) {
+		fsnodes_lazysnap_materialize(node);
 		for (e = node->data.ddata.children ; e ; e=e->nextchild) {
 			fsnodes_chgarch_recursive(e->child,ts,uid,cmd,chgchunks,notchgchunks,nsinodes);
 		}
 	}
 }
 
+/* lazy snapshots */
+/* in lazy mode (SNAPSHOT_MODE_LAZY) children of newly created directories are not copied by the snapshot operation itself - */
+/* such directory is only registered as pending copy of its source (statistics of the whole source are accounted in advance). */
+/* Pending directory is copied (one level at a time - its subdirectories become pending ones) before anything is looked up or */
+/* listed in it, before its source or anything below the source is modified and in the background. Every such copy is stored */
+/* in changelog as SNAPEXPAND(dstinode), so restoring metadata gives exactly the same inode numbers. */
+
+static inline lazysnapjob* fsnodes_lazysnap_job_new(uint32_t ts,uint8_t smode,uint8_t sesflags,uint32_t uid,uint32_t gids,uint32_t *gid,uint16_t cumask) {
+	lazysnapjob *job;
+	job = malloc(sizeof(lazysnapjob));
+	passert(job);
+	job->ts = ts;
+	job->uid = uid;
+	job->gids = gids;
+	if (gids>0) {
+		job->gid = malloc(sizeof(uint32_t)*gids);
+		passert(job->gid);
+		memcpy(job->gid,gid,sizeof(uint32_t)*gids);
+	} else {
+		job->gid = NULL;
+	}
+	job->cumask = cumask;
+	job->smode = smode;
+	job->sesflags = sesflags;
+	job->refcnt = 1;
+	job->storeid = 0;
+	job->next = lazysnapjobhead;
+	if (job->next) {
+		job->next->prev = &(job->next);
+	}
+	job->prev = &lazysnapjobhead;
+	lazysnapjobhead = job;
+	return job;
+}
+
+static inline void fsnodes_lazysnap_job_release(lazysnapjob *job) {
+	job->refcnt--;
+	if (job->refcnt==0) {
+		*(job->prev) = job->next;
+		if (job->next) {
+			job->next->prev = job->prev;
+		}
+		if (job->gid) {
+			free(job->gid);
+		}
+		free(job);
+	}
+}
+
+static inline void fsnodes_lazysnap_add(uint32_t srcid,uint32_t dstid,lazysnapjob *job,const statsrecord *vstats) {
+	lazysnap *ls;
+	uint32_t hash;
+
+	ls = lazysnap_malloc();
+	passert(ls);
+	ls->srcid = srcid;
+	ls->dstid = dstid;
+	ls->job = job;
+	job->refcnt++;
+	ls->vstats = *vstats;
+	hash = LAZYSNAP_HASH(srcid);
+	ls->snext = lazysnapsrchash[hash];
+	if (ls->snext) {
+		ls->snext->sprev = &(ls->snext);
+	}
+	ls->sprev = lazysnapsrchash+hash;
+	lazysnapsrchash[hash] = ls;
+	hash = LAZYSNAP_HASH(dstid);
+	ls->dnext = lazysnapdsthash[hash];
+	if (ls->dnext) {
+		ls->dnext->dprev = &(ls->dnext);
+	}
+	ls->dprev = lazysnapdsthash+hash;
+	lazysnapdsthash[hash] = ls;
+	ls->next = NULL;
+	ls->prev = lazysnaptail;
+	*lazysnaptail = ls;
+	lazysnaptail = &(ls->next);
+	lazysnapcnt++;
+}
+
+static inline void fsnodes_lazysnap_remove(lazysnap *ls) {
+	*(ls->sprev) = ls->snext;
+	if (ls->snext) {
+		ls->snext->sprev = ls->sprev;
+	}
+	*(ls->dprev) = ls->dnext;
+	if (ls->dnext) {
+		ls->dnext->dprev = ls->dprev;
+	}
+	*(ls->prev) = ls->next;
+	if (ls->next) {
+		ls->next->prev = ls->prev;
+	} else {
+		lazysnaptail = ls->prev;
+	}
+	fsnodes_lazysnap_job_release(ls->job);
+	lazysnap_free(ls);
+	lazysnapcnt--;
+}
+
+static inline lazysnap* fsnodes_lazysnap_find_src(uint32_t id) {
+	lazysnap *ls;
+	for (ls = lazysnapsrchash[LAZYSNAP_HASH(id)] ; ls ; ls=ls->snext) {
+		if (ls->srcid==id) {
+			return ls;
+		}
+	}
+	return NULL;
+}
+
+static inline lazysnap* fsnodes_lazysnap_find_dst(uint32_t id) {
+	lazysnap *ls;
+	for (ls = lazysnapdsthash[LAZYSNAP_HASH(id)] ; ls ; ls=ls->dnext) {
+		if (ls->dstid==id) {
+			return ls;
+		}
+	}
+	return NULL;
+}
+
+// new directory 'dstnode' is a copy of 'srcnode' - register it as pending one instead of copying children
+static inline void fsnodes_lazysnap_register(fsnode *srcnode,fsnode *dstnode,lazysnapjob *job) {
+	statsrecord vsr;
+	vsr = srcnode->data.ddata.stats;
+	fsnodes_lazysnap_add(srcnode->id,dstnode->id,job,&vsr);
+	fsnodes_add_stats(dstnode,&vsr);
+}
+
+// pending directory is going to be removed with its whole content - forget about it without copying
+static inline void fsnodes_lazysnap_drop(fsnode *p) {
+	lazysnap *ls;
+	if (lazysnapcnt==0 || (p->flags&EATTR_SNAPSHOT)==0) {
+		return;
+	}
+	ls = fsnodes_lazysnap_find_dst(p->id);
+	if (ls!=NULL && fsnodes_lazysnap_find_src(p->id)==NULL) {
+		fsnodes_sub_stats(p,&(ls->vstats));
+		fsnodes_lazysnap_remove(ls);
+	}
+}
+
+// directory is being deleted - it should be copied before (sources) or it's empty (destinations)
+static void fsnodes_lazysnap_forget(uint32_t id) {
+	lazysnap *ls;
+	while ((ls = fsnodes_lazysnap_find_src(id))!=NULL) {
+		syslog(LOG_WARNING,"lazy snapshot: source directory %"PRIu32" removed before copying it to %"PRIu32,id,ls->dstid);
+		fsnodes_lazysnap_remove(ls);
+	}
+	if ((ls = fsnodes_lazysnap_find_dst(id))!=NULL) {
+		fsnodes_lazysnap_remove(ls);
+	}
+}
+
 static inline uint8_t fsnodes_remove_snapshot_test(fsedge *e,uint32_t sesflags,uint32_t uid,uint32_t gids,uint32_t *gid,uint8_t mr) {
 	fsnode *n;
 	fsedge *ie;
@@ -3180,6 +3653,9 @@ static inline uint8_t fsnodes_remove_snapshot_test(fsedge *e,uint32_t sesflags,u
 	fsnodes_keep_alive_check();
 	if (n->type == TYPE_DIRECTORY) {
 		if (mr==1 || fsnodes_access_ext(n,uid,gids,gid,MODE_MASK_W|MODE_MASK_X,sesflags)) {
+			if (mr==0 && uid!=0) { // not copied objects are always removable by root
+				fsnodes_lazysnap_materialize(n);
+			}
 			for (ie = n->data.ddata.children ; ie ; ie=ie->nextchild) {
 				status = fsnodes_remove_snapshot_test(ie,sesflags,uid,gids,gid,mr);
 				if (status!=STATUS_OK) {
@@ -3202,7 +3678,11 @@ static inline void fsnodes_remove_snapshot(uint32_t ts,fsedge *e,uint32_t sesfla
 	n = e->child;
 	fsnodes_keep_alive_check();
 	if (n->type == TYPE_DIRECTORY) {
+		if (mr==1 || uid==0) { // there is no need to copy objects which would be removed anyway
+			fsnodes_lazysnap_drop(n);
+		}
 		if (mr==1 || fsnodes_access_ext(n,uid,gids,gid,MODE_MASK_W|MODE_MASK_X,sesflags)) {
+			fsnodes_lazysnap_materialize(n);
 			for (ie = n->data.ddata.children ; ie ; ie=ien) {
 				ien = ie->nextchild;
 				fsnodes_remove_snapshot(ts,ie,sesflags,uid,gids,gid,mr);
@@ -3217,7 +3697,7 @@ static inline void fsnodes_remove_snapshot(uint32_t ts,fsedge *e,uint32_t sesfla
 	}
 }
 
-static inline void fsnodes_snapshot(uint32_t ts,fsnode *srcnode,fsnode *parentnode,uint32_t nleng,const uint8_t *name,uint8_t smode,uint8_t sesflags,uint32_t uid,uint32_t gids,uint32_t *gid,uint16_t cumask,uint8_t mr) {
+static inline void fsnodes_snapshot(uint32_t ts,fsnode *srcnode,fsnode *parentnode,uint32_t nleng,const uint8_t *name,uint8_t smode,uint8_t sesflags,uint32_t uid,uint32_t gids,uint32_t *gid,uint16_t cumask,uint8_t mr,lazysnapjob *job) {
 	fsedge *e;
 	fsnode *dstnode;
 	uint32_t i;
@@ -3240,10 +3720,12 @@ static inline void fsnodes_snapshot(uint32_t ts,fsnode *srcnode,fsnode *parentno
 	}
 	if ((e=fsnodes_lookup(parentnode,nleng,name))) { // element already exists
 		dstnode = e->child;
+		fsnodes_bgstore_node(dstnode);
 		if (srcnode->type==TYPE_DIRECTORY) {
 			if (rec) {
+				fsnodes_lazysnap_materialize(srcnode);
 				for (e = srcnode->data.ddata.children ; e ; e=e->nextchild) {
-					fsnodes_snapshot(ts,e->child,dstnode,e->nleng,e->name,smode,sesflags,uid,gids,gid,cumask,mr);
+					fsnodes_snapshot(ts,e->child,dstnode,e->nleng,e->name,smode,sesflags,uid,gids,gid,cumask,mr,job);
 				}
 			}
 		} else if (srcnode->type==TYPE_FILE) {
@@ -3377,8 +3859,13 @@ static inline void fsnodes_snapshot(uint32_t ts,fsnode *srcnode,fsnode *parentno
 			dstnode->flags |= EATTR_SNAPSHOT;
 			if (srcnode->type==TYPE_DIRECTORY) {
 				if (rec) {
-					for (e = srcnode->data.ddata.children ; e ; e=e->nextchild) {
-						fsnodes_snapshot(ts,e->child,dstnode,e->nleng,e->name,smode,sesflags,uid,gids,gid,cumask,mr);
+					if (job) {
+						fsnodes_lazysnap_register(srcnode,dstnode,job);
+					} else {
+						fsnodes_lazysnap_materialize(srcnode);
+						for (e = srcnode->data.ddata.children ; e ; e=e->nextchild) {
+							fsnodes_snapshot(ts,e->child,dstnode,e->nleng,e->name,smode,sesflags,uid,gids,gid,cumask,mr,NULL);
+						}
 					}
 				}
 			} else if (srcnode->type==TYPE_FILE) {
@@ -3436,6 +3923,9 @@ static inline uint8_t fsnodes_snapshot_test(fsnode *origsrcnode,fsnode *srcnode,
 			return ERROR_EPERM;
 		}
 		if (srcnode->type==TYPE_DIRECTORY) {
+			// pending snapshots have to be copied here - not in the middle of snapshot operation
+			fsnodes_lazysnap_materialize(srcnode);
+			fsnodes_lazysnap_cow_children(dstnode);
 			for (e = srcnode->data.ddata.children ; e ; e=e->nextchild) {
 				status = fsnodes_snapshot_test(origsrcnode,e->child,dstnode,e->nleng,e->name,canoverwrite);
 				if (status!=STATUS_OK) {
@@ -3492,6 +3982,7 @@ static inline uint8_t fsnodes_snapshot_recursive_test_quota(fsnode *srcnode,fsno
 			common_length = 0;
 			common_size = 0;
 			common_realsize = 0;
+			fsnodes_lazysnap_materialize(srcnode);
 			for (e = srcnode->data.ddata.children ; e ; e=e->nextchild) {
 				if (fsnodes_snapshot_recursive_test_quota(e->child,dstnode,e->nleng,e->name,&common_inodes,&common_length,&common_size,&common_realsize)) {
 					return 1;
@@ -3529,25 +4020,138 @@ static inline uint8_t fsnodes_snapshot_recursive_test_quota(fsnode *srcnode,fsno
 	return 0;
 }
 
-static inline int fsnodes_namecheck(uint32_t nleng,const uint8_t *name) {
-	uint32_t i;
-	if (nleng==0 || nleng>MAXFNAMELENG) {
-		return -1;
+static void fsnodes_lazysnap_expand(lazysnap *ls) {
+	fsnode *srcnode,*dstnode;
+	lazysnapjob *job;
+	lazysnap *sls;
+	fsedge *e;
+	statsrecord vsr;
+
+	srcnode = fsnodes_node_find(ls->srcid);
+	dstnode = fsnodes_node_find(ls->dstid);
+	if (lazysnapactive && lazysnapbusy==0) { // copies made while copying are implied by this one
+		changelog("%"PRIu32"|SNAPEXPAND(%"PRIu32")",main_time(),ls->dstid);
+	}
+	job = ls->job;
+	job->refcnt++;
+	vsr = ls->vstats;
+	fsnodes_lazysnap_remove(ls);
+	if (dstnode!=NULL && dstnode->type==TYPE_DIRECTORY) {
+		fsnodes_sub_stats(dstnode,&vsr);
+		if (srcnode!=NULL && srcnode->type==TYPE_DIRECTORY) {
+			lazysnapbusy++;
+			if (lazysnapcnt>0 && (sls = fsnodes_lazysnap_find_dst(srcnode->id))!=NULL) { // source is also pending
+				fsnodes_lazysnap_expand(sls);
+			}
+			for (e = srcnode->data.ddata.children ; e ; e=e->nextchild) {
+				fsnodes_snapshot(job->ts,e->child,dstnode,e->nleng,e->name,job->smode,job->sesflags,job->uid,job->gids,job->gid,job->cumask,0,job);
+			}
+			lazysnapbusy--;
+		}
 	}
-	if (name[0]=='.') {
-		if (nleng==1) {
-			return -1;
+	fsnodes_lazysnap_job_release(job);
+}
+
+// anything is going to be looked up or listed in 'p'
+static void fsnodes_lazysnap_materialize(fsnode *p) {
+	lazysnap *ls;
+	if (lazysnapcnt==0 || lazysnapactive==0 || lazysnapbusy || fs_readonly_phase) {
+		return;
+	}
+	if (p->type==TYPE_DIRECTORY && (ls = fsnodes_lazysnap_find_dst(p->id))!=NULL) {
+		fsnodes_lazysnap_expand(ls);
+	}
+}
+
+// object 'p' is going to be modified - copy every pending directory which shares it (top-down)
+static void fsnodes_lazysnap_cow_node(fsnode *p) {
+	fsedge *e;
+	if (lazysnapcnt==0 || lazysnapactive==0 || lazysnapbusy || fs_readonly_phase) {
+		return;
+	}
+	for (e=p->parents ; e ; e=e->nextparent) {
+		if (e->parent) {
+			fsnodes_lazysnap_cow_children(e->parent);
 		}
-		if (nleng==2 && name[1]=='.') {
-			return -1;
+	}
+}
+
+// list of children of 'p' (or any of them) is going to be modified
+static void fsnodes_lazysnap_cow_children(fsnode *p) {
+	lazysnap *ls;
+	if (lazysnapcnt==0 || lazysnapactive==0 || lazysnapbusy || fs_readonly_phase) {
+		return;
+	}
+	fsnodes_lazysnap_cow_node(p);
+	if (p->type==TYPE_DIRECTORY) {
+		while (lazysnapcnt>0 && (ls = fsnodes_lazysnap_find_src(p->id))!=NULL) {
+			fsnodes_lazysnap_expand(ls);
 		}
+		fsnodes_lazysnap_materialize(p);
 	}
-	for (i=0 ; i<nleng ; i++) {
-		if (name[i]=='\0' || name[i]=='/') {
-			return -1;
+}
+
+// whole subtree is going to be copied by non-lazy snapshot
+static void fsnodes_lazysnap_materialize_tree(fsnode *p) {
+	fsedge *e;
+	fsnodes_keep_alive_check();
+	fsnodes_lazysnap_materialize(p);
+	for (e = p->data.ddata.children ; e && lazysnapcnt>0 ; e=e->nextchild) {
+		if (e->child->type==TYPE_DIRECTORY) {
+			fsnodes_lazysnap_materialize_tree(e->child);
 		}
 	}
-	return 0;
+}
+
+static void fs_lazysnap_step(void) {
+	uint64_t deadline;
+	if (lazysnapcnt==0 || lazysnapactive==0) {
+		return;
+	}
+	deadline = monotonic_useconds()+LAZYSNAP_STEP_USEC;
+	while (lazysnaphead!=NULL && monotonic_useconds()<deadline) {
+		fsnodes_lazysnap_expand(lazysnaphead);
+	}
+}
+
+void fs_lazysnap_activate(void) {
+	lazysnapactive = 1;
+}
+
+uint32_t fs_lazysnap_count(void) {
+	return lazysnapcnt;
+}
+
+uint8_t fs_mr_snapexpand(uint32_t ts,uint32_t inode) {
+	lazysnap *ls;
+	(void)ts;
+	if ((ls = fsnodes_lazysnap_find_dst(inode))==NULL) {
+		return ERROR_ENOENT;
+	}
+	fsnodes_lazysnap_expand(ls);
+	meta_version_inc();
+	return STATUS_OK;
+}
+
+static inline int fsnodes_namecheck(uint32_t nleng,const uint8_t *name) {
+	uint32_t i;
+	if (nleng==0 || nleng>MAXFNAMELENG) {
+		return -1;
+	}
+	if (name[0]=='.') {
+		if (nleng==1) {
+			return -1;
+		}
+		if (nleng==2 && name[1]=='.') {
+			return -1;
+		}
+	}
+	for (i=0 ; i<nleng ; i++) {
+		if (name[i]=='\0' || name[i]=='/') {
+			return -1;
+		}
+	}
+	return 0;
 }
 
 static inline uint8_t fsnodes_node_find_ext(uint32_t rootinode,uint8_t sesflags,uint32_t *inode,fsnode **rootnode,fsnode **node,uint8_t skipancestor) {
@@ -3990,6 +4594,11 @@ void fs_statfs(uint32_t rootinode,uint8_t sesflags,uint64_t *totalspace,uint64_t
 	stats_statfs++;
 }
 
+void fs_set_readonly_phase(uint8_t ro) {
+	fs_readonly_phase = ro;
+}
+
+// fs_access, fs_lookup and fs_getattr can be called concurrently (see fsreaders.c) - they must not modify anything
 uint8_t fs_access(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t uid,uint32_t gids,uint32_t *gid,int modemask) {
 	fsnode *p;
 	if ((sesflags&SESFLAG_READONLY) && (modemask&MODE_MASK_W)) {
@@ -4025,7 +4634,7 @@ uint8_t fs_lookup(uint32_t rootinode,uint8_t sesflags,uint32_t parent,uint16_t n
 				*inode = wd->id;
 			}
 			fsnodes_fill_attr(wd,wd,uid,gid[0],auid,agid,sesflags,attr);
-			stats_lookup++;
+			__sync_fetch_and_add(&stats_lookup,1);
 			return STATUS_OK;
 		}
 		if (nleng==2 && name[1]=='.') {	// parent
@@ -4045,7 +4654,7 @@ uint8_t fs_lookup(uint32_t rootinode,uint8_t sesflags,uint32_t parent,uint16_t n
 					fsnodes_fill_attr(rn,wd,uid,gid[0],auid,agid,sesflags,attr);
 				}
 			}
-			stats_lookup++;
+			__sync_fetch_and_add(&stats_lookup,1);
 			return STATUS_OK;
 		}
 	}
@@ -4062,7 +4671,7 @@ uint8_t fs_lookup(uint32_t rootinode,uint8_t sesflags,uint32_t parent,uint16_t n
 	}
 	*inode = e->child->id;
 	fsnodes_fill_attr(e->child,wd,uid,gid[0],auid,agid,sesflags,attr);
-	stats_lookup++;
+	__sync_fetch_and_add(&stats_lookup,1);
 	return STATUS_OK;
 }
 
@@ -4075,7 +4684,7 @@ uint8_t fs_getattr(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint8_t op
 		return ERROR_ENOENT;
 	}
 	fsnodes_fill_attr(p,NULL,uid,gid,auid,agid,sesflags,attr);
-	stats_getattr++;
+	__sync_fetch_and_add(&stats_getattr,1);
 	return STATUS_OK;
 }
 
@@ -4099,6 +4708,7 @@ uint8_t fs_try_setlength(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint
 	if (flags & TRUNCATE_FLAG_UPDATE) {
 		return STATUS_OK;
 	}
+	fsnodes_lazysnap_cow_node(p); // before chunk_multi_truncate
 	if (length>p->data.fdata.length) {
 		uint32_t lastchunk_pre,lastchunksize_pre,lastchunk_post,lastchunksize_post;
 		uint64_t size_diff;
@@ -4141,9 +4751,10 @@ uint8_t fs_try_setlength(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint
 				if (status!=STATUS_OK) {
 					return status;
 				}
+				fsnodes_bgstore_node(p);
 				p->data.fdata.chunktab[*indx] = nchunkid;
 				*chunkid = nchunkid;
-				changelog("%"PRIu32"|TRUNC(%"PRIu32",%"PRIu32"):%"PRIu64,(uint32_t)main_time(),inode,*indx,nchunkid);
+				changelog_op(CHLOP_TRUNC,main_time(),inode,*indx,nchunkid);
 				return ERROR_DELAYED;
 			}
 		}
@@ -4181,7 +4792,7 @@ uint8_t fs_mr_trunc(uint32_t ts,uint32_t inode,uint32_t indx,uint64_t nchunkid)
 }
 
 uint8_t fs_end_setlength(uint64_t chunkid) {
-	changelog("%"PRIu32"|UNLOCK(%"PRIu64")",(uint32_t)main_time(),chunkid);
+	changelog_op(CHLOP_UNLOCK,main_time(),chunkid);
 	return chunk_unlock(chunkid);
 }
 
@@ -4198,14 +4809,16 @@ uint8_t fs_do_setlength(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint8
 	if (fsnodes_node_find_ext(rootinode,sesflags,&inode,NULL,&p,0)==0) {
 		return ERROR_ENOENT;
 	}
+	fsnodes_lazysnap_cow_node(p); // before fsnodes_setlength
 	if (flags & TRUNCATE_FLAG_UPDATE) {
 		if (length>p->data.fdata.length) {
 			fsnodes_setlength(p,length);
-			changelog("%"PRIu32"|LENGTH(%"PRIu32",%"PRIu64",0)",ts,inode,p->data.fdata.length);
+			changelog_op(CHLOP_LENGTH,ts,inode,p->data.fdata.length,0);
 		}
 	} else {
 		fsnodes_setlength(p,length);
-		changelog("%"PRIu32"|LENGTH(%"PRIu32",%"PRIu64",1)",ts,inode,p->data.fdata.length);
+		changelog_op(CHLOP_LENGTH,ts,inode,p->data.fdata.length,1);
+		fsnodes_bgstore_node(p);
 		p->ctime = p->mtime = ts;
 		stats_setattr++;
 	}
@@ -4256,6 +4869,7 @@ uint8_t fs_setattr(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint8_t op
 			}
 		}
 	}
+	fsnodes_bgstore_node(p);
 	// first ignore sugid clears done by kernel
 	if ((setmask&(SET_UID_FLAG|SET_GID_FLAG)) && (setmask&SET_MODE_FLAG)) {	// chown+chmod = chown with sugid clears
 		attrmode |= (p->mode & 06000);
@@ -4346,7 +4960,7 @@ uint8_t fs_setattr(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint8_t op
 	if (setmask&SET_MTIME_NOW_FLAG) {
 		p->mtime = ts;
 	}
-	changelog("%"PRIu32"|ATTR(%"PRIu32",%"PRIu16",%"PRIu32",%"PRIu32",%"PRIu32",%"PRIu32")",ts,inode,(uint16_t)(p->mode),p->uid,p->gid,p->atime,p->mtime);
+	changelog_op(CHLOP_ATTR,ts,inode,(uint16_t)(p->mode),p->uid,p->gid,p->atime,p->mtime);
 	p->ctime = ts;
 	fsnodes_fill_attr(p,NULL,uid,gid[0],auid,agid,sesflags,attr);
 	stats_setattr++;
@@ -4408,8 +5022,9 @@ uint8_t fs_readlink(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t
 	*pleng = p->data.sdata.pleng;
 	*path = p->data.sdata.path;
 	if (p->atime!=ts) {
+		fsnodes_bgstore_node(p);
 		p->atime = ts;
-		changelog("%"PRIu32"|ACCESS(%"PRIu32")",ts,inode);
+		changelog_op(CHLOP_ACCESS,ts,inode);
 	}
 	stats_readlink++;
 	return STATUS_OK;
@@ -4533,7 +5148,7 @@ uint8_t fs_univ_create(uint32_t ts,uint32_t rootinode,uint8_t sesflags,uint32_t
 		if (attr) {
 			fsnodes_fill_attr(p,wd,uid,gid[0],auid,agid,sesflags,attr);
 		}
-		changelog("%"PRIu32"|CREATE(%"PRIu32",%s,%"PRIu8",%"PRIu16",%"PRIu16",%"PRIu32",%"PRIu32",%"PRIu32"):%"PRIu32,(uint32_t)main_time(),parent,changelog_escape_name(nleng,name),type,mode,cumask,uid,gid[0],rdev,p->id);
+		changelog_op(CHLOP_CREATE,main_time(),parent,nleng,name,type,mode,cumask,uid,gid[0],rdev,p->id);
 	} else {
 		meta_version_inc();
 	}
@@ -4597,6 +5212,7 @@ uint8_t fs_univ_unlink(uint32_t ts,uint32_t rootinode,uint8_t sesflags,uint32_t
 	if ((sesflags&SESFLAG_METARESTORE)==0 && (!fsnodes_sticky_access(wd,e->child,uid))) {
 		return ERROR_EPERM;
 	}
+	fsnodes_lazysnap_materialize(e->child);
 	if ((sesflags&SESFLAG_METARESTORE)==0) {
 		if (dirmode==0) {
 			if (e->child->type==TYPE_DIRECTORY) {
@@ -4624,7 +5240,7 @@ uint8_t fs_univ_unlink(uint32_t ts,uint32_t rootinode,uint8_t sesflags,uint32_t
 		*inode = e->child->id;
 	}
 	if ((sesflags&SESFLAG_METARESTORE)==0) {
-		changelog("%"PRIu32"|UNLINK(%"PRIu32",%s):%"PRIu32,ts,parent,changelog_escape_name(nleng,name),e->child->id);
+		changelog_op(CHLOP_UNLINK,ts,parent,nleng,name,e->child->id);
 	} else {
 		meta_version_inc();
 	}
@@ -4737,6 +5353,7 @@ uint8_t fs_univ_move(uint32_t ts,uint32_t rootinode,uint8_t sesflags,uint32_t pa
 		}
 	}
 	if (de) {
+		fsnodes_lazysnap_materialize(de->child);
 		if (de->child->type==TYPE_DIRECTORY && de->child->data.ddata.children!=NULL) {
 			return ERROR_ENOTEMPTY;
 		}
@@ -4752,7 +5369,7 @@ uint8_t fs_univ_move(uint32_t ts,uint32_t rootinode,uint8_t sesflags,uint32_t pa
 		fsnodes_fill_attr(node,dwd,uid,gid[0],auid,agid,sesflags,attr);
 	}
 	if ((sesflags&SESFLAG_METARESTORE)==0) {
-		changelog("%"PRIu32"|MOVE(%"PRIu32",%s,%"PRIu32",%s):%"PRIu32,ts,parent_src,changelog_escape_name(nleng_src,name_src),parent_dst,changelog_escape_name(nleng_dst,name_dst),node->id);
+		changelog_op(CHLOP_MOVE,ts,parent_src,nleng_src,name_src,parent_dst,nleng_dst,name_dst,node->id);
 	} else {
 		meta_version_inc();
 	}
@@ -4823,7 +5440,7 @@ uint8_t fs_univ_link(uint32_t ts,uint32_t rootinode,uint8_t sesflags,uint32_t in
 		if (attr) {
 			fsnodes_fill_attr(sp,dwd,uid,gid[0],auid,agid,sesflags,attr);
 		}
-		changelog("%"PRIu32"|LINK(%"PRIu32",%"PRIu32",%s)",ts,inode_src,parent_dst,changelog_escape_name(nleng_dst,name_dst));
+		changelog_op(CHLOP_LINK,ts,inode_src,parent_dst,nleng_dst,name_dst);
 	} else {
 		meta_version_inc();
 	}
@@ -4857,6 +5474,7 @@ uint8_t fs_univ_snapshot(uint32_t ts,uint32_t rootinode,uint8_t sesflags,uint32_
 	fsnode *sp;
 	fsnode *dwd;
 	fsedge *e;
+	lazysnapjob *job;
 	uint8_t status;
 	if ((sesflags&SESFLAG_METARESTORE)==0 && (sesflags&SESFLAG_READONLY)) {
 		return ERROR_EROFS;
@@ -4919,6 +5537,12 @@ uint8_t fs_univ_snapshot(uint32_t ts,uint32_t rootinode,uint8_t sesflags,uint32_
 		}
 
 		fsnodes_keep_alive_begin();
+		if ((sesflags&SESFLAG_METARESTORE)==0 && lazysnapcnt>0) { // copy pending snapshots before anything is changed
+			fsnodes_lazysnap_cow_children(dwd);
+			if ((smode&SNAPSHOT_MODE_LAZY)==0 && sp->type==TYPE_DIRECTORY) {
+				fsnodes_lazysnap_materialize_tree(sp);
+			}
+		}
 		status = fsnodes_snapshot_test(sp,sp,dwd,nleng_dst,name_dst,smode & SNAPSHOT_MODE_CAN_OVERWRITE);
 		if (status!=STATUS_OK) {
 			return status;
@@ -4958,7 +5582,15 @@ uint8_t fs_univ_snapshot(uint32_t ts,uint32_t rootinode,uint8_t sesflags,uint32_
 			}
 		}
 
-		fsnodes_snapshot(ts,sp,dwd,nleng_dst,name_dst,smode,sesflags,uid,gids,gid,cumask,((sesflags&SESFLAG_METARESTORE)==0)?0:1);
+		if (smode & SNAPSHOT_MODE_LAZY) {
+			job = fsnodes_lazysnap_job_new(ts,smode,sesflags&(~SESFLAG_METARESTORE),uid,gids,gid,cumask);
+		} else {
+			job = NULL;
+		}
+		fsnodes_snapshot(ts,sp,dwd,nleng_dst,name_dst,smode,sesflags,uid,gids,gid,cumask,((sesflags&SESFLAG_METARESTORE)==0)?0:1,job);
+		if (job) {
+			fsnodes_lazysnap_job_release(job);
+		}
 	}
 	if ((sesflags&SESFLAG_METARESTORE)==0) {
 		changelog("%"PRIu32"|SNAPSHOT(%"PRIu32",%"PRIu32",%s,%"PRIu8",%"PRIu8",%"PRIu32",%"PRIu32",%s,%"PRIu16")",ts,inode_src,parent_dst,changelog_escape_name(nleng_dst,name_dst),smode,sesflags,uid,gids,changelog_escape_name(gids*4,(const uint8_t*)gid),cumask);
@@ -5090,6 +5722,7 @@ uint8_t fs_readdir_size(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint3
 		if (p->type!=TYPE_DIRECTORY) {
 			return ERROR_ENOTDIR;
 		}
+		fsnodes_lazysnap_materialize(p);
 		if (nedgeid==0) {
 			if (flags&GETDIR_FLAG_WITHATTR) {
 				if (!fsnodes_access_ext(p,uid,gids,gid,MODE_MASK_R|MODE_MASK_X,sesflags)) {
@@ -5121,8 +5754,9 @@ void fs_readdir_data(uint32_t rootinode,uint8_t sesflags,uint32_t uid,uint32_t g
 	uint32_t ts = main_time();
 
 	if (p->atime!=ts) {
+		fsnodes_bgstore_node(p);
 		p->atime = ts;
-		changelog("%"PRIu32"|ACCESS(%"PRIu32")",ts,p->id);
+		changelog_op(CHLOP_ACCESS,ts,p->id);
 	}
 	fsnodes_readdirdata(rootinode,uid,gid,auid,agid,sesflags,p,e,maxentries,nedgeid,dbuff,flags&GETDIR_FLAG_WITHATTR);
 	stats_readdir++;
@@ -5215,8 +5849,9 @@ uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint8_t canmodatime,uint64_t *
 	}
 	*length = p->data.fdata.length;
 	if (p->atime!=ts && canmodatime) {
+		fsnodes_bgstore_node(p);
 		p->atime = ts;
-		changelog("%"PRIu32"|ACCESS(%"PRIu32")",ts,inode);
+		changelog_op(CHLOP_ACCESS,ts,inode);
 	}
 	stats_read++;
 	return STATUS_OK;
@@ -5282,6 +5917,7 @@ uint8_t fs_writechunk(uint32_t inode,uint32_t indx,uint8_t canmodmtime,uint64_t
 	if (fsnodes_test_quota(p,0,lengdiff,sizediff,labelset_get_keepmax_goal(p->lsetid)*sizediff)) {
 		return ERROR_QUOTA;
 	}
+	fsnodes_bgstore_node(p);
 	fsnodes_get_stats(p,&psr);
 	/* resize chunks structure */
 	if (indx>=p->data.fdata.chunks) {
@@ -5311,7 +5947,7 @@ uint8_t fs_writechunk(uint32_t inode,uint32_t indx,uint8_t canmodmtime,uint64_t
 	}
 	*chunkid = nchunkid;
 	*length = p->data.fdata.length;
-	changelog("%"PRIu32"|WRITE(%"PRIu32",%"PRIu32",%"PRIu8",%u):%"PRIu64,ts,inode,indx,*opflag,canmodmtime?1:0,nchunkid);
+	changelog_op(CHLOP_WRITE,ts,inode,indx,*opflag,canmodmtime?1:0,nchunkid);
 	if ((p->mtime!=ts || p->ctime!=ts) && canmodmtime) {
 		p->mtime = p->ctime = ts;
 	}
@@ -5401,6 +6037,7 @@ static inline uint8_t fs_univ_rollback(uint8_t mr,uint32_t inode,uint32_t indx,u
 			chunk_add_file(prevchunkid,p->lsetid);
 		}
 		chunk_delete_file(chunkid,p->lsetid);
+		fsnodes_bgstore_node(p);
 		p->data.fdata.chunktab[indx] = prevchunkid;
 		fsnodes_get_stats(p,&nsr);
 		for (e=p->parents ; e ; e=e->nextparent) {
@@ -5448,9 +6085,10 @@ uint8_t fs_writeend(uint32_t inode,uint64_t length,uint64_t chunkid,uint8_t canm
 			}
 			fsnodes_setlength(p,length);
 			if (canmodmtime) {
+				fsnodes_bgstore_node(p);
 				p->mtime = p->ctime = ts;
 			}
-			changelog("%"PRIu32"|LENGTH(%"PRIu32",%"PRIu64",%u)",ts,inode,length,canmodmtime?1:0);
+			changelog_op(CHLOP_LENGTH,ts,inode,length,canmodmtime?1:0);
 		}
 //		{
 //			uint32_t i;
@@ -5461,7 +6099,7 @@ uint8_t fs_writeend(uint32_t inode,uint64_t length,uint64_t chunkid,uint8_t canm
 //	} else {
 //		syslog(LOG_NOTICE,"writeend: inode: %u ; length: 0 ; chunkid: %016"PRIX64,inode,chunkid);
 	}
-	changelog("%"PRIu32"|UNLOCK(%"PRIu64")",ts,chunkid);
+	changelog_op(CHLOP_UNLOCK,ts,chunkid);
 	return chunk_unlock(chunkid);
 }
 
@@ -5487,10 +6125,12 @@ uint8_t fs_repair(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t ui
 	if (!fsnodes_access_ext(p,uid,gids,gid,MODE_MASK_W,sesflags)) {
 		return ERROR_EACCES;
 	}
+	fsnodes_lazysnap_cow_node(p); // before chunk_repair
 	fsnodes_get_stats(p,&psr);
 	for (indx=0 ; indx<p->data.fdata.chunks ; indx++) {
 		if (chunk_repair(p->lsetid,p->data.fdata.chunktab[indx],&nversion)) {
 			changelog("%"PRIu32"|REPAIR(%"PRIu32",%"PRIu32"):%"PRIu32,ts,inode,indx,nversion);
+			fsnodes_bgstore_node(p);
 			p->mtime = p->ctime = ts;
 			if (nversion>0) {
 				(*repaired)++;
@@ -5836,10 +6476,12 @@ uint8_t fs_setxattr(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint8_t o
 	if (mode>MFS_XATTR_REMOVE) {
 		return ERROR_EINVAL;
 	}
+	fsnodes_lazysnap_cow_node(p); // before xattr_setattr
 	status = xattr_setattr(inode,anleng,attrname,avleng,attrvalue,mode);
 	if (status!=STATUS_OK) {
 		return status;
 	}
+	fsnodes_bgstore_node(p);
 	p->ctime = ts;
 	changelog("%"PRIu32"|SETXATTR(%"PRIu32",%s,%s,%"PRIu8")",ts,inode,changelog_escape_name(anleng,attrname),changelog_escape_name(avleng,attrvalue),mode);
 	return STATUS_OK;
@@ -5921,6 +6563,7 @@ uint8_t fs_setacl(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t ui
 		otherperm = p->mode & 7;
 	}
 	posix_acl_set(inode,acltype,userperm,groupperm,otherperm,mask,namedusers,namedgroups,aclblob);
+	fsnodes_bgstore_node(p);
 	if (acltype==POSIX_ACL_ACCESS) {
 		p->mode &= 07000;
 		p->mode |= ((userperm&7)<<6) | ((groupperm&7)<<3) | (otherperm&7);
@@ -6555,6 +7198,7 @@ void fs_test_files() {
 								mchunks++;
 								break;
 							case CHUNK_FLOOP_DELETED:
+								fsnodes_bgstore_node(f);
 								f->data.fdata.chunktab[j] = 0;
 								changelog("%"PRIu32"|SETFILECHUNK(%"PRIu32",%"PRIu32",0)",main_time(),f->id,j);
 								syslog(LOG_NOTICE,"inode: %"PRIu32" ; index: %"PRIu32" - removed not existing chunk exceeding file size (chunkid: %016"PRIX64")",f->id,j,chunkid);
@@ -6818,6 +7462,12 @@ void fs_cleanupfreenodes(void) {
 	freetail = &freelist;
 }
 
+void fs_cleanuplazysnaps(void) {
+	while (lazysnaphead) {
+		fsnodes_lazysnap_remove(lazysnaphead);
+	}
+}
+
 void fs_cleanup(void) {
 	fprintf(stderr,"cleaning objects ...");
 	fflush(stderr);
@@ -6836,6 +7486,7 @@ void fs_cleanup(void) {
 	quotanode_free_all();
 //	fs_cleanupquota();
 	fprintf(stderr," done\n");
+	fs_cleanuplazysnaps();
 	quotahead = NULL;
 	trashspace = 0;
 	sustainedspace = 0;
@@ -7459,6 +8110,331 @@ static inline int fs_loadnode(bio *fd,uint8_t mver) {
 	return 0;
 }
 
+/* parallel node loader (only current format):
+ * main thread reads records and does everything what touches shared structures (free inode bitmask, label sets, open files),
+ * records are sent in batches to loader threads - every thread owns contiguous range of node hash table, own allocators and decodes records of nodes hashed to its range
+ */
+
+#define NODELOAD_MAX_THREADS 64
+#define NODELOAD_BATCH_SIZE 0x100000
+#define NODELOAD_QUEUE_BATCHES 4
+#define NODELOAD_HDRSIZE (4+1+1+2+6*4)
+
+typedef struct _fsnode_loader {
+	void *queue;		// queue size is counted in batches - batch length is passed as id
+	uint8_t *buff;
+	uint32_t bleng,bsize;
+	uint32_t hashelem;
+	fsnode_arena arena;
+	pthread_t thread;
+} fsnode_loader;
+
+static inline void fs_decodenode(const uint8_t **rptr,fsnode_loader *nl) {
+	const uint8_t *ptr;
+	uint8_t type;
+	uint32_t i,pleng,ch,sessionids,hash;
+	fsnode *p;
+
+	ptr = *rptr;
+	type = get8bit(&ptr);
+	switch (type) {
+		case TYPE_DIRECTORY:
+			p = fsnode_arena_malloc(&(nl->arena),0);
+			break;
+		case TYPE_FILE:
+		case TYPE_TRASH:
+		case TYPE_SUSTAINED:
+			p = fsnode_arena_malloc(&(nl->arena),1);
+			break;
+		case TYPE_SYMLINK:
+			p = fsnode_arena_malloc(&(nl->arena),2);
+			break;
+		case TYPE_BLOCKDEV:
+		case TYPE_CHARDEV:
+			p = fsnode_arena_malloc(&(nl->arena),3);
+			break;
+		default:
+			p = fsnode_arena_malloc(&(nl->arena),4);
+	}
+	passert(p);
+	p->xattrflag = 0;
+	p->aclpermflag = 0;
+	p->acldefflag = 0;
+	p->type = type;
+	p->id = get32bit(&ptr);
+	p->lsetid = get8bit(&ptr);
+	if (type!=TYPE_DIRECTORY && type!=TYPE_FILE && type!=TYPE_TRASH && type!=TYPE_SUSTAINED) {
+		p->lsetid=0;
+	}
+	p->flags = get8bit(&ptr);
+	p->mode = get16bit(&ptr);
+	p->uid = get32bit(&ptr);
+	p->gid = get32bit(&ptr);
+	p->atime = get32bit(&ptr);
+	p->mtime = get32bit(&ptr);
+	p->ctime = get32bit(&ptr);
+	p->trashtime = get32bit(&ptr);
+	switch (type) {
+	case TYPE_DIRECTORY:
+		memset(&(p->data.ddata.stats),0,sizeof(statsrecord));
+		p->data.ddata.quota = NULL;
+		p->data.ddata.children = NULL;
+		p->data.ddata.nlink = 2;
+		p->data.ddata.elements = 0;
+	case TYPE_SOCKET:
+	case TYPE_FIFO:
+		break;
+	case TYPE_BLOCKDEV:
+	case TYPE_CHARDEV:
+		p->data.devdata.rdev = get32bit(&ptr);
+		break;
+	case TYPE_SYMLINK:
+		pleng = get32bit(&ptr);
+		p->data.sdata.pleng = pleng;
+		if (pleng>0) {
+			if (pleng>MFS_SYMLINK_MAX) {	// path has been skipped by reader
+				p->data.sdata.pleng = 22;
+				p->data.sdata.path = symlink_arena_malloc(&(nl->arena),p->data.sdata.pleng);
+				passert(p->data.sdata.path);
+				memcpy(p->data.sdata.path,"... path too long ...",p->data.sdata.pleng);
+			} else {
+				p->data.sdata.path = symlink_arena_malloc(&(nl->arena),pleng);
+				passert(p->data.sdata.path);
+				memcpy(p->data.sdata.path,ptr,pleng);
+				ptr += pleng;
+			}
+		} else {
+			p->data.sdata.path = NULL;
+		}
+		break;
+	case TYPE_FILE:
+	case TYPE_TRASH:
+	case TYPE_SUSTAINED:
+		p->data.fdata.length = get64bit(&ptr);
+		ch = get32bit(&ptr);
+		p->data.fdata.chunks = ch;
+		sessionids = get16bit(&ptr);
+		if (ch>0) {
+			p->data.fdata.chunktab = chunktab_arena_malloc(&(nl->arena),ch);
+			passert(p->data.fdata.chunktab);
+		} else {
+			p->data.fdata.chunktab = NULL;
+		}
+		for (i=0 ; i<ch ; i++) {
+			p->data.fdata.chunktab[i] = get64bit(&ptr);
+		}
+		ptr += 4*sessionids;	// open files have been acquired by reader
+	}
+	p->parents = NULL;
+	// table doesn't grow while nodes are loaded and this hash position belongs only to this thread
+	hash = hash32(p->id) & (nodehashsize-1);
+	p->next = nodehashtab[hash>>HASHTAB_LOBITS][hash&HASHTAB_MASK];
+	nodehashtab[hash>>HASHTAB_LOBITS][hash&HASHTAB_MASK] = p;
+	nl->hashelem++;
+	*rptr = ptr;
+}
+
+static void* fs_loadnodes_worker(void *arg) {
+	fsnode_loader *nl = (fsnode_loader*)arg;
+	uint8_t *batch;
+	const uint8_t *ptr,*end;
+	uint32_t bleng,op;
+
+	for (;;) {
+		queue_get(nl->queue,&bleng,&op,&batch,NULL);
+		if (op==0) {	// end marker
+			return arg;
+		}
+		ptr = batch;
+		end = batch+bleng;
+		while (ptr<end) {
+			fs_decodenode(&ptr,nl);
+		}
+		free(batch);
+	}
+	return arg;
+}
+
+static inline void fs_loadnodes_flush(fsnode_loader *nl) {
+	if (nl->bleng>0) {
+		queue_put(nl->queue,nl->bleng,1,nl->buff,1);
+		nl->buff = NULL;
+		nl->bleng = 0;
+		nl->bsize = 0;
+	}
+}
+
+// returns pointer to 'leng' bytes reserved at the end of current batch
+static inline uint8_t* fs_loadnodes_reserve(fsnode_loader *nl,uint32_t leng) {
+	uint8_t *ret;
+	if (nl->bleng+leng>nl->bsize) {
+		fs_loadnodes_flush(nl);
+		if (nl->buff) {
+			free(nl->buff);
+		}
+		nl->bsize = (leng>NODELOAD_BATCH_SIZE)?leng:NODELOAD_BATCH_SIZE;
+		nl->buff = malloc(nl->bsize);
+		passert(nl->buff);
+	}
+	ret = nl->buff+nl->bleng;
+	nl->bleng += leng;
+	return ret;
+}
+
+static inline int fs_loadnodes_parallel(bio *fd,uint32_t threads) {
+	uint8_t rhdr[1+NODELOAD_HDRSIZE+8+4+2];
+	uint8_t *wptr;
+	const uint8_t *ptr;
+	fsnode_loader *nltab,*nl;
+	uint8_t type,lsetid;
+	uint32_t i,id,hdrleng,dataleng,skipleng,ch,sessionids,created;
+	int status;
+
+	fsnodes_node_hash_alloc();
+	nltab = malloc(sizeof(fsnode_loader)*threads);
+	passert(nltab);
+	created = 0;
+	for (i=0 ; i<threads ; i++) {
+		nl = nltab+created;
+		nl->queue = queue_new(NODELOAD_QUEUE_BATCHES);
+		nl->buff = NULL;
+		nl->bleng = 0;
+		nl->bsize = 0;
+		nl->hashelem = 0;
+		fsnode_arena_init(&(nl->arena));
+		if (main_minthread_create(&(nl->thread),0,fs_loadnodes_worker,nl)<0) {
+			queue_delete(nl->queue);
+			break;
+		}
+		created++;
+	}
+	threads = created;
+	if (threads==0) {
+		free(nltab);
+		return -2;
+	}
+
+	status = 0;
+	while (status==0) {
+		if (bio_read(fd,rhdr,1)!=1) {
+			status = -1;
+			break;
+		}
+		type = rhdr[0];
+		if (type==0) {	// last node
+			status = 1;
+			break;
+		}
+		switch (type) {
+		case TYPE_DIRECTORY:
+		case TYPE_FIFO:
+		case TYPE_SOCKET:
+			hdrleng = NODELOAD_HDRSIZE;
+			break;
+		case TYPE_BLOCKDEV:
+		case TYPE_CHARDEV:
+		case TYPE_SYMLINK:
+			hdrleng = NODELOAD_HDRSIZE+4;
+			break;
+		case TYPE_FILE:
+		case TYPE_TRASH:
+		case TYPE_SUSTAINED:
+			hdrleng = NODELOAD_HDRSIZE+8+4+2;
+			break;
+		default:
+			fputc('\n',stderr);
+			mfs_arg_syslog(LOG_ERR,"loading node: unrecognized node type: %"PRIu8,type);
+			status = -1;
+			continue;
+		}
+		if (bio_read(fd,rhdr+1,hdrleng)!=hdrleng) {
+			int err = errno;
+			fputc('\n',stderr);
+			errno = err;
+			mfs_errlog(LOG_ERR,"loading node: read error");
+			status = -1;
+			break;
+		}
+		ptr = rhdr+1;
+		id = get32bit(&ptr);
+		lsetid = get8bit(&ptr);
+		dataleng = 0;
+		skipleng = 0;
+		sessionids = 0;
+		ptr = rhdr+1+NODELOAD_HDRSIZE;
+		if (type==TYPE_SYMLINK) {
+			dataleng = get32bit(&ptr);
+			if (dataleng>MFS_SYMLINK_MAX) {
+				skipleng = dataleng;
+				dataleng = 0;
+			}
+		} else if (type==TYPE_FILE || type==TYPE_TRASH || type==TYPE_SUSTAINED) {
+			ptr += 8;
+			ch = get32bit(&ptr);
+			sessionids = get16bit(&ptr);
+			dataleng = 8*ch+4*sessionids;
+		}
+		// hash table is divided into contiguous ranges - one per thread
+		nl = nltab + (uint32_t)(((uint64_t)(hash32(id) & (nodehashsize-1)) * threads) / nodehashsize);
+		wptr = fs_loadnodes_reserve(nl,1+hdrleng+dataleng);
+		memcpy(wptr,rhdr,1+hdrleng);
+		wptr += 1+hdrleng;
+		if (dataleng>0 && bio_read(fd,wptr,dataleng)!=dataleng) {
+			int err = errno;
+			fputc('\n',stderr);
+			errno = err;
+			mfs_errlog(LOG_ERR,"loading node: read error");
+			nl->bleng -= 1+hdrleng+dataleng;
+			status = -1;
+			break;
+		}
+		if (skipleng>0) {
+			bio_skip(fd,skipleng);
+		}
+		if (type!=TYPE_DIRECTORY && type!=TYPE_FILE && type!=TYPE_TRASH && type!=TYPE_SUSTAINED) {
+			lsetid = 0;
+		}
+		labelset_incref(lsetid,type);
+		if (sessionids>0) {
+			ptr = wptr+(dataleng-4*sessionids);
+			while (sessionids) {
+				of_mr_acquire(get32bit(&ptr),id);
+				sessionids--;
+			}
+		}
+		fsnodes_used_inode(id);
+		nodes++;
+		if (type==TYPE_DIRECTORY) {
+			dirnodes++;
+		}
+		if (type==TYPE_FILE || type==TYPE_TRASH || type==TYPE_SUSTAINED) {
+			filenodes++;
+		}
+	}
+
+	// nodes decoded so far are moved to global structures also after error (they are freed by cleanup)
+	for (i=0 ; i<threads ; i++) {
+		nl = nltab+i;
+		fs_loadnodes_flush(nl);
+		if (nl->buff) {
+			free(nl->buff);
+		}
+		queue_put(nl->queue,0,0,NULL,1);
+	}
+	for (i=0 ; i<threads ; i++) {
+		nl = nltab+i;
+		zassert(pthread_join(nl->thread,NULL));
+		queue_delete(nl->queue);
+		fsnode_arena_merge(&(nl->arena));
+		nodehashelem += nl->hashelem;
+	}
+	free(nltab);
+	if (nodehashelem>nodehashsize) {
+		fsnodes_node_hash_rehash();
+	}
+	return (status<0)?-1:0;
+}
+
 uint8_t fs_storenodes(bio *fd) {
 	uint32_t i;
 	uint8_t hdr[8];
@@ -7522,6 +8498,106 @@ uint8_t fs_storeedges(bio *fd) {
 	return 0;
 }
 
+int fs_bgstore_start(bio *nodefd,bio *edgefd) {
+	uint8_t hdr[8];
+	uint8_t *ptr;
+
+	ptr = hdr;
+	put32bit(&ptr,maxnodeid);
+	put32bit(&ptr,nodes);
+	if (bio_write(nodefd,hdr,8)!=8) {
+		return -1;
+	}
+	fsbgmaxnodeid = maxnodeid;
+	fsbgnextedgeid = nextedgeid;
+	fsbgnodemap = calloc((maxnodeid>>3)+1,1);
+	passert(fsbgnodemap);
+	fsbgedgemap = calloc((maxnodeid>>3)+1,1);
+	passert(fsbgedgemap);
+	fsbgnodefd = nodefd;
+	fsbgedgefd = edgefd;
+	fsbgpos = 0;
+	fsbgphase = 1;
+	return 0;
+}
+
+// stores nodes from next 'buckets' hash buckets - returns 1 when all nodes have been stored
+uint8_t fs_bgstore_nodes(uint32_t buckets) {
+	uint32_t i,end;
+	fsnode *p;
+
+	end = fsbgpos + buckets;
+	if (end>noderehashpos || end<fsbgpos) {
+		end = noderehashpos;
+	}
+	for (i=fsbgpos ; i<end ; i++) {
+		for (p=nodehashtab[i>>HASHTAB_LOBITS][i&HASHTAB_MASK] ; p ; p=p->next) {
+			if (fsnodes_bgstore_check(fsbgnodemap,p->id)) {
+				fs_storenode(p,fsbgnodefd);
+			}
+		}
+	}
+	fsbgpos = end;
+	if (fsbgpos<noderehashpos) {
+		return 0;
+	}
+	fs_storenode(NULL,fsbgnodefd);	// end marker
+	return 1;
+}
+
+int fs_bgstore_edges_begin(bio *fd) {
+	uint8_t hdr[8];
+	uint8_t *ptr;
+
+	ptr = hdr;
+	put64bit(&ptr,fsbgnextedgeid);
+	if (bio_write(fd,hdr,8)!=8) {
+		return -1;
+	}
+	fsbgedgefd = fd;
+	fsbgpos = 0;
+	fsbgphase = 2;
+	return 0;
+}
+
+// stores edges of nodes from next 'buckets' hash buckets - returns 1 when all edges have been stored
+uint8_t fs_bgstore_edges(uint32_t buckets) {
+	uint32_t i,end;
+	fsnode *p;
+
+	end = fsbgpos + buckets;
+	if (end>noderehashpos || end<fsbgpos) {
+		end = noderehashpos;
+	}
+	for (i=fsbgpos ; i<end ; i++) {
+		for (p=nodehashtab[i>>HASHTAB_LOBITS][i&HASHTAB_MASK] ; p ; p=p->next) {
+			if (fsnodes_bgstore_check(fsbgedgemap,p->id)) {
+				fsnodes_bgstore_edgelist(p);
+			}
+		}
+	}
+	fsbgpos = end;
+	if (fsbgpos<noderehashpos) {
+		return 0;
+	}
+	fs_storeedge(NULL,fsbgedgefd);	// end marker
+	return 1;
+}
+
+// finishes (or aborts) incremental store
+void fs_bgstore_end(void) {
+	if (fsbgphase==0) {
+		return;
+	}
+	free(fsbgnodemap);
+	free(fsbgedgemap);
+	fsbgnodemap = NULL;
+	fsbgedgemap = NULL;
+	fsbgnodefd = NULL;
+	fsbgedgefd = NULL;
+	fsbgphase = 0;
+}
+
 int fs_lostnode(fsnode *p) {
 	uint8_t artname[40];
 	uint32_t i,l;
@@ -7606,6 +8682,13 @@ int fs_loadnodes(bio *fd,uint8_t mver) {
 	}
 	fsnodes_init_freebitmask();
 
+	if (mver>=0x13 && LoadThreads>0 && nodehashsize==0) {
+		s = fs_loadnodes_parallel(fd,LoadThreads);
+		if (s!=-2) {	// -2 - loader threads not created
+			return s;
+		}
+	}
+
 	fs_loadnode(NULL,0);
 	do {
 		s = fs_loadnode(fd,mver);
@@ -7896,6 +8979,210 @@ int fs_loadquota(bio *fd,uint8_t mver,int ignoreflag) {
 	return 0;
 }
 
+// pending snapshots:
+// jobs:4 ( ts:4 uid:4 cumask:2 smode:1 sesflags:1 gids:4 gid:4*gids ) * jobs
+// entries:4 ( srcinode:4 dstinode:4 job:4 inodes:4 dirs:4 files:4 chunks:4 length:8 size:8 realsize:8 ) * entries
+
+uint8_t fs_storesnaps(bio *fd) {
+	uint8_t wbuff[52*100],*ptr;
+	lazysnapjob *job;
+	lazysnap *ls;
+	uint32_t l,i;
+	if (fd==NULL) {
+		return 0x10;
+	}
+	l=0;
+	for (job = lazysnapjobhead ; job ; job=job->next) {
+		l++;
+		job->storeid = l;
+	}
+	ptr = wbuff;
+	put32bit(&ptr,l);
+	if (bio_write(fd,wbuff,4)!=4) {
+		syslog(LOG_NOTICE,"write error");
+		return 0xFF;
+	}
+	for (job = lazysnapjobhead ; job ; job=job->next) {
+		ptr = wbuff;
+		put32bit(&ptr,job->ts);
+		put32bit(&ptr,job->uid);
+		put16bit(&ptr,job->cumask);
+		put8bit(&ptr,job->smode);
+		put8bit(&ptr,job->sesflags);
+		put32bit(&ptr,job->gids);
+		if (bio_write(fd,wbuff,16)!=16) {
+			syslog(LOG_NOTICE,"write error");
+			return 0xFF;
+		}
+		l = 0;
+		ptr = wbuff;
+		for (i=0 ; i<job->gids ; i++) {
+			if (l==1300) {
+				if (bio_write(fd,wbuff,4*1300)!=(4*1300)) {
+					syslog(LOG_NOTICE,"write error");
+					return 0xFF;
+				}
+				l = 0;
+				ptr = wbuff;
+			}
+			put32bit(&ptr,job->gid[i]);
+			l++;
+		}
+		if (l>0) {
+			if (bio_write(fd,wbuff,4*l)!=(4*l)) {
+				syslog(LOG_NOTICE,"write error");
+				return 0xFF;
+			}
+		}
+	}
+	ptr = wbuff;
+	put32bit(&ptr,lazysnapcnt);
+	if (bio_write(fd,wbuff,4)!=4) {
+		syslog(LOG_NOTICE,"write error");
+		return 0xFF;
+	}
+	l=0;
+	ptr=wbuff;
+	for (ls = lazysnaphead ; ls ; ls=ls->next) {
+		if (l==100) {
+			if (bio_write(fd,wbuff,52*100)!=(52*100)) {
+				syslog(LOG_NOTICE,"write error");
+				return 0xFF;
+			}
+			l=0;
+			ptr=wbuff;
+		}
+		put32bit(&ptr,ls->srcid);
+		put32bit(&ptr,ls->dstid);
+		put32bit(&ptr,ls->job->storeid);
+		put32bit(&ptr,ls->vstats.inodes);
+		put32bit(&ptr,ls->vstats.dirs);
+		put32bit(&ptr,ls->vstats.files);
+		put32bit(&ptr,ls->vstats.chunks);
+		put64bit(&ptr,ls->vstats.length);
+		put64bit(&ptr,ls->vstats.size);
+		put64bit(&ptr,ls->vstats.realsize);
+		l++;
+	}
+	if (l>0) {
+		if (bio_write(fd,wbuff,52*l)!=(52*l)) {
+			syslog(LOG_NOTICE,"write error");
+			return 0xFF;
+		}
+	}
+	return 0;
+}
+
+int fs_loadsnaps(bio *fd,uint8_t mver,int ignoreflag) {
+	uint8_t rbuff[52];
+	const uint8_t *ptr;
+	lazysnapjob **jobtab;
+	uint32_t *gid;
+	uint32_t jobs,t,i,j,srcid,dstid,jobid;
+	uint32_t ts,uid,gids;
+	uint16_t cumask;
+	uint8_t smode,sesflags;
+	statsrecord vsr;
+	fsnode *sn,*dn;
+	uint8_t nl=1;
+	int ret;
+
+	(void)mver;
+	if (bio_read(fd,rbuff,4)!=4) {
+		mfs_errlog(LOG_ERR,"loading pending snapshots: read error");
+		return -1;
+	}
+	ptr = rbuff;
+	jobs = get32bit(&ptr);
+	jobtab = malloc(sizeof(lazysnapjob*)*(jobs+1));
+	passert(jobtab);
+	ret = 0;
+	for (j=0 ; j<jobs ; j++) {
+		jobtab[j] = NULL;
+	}
+	for (j=0 ; j<jobs && ret==0 ; j++) {
+		if (bio_read(fd,rbuff,16)!=16) {
+			mfs_errlog(LOG_ERR,"loading pending snapshots: read error");
+			ret = -1;
+			break;
+		}
+		ptr = rbuff;
+		ts = get32bit(&ptr);
+		uid = get32bit(&ptr);
+		cumask = get16bit(&ptr);
+		smode = get8bit(&ptr);
+		sesflags = get8bit(&ptr);
+		gids = get32bit(&ptr);
+		gid = malloc(sizeof(uint32_t)*(gids+1));
+		passert(gid);
+		for (i=0 ; i<gids ; i++) {
+			if (bio_read(fd,rbuff,4)!=4) {
+				mfs_errlog(LOG_ERR,"loading pending snapshots: read error");
+				ret = -1;
+				break;
+			}
+			ptr = rbuff;
+			gid[i] = get32bit(&ptr);
+		}
+		if (ret==0) {
+			jobtab[j] = fsnodes_lazysnap_job_new(ts,smode,sesflags,uid,gids,gid,cumask);
+		}
+		free(gid);
+	}
+	if (ret==0 && bio_read(fd,rbuff,4)!=4) {
+		mfs_errlog(LOG_ERR,"loading pending snapshots: read error");
+		ret = -1;
+	}
+	if (ret==0) {
+		ptr = rbuff;
+		t = get32bit(&ptr);
+		while (t>0) {
+			if (bio_read(fd,rbuff,52)!=52) {
+				mfs_errlog(LOG_ERR,"loading pending snapshots: read error");
+				ret = -1;
+				break;
+			}
+			ptr = rbuff;
+			srcid = get32bit(&ptr);
+			dstid = get32bit(&ptr);
+			jobid = get32bit(&ptr);
+			vsr.inodes = get32bit(&ptr);
+			vsr.dirs = get32bit(&ptr);
+			vsr.files = get32bit(&ptr);
+			vsr.chunks = get32bit(&ptr);
+			vsr.length = get64bit(&ptr);
+			vsr.size = get64bit(&ptr);
+			vsr.realsize = get64bit(&ptr);
+			sn = fsnodes_node_find(srcid);
+			dn = fsnodes_node_find(dstid);
+			if (sn==NULL || sn->type!=TYPE_DIRECTORY || dn==NULL || dn->type!=TYPE_DIRECTORY || jobid==0 || jobid>jobs) {
+				if (nl) {
+					fputc('\n',stderr);
+					nl=0;
+				}
+				fprintf(stderr,"pending snapshot of directory %"PRIu32" into %"PRIu32": wrong %s\n",srcid,dstid,(jobid==0 || jobid>jobs)?"job":"inodes");
+				syslog(LOG_ERR,"pending snapshot of directory %"PRIu32" into %"PRIu32": wrong %s",srcid,dstid,(jobid==0 || jobid>jobs)?"job":"inodes");
+				if (ignoreflag==0) {
+					fprintf(stderr,"use option '-i' to remove this pending snapshot\n");
+					ret = -1;
+					break;
+				}
+			} else {
+				fsnodes_lazysnap_add(srcid,dstid,jobtab[jobid-1],&vsr);
+				fsnodes_add_stats(dn,&vsr);
+			}
+			t--;
+		}
+	}
+	for (j=0 ; j<jobs ; j++) {
+		if (jobtab[j]!=NULL) {
+			fsnodes_lazysnap_job_release(jobtab[j]);
+		}
+	}
+	free(jobtab);
+	return ret;
+}
+
 void fs_new(void) {
 	nextedgeid = (EDGEID_MAX-1);
 	hashelements = 1;
@@ -7987,6 +9274,11 @@ int fs_strinit(void) {
 	fsedge_init();
 	symlink_init();
 	chunktab_init();
+	LoadThreads = cfg_getuint32("METADATA_LOAD_THREADS",4);
+	if (LoadThreads>NODELOAD_MAX_THREADS) {
+		syslog(LOG_WARNING,"METADATA_LOAD_THREADS value too big - decreasing to %u",NODELOAD_MAX_THREADS);
+		LoadThreads = NODELOAD_MAX_THREADS;
+	}
 	test_start_time = main_time()+900;
 	if (cfg_isdefined("QUOTA_TIME_LIMIT") && !cfg_isdefined("QUOTA_DEFAULT_GRACE_PERIOD")) {
 		QuotaDefaultGracePeriod = cfg_getuint32("QUOTA_TIME_LIMIT",7*86400); // deprecated option
@@ -8000,6 +9292,7 @@ int fs_strinit(void) {
 	main_time_register(300,0,fs_emptytrash);
 	main_time_register(60,0,fs_emptysustained);
 	main_time_register(60,0,fsnodes_freeinodes);
+	main_msectime_register(50,0,fs_lazysnap_step);
 	return 0;
 }
 
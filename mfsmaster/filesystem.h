@@ -44,6 +44,7 @@ uint8_t fs_mr_release(uint32_t inode,uint32_t sessionid);
 uint8_t fs_mr_symlink(uint32_t ts,uint32_t parent,uint32_t nleng,const uint8_t *name,const uint8_t *path,uint32_t uid,uint32_t gid,uint32_t inode);
 uint8_t fs_mr_setpath(uint32_t inode,const uint8_t *path);
 uint8_t fs_mr_snapshot(uint32_t ts,uint32_t inode_src,uint32_t parent_dst,uint16_t nleng_dst,uint8_t *name_dst,uint8_t smode,uint8_t sesflags,uint32_t uid,uint32_t gids,uint32_t *gid,uint16_t requmask);
+uint8_t fs_mr_snapexpand(uint32_t ts,uint32_t inode);
 uint8_t fs_mr_unlink(uint32_t ts,uint32_t parent,uint32_t nleng,const uint8_t *name,uint32_t inode);
 uint8_t fs_mr_purge(uint32_t ts,uint32_t inode);
 uint8_t fs_mr_undel(uint32_t ts,uint32_t inode);
@@ -76,6 +77,9 @@ void fs_getdirpath_data(uint32_t inode,uint8_t *buff,uint32_t size);
 uint8_t fs_getrootinode(uint32_t *rootinode,const uint8_t *path);
 
 void fs_statfs(uint32_t rootinode,uint8_t sesflags,uint64_t *totalspace,uint64_t *availspace,uint64_t *trashspace,uint64_t *sustainedspace,uint32_t *inodes);
+void fs_set_readonly_phase(uint8_t ro);
+uint32_t fs_lazysnap_count(void);
+void fs_lazysnap_activate(void);
 uint8_t fs_access(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t uid,uint32_t gids,uint32_t *gid,int modemask);
 uint8_t fs_lookup(uint32_t rootinode,uint8_t sesflags,uint32_t parent,uint16_t nleng,const uint8_t *name,uint32_t uid,uint32_t gids,uint32_t *gid,uint32_t auid,uint32_t agid,uint32_t *inode,uint8_t attr[35]);
 uint8_t fs_getattr(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint8_t opened,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t attr[35]);
@@ -190,10 +194,17 @@ int fs_loadnodes(bio *fd,uint8_t mver);
 int fs_loadedges(bio *fd,uint8_t mver,int ignoreflag);
 int fs_loadfree(bio *fd,uint8_t mver);
 int fs_loadquota(bio *fd,uint8_t mver,int ignoreflag);
+int fs_loadsnaps(bio *fd,uint8_t mver,int ignoreflag);
 uint8_t fs_storenodes(bio *fd);
 uint8_t fs_storeedges(bio *fd);
+int fs_bgstore_start(bio *nodefd,bio *edgefd);
+uint8_t fs_bgstore_nodes(uint32_t buckets);
+int fs_bgstore_edges_begin(bio *fd);
+uint8_t fs_bgstore_edges(uint32_t buckets);
+void fs_bgstore_end(void);
 uint8_t fs_storefree(bio *fd);
 uint8_t fs_storequota(bio *fd);
+uint8_t fs_storesnaps(bio *fd);
 
 uint8_t fs_mr_renumerate_edges(uint64_t expected_nextedgeid);
 void fs_renumerate_edge_test(void);
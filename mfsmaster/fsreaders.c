@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <syslog.h>
+
+#include "fsreaders.h"
+#include "filesystem.h"
+#include "cfg.h"
+#include "main.h"
+#include "massert.h"
+
+// Read-only metadata operations are collected while packets are parsed and then executed in one
+// 'read phase' by the worker threads and the main thread together. During this phase main thread
+// does nothing else, so metadata can't be modified and no locks on fs structures are needed.
+
+#define MAXTHREADS 64
+#define MINPARALLELJOBS 32
+#define JOBSPERFETCH 16
+
+typedef struct _fsreaders_job {
+	void (*work)(void *);
+	void (*done)(void *);
+	void *arg;
+} fsreaders_job;
+
+static fsreaders_job *jobtab = NULL;
+static uint32_t jobtabsize = 0;
+static uint32_t jobcount = 0;
+static volatile uint32_t jobnext = 0;
+
+static uint32_t threadscnt = 0;
+static pthread_t threads[MAXTHREADS];
+static pthread_mutex_t rlock;
+static pthread_cond_t workcond;
+static pthread_cond_t donecond;
+static uint32_t phaseid = 0;
+static uint32_t activethreads = 0;
+static uint8_t exiting = 0;
+
+static inline void fsreaders_process(void) {
+	uint32_t i,e;
+
+	for (;;) {
+		i = __sync_fetch_and_add(&jobnext,JOBSPERFETCH);
+		if (i>=jobcount) {
+			return;
+		}
+		e = i + JOBSPERFETCH;
+		if (e>jobcount) {
+			e = jobcount;
+		}
+		while (i<e) {
+			jobtab[i].work(jobtab[i].arg);
+			i++;
+		}
+	}
+}
+
+static void* fsreaders_worker(void *arg) {
+	uint32_t myphaseid;
+
+	myphaseid = 0;
+	zassert(pthread_mutex_lock(&rlock));
+	for (;;) {
+		while (myphaseid==phaseid && exiting==0) {
+			zassert(pthread_cond_wait(&workcond,&rlock));
+		}
+		if (exiting) {
+			break;
+		}
+		myphaseid = phaseid;
+		zassert(pthread_mutex_unlock(&rlock));
+		fsreaders_process();
+		zassert(pthread_mutex_lock(&rlock));
+		activethreads--;
+		if (activethreads==0) {
+			zassert(pthread_cond_signal(&donecond));
+		}
+	}
+	zassert(pthread_mutex_unlock(&rlock));
+	return arg;
+}
+
+uint8_t fsreaders_enabled(void) {
+	return (threadscnt>0)?1:0;
+}
+
+void fsreaders_add(void (*work)(void *),void (*done)(void *),void *arg) {
+	if (jobcount>=jobtabsize) {
+		jobtabsize = (jobtabsize==0)?1024:jobtabsize*2;
+		jobtab = realloc(jobtab,sizeof(fsreaders_job)*jobtabsize);
+		passert(jobtab);
+	}
+	jobtab[jobcount].work = work;
+	jobtab[jobcount].done = done;
+	jobtab[jobcount].arg = arg;
+	jobcount++;
+}
+
+// executes all collected jobs - has to be called before any metadata modification
+void fsreaders_run(void) {
+	uint32_t i;
+
+	if (jobcount==0) {
+		return;
+	}
+	if (threadscnt>0 && jobcount>=MINPARALLELJOBS) {
+		fs_set_readonly_phase(1);
+		jobnext = 0;
+		zassert(pthread_mutex_lock(&rlock));
+		activethreads = threadscnt;
+		phaseid++;
+		zassert(pthread_cond_broadcast(&workcond));
+		zassert(pthread_mutex_unlock(&rlock));
+		fsreaders_process();
+		zassert(pthread_mutex_lock(&rlock));
+		while (activethreads>0) {
+			zassert(pthread_cond_wait(&donecond,&rlock));
+		}
+		zassert(pthread_mutex_unlock(&rlock));
+		fs_set_readonly_phase(0);
+	} else {
+		for (i=0 ; i<jobcount ; i++) {
+			jobtab[i].work(jobtab[i].arg);
+		}
+	}
+	// results are sent in the same order as requests were received
+	for (i=0 ; i<jobcount ; i++) {
+		jobtab[i].done(jobtab[i].arg);
+	}
+	jobcount = 0;
+}
+
+void fsreaders_term(void) {
+	uint32_t i;
+
+	fsreaders_run();
+	if (threadscnt>0) {
+		zassert(pthread_mutex_lock(&rlock));
+		exiting = 1;
+		zassert(pthread_cond_broadcast(&workcond));
+		zassert(pthread_mutex_unlock(&rlock));
+		for (i=0 ; i<threadscnt ; i++) {
+			zassert(pthread_join(threads[i],NULL));
+		}
+		threadscnt = 0;
+		zassert(pthread_cond_destroy(&donecond));
+		zassert(pthread_cond_destroy(&workcond));
+		zassert(pthread_mutex_destroy(&rlock));
+	}
+	if (jobtab!=NULL) {
+		free(jobtab);
+		jobtab = NULL;
+	}
+	jobtabsize = 0;
+}
+
+int fsreaders_init(void) {
+	uint32_t i,cnt;
+
+	cnt = cfg_getuint32("MATOCL_READ_THREADS",0);
+	if (cnt>MAXTHREADS) {
+		syslog(LOG_WARNING,"MATOCL_READ_THREADS value too big - decreasing to %u",MAXTHREADS);
+		cnt = MAXTHREADS;
+	}
+	threadscnt = 0;
+	exiting = 0;
+	if (cnt>0) {
+		zassert(pthread_mutex_init(&rlock,NULL));
+		zassert(pthread_cond_init(&workcond,NULL));
+		zassert(pthread_cond_init(&donecond,NULL));
+		for (i=0 ; i<cnt ; i++) {
+			if (main_minthread_create(threads+i,0,fsreaders_worker,NULL)<0) {
+				fprintf(stderr,"can't create metadata reader thread\n");
+				break;
+			}
+			threadscnt++;
+		}
+	}
+	main_destruct_register(fsreaders_term);
+	return 0;
+}
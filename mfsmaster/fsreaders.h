@@ -18,13 +18,14 @@
  * or visit http://www.gnu.org/licenses/gpl-2.0.html
  */
 
-#ifndef _MAINSERV_H_
-#define _MAINSERV_H_
+#ifndef _FSREADERS_H_
+#define _FSREADERS_H_
 
-void mainserv_stats(uint64_t *bin,uint64_t *bout,uint32_t *hlopr,uint32_t *hlopw);
-uint8_t mainserv_read(int sock,const uint8_t *packet,uint32_t length);
-uint8_t mainserv_write(int sock,const uint8_t *packet,uint32_t length);
-// void mainserv_serve(int sock);
-int mainserv_init(void);
+#include <inttypes.h>
+
+uint8_t fsreaders_enabled(void);
+void fsreaders_add(void (*work)(void *),void (*done)(void *),void *arg);
+void fsreaders_run(void);
+int fsreaders_init(void);
 
 #endif
@@ -27,6 +27,7 @@
 #include "topology.h"
 #include "exports.h"
 #include "datacachemgr.h"
+#include "fsreaders.h"
 #include "matomlserv.h"
 #include "matocsserv.h"
 #include "matoclserv.h"
@@ -73,6 +74,7 @@ struct {
 	{chartsdata_init,"charts module"},
 	{matomlserv_init,"communication with metalogger"},
 	{matocsserv_init,"communication with chunkserver"},
+	{fsreaders_init,"metadata readers"}, // has to be before 'matoclserv_init'
 	{matoclserv_init,"communication with clients"},
 	{(runfn)0,"****"}
 },LateRunTab[]={
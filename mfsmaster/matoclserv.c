@@ -69,9 +69,14 @@
 #include "missinglog.h"
 #include "mfsstrerr.h"
 #include "iptosesid.h"
+#include "fsreaders.h"
 
 #define MaxPacketSize CLTOMA_MAXPACKETSIZE
 
+// input buffers - packets are parsed directly from them, idle connections give them back to pool
+#define INPUT_BUFFSIZE 16384
+#define INPUT_POOLSIZE 256
+
 // matoclserventry.mode
 enum {KILL,DATA,FINISH};
 // chunklis.type
@@ -139,12 +144,6 @@ typedef struct out_packetstruct {
 	uint8_t data[1];
 } out_packetstruct;
 
-typedef struct in_packetstruct {
-	struct in_packetstruct *next;
-	uint32_t type,leng;
-	uint8_t data[1];
-} in_packetstruct;
-
 typedef struct matoclserventry {
 	uint8_t registered;
 	uint8_t mode;				//0 - not active, 1 - read header, 2 - read packet
@@ -152,14 +151,14 @@ typedef struct matoclserventry {
 	uint8_t notifications;
 */
 	int sock;				//socket number
-	int32_t pdescpos;
+	void *fdh;				//handle of descriptor registered in main loop
+	short fdevents;				//events currently requested for this descriptor
 	double lastread,lastwrite;		//time of last activity
-	uint8_t input_hdr[8];
-	uint8_t *input_startptr;
-	uint32_t input_bytesleft;
+	uint8_t *inputbuff;			//input data - packets are parsed in place
+	uint32_t inputbuffsize;
+	uint32_t inputstart,inputend;		//unparsed data
+	uint8_t inputlocked;			//packet from input buffer is being processed - data can't be moved
 	uint8_t input_end;
-	in_packetstruct *input_packet;
-	in_packetstruct *inputhead,**inputtail;
 	out_packetstruct *outputhead,**outputtail;
 	uint32_t version;
 	uint32_t peerip;
@@ -180,13 +179,19 @@ typedef struct matoclserventry {
 */
 //	filelist *openedfiles;
 
+	struct matoclserventry *anext,**aprev;	// active connections (aprev==NULL - not on the list)
 	struct matoclserventry *next;
 } matoclserventry;
 
 //static session *sessionshead=NULL;
 static matoclserventry *matoclservhead=NULL;
+// connections with something to do in next main loop (new input, new output or change of mode)
+static matoclserventry *matoclservactivehead=NULL,**matoclservactivetail=&matoclservactivehead;
 static int lsock;
-static int32_t lsockpdescpos;
+
+static uint8_t *inputpoolhead = NULL;
+static uint32_t inputpoolelements = 0;
+static void *lsockfdh;
 static int starting;
 
 #define CHUNKHASHSIZE 256
@@ -740,6 +745,28 @@ void matoclserv_init_sessions(uint32_t sessionid,uint32_t inode) {
 }
 #endif
 
+static inline void matoclserv_activate(matoclserventry *eptr) {
+	if (eptr->aprev==NULL) {
+		eptr->anext = NULL;
+		eptr->aprev = matoclservactivetail;
+		*matoclservactivetail = eptr;
+		matoclservactivetail = &(eptr->anext);
+	}
+}
+
+static inline void matoclserv_deactivate(matoclserventry *eptr) {
+	if (eptr->aprev!=NULL) {
+		*(eptr->aprev) = eptr->anext;
+		if (eptr->anext!=NULL) {
+			eptr->anext->aprev = eptr->aprev;
+		} else {
+			matoclservactivetail = eptr->aprev;
+		}
+		eptr->anext = NULL;
+		eptr->aprev = NULL;
+	}
+}
+
 uint8_t* matoclserv_createpacket(matoclserventry *eptr,uint32_t type,uint32_t size) {
 	out_packetstruct *outpacket;
 	uint8_t *ptr;
@@ -756,6 +783,7 @@ uint8_t* matoclserv_createpacket(matoclserventry *eptr,uint32_t type,uint32_t si
 	outpacket->next = NULL;
 	*(eptr->outputtail) = outpacket;
 	eptr->outputtail = &(outpacket->next);
+	matoclserv_activate(eptr);
 	return ptr;
 }
 
@@ -885,9 +913,10 @@ static inline int matoclserv_fuse_read_chunk_common(matoclserventry *eptr,uint32
 	lwchunks *lwc;
 	uint32_t i;
 	uint8_t count;
+	uint8_t cached;
 	uint8_t cs_data[100*14];
 
-	status = fs_readchunk(inode,indx,canmodatime,&chunkid,&fleng);
+	status = fs_readchunk(inode,indx,canmodatime&0x7F,&chunkid,&fleng);
 	if (status!=STATUS_OK) {
 		if (status==ERROR_LOCKED || status==ERROR_CHUNKBUSY) {
 			i = CHUNKHASH(chunkid);
@@ -932,6 +961,11 @@ static inline int matoclserv_fuse_read_chunk_common(matoclserventry *eptr,uint32
 		return 0;
 	}
 	dcm_access(inode,sessions_get_id(eptr->sesdata));
+	cached = 0;
+	if ((canmodatime&0x80) && chunkid>0 && eptr->version>=VERSION2INT(1,7,32)) {
+		chunk_client_cached(chunkid);
+		cached = 0x80;
+	}
 	if (eptr->version>=VERSION2INT(3,0,10)) {
 		ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_READ_CHUNK,25+count*14);
 	} else if (eptr->version>=VERSION2INT(1,7,32)) {
@@ -941,9 +975,9 @@ static inline int matoclserv_fuse_read_chunk_common(matoclserventry *eptr,uint32
 	}
 	put32bit(&ptr,msgid);
 	if (eptr->version>=VERSION2INT(3,0,10)) {
-		put8bit(&ptr,2);
+		put8bit(&ptr,2|cached);
 	} else if (eptr->version>=VERSION2INT(1,7,32)) {
-		put8bit(&ptr,1);
+		put8bit(&ptr,1|cached);
 	}
 	put64bit(&ptr,fleng);
 	put64bit(&ptr,chunkid);
@@ -2474,14 +2508,146 @@ void matoclserv_fuse_statfs(matoclserventry *eptr,const uint8_t *data,uint32_t l
 	sessions_inc_stats(eptr->sesdata,0);
 }
 
+/* read-only operations - can be executed by fsreaders threads */
+
+#define ROJOB_GIDS 32
+
+typedef struct _rojob {
+	matoclserventry *eptr;
+	uint32_t type;
+	uint32_t msgid;
+	uint32_t rootinode;
+	uint8_t sesflags;
+	uint32_t inode;
+	uint32_t uid,auid,agid;
+	uint32_t gids;
+	uint32_t *gid;
+	uint32_t gidtab[ROJOB_GIDS];
+	uint16_t modemask;
+	uint8_t opened;
+	uint8_t nleng;
+	uint8_t name[256];
+	// results
+	uint8_t status;
+	uint32_t newinode;
+	uint8_t attr[35];
+	struct _rojob *next;
+} rojob;
+
+static rojob *rojobfreehead = NULL;
+
+static inline rojob* matoclserv_rojob_new(matoclserventry *eptr,uint32_t type,uint32_t msgid,uint32_t gids,const uint32_t *gid) {
+	rojob *job;
+
+	if (rojobfreehead!=NULL) {
+		job = rojobfreehead;
+		rojobfreehead = job->next;
+	} else {
+		job = malloc(sizeof(rojob));
+		passert(job);
+	}
+	job->eptr = eptr;
+	job->type = type;
+	job->msgid = msgid;
+	job->rootinode = sessions_get_rootinode(eptr->sesdata);
+	job->sesflags = sessions_get_sesflags(eptr->sesdata);
+	job->gids = gids;
+	if (gids>ROJOB_GIDS) {
+		job->gid = malloc(sizeof(uint32_t)*gids);
+		passert(job->gid);
+	} else {
+		job->gid = job->gidtab;
+	}
+	if (gids>0) {
+		memcpy(job->gid,gid,sizeof(uint32_t)*gids);
+	}
+	return job;
+}
+
+static void matoclserv_rojob_work(void *arg) {
+	rojob *job = (rojob*)arg;
+
+	switch (job->type) {
+		case CLTOMA_FUSE_ACCESS:
+			job->status = fs_access(job->rootinode,job->sesflags,job->inode,job->uid,job->gids,job->gid,job->modemask);
+			break;
+		case CLTOMA_FUSE_LOOKUP:
+			job->status = fs_lookup(job->rootinode,job->sesflags,job->inode,job->nleng,job->name,job->uid,job->gids,job->gid,job->auid,job->agid,&(job->newinode),job->attr);
+			break;
+		case CLTOMA_FUSE_GETATTR:
+			job->status = fs_getattr(job->rootinode,job->sesflags,job->inode,job->opened,job->uid,job->gid[0],job->auid,job->agid,job->attr);
+			break;
+	}
+}
+
+static void matoclserv_rojob_done(void *arg) {
+	rojob *job = (rojob*)arg;
+	matoclserventry *eptr = job->eptr;
+	uint8_t *ptr;
+
+	switch (job->type) {
+		case CLTOMA_FUSE_ACCESS:
+			ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_ACCESS,5);
+			put32bit(&ptr,job->msgid);
+			put8bit(&ptr,job->status);
+			break;
+		case CLTOMA_FUSE_LOOKUP:
+			if (job->status==ERROR_ENOENT_NOCACHE && eptr->version<VERSION2INT(3,0,25)) {
+				job->status = ERROR_ENOENT;
+			}
+			ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_LOOKUP,(job->status!=STATUS_OK)?5:43);
+			put32bit(&ptr,job->msgid);
+			if (job->status!=STATUS_OK) {
+				put8bit(&ptr,job->status);
+			} else {
+				put32bit(&ptr,job->newinode);
+				memcpy(ptr,job->attr,35);
+			}
+			sessions_inc_stats(eptr->sesdata,3);
+			break;
+		case CLTOMA_FUSE_GETATTR:
+			ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_GETATTR,(job->status!=STATUS_OK)?5:39);
+			put32bit(&ptr,job->msgid);
+			if (job->status!=STATUS_OK) {
+				put8bit(&ptr,job->status);
+			} else {
+				memcpy(ptr,job->attr,35);
+			}
+			sessions_inc_stats(eptr->sesdata,1);
+			break;
+	}
+	if (job->gid!=job->gidtab) {
+		free(job->gid);
+	}
+	job->next = rojobfreehead;
+	rojobfreehead = job;
+}
+
+static inline void matoclserv_rojob_exec(rojob *job) {
+	if (fsreaders_enabled() && fs_lazysnap_count()==0) { // lookups in pending snapshots modify metadata
+		fsreaders_add(matoclserv_rojob_work,matoclserv_rojob_done,job);
+	} else {
+		matoclserv_rojob_work(job);
+		matoclserv_rojob_done(job);
+	}
+}
+
+static void matoclserv_rojob_cleanup(void) {
+	rojob *job;
+
+	while ((job = rojobfreehead)!=NULL) {
+		rojobfreehead = job->next;
+		free(job);
+	}
+}
+
 void matoclserv_fuse_access(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
 	uint32_t *gid;
 	uint32_t i;
 	uint32_t inode,uid,gids;
 	uint16_t modemask;
 	uint32_t msgid;
-	uint8_t *ptr;
-	uint8_t status;
+	rojob *job;
 	if ((length&1)==1) {
 		if (length!=17) {
 			syslog(LOG_NOTICE,"CLTOMA_FUSE_ACCESS - wrong size (%"PRIu32"/17)",length);
@@ -2518,10 +2684,11 @@ void matoclserv_fuse_access(matoclserventry *eptr,const uint8_t *data,uint32_t l
 		sessions_ugid_remap(eptr->sesdata,&uid,gid);
 		modemask = get16bit(&data);
 	}
-	status = fs_access(sessions_get_rootinode(eptr->sesdata),sessions_get_sesflags(eptr->sesdata),inode,uid,gids,gid,modemask);
-	ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_ACCESS,5);
-	put32bit(&ptr,msgid);
-	put8bit(&ptr,status);
+	job = matoclserv_rojob_new(eptr,CLTOMA_FUSE_ACCESS,msgid,gids,gid);
+	job->inode = inode;
+	job->uid = uid;
+	job->modemask = modemask;
+	matoclserv_rojob_exec(job);
 }
 
 void matoclserv_fuse_lookup(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
@@ -2530,11 +2697,8 @@ void matoclserv_fuse_lookup(matoclserventry *eptr,const uint8_t *data,uint32_t l
 	uint32_t i;
 	uint8_t nleng;
 	const uint8_t *name;
-	uint32_t newinode;
-	uint8_t attr[35];
 	uint32_t msgid;
-	uint8_t *ptr;
-	uint8_t status;
+	rojob *job;
 	if (length<17) {
 		syslog(LOG_NOTICE,"CLTOMA_FUSE_LOOKUP - wrong size (%"PRIu32")",length);
 		eptr->mode = KILL;
@@ -2570,28 +2734,21 @@ void matoclserv_fuse_lookup(matoclserventry *eptr,const uint8_t *data,uint32_t l
 		agid = gid[0];
 		sessions_ugid_remap(eptr->sesdata,&uid,gid);
 	}
-	status = fs_lookup(sessions_get_rootinode(eptr->sesdata),sessions_get_sesflags(eptr->sesdata),inode,nleng,name,uid,gids,gid,auid,agid,&newinode,attr);
-	if (status==ERROR_ENOENT_NOCACHE && eptr->version<VERSION2INT(3,0,25)) {
-		status = ERROR_ENOENT;
-	}
-	ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_LOOKUP,(status!=STATUS_OK)?5:43);
-	put32bit(&ptr,msgid);
-	if (status!=STATUS_OK) {
-		put8bit(&ptr,status);
-	} else {
-		put32bit(&ptr,newinode);
-		memcpy(ptr,attr,35);
-	}
-	sessions_inc_stats(eptr->sesdata,3);
+	job = matoclserv_rojob_new(eptr,CLTOMA_FUSE_LOOKUP,msgid,gids,gid);
+	job->inode = inode;
+	job->nleng = nleng;
+	memcpy(job->name,name,nleng);
+	job->uid = uid;
+	job->auid = auid;
+	job->agid = agid;
+	matoclserv_rojob_exec(job);
 }
 
 void matoclserv_fuse_getattr(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
 	uint32_t inode,uid,gid,auid,agid;
 	uint8_t opened;
-	uint8_t attr[35];
 	uint32_t msgid;
-	uint8_t *ptr;
-	uint8_t status;
+	rojob *job;
 	if (length!=8 && length!=16 && length!=17) {
 		syslog(LOG_NOTICE,"CLTOMA_FUSE_GETATTR - wrong size (%"PRIu32"/8|16|17)",length);
 		eptr->mode = KILL;
@@ -2612,15 +2769,13 @@ void matoclserv_fuse_getattr(matoclserventry *eptr,const uint8_t *data,uint32_t
 		auid = uid = 12345;
 		agid = gid = 12345;
 	}
-	status = fs_getattr(sessions_get_rootinode(eptr->sesdata),sessions_get_sesflags(eptr->sesdata),inode,opened,uid,gid,auid,agid,attr);
-	ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_GETATTR,(status!=STATUS_OK)?5:39);
-	put32bit(&ptr,msgid);
-	if (status!=STATUS_OK) {
-		put8bit(&ptr,status);
-	} else {
-		memcpy(ptr,attr,35);
-	}
-	sessions_inc_stats(eptr->sesdata,1);
+	job = matoclserv_rojob_new(eptr,CLTOMA_FUSE_GETATTR,msgid,1,&gid);
+	job->inode = inode;
+	job->opened = opened;
+	job->uid = uid;
+	job->auid = auid;
+	job->agid = agid;
+	matoclserv_rojob_exec(job);
 }
 
 void matoclserv_fuse_setattr(matoclserventry *eptr,const uint8_t *data,uint32_t length) {
@@ -3266,9 +3421,11 @@ void matoclserv_fuse_readdir(matoclserventry *eptr,const uint8_t *data,uint32_t
 		put8bit(&ptr,status);
 	} else {
 		if (length>=29) {
-			put64bit(&ptr,nedgeid);
+			fs_readdir_data(sessions_get_rootinode(eptr->sesdata),sessions_get_sesflags(eptr->sesdata),uid,gid[0],auid,agid,flags,maxentries,&nedgeid,c1,c2,ptr+8);
+			put64bit(&ptr,nedgeid);	// handle of the next page
+		} else {
+			fs_readdir_data(sessions_get_rootinode(eptr->sesdata),sessions_get_sesflags(eptr->sesdata),uid,gid[0],auid,agid,flags,maxentries,&nedgeid,c1,c2,ptr);
 		}
-		fs_readdir_data(sessions_get_rootinode(eptr->sesdata),sessions_get_sesflags(eptr->sesdata),uid,gid[0],auid,agid,flags,maxentries,&nedgeid,c1,c2,ptr);
 /* CACHENOTIFY
 		if (flags&GETDIR_FLAG_ADDTOCACHE) {
 			if (inode==MFS_ROOT_ID) {
@@ -5087,6 +5244,10 @@ void matoclserv_gotpacket(matoclserventry *eptr,uint32_t type,const uint8_t *dat
 	if (type==ANTOAN_BAD_COMMAND_SIZE) { // for future use
 		return;
 	}
+	// collected read-only operations can't be reordered with other ones
+	if (type!=CLTOMA_FUSE_LOOKUP && type!=CLTOMA_FUSE_GETATTR && type!=CLTOMA_FUSE_ACCESS) {
+		fsreaders_run();
+	}
 //	printf("AQQ\n");
 	if (eptr->registered==0) {	// unregistered clients - beware that in this context sesdata is NULL
 		switch (type) {
@@ -5483,36 +5644,117 @@ void matoclserv_gotpacket(matoclserventry *eptr,uint32_t type,const uint8_t *dat
 	}
 }
 
+static inline uint8_t matoclserv_inputbuff_haspacket(matoclserventry *eptr) {
+	const uint8_t *ptr;
+	uint32_t leng;
+
+	if (eptr->inputend-eptr->inputstart<8) {
+		return 0;
+	}
+	ptr = eptr->inputbuff+eptr->inputstart+4;
+	leng = get32bit(&ptr);
+	return (leng<=MaxPacketSize && eptr->inputend-eptr->inputstart>=8+leng)?1:0;
+}
+
+static inline uint8_t* matoclserv_inputbuff_get(void) {
+	uint8_t *buff;
+	if (inputpoolhead!=NULL) {
+		buff = inputpoolhead;
+		inputpoolhead = *((uint8_t**)buff);
+		inputpoolelements--;
+	} else {
+		buff = malloc(INPUT_BUFFSIZE);
+		passert(buff);
+	}
+	return buff;
+}
+
+static inline void matoclserv_inputbuff_release(matoclserventry *eptr) {
+	if (eptr->inputbuffsize==INPUT_BUFFSIZE && inputpoolelements<INPUT_POOLSIZE) {
+		*((uint8_t**)(eptr->inputbuff)) = inputpoolhead;
+		inputpoolhead = eptr->inputbuff;
+		inputpoolelements++;
+	} else {
+		free(eptr->inputbuff);
+	}
+	eptr->inputbuff = NULL;
+	eptr->inputbuffsize = 0;
+	eptr->inputstart = 0;
+	eptr->inputend = 0;
+}
+
+static void matoclserv_inputpool_free(void) {
+	uint8_t *buff;
+	while ((buff = inputpoolhead)!=NULL) {
+		inputpoolhead = *((uint8_t**)buff);
+		free(buff);
+	}
+	inputpoolelements = 0;
+}
+
+// called when input buffer is full - moves incomplete packet to the beginning of buffer or enlarges buffer to fit it
+static int matoclserv_inputbuff_makespace(matoclserventry *eptr) {
+	const uint8_t *ptr;
+	uint32_t leng,need,avail;
+	uint8_t *newbuff;
+
+	if (eptr->inputlocked) {
+		return 0;
+	}
+	avail = eptr->inputend - eptr->inputstart;
+	need = 8;
+	if (avail>=8) {
+		ptr = eptr->inputbuff + eptr->inputstart + 4;
+		leng = get32bit(&ptr);
+		if (leng>MaxPacketSize) {
+			return 0;
+		}
+		need += leng;
+	}
+	if (need<=avail) { // complete packet - parse it first
+		return 0;
+	}
+	if (need>eptr->inputbuffsize) {
+		newbuff = malloc(need);
+		passert(newbuff);
+		memcpy(newbuff,eptr->inputbuff+eptr->inputstart,avail);
+		matoclserv_inputbuff_release(eptr);
+		eptr->inputbuff = newbuff;
+		eptr->inputbuffsize = need;
+	} else if (eptr->inputstart>0) {
+		memmove(eptr->inputbuff,eptr->inputbuff+eptr->inputstart,avail);
+	}
+	eptr->inputstart = 0;
+	eptr->inputend = avail;
+	return 1;
+}
+
 void matoclserv_read(matoclserventry *eptr,double now) {
 	int32_t i;
-	uint32_t type,leng;
-	const uint8_t *ptr;
-	uint32_t rbleng,rbpos;
+	uint8_t rcvd;
 	uint8_t err,hup,errmsg;
-	static uint8_t *readbuff = NULL;
-	static uint32_t readbuffsize = 0;
 
 	if (eptr == NULL) {
-		if (readbuff != NULL) {
-			free(readbuff);
-		}
-		readbuff = NULL;
-		readbuffsize = 0;
+		matoclserv_inputpool_free();
 		return;
 	}
 
-	if (readbuffsize==0) {
-		readbuffsize = 65536;
-		readbuff = malloc(readbuffsize);
-		passert(readbuff);
+	if (eptr->inputbuff==NULL) {
+		eptr->inputbuff = matoclserv_inputbuff_get();
+		eptr->inputbuffsize = INPUT_BUFFSIZE;
+		eptr->inputstart = 0;
+		eptr->inputend = 0;
 	}
 
-	rbleng = 0;
+	rcvd = 0;
 	err = 0;
 	hup = 0;
 	errmsg = 0;
 	for (;;) {
-		i = read(eptr->sock,readbuff+rbleng,readbuffsize-rbleng);
+		if (eptr->inputend==eptr->inputbuffsize && matoclserv_inputbuff_makespace(eptr)==0) {
+			break;
+		}
+		i = read(eptr->sock,eptr->inputbuff+eptr->inputend,eptr->inputbuffsize-eptr->inputend);
 		if (i==0) {
 			hup = 1;
 			break;
@@ -5530,73 +5772,18 @@ void matoclserv_read(matoclserventry *eptr,double now) {
 			break;
 		} else {
 			stats_brcvd += i;
-			rbleng += i;
-			if (rbleng==readbuffsize) {
-				readbuffsize*=2;
-				readbuff = realloc(readbuff,readbuffsize);
-				passert(readbuff);
-			} else {
+			eptr->inputend += i;
+			rcvd = 1;
+			if (eptr->inputend<eptr->inputbuffsize) {
 				break;
 			}
 		}
 	}
 
-	if (rbleng>0) {
+	if (rcvd) {
 		eptr->lastread = now;
 	}
 
-	rbpos = 0;
-	while (rbpos<rbleng) {
-		if ((rbleng-rbpos)>=eptr->input_bytesleft) {
-			memcpy(eptr->input_startptr,readbuff+rbpos,eptr->input_bytesleft);
-			i = eptr->input_bytesleft;
-		} else {
-			memcpy(eptr->input_startptr,readbuff+rbpos,rbleng-rbpos);
-			i = rbleng-rbpos;
-		}
-		rbpos += i;
-		eptr->input_startptr+=i;
-		eptr->input_bytesleft-=i;
-
-		if (eptr->input_bytesleft>0) {
-			break;
-		}
-
-		if (eptr->input_packet == NULL) {
-			ptr = eptr->input_hdr;
-			type = get32bit(&ptr);
-			leng = get32bit(&ptr);
-
-			if (leng>MaxPacketSize) {
-				syslog(LOG_WARNING,"main master server module: packet too long (%"PRIu32"/%u)",leng,MaxPacketSize);
-				eptr->input_end = 1;
-				return;
-			}
-
-			stats_prcvd++;
-			eptr->input_packet = malloc(offsetof(in_packetstruct,data)+leng);
-			passert(eptr->input_packet);
-			eptr->input_packet->next = NULL;
-			eptr->input_packet->type = type;
-			eptr->input_packet->leng = leng;
-
-			eptr->input_startptr = eptr->input_packet->data;
-			eptr->input_bytesleft = leng;
-		}
-
-		if (eptr->input_bytesleft>0) {
-			continue;
-		}
-
-		if (eptr->input_packet != NULL) {
-			*(eptr->inputtail) = eptr->input_packet;
-			eptr->inputtail = &(eptr->input_packet->next);
-			eptr->input_packet = NULL;
-			eptr->input_bytesleft = 8;
-			eptr->input_startptr = eptr->input_hdr;
-		}
-	}
-
 	if (hup) {
 		if (eptr->registered>0 && eptr->registered<100) {	// show this message only for standard, registered clients
 			syslog(LOG_NOTICE,"connection with client(ip:%u.%u.%u.%u) has been closed by peer",(eptr->peerip>>24)&0xFF,(eptr->peerip>>16)&0xFF,(eptr->peerip>>8)&0xFF,eptr->peerip&0xFF);
@@ -5611,23 +5798,37 @@ void matoclserv_read(matoclserventry *eptr,double now) {
 }
 
 void matoclserv_parse(matoclserventry *eptr) {
-	in_packetstruct *ipack;
+	const uint8_t *ptr;
+	uint32_t type,leng;
 	uint64_t starttime;
 	uint64_t currtime;
 
 	starttime = monotonic_useconds();
 	currtime = starttime;
-	while (eptr->mode==DATA && (ipack = eptr->inputhead)!=NULL && starttime+10000>currtime) {
-		matoclserv_gotpacket(eptr,ipack->type,ipack->data,ipack->leng);
-		eptr->inputhead = ipack->next;
-		free(ipack);
-		if (eptr->inputhead==NULL) {
-			eptr->inputtail = &(eptr->inputhead);
-		} else {
-			currtime = monotonic_useconds();
+	while (eptr->mode==DATA && eptr->inputend-eptr->inputstart>=8 && starttime+10000>currtime) {
+		ptr = eptr->inputbuff+eptr->inputstart;
+		type = get32bit(&ptr);
+		leng = get32bit(&ptr);
+		if (leng>MaxPacketSize) {
+			syslog(LOG_WARNING,"main master server module: packet too long (%"PRIu32"/%u)",leng,MaxPacketSize);
+			eptr->inputstart = eptr->inputend;
+			eptr->input_end = 1;
+			break;
+		}
+		if (eptr->inputend-eptr->inputstart<8+leng) {
+			break;
 		}
+		stats_prcvd++;
+		eptr->inputlocked = 1;
+		matoclserv_gotpacket(eptr,type,ptr,leng);
+		eptr->inputlocked = 0;
+		eptr->inputstart += 8+leng;
+		currtime = monotonic_useconds();
 	}
-	if (eptr->mode==DATA && eptr->inputhead==NULL && eptr->input_end) {
+	if (eptr->inputbuff!=NULL && eptr->inputstart==eptr->inputend) {
+		matoclserv_inputbuff_release(eptr);
+	}
+	if (eptr->mode==DATA && eptr->input_end && matoclserv_inputbuff_haspacket(eptr)==0) {
 		eptr->mode = KILL;
 	}
 }
@@ -5717,57 +5918,51 @@ void matoclserv_write(matoclserventry *eptr,double now) {
 #endif
 }
 
-void matoclserv_desc(struct pollfd *pdesc,uint32_t *ndesc) {
-	uint32_t pos = *ndesc;
-	matoclserventry *eptr;
+static inline void matoclserv_setevents(matoclserventry *eptr) {
+	short events;
 
-	pdesc[pos].fd = lsock;
-		pdesc[pos].events = POLLIN;
-		lsockpdescpos = pos;
-		pos++;
-//		FD_SET(lsock,rset);
-//		max = lsock;
-	for (eptr=matoclservhead ; eptr ; eptr=eptr->next) {
-		pdesc[pos].fd = eptr->sock;
-		pdesc[pos].events = 0;
-		eptr->pdescpos = pos;
-//		i=eptr->sock;
-		pdesc[pos].events |= POLLIN;
-//			FD_SET(i,rset);
-//			if (i>max) {
-//				max=i;
-//			}
-		if (eptr->outputhead!=NULL) {
-			pdesc[pos].events |= POLLOUT;
-//			FD_SET(i,wset);
-//			if (i>max) {
-//				max=i;
-//			}
+	events = (eptr->outputhead!=NULL)?(POLLIN|POLLOUT):POLLIN;
+	if (eptr->fdevents!=events) {
+		main_fd_change(eptr->fdh,events);
+		eptr->fdevents = events;
+	}
+}
+
+void matoclserv_fdserve(void *udata,short revents) {
+	matoclserventry *eptr = (matoclserventry*)udata;
+	double now;
+
+	now = monotonic_seconds();
+	if ((revents & (POLLERR|POLLIN))==POLLIN && eptr->mode!=KILL) {
+		matoclserv_read(eptr,now);
+		matoclserv_activate(eptr);
+	}
+	if (revents & (POLLERR|POLLHUP)) {
+		eptr->input_end = 1;
+		matoclserv_activate(eptr);
+	}
+	if ((revents & POLLOUT) && eptr->mode!=KILL) {
+		matoclserv_write(eptr,now);
+		matoclserv_setevents(eptr);
+		if (eptr->mode!=DATA) {
+			matoclserv_activate(eptr);
 		}
-		pos++;
 	}
-	*ndesc = pos;
-//	return max;
 }
 
 void matoclserv_disconnection_loop(void) {
 	matoclserventry *eptr,**kptr;
-	in_packetstruct *ipptr,*ipaptr;
 	out_packetstruct *opptr,*opaptr;
 
 	kptr = &matoclservhead;
 	while ((eptr=*kptr)) {
 		if (eptr->mode == KILL) {
 			matocl_beforedisconnect(eptr);
+			matoclserv_deactivate(eptr);
+			main_fd_unregister(eptr->fdh);
 			tcpclose(eptr->sock);
-			if (eptr->input_packet) {
-				free(eptr->input_packet);
-			}
-			ipptr = eptr->inputhead;
-			while (ipptr) {
-				ipaptr = ipptr;
-				ipptr = ipptr->next;
-				free(ipaptr);
+			if (eptr->inputbuff) {
+				matoclserv_inputbuff_release(eptr);
 			}
 			opptr = eptr->outputhead;
 			while (opptr) {
@@ -5783,113 +5978,144 @@ void matoclserv_disconnection_loop(void) {
 	}
 }
 
-void matoclserv_serve(struct pollfd *pdesc) {
-	double now;
+void matoclserv_accept(void *udata,short revents) {
 	matoclserventry *eptr;
+	double now;
 	int ns;
-	static double lastaction = 0.0;
-	double timeoutadd;
 
-	now = monotonic_seconds();
-// timeout fix
-	if (lastaction>0.0) {
-		timeoutadd = now-lastaction;
-		if (timeoutadd>1.0) {
-			for (eptr=matoclservhead ; eptr ; eptr=eptr->next) {
-				eptr->lastread += timeoutadd;
-			}
-		}
+	(void)udata;
+	if ((revents & POLLIN)==0) {
+		return;
 	}
-	lastaction = now;
-
-	if (lsockpdescpos>=0 && (pdesc[lsockpdescpos].revents & POLLIN)) {
-//	if (FD_ISSET(lsock,rset)) {
-		ns=tcpaccept(lsock);
-		if (ns<0) {
-			mfs_errlog_silent(LOG_NOTICE,"main master server module: accept error");
-		} else {
-			tcpnonblock(ns);
-			tcpnodelay(ns);
-			eptr = malloc(sizeof(matoclserventry));
-			passert(eptr);
-			eptr->next = matoclservhead;
-			matoclservhead = eptr;
-			eptr->sock = ns;
-			eptr->pdescpos = -1;
-			tcpgetpeer(ns,&(eptr->peerip),NULL);
-			eptr->registered = 0;
+	now = monotonic_seconds();
+	ns=tcpaccept(lsock);
+	if (ns<0) {
+		mfs_errlog_silent(LOG_NOTICE,"main master server module: accept error");
+	} else {
+		tcpnonblock(ns);
+		tcpnodelay(ns);
+		eptr = malloc(sizeof(matoclserventry));
+		passert(eptr);
+		eptr->next = matoclservhead;
+		matoclservhead = eptr;
+		eptr->sock = ns;
+		eptr->fdevents = POLLIN;
+		eptr->fdh = main_fd_register(ns,POLLIN,matoclserv_fdserve,eptr);
+		tcpgetpeer(ns,&(eptr->peerip),NULL);
+		eptr->registered = 0;
 /* CACHENOTIFY
-			eptr->notifications = 0;
+		eptr->notifications = 0;
 */
-			eptr->version = 0;
-			eptr->mode = DATA;
-			eptr->lastread = now;
-			eptr->lastwrite = now;
-			eptr->input_bytesleft = 8;
-			eptr->input_startptr = eptr->input_hdr;
-			eptr->input_end = 0;
-			eptr->input_packet = NULL;
-			eptr->inputhead = NULL;
-			eptr->inputtail = &(eptr->inputhead);
-			eptr->outputhead = NULL;
-			eptr->outputtail = &(eptr->outputhead);
+		eptr->version = 0;
+		eptr->mode = DATA;
+		eptr->lastread = now;
+		eptr->lastwrite = now;
+		eptr->inputbuff = NULL;
+		eptr->inputbuffsize = 0;
+		eptr->inputstart = 0;
+		eptr->inputend = 0;
+		eptr->inputlocked = 0;
+		eptr->input_end = 0;
+		eptr->outputhead = NULL;
+		eptr->outputtail = &(eptr->outputhead);
 
-			eptr->path = NULL;
-			eptr->info = NULL;
-			eptr->ileng = 0;
-			eptr->usepassword = 0;
+		eptr->path = NULL;
+		eptr->info = NULL;
+		eptr->ileng = 0;
+		eptr->usepassword = 0;
 
-			eptr->sesdata = NULL;
+		eptr->sesdata = NULL;
 /* CACHENOTIFY
-			eptr->cacheddirs = NULL;
+		eptr->cacheddirs = NULL;
 */
-			memset(eptr->passwordrnd,0,32);
-//			eptr->openedfiles = NULL;
-		}
+		memset(eptr->passwordrnd,0,32);
+//		eptr->openedfiles = NULL;
+		eptr->anext = NULL;
+		eptr->aprev = NULL;
 	}
+}
 
-// read
-	for (eptr=matoclservhead ; eptr ; eptr=eptr->next) {
-		if (eptr->pdescpos>=0) {
-			if ((pdesc[eptr->pdescpos].revents & (POLLERR|POLLIN))==POLLIN && eptr->mode!=KILL) {
-				matoclserv_read(eptr,now);
-			}
-			if (pdesc[eptr->pdescpos].revents & (POLLERR|POLLHUP)) {
-				eptr->input_end = 1;
-			}
-		}
-		matoclserv_parse(eptr);
-	}
+// called once per second - sends NOPs to idle clients and kills connections without any input
+void matoclserv_idle_check(void) {
+	double now;
+	matoclserventry *eptr;
+	static double lastcheck = 0.0;
+	double timeoutadd;
 
-// write
+	now = monotonic_seconds();
+// timeout fix (main loop was blocked)
+	timeoutadd = (lastcheck>0.0)?(now-lastcheck-1.0):0.0;
+	lastcheck = now;
 	for (eptr=matoclservhead ; eptr ; eptr=eptr->next) {
+		if (timeoutadd>1.0) {
+			eptr->lastread += timeoutadd;
+		}
 		if (eptr->lastwrite+1.0<now && eptr->registered<100 && eptr->outputhead==NULL) {
 			uint8_t *ptr = matoclserv_createpacket(eptr,ANTOAN_NOP,4);	// 4 byte length because of 'msgid'
 			*((uint32_t*)ptr) = 0;
 		}
-		if (eptr->pdescpos>=0) {
+		if (eptr->lastread+10.0<now) {
+			eptr->mode = KILL;
+		}
+		if (eptr->mode!=DATA) {
+			matoclserv_activate(eptr);
+		}
+	}
+}
+
+// only connections from active list are served here
+void matoclserv_serve(void) {
+	double now;
+	matoclserventry *eptr,*eptrn;
+	uint8_t killed;
+
+	if (matoclservactivehead==NULL) {
+		return;
+	}
+	now = monotonic_seconds();
+
+// parse (reading is done in matoclserv_fdserve)
+	for (eptr=matoclservactivehead ; eptr ; eptr=eptr->anext) {
+		if (eptr->inputstart<eptr->inputend || eptr->input_end) {
+			matoclserv_parse(eptr);
+		}
+	}
+	fsreaders_run();
+
+// write
+	killed = 0;
+	for (eptr=matoclservactivehead ; eptr ; eptr=eptrn) {
+		eptrn = eptr->anext;
 /* CACHENOTIFY
-			if (eptr->notifications) {
-				if (eptr->version>=VERSION2INT(1,6,22)) {
-					uint8_t *ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_NOTIFY_END,4);	// transaction end
-					*((uint32_t*)ptr) = 0;
-				}
-				eptr->notifications = 0;
-			}
-*/
-			if ((((pdesc[eptr->pdescpos].events & POLLOUT)==0 && (eptr->outputhead)) || (pdesc[eptr->pdescpos].revents & POLLOUT)) && eptr->mode!=KILL) {
-				matoclserv_write(eptr,now);
+		if (eptr->notifications) {
+			if (eptr->version>=VERSION2INT(1,6,22)) {
+				uint8_t *ptr = matoclserv_createpacket(eptr,MATOCL_FUSE_NOTIFY_END,4);	// transaction end
+				*((uint32_t*)ptr) = 0;
 			}
+			eptr->notifications = 0;
 		}
-		if (eptr->lastread+10.0<now) {
-			eptr->mode = KILL;
+*/
+		// new data - try to send it at once, otherwise wait for POLLOUT
+		if ((eptr->fdevents & POLLOUT)==0 && eptr->outputhead && eptr->mode!=KILL) {
+			matoclserv_write(eptr,now);
 		}
 		if (eptr->mode==FINISH && eptr->outputhead==NULL) {
 			eptr->mode = KILL;
 		}
+		if (eptr->mode==KILL) {
+			killed = 1;
+		} else {
+			matoclserv_setevents(eptr);
+			// packets left in input buffer (parsing time limit) - stay active
+			if (eptr->mode!=DATA || matoclserv_inputbuff_haspacket(eptr)==0) {
+				matoclserv_deactivate(eptr);
+			}
+		}
 	}
 
-	matoclserv_disconnection_loop();
+	if (killed) {
+		matoclserv_disconnection_loop();
+	}
 }
 
 void matoclserv_keep_alive(void) {
@@ -5909,13 +6135,13 @@ void matoclserv_keep_alive(void) {
 		}
 		if (eptr->mode == DATA && eptr->outputhead) {
 			matoclserv_write(eptr,now);
+			matoclserv_setevents(eptr);
 		}
 	}
 }
 
 void matoclserv_term(void) {
 	matoclserventry *eptr,*eaptr;
-	in_packetstruct *ipptr,*ipaptr;
 	out_packetstruct *opptr,*opaptr;
 	swchunks *swc,*swcn;
 	lwchunks *lwc,*lwcn;
@@ -5924,18 +6150,13 @@ void matoclserv_term(void) {
 //	filelist *of,*ofn;
 
 	syslog(LOG_NOTICE,"main master server module: closing %s:%s",ListenHost,ListenPort);
+	main_fd_unregister(lsockfdh);
 	tcpclose(lsock);
 
 	eptr = matoclservhead;
 	while (eptr) {
-		if (eptr->input_packet) {
-			free(eptr->input_packet);
-		}
-		ipptr = eptr->inputhead;
-		while (ipptr) {
-			ipaptr = ipptr;
-			ipptr = ipptr->next;
-			free(ipaptr);
+		if (eptr->inputbuff) {
+			free(eptr->inputbuff);
 		}
 		opptr = eptr->outputhead;
 		while (opptr) {
@@ -5966,6 +6187,7 @@ void matoclserv_term(void) {
 
 	matoclserv_read(NULL,0.0); // free internal read buffer
 	matoclserv_gid_storage(0); // free supplementary groups buffer
+	matoclserv_rojob_cleanup();
 
 	free(ListenHost);
 	free(ListenPort);
@@ -6099,8 +6321,10 @@ void matoclserv_reload(void) {
 	mfs_arg_syslog(LOG_NOTICE,"main master server module: socket address has changed, now listen on %s:%s",ListenHost,ListenPort);
 	free(oldListenHost);
 	free(oldListenPort);
+	main_fd_unregister(lsockfdh);
 	tcpclose(lsock);
 	lsock = newlsock;
+	lsockfdh = main_fd_register(lsock,POLLIN,matoclserv_accept,NULL);
 }
 
 int matoclserv_init(void) {
@@ -6138,11 +6362,13 @@ int matoclserv_init(void) {
 
 	main_time_register(10,0,matoclserv_start_cond_check);
 	main_time_register(1,0,matoclserv_timeout_waiting_ops);
+	main_time_register(1,0,matoclserv_idle_check);
 //	main_time_register(10,0,matocl_session_check);
 //	main_time_register(3600,0,matocl_session_statsmove);
 	main_reload_register(matoclserv_reload);
 	main_destruct_register(matoclserv_term);
-	main_poll_register(matoclserv_desc,matoclserv_serve);
+	lsockfdh = main_fd_register(lsock,POLLIN,matoclserv_accept,NULL);
+	main_eachloop_register(matoclserv_serve);
 	main_keepalive_register(matoclserv_keep_alive);
 //	main_wantexit_register(matoclserv_wantexit);
 //	main_canexit_register(matoclserv_canexit);
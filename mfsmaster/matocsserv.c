@@ -59,8 +59,18 @@
 
 #define MaxPacketSize CSTOMA_MAXPACKETSIZE
 
+// input buffers - packets are parsed directly from them, idle connections give them back to pool
+#define INPUT_BUFFSIZE 16384
+#define INPUT_POOLSIZE 256
+
 #define MANAGER_SWITCH_CONST 5
 
+// chunks from register packets merged in one main loop iteration (shared by all registering chunkservers)
+#define REGISTER_CHUNKS_PER_LOOP 100000
+#define REGISTER_CHUNKS_MIN_SLICE 2000
+// chunks merged in one call to chunk module
+#define REGISTER_CHUNKS_BATCH 512
+
 // matocsserventry.mode
 enum{KILL,DATA,FINISH};
 
@@ -75,23 +85,16 @@ typedef struct out_packetstruct {
 	uint8_t data[1];
 } out_packetstruct;
 
-typedef struct in_packetstruct {
-	struct in_packetstruct *next;
-	uint32_t type,leng;
-	uint8_t data[1];
-} in_packetstruct;
-
 typedef struct matocsserventry {
 	uint8_t mode;
 	int sock;
 	int32_t pdescpos;
 	double lastread,lastwrite;
-	uint8_t input_hdr[8];
-	uint8_t *input_startptr;
-	uint32_t input_bytesleft;
+	uint8_t *inputbuff;			//input data - packets are parsed in place
+	uint32_t inputbuffsize;
+	uint32_t inputstart,inputend;		//unparsed data
+	uint8_t inputlocked;			//packet from input buffer is being processed - data can't be moved
 	uint8_t input_end;
-	in_packetstruct *input_packet;
-	in_packetstruct *inputhead,**inputtail;
 	out_packetstruct *outputhead,**outputtail;
 
 	char *servstrip;		// human readable version of servip
@@ -124,6 +127,13 @@ typedef struct matocsserventry {
 	uint16_t csid;
 	uint8_t registered;
 
+	const uint8_t *regdata;		// chunk list from register packet (in input buffer) waiting to be merged
+	uint32_t regleft;		// number of chunks not merged yet
+	uint32_t regpleng;		// length of this packet
+	uint64_t regchunkid;		// previous chunkid (compact lists)
+	uint8_t regrversion;
+	uint16_t features;		// CSTOMA_REGISTER_FEATURE_* announced at the end of registration
+
 	uint8_t privflag;
 //	uint8_t cancreatechunks;
 
@@ -139,8 +149,14 @@ typedef struct matocsserventry {
 
 static matocsserventry *matocsservhead=NULL;
 static int lsock;
+
+static uint8_t *inputpoolhead = NULL;
+static uint32_t inputpoolelements = 0;
 static int32_t lsockpdescpos;
 
+static uint32_t regbudget = REGISTER_CHUNKS_PER_LOOP;
+static uint32_t regslice = REGISTER_CHUNKS_PER_LOOP;
+
 // from config
 static char *ListenHost;
 static char *ListenPort;
@@ -1202,6 +1218,44 @@ int matocsserv_send_replicatechunk(void *e,uint64_t chunkid,uint32_t version,voi
 	return 0;
 }
 
+int matocsserv_send_replicatechunk_striped(void *e,uint64_t chunkid,uint32_t version,uint8_t cnt,void **src) {
+	matocsserventry *dsteptr = (matocsserventry *)e;
+	matocsserventry *srceptr;
+	uint8_t i,j;
+	uint8_t *data;
+
+	if (cnt<=1 || (dsteptr->features & CSTOMA_REGISTER_FEATURE_STRIPEDREPLICATE)==0) {
+		return matocsserv_send_replicatechunk(e,chunkid,version,src[0]);
+	}
+	if (matocsserv_replication_find(chunkid,version,dsteptr)) {
+		return -1;
+	}
+	if (dsteptr->mode!=KILL) {
+		for (i=j=0 ; i<cnt ; i++) {
+			srceptr = (matocsserventry *)(src[i]);
+			if (srceptr->mode!=KILL) {
+				src[j++] = src[i];
+			}
+		}
+		cnt = j;
+		if (cnt==0) {
+			return 0;
+		}
+		data = matocsserv_createpacket(dsteptr,MATOCS_REPLICATE,8+4+cnt*(8+4+4+2));
+		put64bit(&data,chunkid);
+		put32bit(&data,version);
+		for (i=0 ; i<cnt ; i++) {
+			srceptr = (matocsserventry *)(src[i]);
+			put64bit(&data,chunkid);
+			put32bit(&data,version);
+			put32bit(&data,srceptr->servip);
+			put16bit(&data,srceptr->servport);
+		}
+		matocsserv_replication_begin(chunkid,version,dsteptr,cnt,src);
+	}
+	return 0;
+}
+
 int matocsserv_send_replicatechunk_xor(void *e,uint64_t chunkid,uint32_t version,uint8_t cnt,const uint32_t xormasks[4],void **src,uint64_t *srcchunkid,uint32_t *srcversion) {
 	matocsserventry *dsteptr = (matocsserventry *)e;
 	matocsserventry *srceptr;
@@ -1467,6 +1521,82 @@ void matocsserv_get_version(matocsserventry *eptr,const uint8_t *data,uint32_t l
 }
 
 
+// checks compact chunk list (strictly increasing chunkids, versions fit in 32 bits, no trailing data)
+static int matocsserv_check_compact_chunks(const uint8_t *data,uint32_t length,uint32_t chunkcount) {
+	const uint8_t *endptr;
+	uint32_t i,j,k;
+	uint64_t v;
+
+	endptr = data+length;
+	for (i=0 ; i<chunkcount ; i++) {
+		for (j=0 ; j<2 ; j++) {
+			for (k=0 ; k<10 && data+k<endptr && (data[k]&0x80) ; k++) {}
+			if (k==10 || data+k>=endptr) {
+				return -1;
+			}
+			v = getvar64bit(&data);
+			if ((j==0 && v==0) || (j==1 && v>UINT64_C(0xFFFFFFFF))) {
+				return -1;
+			}
+		}
+	}
+	return (data==endptr)?0:-1;
+}
+
+static void matocsserv_register_chunks(matocsserventry *eptr) {
+	uint64_t chunkids[REGISTER_CHUNKS_BATCH];
+	uint32_t versions[REGISTER_CHUNKS_BATCH];
+	uint32_t todo,cnt,i;
+	uint64_t v;
+	uint8_t *p;
+
+	todo = eptr->regleft;
+	if (todo>regslice) {
+		todo = regslice;
+	}
+	if (todo>regbudget) {
+		todo = regbudget;
+	}
+	regbudget -= todo;
+	eptr->regleft -= todo;
+	while (todo>0) {
+		cnt = (todo>REGISTER_CHUNKS_BATCH)?REGISTER_CHUNKS_BATCH:todo;
+		for (i=0 ; i<cnt ; i++) {
+			if (eptr->regrversion==63) {
+				eptr->regchunkid += getvar64bit(&(eptr->regdata));
+				chunkids[i] = eptr->regchunkid;
+				v = getvar64bit(&(eptr->regdata));
+				versions[i] = (v>>1) | ((v&1)?0x80000000:0);
+			} else {
+				chunkids[i] = get64bit(&(eptr->regdata));
+				versions[i] = get32bit(&(eptr->regdata));
+			}
+		}
+		chunk_server_has_chunks(eptr->csid,chunkids,versions,cnt);
+		todo -= cnt;
+	}
+	if (eptr->regleft>0) {
+		return;
+	}
+	eptr->regdata = NULL;
+	if (eptr->version>=VERSION2INT(2,0,0) && eptr->regrversion!=51) {
+		if (eptr->version>=VERSION2INT(3,0,39)) {
+			p = matocsserv_createpacket(eptr,MATOCS_MASTER_ACK,7);
+		} else {
+			p = matocsserv_createpacket(eptr,MATOCS_MASTER_ACK,1);
+		}
+		if (p) {
+			put8bit(&p,0);
+			if (eptr->version>=VERSION2INT(3,0,39)) {
+				put32bit(&p,VERSHEX);
+				put16bit(&p,MATOCS_MASTER_ACK_FLAG_COMPACTCHUNKS);
+			}
+		} else {
+			eptr->mode = KILL;
+		}
+	}
+}
+
 void matocsserv_register(matocsserventry *eptr,const uint8_t *data,uint32_t length) {
 	uint64_t chunkid;
 	uint32_t chunkversion;
@@ -1669,29 +1799,31 @@ void matocsserv_register(matocsserventry *eptr,const uint8_t *data,uint32_t leng
 				eptr->mode=KILL;
 				return;
 			}
-			chunkcount = (length-1)/12;
-			for (i=0 ; i<chunkcount ; i++) {
-				chunkid = get64bit(&data);
-				chunkversion = get32bit(&data);
-				chunk_server_has_chunk(eptr->csid,chunkid,chunkversion);
+			// chunks are merged in parts from main loop (see matocsserv_parse) - ack is sent after last one
+			eptr->regdata = data;
+			eptr->regleft = (length-1)/12;
+			eptr->regpleng = length;
+			eptr->regrversion = rversion;
+			matocsserv_register_chunks(eptr);
+			return;
+		} else if (rversion==63) {
+			if (length<5) {
+				syslog(LOG_NOTICE,"CSTOMA_REGISTER (ver 6:COMPACT CHUNKS) - wrong size (%"PRIu32"/5+)",length);
+				eptr->mode=KILL;
+				return;
 			}
-			if (eptr->version>=VERSION2INT(2,0,0) && rversion==61) {
-				uint8_t *p;
-//				if (eptr->version<VERSION2INT(2,0,0)) {
-//					p = matocsserv_createpacket(eptr,MATOCS_MASTER_ACK,5);
-//				} else {
-					p = matocsserv_createpacket(eptr,MATOCS_MASTER_ACK,1);
-//				}
-				if (p) {
-					put8bit(&p,0);
-//					if (eptr->version<VERSION2INT(2,0,0)) {
-//						put32bit(&p,VERSHEX);
-//					}
-				} else {
-					eptr->mode = KILL;
-					return;
-				}
+			chunkcount = get32bit(&data);
+			if (matocsserv_check_compact_chunks(data,length-5,chunkcount)<0) {
+				syslog(LOG_NOTICE,"CSTOMA_REGISTER (ver 6:COMPACT CHUNKS) - malformed chunk list");
+				eptr->mode=KILL;
+				return;
 			}
+			eptr->regdata = data;
+			eptr->regleft = chunkcount;
+			eptr->regpleng = length;
+			eptr->regchunkid = 0;
+			eptr->regrversion = rversion;
+			matocsserv_register_chunks(eptr);
 			return;
 		} else if (rversion==52) {
 			if (length!=41) {
@@ -1712,11 +1844,14 @@ void matocsserv_register(matocsserventry *eptr,const uint8_t *data,uint32_t leng
 			chunk_server_register_end(eptr->csid);
 			return;
 		} else if (rversion==62) {
-			if (length!=1) {
-				syslog(LOG_NOTICE,"CSTOMA_REGISTER (ver 6:END) - wrong size (%"PRIu32"/1)",length);
+			if (length!=1 && length!=3) {
+				syslog(LOG_NOTICE,"CSTOMA_REGISTER (ver 6:END) - wrong size (%"PRIu32"/1|3)",length);
 				eptr->mode=KILL;
 				return;
 			}
+			if (length==3) {
+				eptr->features = get16bit(&data);
+			}
 			syslog(LOG_NOTICE,"chunkserver register end (packet version: 6) - ip: %s / port: %"PRIu16,eptr->servstrip,eptr->servport);
 			eptr->registered = REGISTERED;
 			chunk_server_register_end(eptr->csid);
@@ -1971,35 +2106,116 @@ void matocsserv_gotpacket(matocsserventry *eptr,uint32_t type,const uint8_t *dat
 	}
 }
 
+static inline uint8_t matocsserv_inputbuff_haspacket(matocsserventry *eptr) {
+	const uint8_t *ptr;
+	uint32_t leng;
+
+	if (eptr->inputend-eptr->inputstart<8) {
+		return 0;
+	}
+	ptr = eptr->inputbuff+eptr->inputstart+4;
+	leng = get32bit(&ptr);
+	return (leng<=MaxPacketSize && eptr->inputend-eptr->inputstart>=8+leng)?1:0;
+}
+
+static inline uint8_t* matocsserv_inputbuff_get(void) {
+	uint8_t *buff;
+	if (inputpoolhead!=NULL) {
+		buff = inputpoolhead;
+		inputpoolhead = *((uint8_t**)buff);
+		inputpoolelements--;
+	} else {
+		buff = malloc(INPUT_BUFFSIZE);
+		passert(buff);
+	}
+	return buff;
+}
+
+static inline void matocsserv_inputbuff_release(matocsserventry *eptr) {
+	if (eptr->inputbuffsize==INPUT_BUFFSIZE && inputpoolelements<INPUT_POOLSIZE) {
+		*((uint8_t**)(eptr->inputbuff)) = inputpoolhead;
+		inputpoolhead = eptr->inputbuff;
+		inputpoolelements++;
+	} else {
+		free(eptr->inputbuff);
+	}
+	eptr->inputbuff = NULL;
+	eptr->inputbuffsize = 0;
+	eptr->inputstart = 0;
+	eptr->inputend = 0;
+}
+
+static void matocsserv_inputpool_free(void) {
+	uint8_t *buff;
+	while ((buff = inputpoolhead)!=NULL) {
+		inputpoolhead = *((uint8_t**)buff);
+		free(buff);
+	}
+	inputpoolelements = 0;
+}
+
+// called when input buffer is full - moves incomplete packet to the beginning of buffer or enlarges buffer to fit it
+static int matocsserv_inputbuff_makespace(matocsserventry *eptr) {
+	const uint8_t *ptr;
+	uint32_t leng,need,avail;
+	uint8_t *newbuff;
+
+	if (eptr->inputlocked) {
+		return 0;
+	}
+	avail = eptr->inputend - eptr->inputstart;
+	need = 8;
+	if (avail>=8) {
+		ptr = eptr->inputbuff + eptr->inputstart + 4;
+		leng = get32bit(&ptr);
+		if (leng>MaxPacketSize) {
+			return 0;
+		}
+		need += leng;
+	}
+	if (need<=avail) { // complete packet - parse it first
+		return 0;
+	}
+	if (need>eptr->inputbuffsize) {
+		newbuff = malloc(need);
+		passert(newbuff);
+		memcpy(newbuff,eptr->inputbuff+eptr->inputstart,avail);
+		matocsserv_inputbuff_release(eptr);
+		eptr->inputbuff = newbuff;
+		eptr->inputbuffsize = need;
+	} else if (eptr->inputstart>0) {
+		memmove(eptr->inputbuff,eptr->inputbuff+eptr->inputstart,avail);
+	}
+	eptr->inputstart = 0;
+	eptr->inputend = avail;
+	return 1;
+}
+
 void matocsserv_read(matocsserventry *eptr,double now) {
 	int32_t i;
-	uint32_t type,leng;
-	const uint8_t *ptr;
-	uint32_t rbleng,rbpos;
+	uint8_t rcvd;
 	uint8_t err,hup;
-	static uint8_t *readbuff = NULL;
-	static uint32_t readbuffsize = 0;
 
 	if (eptr == NULL) {
-		if (readbuff != NULL) {
-			free(readbuff);
-		}
-		readbuff = NULL;
-		readbuffsize = 0;
+		matocsserv_inputpool_free();
 		return;
 	}
 
-	if (readbuffsize==0) {
-		readbuffsize = 65536;
-		readbuff = malloc(readbuffsize);
-		passert(readbuff);
+	if (eptr->inputbuff==NULL) {
+		eptr->inputbuff = matocsserv_inputbuff_get();
+		eptr->inputbuffsize = INPUT_BUFFSIZE;
+		eptr->inputstart = 0;
+		eptr->inputend = 0;
 	}
 
-	rbleng = 0;
+	rcvd = 0;
 	err = 0;
 	hup = 0;
 	for (;;) {
-		i = read(eptr->sock,readbuff+rbleng,readbuffsize-rbleng);
+		if (eptr->inputend==eptr->inputbuffsize && matocsserv_inputbuff_makespace(eptr)==0) {
+			break;
+		}
+		i = read(eptr->sock,eptr->inputbuff+eptr->inputend,eptr->inputbuffsize-eptr->inputend);
 		if (i==0) {
 			hup = 1;
 			break;
@@ -2009,72 +2225,18 @@ void matocsserv_read(matocsserventry *eptr,double now) {
 			}
 			break;
 		} else {
-			rbleng += i;
-			if (rbleng==readbuffsize) {
-				readbuffsize*=2;
-				readbuff = realloc(readbuff,readbuffsize);
-				passert(readbuff);
-			} else {
+			eptr->inputend += i;
+			rcvd = 1;
+			if (eptr->inputend<eptr->inputbuffsize) {
 				break;
 			}
 		}
 	}
 
-	if (rbleng>0) {
+	if (rcvd) {
 		eptr->lastread = now;
 	}
 
-	rbpos = 0;
-	while (rbpos<rbleng) {
-		if ((rbleng-rbpos)>=eptr->input_bytesleft) {
-			memcpy(eptr->input_startptr,readbuff+rbpos,eptr->input_bytesleft);
-			i = eptr->input_bytesleft;
-		} else {
-			memcpy(eptr->input_startptr,readbuff+rbpos,rbleng-rbpos);
-			i = rbleng-rbpos;
-		}
-		rbpos += i;
-		eptr->input_startptr+=i;
-		eptr->input_bytesleft-=i;
-
-		if (eptr->input_bytesleft>0) {
-			break;
-		}
-
-		if (eptr->input_packet == NULL) {
-			ptr = eptr->input_hdr;
-			type = get32bit(&ptr);
-			leng = get32bit(&ptr);
-
-			if (leng>MaxPacketSize) {
-				syslog(LOG_WARNING,"CS(%s) packet too long (%"PRIu32"/%u)",eptr->servstrip,leng,MaxPacketSize);
-				eptr->input_end = 1;
-				return;
-			}
-
-			eptr->input_packet = malloc(offsetof(in_packetstruct,data)+leng);
-			passert(eptr->input_packet);
-			eptr->input_packet->next = NULL;
-			eptr->input_packet->type = type;
-			eptr->input_packet->leng = leng;
-
-			eptr->input_startptr = eptr->input_packet->data;
-			eptr->input_bytesleft = leng;
-		}
-
-		if (eptr->input_bytesleft>0) {
-			continue;
-		}
-
-		if (eptr->input_packet != NULL) {
-			*(eptr->inputtail) = eptr->input_packet;
-			eptr->inputtail = &(eptr->input_packet->next);
-			eptr->input_packet = NULL;
-			eptr->input_bytesleft = 8;
-			eptr->input_startptr = eptr->input_hdr;
-		}
-	}
-
 	if (hup) {
 		syslog(LOG_NOTICE,"connection with CS(%s) has been closed by peer",eptr->servstrip);
 		eptr->input_end = 1;
@@ -2085,23 +2247,50 @@ void matocsserv_read(matocsserventry *eptr,double now) {
 }
 
 void matocsserv_parse(matocsserventry *eptr) {
-	in_packetstruct *ipack;
+	const uint8_t *ptr;
+	uint32_t type,leng;
 	uint64_t starttime;
 	uint64_t currtime;
 
+	if (eptr->regleft>0) { // register packet is still being merged - it stays in input buffer, following packets have to wait
+		if (eptr->mode!=DATA) {
+			return;
+		}
+		matocsserv_register_chunks(eptr);
+		if (eptr->regleft>0) {
+			return;
+		}
+		eptr->inputlocked = 0;
+		eptr->inputstart += 8+eptr->regpleng;
+	}
 	starttime = monotonic_useconds();
 	currtime = starttime;
-	while (eptr->mode==DATA && (ipack = eptr->inputhead)!=NULL && starttime+10000>currtime) {
-		matocsserv_gotpacket(eptr,ipack->type,ipack->data,ipack->leng);
-		eptr->inputhead = ipack->next;
-		free(ipack);
-		if (eptr->inputhead==NULL) {
-			eptr->inputtail = &(eptr->inputhead);
-		} else {
-			currtime = monotonic_useconds();
+	while (eptr->mode==DATA && eptr->inputend-eptr->inputstart>=8 && starttime+10000>currtime) {
+		ptr = eptr->inputbuff+eptr->inputstart;
+		type = get32bit(&ptr);
+		leng = get32bit(&ptr);
+		if (leng>MaxPacketSize) {
+			syslog(LOG_WARNING,"CS(%s) packet too long (%"PRIu32"/%u)",eptr->servstrip,leng,MaxPacketSize);
+			eptr->inputstart = eptr->inputend;
+			eptr->input_end = 1;
+			break;
+		}
+		if (eptr->inputend-eptr->inputstart<8+leng) {
+			break;
+		}
+		eptr->inputlocked = 1;
+		matocsserv_gotpacket(eptr,type,ptr,leng);
+		if (eptr->regleft>0) {
+			return;
 		}
+		eptr->inputlocked = 0;
+		eptr->inputstart += 8+leng;
+		currtime = monotonic_useconds();
+	}
+	if (eptr->inputbuff!=NULL && eptr->inputstart==eptr->inputend) {
+		matocsserv_inputbuff_release(eptr);
 	}
-	if (eptr->mode==DATA && eptr->inputhead==NULL && eptr->input_end) {
+	if (eptr->mode==DATA && eptr->input_end && matocsserv_inputbuff_haspacket(eptr)==0) {
 		eptr->mode = KILL;
 	}
 }
@@ -2217,7 +2406,6 @@ void matocsserv_desc(struct pollfd *pdesc,uint32_t *ndesc) {
 
 void matocsserv_disconnection_loop(void) {
 	matocsserventry *eptr,**kptr;
-	in_packetstruct *ipptr,*ipaptr;
 	out_packetstruct *opptr,*opaptr;
 
 	kptr = &matocsservhead;
@@ -2233,14 +2421,8 @@ void matocsserv_disconnection_loop(void) {
 			}
 			csdb_lost_connection(eptr->csptr);
 			tcpclose(eptr->sock);
-			if (eptr->input_packet) {
-				free(eptr->input_packet);
-			}
-			ipptr = eptr->inputhead;
-			while (ipptr) {
-				ipaptr = ipptr;
-				ipptr = ipptr->next;
-				free(ipaptr);
+			if (eptr->inputbuff) {
+				matocsserv_inputbuff_release(eptr);
 			}
 			opptr = eptr->outputhead;
 			while (opptr) {
@@ -2268,6 +2450,7 @@ void matocsserv_serve(struct pollfd *pdesc) {
 	uint32_t peerip;
 	matocsserventry *eptr;
 	int ns;
+	uint32_t regcnt;
 	static double lastaction = 0.0;
 	double timeoutadd;
 
@@ -2300,12 +2483,12 @@ void matocsserv_serve(struct pollfd *pdesc) {
 			eptr->mode = DATA;
 			eptr->lastread = now;
 			eptr->lastwrite = now;
-			eptr->input_bytesleft = 8;
-			eptr->input_startptr = eptr->input_hdr;
+			eptr->inputbuff = NULL;
+			eptr->inputbuffsize = 0;
+			eptr->inputstart = 0;
+			eptr->inputend = 0;
+			eptr->inputlocked = 0;
 			eptr->input_end = 0;
-			eptr->input_packet = NULL;
-			eptr->inputhead = NULL;
-			eptr->inputtail = &(eptr->inputhead);
 			eptr->outputhead = NULL;
 			eptr->outputtail = &(eptr->outputhead);
 
@@ -2340,6 +2523,13 @@ void matocsserv_serve(struct pollfd *pdesc) {
 			eptr->csid = MAXCSCOUNT;
 			eptr->registered = UNREGISTERED;
 
+			eptr->regdata = NULL;
+			eptr->regleft = 0;
+			eptr->regpleng = 0;
+			eptr->regchunkid = 0;
+			eptr->regrversion = 0;
+			eptr->features = 0;
+
 			eptr->privflag = 0;
 //			eptr->cancreatechunks = 1;
 
@@ -2352,6 +2542,19 @@ void matocsserv_serve(struct pollfd *pdesc) {
 		}
 	}
 
+// share chunk merging budget between registering servers
+	regcnt = 1;
+	for (eptr=matocsservhead ; eptr ; eptr=eptr->next) {
+		if (eptr->regleft>0) {
+			regcnt++;
+		}
+	}
+	regbudget = REGISTER_CHUNKS_PER_LOOP;
+	regslice = REGISTER_CHUNKS_PER_LOOP/regcnt;
+	if (regslice<REGISTER_CHUNKS_MIN_SLICE) {
+		regslice = REGISTER_CHUNKS_MIN_SLICE;
+	}
+
 // read
 	for (eptr=matocsservhead ; eptr ; eptr=eptr->next) {
 //		syslog(LOG_NOTICE,"server: %s:%u ; lastread: %.6lf ; lastwrite: %.6lf ; timeout: %u ; now: %.6lf",eptr->servstrip,eptr->servport,eptr->lastread,eptr->lastwrite,eptr->timeout,now);
@@ -2409,21 +2612,14 @@ void matocsserv_keep_alive(void) {
 
 void matocsserv_term(void) {
 	matocsserventry *eptr,*eaptr;
-	in_packetstruct *ipptr,*ipaptr;
 	out_packetstruct *opptr,*opaptr;
 	syslog(LOG_INFO,"master <-> chunkservers module: closing %s:%s",ListenHost,ListenPort);
 	tcpclose(lsock);
 
 	eptr = matocsservhead;
 	while (eptr) {
-		if (eptr->input_packet) {
-			free(eptr->input_packet);
-		}
-		ipptr = eptr->inputhead;
-		while (ipptr) {
-			ipaptr = ipptr;
-			ipptr = ipptr->next;
-			free(ipaptr);
+		if (eptr->inputbuff) {
+			free(eptr->inputbuff);
 		}
 		opptr = eptr->outputhead;
 		while (opptr) {
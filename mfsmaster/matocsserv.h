@@ -58,6 +58,7 @@ double matocsserv_replication_read_counter(void *e,uint32_t now);
 uint16_t matocsserv_deletion_counter(void *e);
 
 int matocsserv_send_replicatechunk(void *e,uint64_t chunkid,uint32_t version,void *src);
+int matocsserv_send_replicatechunk_striped(void *e,uint64_t chunkid,uint32_t version,uint8_t cnt,void **src);
 int matocsserv_send_replicatechunk_raid(void *e,uint64_t chunkid,uint32_t version,uint8_t cnt,const uint32_t xormasks[4],void **src,uint64_t *srcchunkid,uint32_t *srcversion);
 int matocsserv_send_chunkop(void *e,uint64_t chunkid,uint32_t version,uint32_t newversion,uint64_t copychunkid,uint32_t copyversion,uint32_t leng);
 int matocsserv_send_deletechunk(void *e,uint64_t chunkid,uint32_t version);
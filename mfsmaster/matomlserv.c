@@ -55,6 +55,10 @@
 
 #define MaxPacketSize ANTOMA_MAXPACKETSIZE
 
+// input buffers - packets are parsed directly from them, idle connections give them back to pool
+#define INPUT_BUFFSIZE 16384
+#define INPUT_POOLSIZE 256
+
 #define META_DL_BLOCK ((((MATOAN_MAXPACKETSIZE) - 1000) < 1000000) ? ((MATOAN_MAXPACKETSIZE) - 1000) : 1000000)
 
 #define OLD_CHANGES_GROUP_COUNT 10000
@@ -75,23 +79,16 @@ typedef struct out_packetstruct {
 	uint8_t data[1];
 } out_packetstruct;
 
-typedef struct in_packetstruct {
-	struct in_packetstruct *next;
-	uint32_t type,leng;
-	uint8_t data[1];
-} in_packetstruct;
-
 typedef struct matomlserventry {
 	uint8_t mode;
 	int sock;
 	int32_t pdescpos;
 	double lastread,lastwrite;
-	uint8_t input_hdr[8];
-	uint8_t *input_startptr;
-	uint32_t input_bytesleft;
+	uint8_t *inputbuff;			//input data - packets are parsed in place
+	uint32_t inputbuffsize;
+	uint32_t inputstart,inputend;		//unparsed data
+	uint8_t inputlocked;			//packet from input buffer is being processed - data can't be moved
 	uint8_t input_end;
-	in_packetstruct *input_packet;
-	in_packetstruct *inputhead,**inputtail;
 	out_packetstruct *outputhead,**outputtail;
 
 	uint16_t timeout;
@@ -102,6 +99,7 @@ typedef struct matomlserventry {
 	uint32_t servip;
 	uint8_t clienttype;
 	uint8_t logstate;
+	uint8_t binchanges;
 
 
 	int upload_meta_fd;
@@ -113,6 +111,9 @@ typedef struct matomlserventry {
 
 static matomlserventry *matomlservhead=NULL;
 static int lsock;
+
+static uint8_t *inputpoolhead = NULL;
+static uint32_t inputpoolelements = 0;
 static int32_t lsockpdescpos;
 
 /*
@@ -289,16 +290,36 @@ uint8_t* matomlserv_createpacket(matomlserventry *eptr,uint32_t type,uint32_t si
 	return ptr;
 }
 
-void matomlserv_send_old_change(void *veptr,uint64_t version,uint8_t *data,uint32_t length) {
-	matomlserventry *eptr = (matomlserventry *)veptr;
+static inline void matomlserv_send_change(matomlserventry *eptr,uint64_t version,const uint8_t *data,uint32_t length) {
+	static char textbuff[4096];
 	uint8_t *pdata;
 
+	if (length>0 && CHLOP_ISBINARY(data)) {
+		if (eptr->binchanges) {
+			pdata = matomlserv_createpacket(eptr,MATOAN_METACHANGES_LOG,9+length);
+			put8bit(&pdata,0xBB);
+			put64bit(&pdata,version);
+			memcpy(pdata,data,length);
+			return;
+		}
+		// metalogger doesn't understand binary records - send them as text
+		length = changelog_bin_to_text(data,length,textbuff,4096);
+		if (length==0) {
+			syslog(LOG_WARNING,"can't convert binary change %"PRIu64" to text",version);
+			return;
+		}
+		data = (const uint8_t*)textbuff;
+	}
 	pdata = matomlserv_createpacket(eptr,MATOAN_METACHANGES_LOG,9+length);
 	put8bit(&pdata,0xFF);
 	put64bit(&pdata,version);
 	memcpy(pdata,data,length);
 }
 
+void matomlserv_send_old_change(void *veptr,uint64_t version,uint8_t *data,uint32_t length) {
+	matomlserv_send_change((matomlserventry *)veptr,version,data,length);
+}
+
 /*
 void matomlserv_send_old_changes(matomlserventry *eptr,uint64_t version) {
 	uint64_t minver = changelog_get_minversion();
@@ -389,24 +410,30 @@ void matomlserv_register(matomlserventry *eptr,const uint8_t *data,uint32_t leng
 		rversion = get8bit(&data);
 		if (rversion==1) {
 			eptr->clienttype = METALOGGER;
-			if (length!=7) {
-				syslog(LOG_NOTICE,"ANTOMA_REGISTER (logger 1) - wrong size (%"PRIu32"/7)",length);
+			if (length!=7 && length!=8) {
+				syslog(LOG_NOTICE,"ANTOMA_REGISTER (logger 1) - wrong size (%"PRIu32"/7|8)",length);
 				eptr->mode = KILL;
 				return;
 			}
 			eptr->version = get32bit(&data);
 			eptr->timeout = get16bit(&data);
+			if (length==8) {
+				eptr->binchanges = (get8bit(&data) & ANTOMA_REGISTER_FLAG_BINCHANGES)?1:0;
+			}
 			eptr->logstate = SYNC;
 		} else if (rversion==2) {
 			eptr->clienttype = METALOGGER;
-			if (length!=7+8) {
-				syslog(LOG_NOTICE,"ANTOMA_REGISTER (logger 2) - wrong size (%"PRIu32"/15)",length);
+			if (length!=7+8 && length!=7+8+1) {
+				syslog(LOG_NOTICE,"ANTOMA_REGISTER (logger 2) - wrong size (%"PRIu32"/15|16)",length);
 				eptr->mode = KILL;
 				return;
 			}
 			eptr->version = get32bit(&data);
 			eptr->timeout = get16bit(&data);
 			req_minversion = get64bit(&data);
+			if (length==7+8+1) {
+				eptr->binchanges = (get8bit(&data) & ANTOMA_REGISTER_FLAG_BINCHANGES)?1:0;
+			}
 			chlog_minversion = changelog_get_minversion();
 			if (chlog_minversion>0 && chlog_minversion<=req_minversion) {
 						n = changelog_get_old_changes(req_minversion,matomlserv_send_old_change,eptr,OLD_CHANGES_GROUP_COUNT);
@@ -461,6 +488,7 @@ void matomlserv_download_start(matomlserventry *eptr,const uint8_t *data,uint32_
 		}
 	}
 	if (filenum==1) {
+		changelog_flush();
 		eptr->upload_meta_fd = open("metadata.mfs.back",O_RDONLY);
 		eptr->upload_chain1_fd = open("changelog.0.mfs",O_RDONLY);
 		eptr->upload_chain2_fd = open("changelog.1.mfs",O_RDONLY);
@@ -551,14 +579,10 @@ void matomlserv_download_end(matomlserventry *eptr,const uint8_t *data,uint32_t
 
 void matomlserv_broadcast_logstring(uint64_t version,uint8_t *logstr,uint32_t logstrsize) {
 	matomlserventry *eptr;
-	uint8_t *data;
 
 	for (eptr = matomlservhead ; eptr ; eptr=eptr->next) {
 		if (eptr->version>0 && eptr->clienttype==METALOGGER && eptr->logstate==SYNC) {
-			data = matomlserv_createpacket(eptr,MATOAN_METACHANGES_LOG,9+logstrsize);
-			put8bit(&data,0xFF);
-			put64bit(&data,version);
-			memcpy(data,logstr,logstrsize);
+			matomlserv_send_change(eptr,version,logstr,logstrsize);
 		}
 	}
 }
@@ -619,35 +643,116 @@ void matomlserv_gotpacket(matomlserventry *eptr,uint32_t type,const uint8_t *dat
 	}
 }
 
+static inline uint8_t matomlserv_inputbuff_haspacket(matomlserventry *eptr) {
+	const uint8_t *ptr;
+	uint32_t leng;
+
+	if (eptr->inputend-eptr->inputstart<8) {
+		return 0;
+	}
+	ptr = eptr->inputbuff+eptr->inputstart+4;
+	leng = get32bit(&ptr);
+	return (leng<=MaxPacketSize && eptr->inputend-eptr->inputstart>=8+leng)?1:0;
+}
+
+static inline uint8_t* matomlserv_inputbuff_get(void) {
+	uint8_t *buff;
+	if (inputpoolhead!=NULL) {
+		buff = inputpoolhead;
+		inputpoolhead = *((uint8_t**)buff);
+		inputpoolelements--;
+	} else {
+		buff = malloc(INPUT_BUFFSIZE);
+		passert(buff);
+	}
+	return buff;
+}
+
+static inline void matomlserv_inputbuff_release(matomlserventry *eptr) {
+	if (eptr->inputbuffsize==INPUT_BUFFSIZE && inputpoolelements<INPUT_POOLSIZE) {
+		*((uint8_t**)(eptr->inputbuff)) = inputpoolhead;
+		inputpoolhead = eptr->inputbuff;
+		inputpoolelements++;
+	} else {
+		free(eptr->inputbuff);
+	}
+	eptr->inputbuff = NULL;
+	eptr->inputbuffsize = 0;
+	eptr->inputstart = 0;
+	eptr->inputend = 0;
+}
+
+static void matomlserv_inputpool_free(void) {
+	uint8_t *buff;
+	while ((buff = inputpoolhead)!=NULL) {
+		inputpoolhead = *((uint8_t**)buff);
+		free(buff);
+	}
+	inputpoolelements = 0;
+}
+
+// called when input buffer is full - moves incomplete packet to the beginning of buffer or enlarges buffer to fit it
+static int matomlserv_inputbuff_makespace(matomlserventry *eptr) {
+	const uint8_t *ptr;
+	uint32_t leng,need,avail;
+	uint8_t *newbuff;
+
+	if (eptr->inputlocked) {
+		return 0;
+	}
+	avail = eptr->inputend - eptr->inputstart;
+	need = 8;
+	if (avail>=8) {
+		ptr = eptr->inputbuff + eptr->inputstart + 4;
+		leng = get32bit(&ptr);
+		if (leng>MaxPacketSize) {
+			return 0;
+		}
+		need += leng;
+	}
+	if (need<=avail) { // complete packet - parse it first
+		return 0;
+	}
+	if (need>eptr->inputbuffsize) {
+		newbuff = malloc(need);
+		passert(newbuff);
+		memcpy(newbuff,eptr->inputbuff+eptr->inputstart,avail);
+		matomlserv_inputbuff_release(eptr);
+		eptr->inputbuff = newbuff;
+		eptr->inputbuffsize = need;
+	} else if (eptr->inputstart>0) {
+		memmove(eptr->inputbuff,eptr->inputbuff+eptr->inputstart,avail);
+	}
+	eptr->inputstart = 0;
+	eptr->inputend = avail;
+	return 1;
+}
+
 void matomlserv_read(matomlserventry *eptr,double now) {
 	int32_t i;
-	uint32_t type,leng;
-	const uint8_t *ptr;
-	uint32_t rbleng,rbpos;
+	uint8_t rcvd;
 	uint8_t err,hup;
-	static uint8_t *readbuff = NULL;
-	static uint32_t readbuffsize = 0;
 
 	if (eptr == NULL) {
-		if (readbuff != NULL) {
-			free(readbuff);
-		}
-		readbuff = NULL;
-		readbuffsize = 0;
+		matomlserv_inputpool_free();
 		return;
 	}
 
-	if (readbuffsize==0) {
-		readbuffsize = 65536;
-		readbuff = malloc(readbuffsize);
-		passert(readbuff);
+	if (eptr->inputbuff==NULL) {
+		eptr->inputbuff = matomlserv_inputbuff_get();
+		eptr->inputbuffsize = INPUT_BUFFSIZE;
+		eptr->inputstart = 0;
+		eptr->inputend = 0;
 	}
 
-	rbleng = 0;
+	rcvd = 0;
 	err = 0;
 	hup = 0;
 	for (;;) {
-		i = read(eptr->sock,readbuff+rbleng,readbuffsize-rbleng);
+		if (eptr->inputend==eptr->inputbuffsize && matomlserv_inputbuff_makespace(eptr)==0) {
+			break;
+		}
+		i = read(eptr->sock,eptr->inputbuff+eptr->inputend,eptr->inputbuffsize-eptr->inputend);
 		if (i==0) {
 			hup = 1;
 			break;
@@ -657,72 +762,18 @@ void matomlserv_read(matomlserventry *eptr,double now) {
 			}
 			break;
 		} else {
-			rbleng += i;
-			if (rbleng==readbuffsize) {
-				readbuffsize*=2;
-				readbuff = realloc(readbuff,readbuffsize);
-				passert(readbuff);
-			} else {
+			eptr->inputend += i;
+			rcvd = 1;
+			if (eptr->inputend<eptr->inputbuffsize) {
 				break;
 			}
 		}
 	}
 
-	if (rbleng>0) {
+	if (rcvd) {
 		eptr->lastread = now;
 	}
 
-	rbpos = 0;
-	while (rbpos<rbleng) {
-		if ((rbleng-rbpos)>=eptr->input_bytesleft) {
-			memcpy(eptr->input_startptr,readbuff+rbpos,eptr->input_bytesleft);
-			i = eptr->input_bytesleft;
-		} else {
-			memcpy(eptr->input_startptr,readbuff+rbpos,rbleng-rbpos);
-			i = rbleng-rbpos;
-		}
-		rbpos += i;
-		eptr->input_startptr+=i;
-		eptr->input_bytesleft-=i;
-
-		if (eptr->input_bytesleft>0) {
-			break;
-		}
-
-		if (eptr->input_packet == NULL) {
-			ptr = eptr->input_hdr;
-			type = get32bit(&ptr);
-			leng = get32bit(&ptr);
-
-			if (leng>MaxPacketSize) {
-				syslog(LOG_WARNING,"ML(%s) packet too long (%"PRIu32"/%u)",eptr->servstrip,leng,MaxPacketSize);
-				eptr->input_end = 1;
-				return;
-			}
-
-			eptr->input_packet = malloc(offsetof(in_packetstruct,data)+leng);
-			passert(eptr->input_packet);
-			eptr->input_packet->next = NULL;
-			eptr->input_packet->type = type;
-			eptr->input_packet->leng = leng;
-
-			eptr->input_startptr = eptr->input_packet->data;
-			eptr->input_bytesleft = leng;
-		}
-
-		if (eptr->input_bytesleft>0) {
-			continue;
-		}
-
-		if (eptr->input_packet != NULL) {
-			*(eptr->inputtail) = eptr->input_packet;
-			eptr->inputtail = &(eptr->input_packet->next);
-			eptr->input_packet = NULL;
-			eptr->input_bytesleft = 8;
-			eptr->input_startptr = eptr->input_hdr;
-		}
-	}
-
 	if (hup) {
 		syslog(LOG_NOTICE,"connection with %s(%s) has been closed by peer",matomlserv_clientname(eptr),eptr->servstrip);
 		eptr->input_end = 1;
@@ -733,23 +784,36 @@ void matomlserv_read(matomlserventry *eptr,double now) {
 }
 
 void matomlserv_parse(matomlserventry *eptr) {
-	in_packetstruct *ipack;
+	const uint8_t *ptr;
+	uint32_t type,leng;
 	uint64_t starttime;
 	uint64_t currtime;
 
 	starttime = monotonic_useconds();
 	currtime = starttime;
-	while (eptr->mode==DATA && (ipack = eptr->inputhead)!=NULL && starttime+10000>currtime) {
-		matomlserv_gotpacket(eptr,ipack->type,ipack->data,ipack->leng);
-		eptr->inputhead = ipack->next;
-		free(ipack);
-		if (eptr->inputhead==NULL) {
-			eptr->inputtail = &(eptr->inputhead);
-		} else {
-			currtime = monotonic_useconds();
+	while (eptr->mode==DATA && eptr->inputend-eptr->inputstart>=8 && starttime+10000>currtime) {
+		ptr = eptr->inputbuff+eptr->inputstart;
+		type = get32bit(&ptr);
+		leng = get32bit(&ptr);
+		if (leng>MaxPacketSize) {
+			syslog(LOG_WARNING,"ML(%s) packet too long (%"PRIu32"/%u)",eptr->servstrip,leng,MaxPacketSize);
+			eptr->inputstart = eptr->inputend;
+			eptr->input_end = 1;
+			break;
 		}
+		if (eptr->inputend-eptr->inputstart<8+leng) {
+			break;
+		}
+		eptr->inputlocked = 1;
+		matomlserv_gotpacket(eptr,type,ptr,leng);
+		eptr->inputlocked = 0;
+		eptr->inputstart += 8+leng;
+		currtime = monotonic_useconds();
+	}
+	if (eptr->inputbuff!=NULL && eptr->inputstart==eptr->inputend) {
+		matomlserv_inputbuff_release(eptr);
 	}
-	if (eptr->mode==DATA && eptr->inputhead==NULL && eptr->input_end) {
+	if (eptr->mode==DATA && eptr->input_end && matomlserv_inputbuff_haspacket(eptr)==0) {
 		eptr->mode = KILL;
 	}
 }
@@ -865,7 +929,6 @@ void matomlserv_desc(struct pollfd *pdesc,uint32_t *ndesc) {
 
 void matomlserv_disconnection_loop(void) {
 	matomlserventry *eptr,**kptr;
-	in_packetstruct *ipptr,*ipaptr;
 	out_packetstruct *opptr,*opaptr;
 
 	kptr = &matomlservhead;
@@ -877,14 +940,8 @@ void matomlserv_disconnection_loop(void) {
 			} else {
 				close(eptr->sock);
 			}
-			if (eptr->input_packet) {
-				free(eptr->input_packet);
-			}
-			ipptr = eptr->inputhead;
-			while (ipptr) {
-				ipaptr = ipptr;
-				ipptr = ipptr->next;
-				free(ipaptr);
+			if (eptr->inputbuff) {
+				matomlserv_inputbuff_release(eptr);
 			}
 			opptr = eptr->outputhead;
 			while (opptr) {
@@ -939,12 +996,12 @@ void matomlserv_serve(struct pollfd *pdesc) {
 			eptr->mode = DATA;
 			eptr->lastread = now;
 			eptr->lastwrite = now;
-			eptr->input_bytesleft = 8;
-			eptr->input_startptr = eptr->input_hdr;
+			eptr->inputbuff = NULL;
+			eptr->inputbuffsize = 0;
+			eptr->inputstart = 0;
+			eptr->inputend = 0;
+			eptr->inputlocked = 0;
 			eptr->input_end = 0;
-			eptr->input_packet = NULL;
-			eptr->inputhead = NULL;
-			eptr->inputtail = &(eptr->inputhead);
 			eptr->outputhead = NULL;
 			eptr->outputtail = &(eptr->outputhead);
 			eptr->timeout = 10;
@@ -954,6 +1011,7 @@ void matomlserv_serve(struct pollfd *pdesc) {
 			eptr->version = 0;
 			eptr->clienttype = UNKNOWN;
 			eptr->logstate = NONE;
+			eptr->binchanges = 0;
 			eptr->upload_meta_fd = -1;
 			eptr->upload_chain1_fd = -1;
 			eptr->upload_chain2_fd = -1;
@@ -1022,21 +1080,14 @@ void matomlserv_keep_alive(void) {
 
 void matomlserv_term(void) {
 	matomlserventry *eptr,*eaptr;
-	in_packetstruct *ipptr,*ipaptr;
 	out_packetstruct *opptr,*opaptr;
 	syslog(LOG_INFO,"master control module: closing %s:%s",ListenHost,ListenPort);
 	tcpclose(lsock);
 
 	eptr = matomlservhead;
 	while (eptr) {
-		if (eptr->input_packet) {
-			free(eptr->input_packet);
-		}
-		ipptr = eptr->inputhead;
-		while (ipptr) {
-			ipaptr = ipptr;
-			ipptr = ipptr->next;
-			free(ipaptr);
+		if (eptr->inputbuff) {
+			free(eptr->inputbuff);
 		}
 		opptr = eptr->outputhead;
 		while (opptr) {
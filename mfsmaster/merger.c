@@ -26,6 +26,7 @@
 #include "slogger.h"
 #include "sharedpointer.h"
 #include "restore.h"
+#include "binlog.h"
 #include "clocks.h"
 
 #define BSIZE 200000
@@ -35,6 +36,8 @@ typedef struct _hentry {
 	void *shfilename;
 	char *buff;
 	char *ptr;
+	uint32_t leng;
+	uint8_t binary;
 	int64_t nextid;
 } hentry;
 
@@ -88,11 +91,31 @@ void merger_heap_sort_up(void) {
 
 
 void merger_nextentry(uint32_t pos) {
+	uint64_t version;
+	int status;
+
+	if (heap[pos].binary) {
+		status = binlog_readrecord(heap[pos].fd,&version,(uint8_t*)heap[pos].buff,BSIZE,&(heap[pos].leng));
+		if (status>0) {
+			heap[pos].ptr = heap[pos].buff;
+			if (heap[pos].nextid<0 || ((int64_t)version>heap[pos].nextid && (int64_t)version<heap[pos].nextid+maxidhole)) {
+				heap[pos].nextid = version;
+				return;
+			}
+		} else if (status==0) {
+			heap[pos].nextid = INT64_C(-1);
+			return;
+		}
+		mfs_arg_syslog(LOG_WARNING,"found garbage at the end of file: %s (last correct id: %"PRIu64")\n",(char*)shp_get(heap[pos].shfilename),heap[pos].nextid);
+		heap[pos].nextid = INT64_C(-1);
+		return;
+	}
 	if (fgets(heap[pos].buff,BSIZE,heap[pos].fd)) {
 		int64_t nextid = strtoll(heap[pos].buff,&(heap[pos].ptr),10);
 		if (heap[pos].ptr[0]==':' && heap[pos].ptr[1]==' ') {
 			heap[pos].ptr += 2;
 		}
+		heap[pos].leng = strlen(heap[pos].ptr);
 		if (heap[pos].nextid<0 || (nextid>heap[pos].nextid && nextid<heap[pos].nextid+maxidhole)) {
 			heap[pos].nextid = nextid;
 		} else {
@@ -122,6 +145,11 @@ void merger_new_entry(const char *filename) {
 		heap[heapsize].shfilename = shp_new(strdup(filename),free);
 		heap[heapsize].buff = malloc(BSIZE);
 		heap[heapsize].ptr = NULL;
+		heap[heapsize].leng = 0;
+		heap[heapsize].binary = binlog_isbinary(fileno(heap[heapsize].fd));
+		if (heap[heapsize].binary) {
+			fseek(heap[heapsize].fd,BINLOG_HEADER_SIZE,SEEK_SET);
+		}
 		heap[heapsize].nextid = INT64_C(-1);
 		merger_nextentry(heapsize);
 	} else {
@@ -129,6 +157,8 @@ void merger_new_entry(const char *filename) {
 		heap[heapsize].shfilename = NULL;
 		heap[heapsize].buff = NULL;
 		heap[heapsize].ptr = NULL;
+		heap[heapsize].leng = 0;
+		heap[heapsize].binary = 0;
 		heap[heapsize].nextid = INT64_C(-1);
 	}
 }
@@ -196,7 +226,7 @@ int merger_loop(uint8_t verblevel) {
 			fflush(stdout);
 		}
 //		printf("current id: %"PRIu64" / %s\n",heap[0].nextid,heap[0].ptr);
-		if ((status=restore_file(heap[0].shfilename,heap[0].nextid,heap[0].ptr,verblevel))<0) {
+		if ((status=restore_file(heap[0].shfilename,heap[0].nextid,(uint8_t*)heap[0].ptr,heap[0].leng,verblevel))<0) {
 			while (heapsize) {
 				heapsize--;
 				merger_delete_entry();
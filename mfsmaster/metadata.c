@@ -39,6 +39,7 @@
 #include <time.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "MFSCommunication.h"
 
@@ -112,8 +113,8 @@ int meta_store_chunk(bio *fd,uint8_t (*storefn)(bio *),const char chunkname[4])
 	if (storefn) {
 		storefn(fd);
 
-		if (offbegin!=0) {
-			offend = bio_file_position(fd);
+		offend = bio_file_position(fd);
+		if (offend>offbegin) { // position is unknown for sockets
 			ptr = hdr+8;
 			put64bit(&ptr,offend-offbegin-16);
 			bio_seek(fd,offbegin+8,SEEK_SET);
@@ -158,6 +159,9 @@ void meta_store(bio *fd) {
 	if (meta_store_chunk(fd,fs_storefree,"FREE")<0) {
 		return;
 	}
+	if (meta_store_chunk(fd,fs_storesnaps,"SNAP")<0) { // dependency: EDGE (statistics)
+		return;
+	}
 	if (meta_store_chunk(fd,fs_storequota,"QUOT")<0) {
 		return;
 	}
@@ -262,7 +266,7 @@ uint8_t meta_check_metadatafile(const char *name,uint64_t *ver,uint64_t *fileid)
 	return META_CHECK_OK;
 }
 
-int meta_load(bio *fd,uint8_t fver) {
+static int meta_load_data(bio *fd,uint8_t fver,uint8_t chunksbg) {
 	uint8_t hdr[16];
 	const uint8_t *ptr;
 	off_t offbegin=0;
@@ -380,6 +384,17 @@ int meta_load(bio *fd,uint8_t fver) {
 					syslog(LOG_ERR,"error reading metadata (free)");
 					return -1;
 				}
+			} else if (memcmp(hdr,"SNAP",4)==0) {
+				if (mver>fs_storesnaps(NULL)) {
+					mfs_syslog(LOG_ERR,"error reading metadata (pending snapshots) - metadata in file have been stored by newer version of MFS !!!");
+					return -1;
+				}
+				fprintf(stderr,"loading pending snapshots ... ");
+				fflush(stderr);
+				if (fs_loadsnaps(fd,mver,ignoreflag)<0) {
+					syslog(LOG_ERR,"error reading metadata (pending snapshots)");
+					return -1;
+				}
 			} else if (memcmp(hdr,"QUOT",4)==0) {
 				if (mver>fs_storequota(NULL)) {
 					mfs_syslog(LOG_ERR,"error reading metadata (quota) - metadata in file have been stored by newer version of MFS !!!");
@@ -487,12 +502,22 @@ int meta_load(bio *fd,uint8_t fver) {
 					mfs_syslog(LOG_ERR,"error reading metadata (chunks) - metadata in file have been stored by newer version of MFS !!!");
 					return -1;
 				}
-				fprintf(stderr,"loading chunks data ... ");
-				fflush(stderr);
-				if (chunk_load(fd,mver)<0) {
-					fprintf(stderr,"error\n");
-					syslog(LOG_ERR,"error reading metadata (chunks)");
-					return -1;
+				if (chunksbg) { // chunks are loaded by separate thread (see meta_load)
+					fprintf(stderr,"skipping chunks data (loaded by separate thread) ... ");
+					fflush(stderr);
+					if (sleng==UINT64_C(0xFFFFFFFFFFFFFFFF) || bio_seek(fd,offbegin+sleng,SEEK_SET)<0) {
+						fprintf(stderr,"error\n");
+						syslog(LOG_ERR,"error reading metadata (chunks)");
+						return -1;
+					}
+				} else {
+					fprintf(stderr,"loading chunks data ... ");
+					fflush(stderr);
+					if (chunk_load(fd,mver)<0) {
+						fprintf(stderr,"error\n");
+						syslog(LOG_ERR,"error reading metadata (chunks)");
+						return -1;
+					}
 				}
 			} else {
 				hdr[8]=0;
@@ -516,6 +541,106 @@ int meta_load(bio *fd,uint8_t fver) {
 			fprintf(stderr,"ok (%.4lf)\n",profdata);
 		}
 	}
+	return 0;
+}
+
+typedef struct _meta_chunkloader {
+	const char *fname;
+	uint64_t offset;
+	uint64_t leng;
+	uint8_t mver;
+	int status;
+	double loadtime;
+} meta_chunkloader;
+
+// finds section using lengths stored in section headers (they work as an index of the file)
+// returns 1 and sets offset (to the beginning of section data), length and version when section has been found
+static int meta_find_section(const char *fname,uint64_t offset,const char name[4],uint64_t *soffset,uint64_t *sleng,uint8_t *mver) {
+	uint8_t hdr[16];
+	const uint8_t *ptr;
+	uint64_t leng;
+	int fd,ret;
+
+	fd = open(fname,O_RDONLY);
+	if (fd<0) {
+		return 0;
+	}
+	ret = 0;
+	while (pread(fd,hdr,16,offset)==16) {
+		if (memcmp(hdr,"[MFS EOF MARKER]",16)==0) {
+			break;
+		}
+		ptr = hdr+8;
+		leng = get64bit(&ptr);
+		if (leng==UINT64_C(0xFFFFFFFFFFFFFFFF)) { // unknown length - can't go further
+			break;
+		}
+		offset += 16;
+		if (memcmp(hdr,name,4)==0) {
+			*soffset = offset;
+			*sleng = leng;
+			*mver = (((hdr[5]-'0')&0xF)<<4)+((hdr[7]-'0')&0xF);
+			ret = 1;
+			break;
+		}
+		offset += leng;
+	}
+	close(fd);
+	return ret;
+}
+
+static void* meta_chunkloader_thread(void *arg) {
+	meta_chunkloader *cl = (meta_chunkloader*)arg;
+	bio *fd;
+
+	cl->loadtime = monotonic_seconds();
+	cl->status = -1;
+	fd = bio_file_open(cl->fname,BIO_READ,META_FILE_BUFFER_SIZE);
+	if (fd!=NULL) {
+		if (bio_seek(fd,cl->offset,SEEK_SET)>=0 && chunk_load(fd,cl->mver)>=0) {
+			if (bio_file_position(fd)==cl->offset+cl->leng) {
+				cl->status = 0;
+			} else {
+				syslog(LOG_ERR,"not all chunks section has been read - file corrupted");
+			}
+		}
+		bio_close(fd);
+	}
+	cl->loadtime = monotonic_seconds()-cl->loadtime;
+	return arg;
+}
+
+// fname is NULL when metadata are not read from file
+int meta_load(bio *fd,uint8_t fver,const char *fname) {
+	meta_chunkloader cl;
+	pthread_t th;
+	uint8_t chunksbg;
+	int status;
+
+	// chunks section doesn't depend on other sections, so it can be loaded in parallel with nodes and edges
+	chunksbg = 0;
+	if (fname!=NULL && fver>=0x16 && meta_find_section(fname,bio_file_position(fd)+16,"CHNK",&(cl.offset),&(cl.leng),&(cl.mver))) {
+		if (cl.mver<=chunk_store(NULL)) {
+			cl.fname = fname;
+			if (main_minthread_create(&th,0,meta_chunkloader_thread,&cl)>=0) {
+				chunksbg = 1;
+			}
+		}
+	}
+	status = meta_load_data(fd,fver,chunksbg);
+	if (chunksbg) {
+		zassert(pthread_join(th,NULL));
+		if (cl.status<0) {
+			fprintf(stderr,"loading chunks data (separate thread) ... error\n");
+			syslog(LOG_ERR,"error reading metadata (chunks)");
+			status = -1;
+		} else {
+			fprintf(stderr,"loading chunks data (separate thread) ... ok (%.4lf)\n",cl.loadtime);
+		}
+	}
+	if (status<0) {
+		return -1;
+	}
 	return fs_check_consistency(ignoreflag);
 }
 
@@ -633,6 +758,417 @@ void meta_storeended(int status) {
 	}
 }
 
+// incremental (fork-less) store - objects are serialized on the main thread in time slices,
+// objects modified before being stored are written in their original form first (pre-images),
+// data blocks are written to the file by a separate thread
+
+#define META_BGSTORE_BUFFER_SIZE 0x400000
+#define META_BGSTORE_QUEUE_LIMIT 0x4000000
+#define META_BGSTORE_SLICE_USEC 5000
+#define META_BGSTORE_BUCKETS 0x10000
+
+enum {BGSTORE_NONE,BGSTORE_NODES,BGSTORE_EDGES,BGSTORE_CHUNKS,BGSTORE_FINISH};
+
+typedef struct _bgstore_block {
+	uint8_t *data;
+	uint64_t offset;
+	uint32_t leng;
+	uint8_t patch;
+	struct _bgstore_block *next;
+} bgstore_block;
+
+static uint8_t bgstorestate = BGSTORE_NONE;
+static bio *bgstorefd;		// current stream (memory)
+static bio *bgstoreedges;	// edge pre-images collected while nodes are stored
+static bio *bgstorechunks;	// chunk pre-images collected before chunks are stored
+static bio *bgstoretail;	// sections captured at the beginning (FREE ... CSDB)
+static uint64_t bgstoresection;	// position of current section header
+
+static int bgstorefile;
+static pthread_t bgwriterthread;
+static pthread_mutex_t bgqlock;
+static pthread_cond_t bgqcond;
+static bgstore_block *bgqhead,**bgqtail;
+static uint64_t bgqbytes;
+static uint8_t bgqeof;
+static uint8_t bgqdone;
+static uint8_t bgqerror;
+
+static uint8_t MetaStoreMode;
+
+static void meta_back_rotate(void) {
+	if (BackMetaCopies>0) {
+		char metaname1[100],metaname2[100];
+		int n;
+		for (n=BackMetaCopies-1 ; n>0 ; n--) {
+			snprintf(metaname1,100,"metadata.mfs.back.%"PRIu32,n+1);
+			snprintf(metaname2,100,"metadata.mfs.back.%"PRIu32,n);
+			rename(metaname2,metaname1);
+		}
+		rename("metadata.mfs.back","metadata.mfs.back.1");
+	}
+	rename("metadata.mfs.back.tmp","metadata.mfs.back");
+	unlink("metadata.mfs");
+}
+
+static void* meta_bgstore_writer(void *arg) {
+	bgstore_block *b;
+	uint32_t pos;
+	ssize_t r;
+	uint8_t err;
+
+	zassert(pthread_mutex_lock(&bgqlock));
+	for (;;) {
+		while (bgqhead==NULL && bgqeof==0) {
+			zassert(pthread_cond_wait(&bgqcond,&bgqlock));
+		}
+		if (bgqhead==NULL) {
+			break;
+		}
+		b = bgqhead;
+		bgqhead = b->next;
+		if (bgqhead==NULL) {
+			bgqtail = &bgqhead;
+		}
+		err = bgqerror;
+		zassert(pthread_mutex_unlock(&bgqlock));
+		if (err==0) {
+			if (b->patch) {
+				if (pwrite(bgstorefile,b->data,b->leng,b->offset)!=(ssize_t)(b->leng)) {
+					err = 1;
+				}
+			} else {
+				pos = 0;
+				while (pos<b->leng) {
+					r = write(bgstorefile,b->data+pos,b->leng-pos);
+					if (r<0 && errno==EINTR) {
+						continue;
+					}
+					if (r<=0) {
+						err = 1;
+						break;
+					}
+					pos += r;
+				}
+			}
+			if (err) {
+				mfs_errlog(LOG_ERR,"metadata store - write error");
+			}
+		}
+		free(b->data);
+		zassert(pthread_mutex_lock(&bgqlock));
+		if (err) {
+			bgqerror = 1;
+		}
+		bgqbytes -= b->leng;
+		free(b);
+	}
+	bgqdone = 1;
+	zassert(pthread_mutex_unlock(&bgqlock));
+	return arg;
+}
+
+static void meta_bgstore_enqueue(uint8_t *data,uint32_t leng,uint8_t patch,uint64_t offset) {
+	bgstore_block *b;
+
+	b = malloc(sizeof(bgstore_block));
+	passert(b);
+	b->data = data;
+	b->leng = leng;
+	b->patch = patch;
+	b->offset = offset;
+	b->next = NULL;
+	zassert(pthread_mutex_lock(&bgqlock));
+	*bgqtail = b;
+	bgqtail = &(b->next);
+	bgqbytes += leng;
+	zassert(pthread_cond_signal(&bgqcond));
+	zassert(pthread_mutex_unlock(&bgqlock));
+}
+
+// pass collected data to the writer
+static void meta_bgstore_flush(void) {
+	uint8_t *buff;
+	uint32_t leng;
+
+	leng = bio_mem_release(bgstorefd,&buff);
+	if (leng>0) {
+		meta_bgstore_enqueue(buff,leng,0,0);
+	} else {
+		free(buff);
+	}
+}
+
+// copy data collected in separate buffer to current stream
+static int meta_bgstore_append(bio *src) {
+	uint8_t *buff;
+	uint32_t leng;
+
+	if (bio_error(src)) {
+		bio_close(src);
+		return -1;
+	}
+	leng = bio_mem_release(src,&buff);
+	if (leng>0 && bio_write(bgstorefd,buff,leng)!=leng) {
+		syslog(LOG_NOTICE,"write error");
+	}
+	free(buff);
+	bio_close(src);
+	return 0;
+}
+
+static void meta_bgstore_section_begin(const char chunkname[4],uint8_t mver) {
+	uint8_t hdr[16];
+
+	memcpy(hdr,chunkname,4);
+	hdr[4] = ' ';
+	hdr[5] = '0'+((mver>>4)&0xF);
+	hdr[6] = '.';
+	hdr[7] = '0'+(mver&0xF);
+	memset(hdr+8,0xFF,8);
+	bgstoresection = bio_file_position(bgstorefd);
+	if (bio_write(bgstorefd,hdr,16)!=(size_t)16) {
+		syslog(LOG_NOTICE,"write error");
+	}
+}
+
+static void meta_bgstore_section_end(void) {
+	uint8_t *data,*ptr;
+	uint64_t offend;
+
+	offend = bio_file_position(bgstorefd);
+	meta_bgstore_flush();
+	data = malloc(8);
+	passert(data);
+	ptr = data;
+	put64bit(&ptr,offend-bgstoresection-16);
+	meta_bgstore_enqueue(data,8,1,bgstoresection+8);
+}
+
+// stop writer and remove all incremental store structures
+static void meta_bgstore_abort(void) {
+	if (bgstorestate==BGSTORE_NONE) {
+		return;
+	}
+	fs_bgstore_end();
+	chunk_bgstore_end();
+	zassert(pthread_mutex_lock(&bgqlock));
+	bgqerror = 1;
+	bgqeof = 1;
+	zassert(pthread_cond_signal(&bgqcond));
+	zassert(pthread_mutex_unlock(&bgqlock));
+	zassert(pthread_join(bgwriterthread,NULL));
+	if (bgstorefd!=NULL) {
+		bio_close(bgstorefd);
+		bgstorefd = NULL;
+	}
+	if (bgstoreedges!=NULL) {
+		bio_close(bgstoreedges);
+		bgstoreedges = NULL;
+	}
+	if (bgstorechunks!=NULL) {
+		bio_close(bgstorechunks);
+		bgstorechunks = NULL;
+	}
+	if (bgstoretail!=NULL) {
+		bio_close(bgstoretail);
+		bgstoretail = NULL;
+	}
+	close(bgstorefile);
+	unlink("metadata.mfs.back.tmp");
+	bgstorestate = BGSTORE_NONE;
+}
+
+static void meta_bgstore_failed(void) {
+	meta_bgstore_abort();
+	syslog(LOG_ERR,"can't write metadata");
+	storestarttime = 0.0;
+	// try to save in alternative location - just in case
+	if (meta_emergency_saves()<0) {
+		syslog(LOG_ERR,"metadata not stored !!! - exiting");
+	} else {
+		syslog(LOG_ERR,"metadata stored in emergency mode (in non-standard location) - exiting");
+	}
+	main_exit();
+}
+
+static void meta_bgstore_finish(void) {
+	uint8_t err;
+
+	zassert(pthread_join(bgwriterthread,NULL));
+	bio_close(bgstorefd);
+	bgstorefd = NULL;
+	err = bgqerror;
+	if (close(bgstorefile)<0) {
+		mfs_errlog(LOG_ERR,"metadata store - close error");
+		err = 1;
+	}
+	bgstorestate = BGSTORE_NONE;
+	if (err) {
+		unlink("metadata.mfs.back.tmp");
+		syslog(LOG_ERR,"can't write metadata");
+		storestarttime = 0.0;
+		if (meta_emergency_saves()<0) {
+			syslog(LOG_ERR,"metadata not stored !!! - exiting");
+		} else {
+			syslog(LOG_ERR,"metadata stored in emergency mode (in non-standard location) - exiting");
+		}
+		main_exit();
+		return;
+	}
+	meta_back_rotate();
+	laststoretime = monotonic_seconds()-storestarttime;
+	syslog(LOG_NOTICE,"store process has finished - store time: %.3lf",laststoretime);
+	storestarttime = 0.0;
+	laststorestatus = 0;
+	lastsuccessfulstore = main_time();
+}
+
+// returns 1 when store has been started, -1 when it can't be started (caller should use standard method)
+static int meta_bgstore_start(void) {
+	uint8_t hdr[16];
+	uint8_t *ptr;
+	int fd;
+
+	fd = open("metadata.mfs.back.tmp",O_WRONLY|O_CREAT|O_TRUNC,0666);
+	if (fd<0) {
+		mfs_errlog(LOG_ERR,"metadata store - open error");
+		return -1;
+	}
+	if (lockf(fd,F_TLOCK,0)<0) {
+		mfs_errlog(LOG_ERR,"metadata store - lockf error");
+		close(fd);
+		return -1;
+	}
+	bgstorefile = fd;
+	bgqhead = NULL;
+	bgqtail = &bgqhead;
+	bgqbytes = 0;
+	bgqeof = 0;
+	bgqdone = 0;
+	bgqerror = 0;
+	if (main_minthread_create(&bgwriterthread,0,meta_bgstore_writer,NULL)<0) {
+		mfs_errlog(LOG_WARNING,"metadata store - can't create writer thread");
+		close(fd);
+		unlink("metadata.mfs.back.tmp");
+		return -1;
+	}
+	storestarttime = monotonic_seconds();
+	bgstorefd = bio_mem_open(META_BGSTORE_BUFFER_SIZE);
+	bgstoreedges = bio_mem_open(0x10000);
+	bgstorechunks = bio_mem_open(0x10000);
+	bgstoretail = bio_mem_open(META_BGSTORE_BUFFER_SIZE);
+	bgstorestate = BGSTORE_NODES;
+
+	if (bio_write(bgstorefd,MFSSIGNATURE "M 2.0",8)!=(size_t)8) {
+		syslog(LOG_NOTICE,"write error");
+	}
+	ptr = hdr;
+	put64bit(&ptr,metaversion);
+	put64bit(&ptr,metafileid);
+	if (bio_write(bgstorefd,hdr,16)!=(size_t)16) {
+		syslog(LOG_NOTICE,"write error");
+	}
+	meta_store_chunk(bgstorefd,sessions_store,"SESS");
+	meta_store_chunk(bgstorefd,labelset_store,"LABS");
+	meta_bgstore_section_begin("NODE",fs_storenodes(NULL));
+	// from here all modified nodes, edges and chunks are stored before modification
+	fs_bgstore_start(bgstorefd,bgstoreedges);
+	chunk_bgstore_start(bgstorechunks);
+	// small sections are stored immediately and placed in file later
+	meta_store_chunk(bgstoretail,fs_storefree,"FREE");
+	meta_store_chunk(bgstoretail,fs_storesnaps,"SNAP");
+	meta_store_chunk(bgstoretail,fs_storequota,"QUOT");
+	meta_store_chunk(bgstoretail,xattr_store,"XATR");
+	meta_store_chunk(bgstoretail,posix_acl_store,"PACL");
+	meta_store_chunk(bgstoretail,of_store,"OPEN");
+	meta_store_chunk(bgstoretail,flock_store,"FLCK");
+	meta_store_chunk(bgstoretail,posix_lock_store,"PLCK");
+	meta_store_chunk(bgstoretail,csdb_store,"CSDB");
+	meta_bgstore_flush();
+	return 1;
+}
+
+static void meta_bgstore_step(void) {
+	uint64_t deadline;
+	uint64_t qbytes;
+	uint8_t done,err;
+
+	if (bgstorestate==BGSTORE_NONE) {
+		return;
+	}
+	zassert(pthread_mutex_lock(&bgqlock));
+	qbytes = bgqbytes;
+	done = bgqdone;
+	err = bgqerror;
+	zassert(pthread_mutex_unlock(&bgqlock));
+	if (err) {
+		meta_bgstore_failed();
+		return;
+	}
+	if (bgstorestate==BGSTORE_FINISH) {
+		if (done) {
+			meta_bgstore_finish();
+		}
+		return;
+	}
+	if (qbytes<META_BGSTORE_QUEUE_LIMIT) {
+		deadline = monotonic_useconds()+META_BGSTORE_SLICE_USEC;
+		do {
+			switch (bgstorestate) {
+			case BGSTORE_NODES:
+				if (fs_bgstore_nodes(META_BGSTORE_BUCKETS)) {
+					meta_bgstore_section_end();
+					meta_bgstore_section_begin("EDGE",fs_storeedges(NULL));
+					fs_bgstore_edges_begin(bgstorefd);
+					if (meta_bgstore_append(bgstoreedges)<0) {
+						err = 1;
+					}
+					bgstoreedges = NULL;
+					bgstorestate = BGSTORE_EDGES;
+				}
+				break;
+			case BGSTORE_EDGES:
+				if (fs_bgstore_edges(META_BGSTORE_BUCKETS)) {
+					fs_bgstore_end();
+					meta_bgstore_section_end();
+					if (meta_bgstore_append(bgstoretail)<0) {
+						err = 1;
+					}
+					bgstoretail = NULL;
+					meta_bgstore_section_begin("CHNK",chunk_store(NULL));
+					chunk_bgstore_chunks_begin(bgstorefd);
+					if (meta_bgstore_append(bgstorechunks)<0) {
+						err = 1;
+					}
+					bgstorechunks = NULL;
+					bgstorestate = BGSTORE_CHUNKS;
+				}
+				break;
+			case BGSTORE_CHUNKS:
+				if (chunk_bgstore_chunks(META_BGSTORE_BUCKETS)) {
+					chunk_bgstore_end();
+					meta_bgstore_section_end();
+					meta_store_chunk(bgstorefd,NULL,NULL);
+					bgstorestate = BGSTORE_FINISH;
+				}
+				break;
+			}
+		} while (err==0 && bgstorestate!=BGSTORE_FINISH && monotonic_useconds()<deadline);
+	}
+	if (err || bio_error(bgstorefd)) {
+		meta_bgstore_failed();
+		return;
+	}
+	meta_bgstore_flush();
+	if (bgstorestate==BGSTORE_FINISH) {
+		zassert(pthread_mutex_lock(&bgqlock));
+		bgqeof = 1;
+		zassert(pthread_cond_signal(&bgqcond));
+		zassert(pthread_mutex_unlock(&bgqlock));
+	}
+}
+
 int meta_storeall(int bg) {
 	bio *fd;
 	int i,estat;
@@ -643,6 +1179,10 @@ int meta_storeall(int bg) {
 	if (metaversion==0) {
 		return 2;
 	}
+	if (bgstorestate!=BGSTORE_NONE) {
+		syslog(LOG_ERR,"previous metadata save process hasn't finished yet - do not start another one");
+		return -1;
+	}
 //	if (stat("metadata.mfs.back.tmp",&sb)==0) {
 //		syslog(LOG_ERR,"previous metadata save process hasn't finished yet - do not start another one");
 //		return -1;
@@ -660,6 +1200,11 @@ int meta_storeall(int bg) {
 		}
 		close(mfd);
 	}
+	if (bg && MetaStoreMode==1) {
+		if (meta_bgstore_start()>0) {
+			return 1;
+		}
+	}
 	if (bg) {
 		if (pipe(pfd)<0) {
 			pfd[0]=-1;
@@ -738,18 +1283,7 @@ int meta_storeall(int bg) {
 			return 0;
 		} else {
 			bio_close(fd);
-			if (BackMetaCopies>0) {
-				char metaname1[100],metaname2[100];
-				int n;
-				for (n=BackMetaCopies-1 ; n>0 ; n--) {
-					snprintf(metaname1,100,"metadata.mfs.back.%"PRIu32,n+1);
-					snprintf(metaname2,100,"metadata.mfs.back.%"PRIu32,n);
-					rename(metaname2,metaname1);
-				}
-				rename("metadata.mfs.back","metadata.mfs.back.1");
-			}
-			rename("metadata.mfs.back.tmp","metadata.mfs.back");
-			unlink("metadata.mfs");
+			meta_back_rotate();
 		}
 		if (i==0) { // background
 			exit(0);
@@ -824,6 +1358,10 @@ void meta_cleanup(void) {
 }
 
 void meta_term(void) {
+	if (bgstorestate!=BGSTORE_NONE) {
+		syslog(LOG_NOTICE,"metadata store in progress - aborting (metadata will be stored in foreground)");
+		meta_bgstore_abort();
+	}
 	changelog_rotate();
 	for (;;) {
 		uint8_t status;
@@ -881,7 +1419,7 @@ int meta_downloadall(int socket) {
 	}
 	if (memcmp(hdr,MFSSIGNATURE "M ",5)==0 && hdr[5]>='1' && hdr[5]<='9' && hdr[6]=='.' && hdr[7]>='0' && hdr[7]<='9') {
 		fver = ((hdr[5]-'0')<<4)+(hdr[7]-'0');
-		if (meta_load(fd,fver)<0) {
+		if (meta_load(fd,fver,NULL)<0) {
 			meta_cleanup();
 			bio_close(fd);
 			fprintf(stderr,"download error\n");
@@ -933,7 +1471,7 @@ int meta_loadfile(const char *filename) {
 	}
 	if (memcmp(hdr,MFSSIGNATURE "M ",5)==0 && hdr[5]>='1' && hdr[5]<='9' && hdr[6]=='.' && hdr[7]>='0' && hdr[7]<='9') {
 		fver = ((hdr[5]-'0')<<4)+(hdr[7]-'0');
-		if (meta_load(fd,fver)<0) {
+		if (meta_load(fd,fver,filename)<0) {
 			meta_cleanup();
 			bio_close(fd);
 			return -2;
@@ -1331,6 +1869,11 @@ void meta_reload(void) {
 		mfs_syslog(LOG_WARNING,"BACK_META_KEEP_PREVIOUS is too high (>99) - decreasing");
 		BackMetaCopies=99;
 	}
+	MetaStoreMode = cfg_getuint8("METADATA_STORE_MODE",0);
+	if (MetaStoreMode>1) {
+		mfs_syslog(LOG_WARNING,"METADATA_STORE_MODE - unknown mode - using default (0)");
+		MetaStoreMode = 0;
+	}
 }
 
 void meta_check_fileid(void) {
@@ -1407,9 +1950,13 @@ int meta_init(void) {
 	} else {
 		fprintf(stderr,"starting without metadata\n");
 	}
+	fs_lazysnap_activate(); // from now every copy of pending snapshot is stored in changelog
 	meta_reload();
 	main_reload_register(meta_reload);
 	main_time_register(3600,0,meta_dostoreall);
+	zassert(pthread_mutex_init(&bgqlock,NULL));
+	zassert(pthread_cond_init(&bgqcond,NULL));
+	main_msectime_register(10,0,meta_bgstore_step);
 	main_destruct_register(meta_term);
 	fs_renumerate_edge_test();
 	meta_check_fileid();
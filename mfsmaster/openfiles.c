@@ -173,7 +173,7 @@ void of_sync(uint32_t sessionid,uint32_t *inodes,uint32_t inodecnt) {
 			ipos = of_bisearch(ofr->inode,inodes,inodecnt);
 //			syslog(LOG_NOTICE,"sync: search for %"PRIu32" -> pos: %"PRId32,ofr->inode,ipos);
 			if (ipos<0) { // close
-				changelog("%"PRIu32"|RELEASE(%"PRIu32",%"PRIu32")",main_time(),ofr->sessionid,ofr->inode);
+				changelog_op(CHLOP_RELEASE,main_time(),ofr->sessionid,ofr->inode);
 				of_delnode(ofr);
 			} else {
 				bitmask[ipos>>5] |= (1U<<(ipos&0x1F));
@@ -187,7 +187,7 @@ void of_sync(uint32_t sessionid,uint32_t *inodes,uint32_t inodecnt) {
 
 	for (i=0 ; i<inodecnt ; i++) {
 		if ((bitmask[i>>5] & (1U<<(i&0x1F)))==0) {
-			changelog("%"PRIu32"|ACQUIRE(%"PRIu32",%"PRIu32")",main_time(),sessionid,inodes[i]);
+			changelog_op(CHLOP_ACQUIRE,main_time(),sessionid,inodes[i]);
 			of_newnode(sessionid,inodes[i]);
 		}
 	}
@@ -196,7 +196,7 @@ void of_sync(uint32_t sessionid,uint32_t *inodes,uint32_t inodecnt) {
 
 void of_openfile(uint32_t sessionid,uint32_t inode) {
 	if (of_checknode(sessionid,inode)==0) {
-		changelog("%"PRIu32"|ACQUIRE(%"PRIu32",%"PRIu32")",main_time(),sessionid,inode);
+		changelog_op(CHLOP_ACQUIRE,main_time(),sessionid,inode);
 		of_newnode(sessionid,inode);
 	}
 }
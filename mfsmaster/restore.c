@@ -38,6 +38,8 @@
 #include "chunks.h"
 #include "labelsets.h"
 #include "metadata.h"
+#include "changelog.h"
+#include "datapack.h"
 #include "slogger.h"
 #include "massert.h"
 #include "mfsstrerr.h"
@@ -1019,6 +1021,14 @@ int do_setacl(const char *filename,uint64_t lv,uint32_t ts,const char *ptr) {
 	return fs_mr_setacl(ts,inode,mode,changectime,acltype,userperm,groupperm,otherperm,mask,namedusers,namedgroups,aclblob);
 }
 
+int do_snapexpand(const char *filename,uint64_t lv,uint32_t ts,const char *ptr) {
+	uint32_t inode;
+	EAT(ptr,filename,lv,'(');
+	GETU32(inode,ptr);
+	EAT(ptr,filename,lv,')');
+	return fs_mr_snapexpand(ts,inode);
+}
+
 int do_snapshot(const char *filename,uint64_t lv,uint32_t ts,const char *ptr) {
 	uint32_t inode,parent,smode,sesflags,uid,gids,umask;
 	static uint8_t *gid = NULL;
@@ -1356,6 +1366,8 @@ int restore_line(const char *filename,uint64_t lv,const char *line) {
 		case HASHCODE('S','N','A','P'):
 			if (strncmp(ptr,"SNAPSHOT",8)==0) {
 				return do_snapshot(filename,lv,ts,ptr+8);
+			} else if (strncmp(ptr,"SNAPEXPAND",10)==0) {
+				return do_snapexpand(filename,lv,ts,ptr+10);
 			}
 			break;
 		case HASHCODE('S','Y','M','L'):
@@ -1535,6 +1547,8 @@ int restore_line(const char *filename,uint64_t lv,const char *line) {
 				status = do_setacl(filename,lv,ts,ptr+6);
 			} else if (strncmp(ptr,"SNAPSHOT",8)==0) {
 				status = do_snapshot(filename,lv,ts,ptr+8);
+			} else if (strncmp(ptr,"SNAPEXPAND",10)==0) {
+				status = do_snapexpand(filename,lv,ts,ptr+10);
 			} else if (strncmp(ptr,"SYMLINK",7)==0) {
 				status = do_symlink(filename,lv,ts,ptr+7);
 			} else if (strncmp(ptr,"SESSION",7)==0) { // deprecated
@@ -1584,6 +1598,113 @@ int restore_line(const char *filename,uint64_t lv,const char *line) {
 	return status;
 }
 
+int restore_binary(const char *filename,uint64_t lv,const uint8_t *data,uint32_t leng) {
+	const uint8_t *ptr,*name,*name_dst;
+	uint32_t ts,inode,parent,parent_dst,uid,gid,rdev,atime,mtime,indx,version,lockedto;
+	uint16_t mode,cumask;
+	uint8_t opcode,type,nleng,nleng_dst,flag,opflag;
+	uint64_t chunkid,length;
+
+	if (changelog_bin_check(data,leng)<0) {
+		mfs_arg_syslog(LOG_WARNING,"%s:%"PRIu64": damaged binary entry\n",filename,lv);
+		return -1;
+	}
+	ptr = data;
+	opcode = get8bit(&ptr);
+	ts = get32bit(&ptr);
+	switch (opcode) {
+		case CHLOP_ACCESS:
+			inode = get32bit(&ptr);
+			return fs_mr_access(ts,inode);
+		case CHLOP_ATTR:
+			inode = get32bit(&ptr);
+			mode = get16bit(&ptr);
+			uid = get32bit(&ptr);
+			gid = get32bit(&ptr);
+			atime = get32bit(&ptr);
+			mtime = get32bit(&ptr);
+			return fs_mr_attr(ts,inode,mode,uid,gid,atime,mtime);
+		case CHLOP_CREATE:
+			parent = get32bit(&ptr);
+			nleng = get8bit(&ptr);
+			name = ptr;
+			ptr += nleng;
+			type = get8bit(&ptr);
+			mode = get16bit(&ptr);
+			cumask = get16bit(&ptr);
+			uid = get32bit(&ptr);
+			gid = get32bit(&ptr);
+			rdev = get32bit(&ptr);
+			inode = get32bit(&ptr);
+			return fs_mr_create(ts,parent,nleng,name,type,mode,cumask,uid,gid,rdev,inode);
+		case CHLOP_UNLINK:
+			parent = get32bit(&ptr);
+			nleng = get8bit(&ptr);
+			name = ptr;
+			ptr += nleng;
+			inode = get32bit(&ptr);
+			return fs_mr_unlink(ts,parent,nleng,name,inode);
+		case CHLOP_MOVE:
+			parent = get32bit(&ptr);
+			nleng = get8bit(&ptr);
+			name = ptr;
+			ptr += nleng;
+			parent_dst = get32bit(&ptr);
+			nleng_dst = get8bit(&ptr);
+			name_dst = ptr;
+			ptr += nleng_dst;
+			inode = get32bit(&ptr);
+			return fs_mr_move(ts,parent,nleng,name,parent_dst,nleng_dst,name_dst,inode);
+		case CHLOP_LINK:
+			inode = get32bit(&ptr);
+			parent_dst = get32bit(&ptr);
+			nleng_dst = get8bit(&ptr);
+			return fs_mr_link(ts,inode,parent_dst,nleng_dst,(uint8_t*)ptr);
+		case CHLOP_LENGTH:
+			inode = get32bit(&ptr);
+			length = get64bit(&ptr);
+			flag = get8bit(&ptr);
+			return fs_mr_length(ts,inode,length,flag);
+		case CHLOP_WRITE:
+			inode = get32bit(&ptr);
+			indx = get32bit(&ptr);
+			opflag = get8bit(&ptr);
+			flag = get8bit(&ptr);
+			chunkid = get64bit(&ptr);
+			return fs_mr_write(ts,inode,indx,opflag,flag,chunkid);
+		case CHLOP_UNLOCK:
+			chunkid = get64bit(&ptr);
+			return fs_mr_unlock(chunkid);
+		case CHLOP_TRUNC:
+			inode = get32bit(&ptr);
+			indx = get32bit(&ptr);
+			chunkid = get64bit(&ptr);
+			return fs_mr_trunc(ts,inode,indx,chunkid);
+		case CHLOP_ACQUIRE:
+			parent = get32bit(&ptr);
+			inode = get32bit(&ptr);
+			return of_mr_acquire(parent,inode);
+		case CHLOP_RELEASE:
+			parent = get32bit(&ptr);
+			inode = get32bit(&ptr);
+			return of_mr_release(parent,inode);
+		case CHLOP_INCVERSION:
+			chunkid = get64bit(&ptr);
+			return chunk_mr_increase_version(chunkid);
+		case CHLOP_CHUNKADD:
+			chunkid = get64bit(&ptr);
+			version = get32bit(&ptr);
+			lockedto = get32bit(&ptr);
+			return chunk_mr_chunkadd(chunkid,version,lockedto);
+		case CHLOP_CHUNKDEL:
+			chunkid = get64bit(&ptr);
+			version = get32bit(&ptr);
+			return chunk_mr_chunkdel(chunkid,version);
+	}
+	mfs_arg_syslog(LOG_WARNING,"%s:%"PRIu64": unknown binary entry (opcode: %"PRIu8")\n",filename,lv,opcode);
+	return ERROR_MISMATCH;
+}
+
 int restore_net(uint64_t lv,const char *ptr) {
 	uint8_t status;
 	if (lv!=meta_version()) {
@@ -1605,10 +1726,21 @@ int restore_net(uint64_t lv,const char *ptr) {
 static uint64_t v=0,lastv=0;
 static void *lastshfn = NULL;
 
-int restore_file(void *shfilename,uint64_t lv,const char *ptr,uint8_t vlevel) {
+int restore_file(void *shfilename,uint64_t lv,const uint8_t *data,uint32_t leng,uint8_t vlevel) {
+	static char textbuff[4096];
+	const char *ptr;
 	int status;
 	char *lastfn;
 	char *filename = (char*)shp_get(shfilename);
+	if (CHLOP_ISBINARY(data)) {
+		if (vlevel>0 && changelog_bin_to_text(data,leng,textbuff,4096)>0) {
+			ptr = textbuff;
+		} else {
+			ptr = "(binary)";
+		}
+	} else {
+		ptr = (const char*)data;
+	}
 	if (lastv==0 || v==0 || lastshfn==NULL) {
 		v = meta_version();
 		lastv = lv-1;
@@ -1634,11 +1766,18 @@ int restore_file(void *shfilename,uint64_t lv,const char *ptr,uint8_t vlevel) {
 			if (vlevel>0) {
 				mfs_arg_syslog(LOG_WARNING,"%s: change%s",filename,ptr);
 			}
-			status = restore_line(filename,lv,ptr);
+			if (CHLOP_ISBINARY(data)) {
+				status = restore_binary(filename,lv,data,leng);
+			} else {
+				status = restore_line(filename,lv,ptr);
+			}
 			if (status<0) { // parse error - just ignore this line
 				return 0;
 			}
 			if (status>0) { // other errors - stop processing data
+				if (CHLOP_ISBINARY(data) && changelog_bin_to_text(data,leng,textbuff,4096)>0) {
+					ptr = textbuff;
+				}
 				mfs_arg_syslog(LOG_WARNING,"%s:%"PRIu64": operation (%s) error: %d (%s)",filename,lv,ptr,status,mfsstrerr(status));
 				return -1;
 			}
@@ -24,6 +24,7 @@
 #include <inttypes.h>
 
 int restore_net(uint64_t lv,const char *ptr);
-int restore_file(void *shfilename,uint64_t lv,const char *ptr,uint8_t verblevel);
+int restore_binary(const char *filename,uint64_t lv,const uint8_t *data,uint32_t leng);
+int restore_file(void *shfilename,uint64_t lv,const uint8_t *data,uint32_t leng,uint8_t verblevel);
 
 #endif
@@ -544,6 +544,75 @@ int fs_loadquota(FILE *fd,uint8_t mver) {
 	return 0;
 }
 
+int fs_loadsnaps(FILE *fd,uint8_t mver) {
+	uint8_t rbuff[52];
+	const uint8_t *ptr;
+	uint32_t jobs,t,i,j;
+	uint32_t ts,uid,gids,gid,srcid,dstid,jobid,inodes,dirs,files,chunks;
+	uint64_t length,size,realsize;
+	uint16_t cumask;
+	uint8_t smode,sesflags;
+
+	if (mver>0x10) {
+		fprintf(stderr,"loading pending snapshots: unsupported format\n");
+		return -1;
+	}
+	if (fread(rbuff,1,4,fd)!=4) {
+		return -1;
+	}
+	ptr=rbuff;
+	jobs = get32bit(&ptr);
+	printf("# snapshot jobs: %"PRIu32"\n",jobs);
+	for (j=1 ; j<=jobs ; j++) {
+		if (fread(rbuff,1,16,fd)!=16) {
+			return -1;
+		}
+		ptr = rbuff;
+		ts = get32bit(&ptr);
+		uid = get32bit(&ptr);
+		cumask = get16bit(&ptr);
+		smode = get8bit(&ptr);
+		sesflags = get8bit(&ptr);
+		gids = get32bit(&ptr);
+		printf("SNAPJOB|j:%10"PRIu32"|t:%10"PRIu32"|m:%02"PRIX8"|f:%02"PRIX8"|u:%10"PRIu32"|k:%04"PRIo16"|g:",j,ts,smode,sesflags,uid,cumask);
+		for (i=0 ; i<gids ; i++) {
+			if (fread(rbuff,1,4,fd)!=4) {
+				printf("\n");
+				return -1;
+			}
+			ptr = rbuff;
+			gid = get32bit(&ptr);
+			printf("%s%"PRIu32,(i>0)?",":"",gid);
+		}
+		printf("\n");
+	}
+	if (fread(rbuff,1,4,fd)!=4) {
+		return -1;
+	}
+	ptr=rbuff;
+	t = get32bit(&ptr);
+	printf("# pending snapshots: %"PRIu32"\n",t);
+	while (t>0) {
+		if (fread(rbuff,1,52,fd)!=52) {
+			return -1;
+		}
+		ptr = rbuff;
+		srcid = get32bit(&ptr);
+		dstid = get32bit(&ptr);
+		jobid = get32bit(&ptr);
+		inodes = get32bit(&ptr);
+		dirs = get32bit(&ptr);
+		files = get32bit(&ptr);
+		chunks = get32bit(&ptr);
+		length = get64bit(&ptr);
+		size = get64bit(&ptr);
+		realsize = get64bit(&ptr);
+		printf("SNAP|s:%10"PRIu32"|d:%10"PRIu32"|j:%10"PRIu32"|vi:%10"PRIu32"|vd:%10"PRIu32"|vf:%10"PRIu32"|vc:%10"PRIu32"|vl:%20"PRIu64"|vs:%20"PRIu64"|vr:%20"PRIu64"\n",srcid,dstid,jobid,inodes,dirs,files,chunks,length,size,realsize);
+		t--;
+	}
+	return 0;
+}
+
 int xattr_load(FILE *fd,uint8_t mver) {
 	uint8_t hdrbuff[4+1+4];
 	const uint8_t *ptr;
@@ -1231,6 +1300,11 @@ int fs_load(FILE *fd,uint8_t fver) {
 				printf("error reading metadata (FREE)\n");
 				return -1;
 			}
+		} else if (memcmp(hdr,"SNAP",4)==0) {
+			if (fs_loadsnaps(fd,mver)<0) {
+				printf("error reading metadata (SNAP)\n");
+				return -1;
+			}
 		} else if (memcmp(hdr,"QUOT",4)==0) {
 			if (fs_loadquota(fd,mver)<0) {
 				printf("error reading metadata (QUOT)\n");
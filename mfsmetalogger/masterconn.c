@@ -44,6 +44,7 @@
 #include "datapack.h"
 #include "masterconn.h"
 #include "crc.h"
+#include "binlog.h"
 #include "cfg.h"
 #include "main.h"
 #include "slogger.h"
@@ -92,7 +93,8 @@ typedef struct masterconn {
 	uint8_t downloadretrycnt;
 	uint8_t downloading;
 	uint8_t oldmode;
-	FILE *logfd;	// using stdio because this is text file
+	FILE *logfd;	// using stdio because this is text file (or stream of binary records)
+	uint8_t logbinary;
 	int metafd;	// using standard unix I/O because this is binary file
 	uint64_t filesize;
 	uint64_t dloffset;
@@ -141,6 +143,16 @@ void masterconn_findlastlogversion(void) {
 		return;
 	}
 	fstat(fd,&st);
+	if (binlog_isbinary(fd)) {
+		lastlogversion = binlog_findlastversion(fd,&size);
+		if (size<(uint64_t)(st.st_size)) {	// garbage at the end of file - truncate
+			if (ftruncate(fd,size)<0) {
+				lastlogversion = 0;
+			}
+		}
+		close(fd);
+		return;
+	}
 	size = st.st_size;
 	memset(buff,0,32);
 	lastnewline = 0;
@@ -225,44 +237,71 @@ void masterconn_sendregister(masterconn *eptr) {
 	eptr->downloading=0;
 	eptr->metafd=-1;
 	eptr->logfd=NULL;
+	eptr->logbinary=0;
 
 	if (lastlogversion>0) {
-		buff = masterconn_createpacket(eptr,ANTOMA_REGISTER,1+4+2+8);
+		buff = masterconn_createpacket(eptr,ANTOMA_REGISTER,1+4+2+8+1);
 		put8bit(&buff,2);
 		put16bit(&buff,VERSMAJ);
 		put8bit(&buff,VERSMID);
 		put8bit(&buff,VERSMIN);
 		put16bit(&buff,Timeout);
 		put64bit(&buff,lastlogversion);
+		put8bit(&buff,ANTOMA_REGISTER_FLAG_BINCHANGES);
 	} else {
-		buff = masterconn_createpacket(eptr,ANTOMA_REGISTER,1+4+2);
+		buff = masterconn_createpacket(eptr,ANTOMA_REGISTER,1+4+2+1);
 		put8bit(&buff,1);
 		put16bit(&buff,VERSMAJ);
 		put8bit(&buff,VERSMID);
 		put8bit(&buff,VERSMIN);
 		put16bit(&buff,Timeout);
+		put8bit(&buff,ANTOMA_REGISTER_FLAG_BINCHANGES);
 	}
 }
 
 
-void masterconn_metachanges_log(masterconn *eptr,const uint8_t *data,uint32_t length) {
+void masterconn_metachanges_rotate(masterconn *eptr) {
 	char logname1[100],logname2[100];
 	uint32_t i;
-	uint64_t version;
-	if (length==1 && data[0]==0x55) {
-		if (eptr->logfd!=NULL) {
-			fclose(eptr->logfd);
-			eptr->logfd=NULL;
+	if (eptr->logfd!=NULL) {
+		fclose(eptr->logfd);
+		eptr->logfd=NULL;
+	}
+	if (BackLogsNumber>0) {
+		for (i=BackLogsNumber ; i>0 ; i--) {
+			snprintf(logname1,100,"changelog_ml.%"PRIu32".mfs",i);
+			snprintf(logname2,100,"changelog_ml.%"PRIu32".mfs",i-1);
+			rename(logname2,logname1);
 		}
-		if (BackLogsNumber>0) {
-			for (i=BackLogsNumber ; i>0 ; i--) {
-				snprintf(logname1,100,"changelog_ml.%"PRIu32".mfs",i);
-				snprintf(logname2,100,"changelog_ml.%"PRIu32".mfs",i-1);
-				rename(logname2,logname1);
-			}
-		} else {
-			unlink("changelog_ml.0.mfs");
+	} else {
+		unlink("changelog_ml.0.mfs");
+	}
+}
+
+void masterconn_metachanges_open(masterconn *eptr,uint8_t binary) {
+	struct stat st;
+	eptr->logfd = fopen("changelog_ml.0.mfs","a");
+	if (eptr->logfd==NULL) {
+		return;
+	}
+	// format of new file depends on first received change
+	if (fstat(fileno(eptr->logfd),&st)<0 || st.st_size==0) {
+		eptr->logbinary = binary;
+		if (binary && binlog_writeheader(eptr->logfd)<0) {
+			syslog(LOG_WARNING,"error writing binary changelog header");
 		}
+	} else {
+		eptr->logbinary = binlog_isbinary(fileno(eptr->logfd));
+	}
+}
+
+void masterconn_metachanges_log(masterconn *eptr,const uint8_t *data,uint32_t length) {
+	char logname1[100];
+	uint32_t i;
+	uint64_t version;
+	uint8_t binary;
+	if (length==1 && data[0]==0x55) {
+		masterconn_metachanges_rotate(eptr);
 		return;
 	}
 	if (length<10) {
@@ -270,19 +309,24 @@ void masterconn_metachanges_log(masterconn *eptr,const uint8_t *data,uint32_t le
 		eptr->mode = KILL;
 		return;
 	}
-	if (data[0]!=0xFF) {
+	if (data[0]==0xFF) {
+		binary = 0;
+		if (data[length-1]!='\0') {
+			syslog(LOG_NOTICE,"MATOAN_METACHANGES_LOG - invalid string");
+			eptr->mode = KILL;
+			return;
+		}
+	} else if (data[0]==0xBB) {
+		binary = 1;
+	} else {
 		syslog(LOG_NOTICE,"MATOAN_METACHANGES_LOG - wrong packet");
 		eptr->mode = KILL;
 		return;
 	}
-	if (data[length-1]!='\0') {
-		syslog(LOG_NOTICE,"MATOAN_METACHANGES_LOG - invalid string");
-		eptr->mode = KILL;
-		return;
-	}
 
 	data++;
 	version = get64bit(&data);
+	length -= 9;
 
 	if (lastlogversion>0 && version!=lastlogversion+1) {
 		syslog(LOG_WARNING, "some changes lost: [%"PRIu64"-%"PRIu64"], download metadata again",lastlogversion,version-1);
@@ -300,14 +344,23 @@ void masterconn_metachanges_log(masterconn *eptr,const uint8_t *data,uint32_t le
 	}
 
 	if (eptr->logfd==NULL) {
-		eptr->logfd = fopen("changelog_ml.0.mfs","a");
+		masterconn_metachanges_open(eptr,binary);
+	}
+	if (eptr->logfd!=NULL && binary && eptr->logbinary==0) {
+		// binary record can't be stored in text file - start new one
+		masterconn_metachanges_rotate(eptr);
+		masterconn_metachanges_open(eptr,binary);
 	}
 
 	if (eptr->logfd) {
-		fprintf(eptr->logfd,"%"PRIu64": %s\n",version,data);
+		if (eptr->logbinary) {
+			binlog_writerecord(eptr->logfd,version,data,length);
+		} else {
+			fprintf(eptr->logfd,"%"PRIu64": %s\n",version,data);
+		}
 		lastlogversion = version;
 	} else {
-		syslog(LOG_NOTICE,"lost MFS change %"PRIu64": %s",version,data);
+		syslog(LOG_NOTICE,"lost MFS change %"PRIu64": %s",version,binary?"(binary)":(const char*)data);
 	}
 }
 
@@ -0,0 +1,554 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "datapack.h"
+#include "massert.h"
+#include "crc.h"
+#include "strerr.h"
+#include "MFSCommunication.h"
+
+// persistent (on local disk) cache of chunk blocks
+//
+// one file per chunk: DIR/XX/CHUNKID_VERSION.mfsc (XX - lowest byte of chunkid)
+// file layout:
+//   0x0000: magic:64 chunkid:64 version:32 (padded to 32 bytes)
+//   0x0020: MFSBLOCKSINCHUNK * [ leng:32 crc:32 ] (leng==0 - block not cached)
+//   0x4000: MFSBLOCKSINCHUNK * [ data:MFSBLOCKSIZE ] (sparse)
+//
+// Chunk data can be cached only when master agreed to it (master then changes chunk version
+// before next modification), so pair chunkid+version always identifies the same data
+// and no other invalidation is needed - also between mounts.
+
+#define DC_MAGIC "MFSDC1.0"
+#define DC_HEADERSIZE 32
+#define DC_DATAOFFSET 0x4000
+#define DC_PATHMAX 1100
+#define DC_HASHSIZE 65536
+#define DC_HASH(chunkid) ((((uint32_t)((chunkid)>>32))^((uint32_t)(chunkid)))*0x9E3779B1U>>16)
+
+typedef struct _dcentry {
+	uint64_t chunkid;
+	uint32_t version;
+	uint32_t refs;
+	uint64_t size;
+	uint8_t removed;
+	struct _dcentry *hnext,**hprev;
+	struct _dcentry *lrunext,*lruprev;
+} dcentry;
+
+typedef struct _dcscanentry {
+	uint64_t chunkid;
+	uint32_t version;
+	uint64_t size;
+	time_t mtime;
+} dcscanentry;
+
+static char *dcdir = NULL;
+static uint64_t dcmaxsize;
+static uint64_t dcsize;
+static int dclockfd = -1;
+static dcentry **dchash = NULL;
+static dcentry *lruhead,*lrutail;	// head - recently used
+static pthread_mutex_t dclock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void disk_cache_path(char path[DC_PATHMAX],uint64_t chunkid,uint32_t version) {
+	snprintf(path,DC_PATHMAX,"%s/%02X/%016"PRIX64"_%08"PRIX32".mfsc",dcdir,(unsigned int)(chunkid&0xFF),chunkid,version);
+}
+
+static inline void disk_cache_lru_unlink(dcentry *e) {
+	if (e->lruprev) {
+		e->lruprev->lrunext = e->lrunext;
+	} else {
+		lruhead = e->lrunext;
+	}
+	if (e->lrunext) {
+		e->lrunext->lruprev = e->lruprev;
+	} else {
+		lrutail = e->lruprev;
+	}
+}
+
+static inline void disk_cache_lru_tohead(dcentry *e) {
+	e->lruprev = NULL;
+	e->lrunext = lruhead;
+	if (lruhead) {
+		lruhead->lruprev = e;
+	} else {
+		lrutail = e;
+	}
+	lruhead = e;
+}
+
+static dcentry* disk_cache_new(uint64_t chunkid,uint32_t version,uint64_t size) {
+	dcentry *e;
+	uint32_t hash;
+
+	e = malloc(sizeof(dcentry));
+	passert(e);
+	e->chunkid = chunkid;
+	e->version = version;
+	e->refs = 0;
+	e->size = size;
+	e->removed = 0;
+	hash = DC_HASH(chunkid);
+	e->hnext = dchash[hash];
+	if (e->hnext) {
+		e->hnext->hprev = &(e->hnext);
+	}
+	e->hprev = dchash+hash;
+	dchash[hash] = e;
+	disk_cache_lru_tohead(e);
+	dcsize += size;
+	return e;
+}
+
+// dclock must be locked
+static void disk_cache_remove(dcentry *e,uint8_t unlinkfile) {
+	char path[DC_PATHMAX];
+
+	if (unlinkfile) {
+		disk_cache_path(path,e->chunkid,e->version);
+		if (unlink(path)<0 && errno!=ENOENT) {
+			syslog(LOG_WARNING,"disk cache: can't remove file %s: %s",path,strerr(errno));
+		}
+	}
+	*(e->hprev) = e->hnext;
+	if (e->hnext) {
+		e->hnext->hprev = e->hprev;
+	}
+	disk_cache_lru_unlink(e);
+	dcsize -= e->size;
+	free(e);
+}
+
+// dclock must be locked
+static void disk_cache_evict(void) {
+	dcentry *e;
+
+	while (dcsize > dcmaxsize) {
+		for (e=lrutail ; e!=NULL && e->refs>0 ; e=e->lruprev) {}
+		if (e==NULL) {
+			return;
+		}
+		disk_cache_remove(e,1);
+	}
+}
+
+static dcentry* disk_cache_acquire(uint64_t chunkid,uint32_t version,uint8_t create) {
+	dcentry *e,*en,*r;
+
+	r = NULL;
+	zassert(pthread_mutex_lock(&dclock));
+	for (e=dchash[DC_HASH(chunkid)] ; e!=NULL ; e=en) {
+		en = e->hnext;
+		if (e->chunkid==chunkid && e->removed==0) {
+			if (e->version==version) {
+				r = e;
+			} else if (e->refs==0) { // other versions of this chunk are obsolete
+				disk_cache_remove(e,1);
+			} else {
+				e->removed = 1;
+			}
+		}
+	}
+	if (r==NULL && create) {
+		r = disk_cache_new(chunkid,version,0);
+	}
+	if (r!=NULL) {
+		r->refs++;
+		disk_cache_lru_unlink(r);
+		disk_cache_lru_tohead(r);
+	}
+	zassert(pthread_mutex_unlock(&dclock));
+	return r;
+}
+
+static void disk_cache_release(dcentry *e,uint64_t sizeadd,uint8_t remove) {
+	zassert(pthread_mutex_lock(&dclock));
+	e->size += sizeadd;
+	dcsize += sizeadd;
+	e->refs--;
+	if (remove) {
+		e->removed = 1;
+	}
+	if (e->removed && e->refs==0) {
+		disk_cache_remove(e,1);
+	}
+	disk_cache_evict();
+	zassert(pthread_mutex_unlock(&dclock));
+}
+
+uint32_t disk_cache_read(uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,uint8_t *buff) {
+	dcentry *e;
+	char path[DC_PATHMAX];
+	uint8_t *hdr,*blockbuff;
+	const uint8_t *rptr;
+	uint32_t firstblock,lastblock,b;
+	uint32_t boff,bsize,leng,crc,hsize,copied;
+	uint8_t bad;
+	int fd;
+
+	if (dcdir==NULL || size==0 || offset+size>MFSCHUNKSIZE) {
+		return 0;
+	}
+	e = disk_cache_acquire(chunkid,version,0);
+	if (e==NULL) {
+		return 0;
+	}
+	copied = 0;
+	bad = 0;
+	disk_cache_path(path,chunkid,version);
+	fd = open(path,O_RDONLY);
+	if (fd<0) {
+		bad = 1;
+	} else {
+		firstblock = offset>>MFSBLOCKBITS;
+		lastblock = (offset+size-1)>>MFSBLOCKBITS;
+		hsize = (lastblock-firstblock+1)*8;
+		hdr = malloc(hsize);
+		passert(hdr);
+		blockbuff = malloc(MFSBLOCKSIZE);
+		passert(blockbuff);
+		if (pread(fd,hdr,hsize,DC_HEADERSIZE+firstblock*8)!=(ssize_t)hsize) {
+			bad = 1;
+		} else {
+			rptr = hdr;
+			for (b=firstblock ; b<=lastblock ; b++) {
+				leng = get32bit(&rptr);
+				crc = get32bit(&rptr);
+				boff = (b==firstblock)?(offset&MFSBLOCKMASK):0;
+				bsize = MFSBLOCKSIZE-boff;
+				if (bsize>size-copied) {
+					bsize = size-copied;
+				}
+				if (leng<boff+bsize || leng>MFSBLOCKSIZE) {
+					break;
+				}
+				if (pread(fd,blockbuff,leng,DC_DATAOFFSET+((off_t)b)*MFSBLOCKSIZE)!=(ssize_t)leng || mycrc32(0,blockbuff,leng)!=crc) {
+					syslog(LOG_WARNING,"disk cache: chunk %016"PRIX64"_%08"PRIX32", block %"PRIu32" - read error or wrong crc - dropping cached chunk",chunkid,version,b);
+					bad = 1;
+					break;
+				}
+				memcpy(buff+copied,blockbuff+boff,bsize);
+				copied += bsize;
+			}
+		}
+		free(blockbuff);
+		free(hdr);
+		close(fd);
+	}
+	disk_cache_release(e,0,bad);
+	return copied;
+}
+
+void disk_cache_write(uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,const uint8_t *buff,uint8_t eof) {
+	dcentry *e;
+	char path[DC_PATHMAX];
+	uint8_t *hdr,*wptr;
+	const uint8_t *rptr;
+	uint8_t entry[8];
+	uint32_t firstblock,endblock,b;
+	uint32_t end,bstart,leng,oldleng,hsize;
+	uint64_t sizeadd;
+	uint8_t bad;
+	struct stat st;
+	int fd;
+
+	if (dcdir==NULL || size==0 || offset+size>MFSCHUNKSIZE) {
+		return;
+	}
+	end = offset+size;
+	firstblock = (offset+MFSBLOCKMASK)>>MFSBLOCKBITS;
+	if (eof) {
+		endblock = (end+MFSBLOCKMASK)>>MFSBLOCKBITS;
+	} else {
+		endblock = end>>MFSBLOCKBITS;
+	}
+	if (firstblock>=endblock) {
+		return;
+	}
+	e = disk_cache_acquire(chunkid,version,1);
+	sizeadd = 0;
+	bad = 0;
+	disk_cache_path(path,chunkid,version);
+	fd = open(path,O_RDWR|O_CREAT,0666);
+	if (fd<0) {
+		syslog(LOG_WARNING,"disk cache: can't create file %s: %s",path,strerr(errno));
+		disk_cache_release(e,0,1);
+		return;
+	}
+	if (fstat(fd,&st)<0) {
+		bad = 1;
+	} else if (st.st_size==0) {
+		uint8_t header[DC_HEADERSIZE];
+		memset(header,0,DC_HEADERSIZE);
+		memcpy(header,DC_MAGIC,8);
+		wptr = header+8;
+		put64bit(&wptr,chunkid);
+		put32bit(&wptr,version);
+		if (ftruncate(fd,DC_DATAOFFSET)<0 || pwrite(fd,header,DC_HEADERSIZE,0)!=DC_HEADERSIZE) {
+			bad = 1;
+		}
+	}
+	if (bad==0) {
+		hsize = (endblock-firstblock)*8;
+		hdr = malloc(hsize);
+		passert(hdr);
+		if (pread(fd,hdr,hsize,DC_HEADERSIZE+firstblock*8)!=(ssize_t)hsize) {
+			bad = 1;
+		} else {
+			rptr = hdr;
+			for (b=firstblock ; b<endblock ; b++) {
+				oldleng = get32bit(&rptr);
+				rptr += 4;
+				bstart = b<<MFSBLOCKBITS;
+				leng = (end-bstart<MFSBLOCKSIZE)?(end-bstart):MFSBLOCKSIZE;
+				if (oldleng>=leng) {
+					continue;
+				}
+				// data first, then block entry - after crash block with not stored data will be rejected due to crc mismatch
+				if (pwrite(fd,buff+(bstart-offset),leng,DC_DATAOFFSET+((off_t)b)*MFSBLOCKSIZE)!=(ssize_t)leng) {
+					bad = 1;
+					break;
+				}
+				wptr = entry;
+				put32bit(&wptr,leng);
+				put32bit(&wptr,mycrc32(0,buff+(bstart-offset),leng));
+				if (pwrite(fd,entry,8,DC_HEADERSIZE+b*8)!=8) {
+					bad = 1;
+					break;
+				}
+				sizeadd += leng-oldleng;
+			}
+		}
+		free(hdr);
+	}
+	if (bad) {
+		syslog(LOG_WARNING,"disk cache: error writing file %s: %s",path,strerr(errno));
+	}
+	close(fd);
+	disk_cache_release(e,sizeadd,bad);
+}
+
+uint8_t disk_cache_enabled(void) {
+	return (dcdir!=NULL)?1:0;
+}
+
+static int disk_cache_scan_cmp(const void *a,const void *b) {
+	const dcscanentry *aa = (const dcscanentry*)a;
+	const dcscanentry *bb = (const dcscanentry*)b;
+	if (aa->mtime < bb->mtime) {
+		return -1;
+	} else if (aa->mtime > bb->mtime) {
+		return 1;
+	}
+	return 0;
+}
+
+// returns size of cached data or -1 when file is not valid
+static int64_t disk_cache_check_file(const char *path,uint64_t chunkid,uint32_t version,time_t *mtime) {
+	uint8_t hdr[DC_HEADERSIZE+MFSBLOCKSINCHUNK*8];
+	const uint8_t *rptr;
+	struct stat st;
+	uint64_t size;
+	uint32_t i,leng;
+	int fd;
+
+	fd = open(path,O_RDONLY);
+	if (fd<0) {
+		return -1;
+	}
+	if (fstat(fd,&st)<0 || pread(fd,hdr,DC_HEADERSIZE+MFSBLOCKSINCHUNK*8,0)!=DC_HEADERSIZE+MFSBLOCKSINCHUNK*8) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	*mtime = st.st_mtime;
+	if (memcmp(hdr,DC_MAGIC,8)!=0) {
+		return -1;
+	}
+	rptr = hdr+8;
+	if (get64bit(&rptr)!=chunkid || get32bit(&rptr)!=version) {
+		return -1;
+	}
+	rptr = hdr+DC_HEADERSIZE;
+	size = 0;
+	for (i=0 ; i<MFSBLOCKSINCHUNK ; i++) {
+		leng = get32bit(&rptr);
+		rptr += 4;
+		if (leng>MFSBLOCKSIZE) {
+			return -1;
+		}
+		size += leng;
+	}
+	return size;
+}
+
+int disk_cache_init(const char *dir,uint64_t maxsize) {
+	char path[DC_PATHMAX];
+	dcscanentry *scantab;
+	uint32_t scancnt,scansize,i;
+	DIR *dd;
+	struct dirent *de;
+	dcentry *e,*en;
+	uint64_t chunkid;
+	uint32_t version;
+	int64_t size;
+	time_t mtime;
+	size_t dirleng;
+	char c;
+
+	if (dir==NULL || dir[0]==0) {
+		return 0;
+	}
+	dirleng = strlen(dir);
+	while (dirleng>1 && dir[dirleng-1]=='/') {
+		dirleng--;
+	}
+	if (dirleng+40>DC_PATHMAX) {
+		syslog(LOG_ERR,"disk cache: directory name too long");
+		return -1;
+	}
+	dcdir = malloc(dirleng+1);
+	passert(dcdir);
+	memcpy(dcdir,dir,dirleng);
+	dcdir[dirleng] = 0;
+	if (mkdir(dcdir,0755)<0 && errno!=EEXIST) {
+		syslog(LOG_ERR,"disk cache: can't create directory %s: %s",dcdir,strerr(errno));
+		free(dcdir);
+		dcdir = NULL;
+		return -1;
+	}
+	snprintf(path,DC_PATHMAX,"%s/.lock",dcdir);
+	dclockfd = open(path,O_RDWR|O_CREAT,0666);
+	if (dclockfd<0 || lockf(dclockfd,F_TLOCK,0)<0) {
+		syslog(LOG_ERR,"disk cache: can't lock %s (directory used by another process ?): %s",path,strerr(errno));
+		if (dclockfd>=0) {
+			close(dclockfd);
+			dclockfd = -1;
+		}
+		free(dcdir);
+		dcdir = NULL;
+		return -1;
+	}
+	dchash = malloc(sizeof(dcentry*)*DC_HASHSIZE);
+	passert(dchash);
+	for (i=0 ; i<DC_HASHSIZE ; i++) {
+		dchash[i] = NULL;
+	}
+	lruhead = NULL;
+	lrutail = NULL;
+	dcsize = 0;
+	dcmaxsize = maxsize;
+
+	scancnt = 0;
+	scansize = 1024;
+	scantab = malloc(sizeof(dcscanentry)*scansize);
+	passert(scantab);
+	for (i=0 ; i<256 ; i++) {
+		snprintf(path,DC_PATHMAX,"%s/%02X",dcdir,i);
+		if (mkdir(path,0755)<0 && errno!=EEXIST) {
+			syslog(LOG_WARNING,"disk cache: can't create directory %s: %s",path,strerr(errno));
+			continue;
+		}
+		dd = opendir(path);
+		if (dd==NULL) {
+			continue;
+		}
+		while ((de = readdir(dd))!=NULL) {
+			if (strlen(de->d_name)!=30 || sscanf(de->d_name,"%16"SCNx64"_%8"SCNx32".mfsc%c",&chunkid,&version,&c)!=2) {
+				continue;
+			}
+			snprintf(path,DC_PATHMAX,"%s/%02X/%s",dcdir,i,de->d_name);
+			if ((chunkid&0xFF)!=i || (size = disk_cache_check_file(path,chunkid,version,&mtime))<0) {
+				syslog(LOG_NOTICE,"disk cache: removing invalid file %s",path);
+				unlink(path);
+				continue;
+			}
+			if (scancnt>=scansize) {
+				scansize *= 2;
+				scantab = realloc(scantab,sizeof(dcscanentry)*scansize);
+				passert(scantab);
+			}
+			scantab[scancnt].chunkid = chunkid;
+			scantab[scancnt].version = version;
+			scantab[scancnt].size = size;
+			scantab[scancnt].mtime = mtime;
+			scancnt++;
+		}
+		closedir(dd);
+	}
+	// oldest first - last inserted entry becomes head of lru, the newest version of chunk wins
+	qsort(scantab,scancnt,sizeof(dcscanentry),disk_cache_scan_cmp);
+	zassert(pthread_mutex_lock(&dclock));
+	for (i=0 ; i<scancnt ; i++) {
+		for (e=dchash[DC_HASH(scantab[i].chunkid)] ; e!=NULL ; e=en) {
+			en = e->hnext;
+			if (e->chunkid==scantab[i].chunkid) {
+				disk_cache_remove(e,1);
+			}
+		}
+		disk_cache_new(scantab[i].chunkid,scantab[i].version,scantab[i].size);
+	}
+	disk_cache_evict();
+	syslog(LOG_NOTICE,"disk cache: %s - found %"PRIu32" cached chunks, %"PRIu64" MiB used (limit: %"PRIu64" MiB)",dcdir,scancnt,dcsize>>20,dcmaxsize>>20);
+	zassert(pthread_mutex_unlock(&dclock));
+	free(scantab);
+	return 0;
+}
+
+void disk_cache_term(void) {
+	dcentry *e,*en;
+
+	if (dcdir==NULL) {
+		return;
+	}
+	zassert(pthread_mutex_lock(&dclock));
+	for (e=lruhead ; e!=NULL ; e=en) {
+		en = e->lrunext;
+		free(e);
+	}
+	lruhead = NULL;
+	lrutail = NULL;
+	free(dchash);
+	dchash = NULL;
+	free(dcdir);
+	dcdir = NULL;
+	close(dclockfd);
+	dclockfd = -1;
+	zassert(pthread_mutex_unlock(&dclock));
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef _DISK_CACHE_H_
+#define _DISK_CACHE_H_
+
+#include <inttypes.h>
+
+// returns number of bytes (from the beginning of given range) copied from cache
+uint32_t disk_cache_read(uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,uint8_t *buff);
+// stores blocks fully covered by given range (eof - range ends at the end of file, so last partial block can be stored too)
+void disk_cache_write(uint64_t chunkid,uint32_t version,uint32_t offset,uint32_t size,const uint8_t *buff,uint8_t eof);
+uint8_t disk_cache_enabled(void);
+int disk_cache_init(const char *dir,uint64_t maxsize);
+void disk_cache_term(void);
+
+#endif
@@ -71,6 +71,7 @@
 //#include "dircache.h"
 #include "conncache.h"
 #include "readdata.h"
+#include "diskcache.h"
 #include "writedata.h"
 #include "delayrun.h"
 #include "csdb.h"
@@ -185,6 +186,8 @@ struct mfsopts {
 	unsigned readaheadleng;
 	unsigned readaheadtrigger;
 	unsigned ioretries;
+	char *diskcachedir;
+	unsigned diskcachesize;
 	double attrcacheto;
 	double xattrcacheto;
 	double entrycacheto;
@@ -243,6 +246,8 @@ static struct fuse_opt mfs_opts_stage2[] = {
 	MFS_OPT("mfsreadaheadleng=%u", readaheadleng, 0),
 	MFS_OPT("mfsreadaheadtrigger=%u", readaheadtrigger, 0),
 	MFS_OPT("mfsioretries=%u", ioretries, 0),
+	MFS_OPT("mfsdiskcachedir=%s", diskcachedir, 0),
+	MFS_OPT("mfsdiskcachesize=%u", diskcachesize, 0),
 	MFS_OPT("mfsdebug", debug, 1),
 	MFS_OPT("mfsmeta", meta, 1),
 	MFS_OPT("mfsdelayedinit", delayedinit, 1),
@@ -342,6 +347,8 @@ static void usage(const char *progname) {
 	fprintf(stderr,"    -o mfsreadaheadleng=N       define amount of bytes to be additionaly read (default: 1048576)\n");
 	fprintf(stderr,"    -o mfsreadaheadtrigger=N    define amount of bytes read sequentially that turns on read ahead (default: 10 * mfsreadaheadleng)\n");
 	fprintf(stderr,"    -o mfsioretries=N           define number of retries before I/O error is returned (default: 30)\n");
+	fprintf(stderr,"    -o mfsdiskcachedir=PATH     keep read data also in local directory (preferably on SSD) - cache survives remounts (default: NOT DEFINED - no disk cache)\n");
+	fprintf(stderr,"    -o mfsdiskcachesize=N       define size of local disk cache in MiB (default: 10240)\n");
 	fprintf(stderr,"    -o mfsmaster=HOST           define mfsmaster location (default: " DEFAULT_MASTERNAME ")\n");
 	fprintf(stderr,"    -o mfsport=PORT             define mfsmaster port number (default: " DEFAULT_MASTER_CLIENT_PORT ")\n");
 	fprintf(stderr,"    -o mfsbind=IP               define source ip address for connections (default: NOT DEFINED - chosen automatically by OS)\n");
@@ -535,7 +542,7 @@ static void mfs_fsinit (void *userdata, struct fuse_conn_info *conn) {
 	int *piped = (int*)userdata;
 	char s;
 	conn->max_write = 131072;
-	conn->max_readahead = 131072;
+	conn->max_readahead = 0x100000; // kernel clamps it to its own limit - more read ahead means more read requests processed in parallel
 #if defined(FUSE_CAP_BIG_WRITES) || defined(FUSE_CAP_DONT_MASK) || defined(FUSE_CAP_FLOCK_LOCKS) || defined(FUSE_CAP_POSIX_LOCKS)
 	conn->want = 0;
 #endif
@@ -786,6 +793,9 @@ int mainloop(struct fuse_args *args,const char* mp,int mt,int fg) {
 	if (mfsopts.meta==0) {
 		csdb_init();
 		delay_init();
+		if (disk_cache_init(mfsopts.diskcachedir,((uint64_t)mfsopts.diskcachesize)*1024*1024)<0) {
+			fprintf(stderr,"can't initialize disk cache - working without it\n");
+		}
 		read_data_init(mfsopts.readaheadsize*1024*1024,mfsopts.readaheadleng,mfsopts.readaheadtrigger,mfsopts.ioretries);
 		write_data_init(mfsopts.writecachesize*1024*1024,mfsopts.ioretries);
 	}
@@ -802,6 +812,7 @@ int mainloop(struct fuse_args *args,const char* mp,int mt,int fg) {
 		if (mfsopts.meta==0) {
 			write_data_term();
 			read_data_term();
+			disk_cache_term();
 			delay_term();
 			csdb_term();
 		}
@@ -834,6 +845,7 @@ int mainloop(struct fuse_args *args,const char* mp,int mt,int fg) {
 		if (mfsopts.meta==0) {
 			write_data_term();
 			read_data_term();
+			disk_cache_term();
 			delay_term();
 			csdb_term();
 		}
@@ -863,6 +875,7 @@ int mainloop(struct fuse_args *args,const char* mp,int mt,int fg) {
 		if (mfsopts.meta==0) {
 			write_data_term();
 			read_data_term();
+			disk_cache_term();
 			delay_term();
 			csdb_term();
 		}
@@ -906,6 +919,7 @@ int mainloop(struct fuse_args *args,const char* mp,int mt,int fg) {
 	if (mfsopts.meta==0) {
 		write_data_term();
 		read_data_term();
+		disk_cache_term();
 		delay_term();
 		csdb_term();
 	}
@@ -1117,6 +1131,8 @@ int main(int argc, char *argv[]) {
 	mfsopts.readaheadleng = 0;
 	mfsopts.readaheadtrigger = 0;
 	mfsopts.ioretries = 30;
+	mfsopts.diskcachedir = NULL;
+	mfsopts.diskcachesize = 0;
 	mfsopts.passwordask = 0;
 	mfsopts.attrcacheto = 1.0;
 	mfsopts.xattrcacheto = 30.0;
@@ -1262,6 +1278,13 @@ int main(int argc, char *argv[]) {
 	if (mfsopts.readaheadtrigger==0) {
 		mfsopts.readaheadtrigger=mfsopts.readaheadleng*10;
 	}
+	if (mfsopts.diskcachesize==0) {
+		mfsopts.diskcachesize=10240;
+	}
+	if (mfsopts.diskcachesize<64) {
+		fprintf(stderr,"disk cache size too low (%u MiB) - increased to 64 MiB\n",mfsopts.diskcachesize);
+		mfsopts.diskcachesize=64;
+	}
 
 	if (mfsopts.nostdmountoptions==0) {
 		fuse_opt_add_arg(&args, "-o" DEFAULT_OPTIONS);
@@ -47,6 +47,7 @@
 #include "strerr.h"
 #include "md5.h"
 #include "datapack.h"
+#include "massert.h"
 // #include "dircache.h"
 
 #define CONNECT_TIMEOUT 2000
@@ -70,6 +71,9 @@ typedef struct _threc {
 	uint32_t rcvd_cmd;
 
 	uint32_t packetid;	// thread number
+	struct _threc *snext;	// send queue
+	struct _threc *hnext;	// packetid hash
+	struct _threc *fnext;	// free records (their threads have finished)
 	struct _threc *next;
 } threc;
 
@@ -104,7 +108,20 @@ typedef struct _acquired_file {
 
 #define RECEIVE_TIMEOUT 10
 
+// max number of packets sent to master with one writev
+#define SEND_BATCH_MAX 64
+
+#define THREC_HASHSIZE 1024
+#define THREC_HASH(packetid) ((packetid)%THREC_HASHSIZE)
+
 static threc *threchead=NULL;
+static threc *threchash[THREC_HASHSIZE];
+static threc *threcfree=NULL;
+static pthread_key_t threckey;
+
+// packets waiting to be sent - written by the first thread that finds no active sender
+static threc *sendqhead=NULL,**sendqtail=&sendqhead;
+static uint8_t sendqbusy=0;
 
 static acquired_file *afhead=NULL;
 
@@ -117,11 +134,12 @@ static int sessionlost;
 static uint32_t maxretries;
 
 static pthread_t rpthid,npthid;
-static pthread_mutex_t fdlock,reclock,aflock;
+static pthread_mutex_t fdlock,reclock,aflock,sendqlock;
 
 static uint32_t sessionid;
 static uint64_t metaid;
 static uint32_t masterversion;
+static uint8_t mastercacheflag;	// master confirmed cache flag (0x80 in canmodatime) at least once in this connection
 
 static char masterstrip[17];
 static uint32_t masterip=0;
@@ -425,15 +443,38 @@ void fs_dec_acnt(uint32_t inode) {
 	pthread_mutex_unlock(&aflock);
 }
 
+// thread specific data destructor - record stays in packetid hash (answers for it can still come), so it is only reused by next new thread
+static void fs_free_threc(void *arg) {
+	threc *rec = (threc*)arg;
+	pthread_mutex_lock(&reclock);
+	rec->fnext = threcfree;
+	threcfree = rec;
+	pthread_mutex_unlock(&reclock);
+}
+
 threc* fs_get_my_threc() {
 	pthread_t mythid = pthread_self();
 	threc *rec;
+	rec = pthread_getspecific(threckey);
+	if (rec!=NULL) {
+		return rec;
+	}
 	pthread_mutex_lock(&reclock);
-	for (rec = threchead ; rec ; rec=rec->next) {
-		if (pthread_equal(rec->thid,mythid)) {
-			pthread_mutex_unlock(&reclock);
-			return rec;
-		}
+	if (threcfree!=NULL) {
+		rec = threcfree;
+		threcfree = rec->fnext;
+		pthread_mutex_lock(&(rec->mutex));
+		rec->thid = mythid;
+		rec->sent = 0;
+		rec->status = 0;
+		rec->rcvd = 0;
+		rec->waiting = 0;
+		rec->rcvd_cmd = 0;
+		rec->fnext = NULL;
+		pthread_mutex_unlock(&(rec->mutex));
+		pthread_mutex_unlock(&reclock);
+		zassert(pthread_setspecific(threckey,rec));
+		return rec;
 	}
 	rec = malloc(sizeof(threc));
 	rec->thid = mythid;
@@ -484,17 +525,22 @@ threc* fs_get_my_threc() {
 	} else {
 		rec->packetid = threchead->packetid+1;
 	}
+	rec->snext = NULL;
+	rec->fnext = NULL;
+	rec->hnext = threchash[THREC_HASH(rec->packetid)];
+	threchash[THREC_HASH(rec->packetid)] = rec;
 	rec->next = threchead;
 	//syslog(LOG_NOTICE,"mastercomm: create new threc (%"PRIu32")",rec->packetid);
 	threchead = rec;
 	pthread_mutex_unlock(&reclock);
+	zassert(pthread_setspecific(threckey,rec));
 	return rec;
 }
 
 threc* fs_get_threc_by_id(uint32_t packetid) {
 	threc *rec;
 	pthread_mutex_lock(&reclock);
-	for (rec = threchead ; rec ; rec=rec->next) {
+	for (rec = threchash[THREC_HASH(packetid)] ; rec ; rec=rec->hnext) {
 		if (rec->packetid==packetid) {
 			pthread_mutex_unlock(&reclock);
 			return rec;
@@ -587,39 +633,101 @@ uint8_t* fs_createpacket(threc *rec,uint32_t cmd,uint32_t size) {
 	return ptr;
 }
 
+// writes given packets with one writev - on error wakes up all their owners with status set
+static void fs_send_batch(threc **batch,uint32_t bcnt) {
+	struct iovec iov[SEND_BATCH_MAX];
+	threc *rec;
+	uint32_t i,bytes;
+	uint8_t status;
+
+	pthread_mutex_lock(&fdlock);
+	if (sessionlost==1) {
+		status = 2;
+	} else if (fd==-1) {
+		status = 1;
+	} else {
+		bytes = 0;
+		for (i=0 ; i<bcnt ; i++) {
+			rec = batch[i];
+			pthread_mutex_lock(&(rec->mutex));	// make helgrind happy
+			rec->sent = 1;
+			iov[i].iov_base = rec->obuff;
+			iov[i].iov_len = rec->odataleng;
+			bytes += rec->odataleng;
+			pthread_mutex_unlock(&(rec->mutex));	// make helgrind happy
+		}
+		if (tcptowritev(fd,iov,bcnt,1000)!=(int32_t)bytes) {
+			syslog(LOG_WARNING,"tcp send error: %s",strerr(errno));
+			disconnect = 1;
+			status = 1;
+		} else {
+			master_stats_add(MASTER_BYTESSENT,bytes);
+			for (i=0 ; i<bcnt ; i++) {
+				master_stats_inc(MASTER_PACKETSSENT);
+			}
+			lastwrite = time(NULL);
+			status = 0;
+		}
+	}
+	if (status!=0) {
+		for (i=0 ; i<bcnt ; i++) {
+			rec = batch[i];
+			pthread_mutex_lock(&(rec->mutex));
+			rec->sent = 0;
+			rec->status = status;
+			rec->rcvd = 1;
+			if (rec->waiting) {
+				pthread_cond_signal(&(rec->cond));
+			}
+			pthread_mutex_unlock(&(rec->mutex));
+		}
+	}
+	pthread_mutex_unlock(&fdlock);
+}
+
+// puts packet into send queue - if nobody is sending then current thread sends everything queued (also packets of other threads)
+static void fs_send_packet(threc *rec) {
+	threc *batch[SEND_BATCH_MAX];
+	uint32_t bcnt;
+
+	pthread_mutex_lock(&(rec->mutex));
+	rec->rcvd = 0;
+	rec->status = 0;
+	pthread_mutex_unlock(&(rec->mutex));
+	pthread_mutex_lock(&sendqlock);
+	rec->snext = NULL;
+	*sendqtail = rec;
+	sendqtail = &(rec->snext);
+	if (sendqbusy) {
+		pthread_mutex_unlock(&sendqlock);
+		return;
+	}
+	sendqbusy = 1;
+	while (sendqhead) {
+		bcnt = 0;
+		while (sendqhead && bcnt<SEND_BATCH_MAX) {
+			batch[bcnt++] = sendqhead;
+			sendqhead = sendqhead->snext;
+		}
+		if (sendqhead==NULL) {
+			sendqtail = &sendqhead;
+		}
+		pthread_mutex_unlock(&sendqlock);
+		fs_send_batch(batch,bcnt);
+		pthread_mutex_lock(&sendqlock);
+	}
+	sendqbusy = 0;
+	pthread_mutex_unlock(&sendqlock);
+}
+
 const uint8_t* fs_sendandreceive(threc *rec,uint32_t expected_cmd,uint32_t *answer_leng) {
 	uint32_t cnt;
 	static uint8_t notsup = ERROR_ENOTSUP;
 //	uint32_t size = rec->size;
 
 	for (cnt=0 ; cnt<maxretries ; cnt++) {
-		pthread_mutex_lock(&fdlock);
-		if (sessionlost==1) {
-			pthread_mutex_unlock(&fdlock);
-			return NULL;
-		}
-		if (fd==-1) {
-			pthread_mutex_unlock(&fdlock);
-			sleep(1+((cnt<30)?(cnt/3):10));
-			continue;
-		}
 		//syslog(LOG_NOTICE,"threc(%"PRIu32") - sending ...",rec->packetid);
-		pthread_mutex_lock(&(rec->mutex));	// make helgrind happy
-		if (tcptowrite(fd,rec->obuff,rec->odataleng,1000)!=(int32_t)(rec->odataleng)) {
-			syslog(LOG_WARNING,"tcp send error: %s",strerr(errno));
-			disconnect = 1;
-			pthread_mutex_unlock(&(rec->mutex));
-			pthread_mutex_unlock(&fdlock);
-			sleep(1+((cnt<30)?(cnt/3):10));
-			continue;
-		}
-		rec->rcvd = 0;
-		rec->sent = 1;
-		pthread_mutex_unlock(&(rec->mutex));	// make helgrind happy
-		master_stats_add(MASTER_BYTESSENT,rec->odataleng);
-		master_stats_inc(MASTER_PACKETSSENT);
-		lastwrite = time(NULL);
-		pthread_mutex_unlock(&fdlock);
+		fs_send_packet(rec);
 		// syslog(LOG_NOTICE,"master: lock: %"PRIu32,rec->packetid);
 		pthread_mutex_lock(&(rec->mutex));
 		while (rec->rcvd==0) {
@@ -630,6 +738,10 @@ const uint8_t* fs_sendandreceive(threc *rec,uint32_t expected_cmd,uint32_t *answ
 		*answer_leng = rec->idataleng;
 		// syslog(LOG_NOTICE,"master: unlocked: %"PRIu32,rec->packetid);
 		// syslog(LOG_NOTICE,"master: command_info: %"PRIu32" ; reccmd: %"PRIu32,command_info,rec->cmd);
+		if (rec->status==2) {	// session lost
+			pthread_mutex_unlock(&(rec->mutex));
+			return NULL;
+		}
 		if (rec->status!=0) {
 			pthread_mutex_unlock(&(rec->mutex));
 			sleep(1+((cnt<30)?(cnt/3):10));
@@ -660,33 +772,8 @@ const uint8_t* fs_sendandreceive_any(threc *rec,uint32_t *received_cmd,uint32_t
 //	uint32_t size = rec->size;
 
 	for (cnt=0 ; cnt<maxretries ; cnt++) {
-		pthread_mutex_lock(&fdlock);
-		if (sessionlost==1) {
-			pthread_mutex_unlock(&fdlock);
-			return NULL;
-		}
-		if (fd==-1) {
-			pthread_mutex_unlock(&fdlock);
-			sleep(1+((cnt<30)?(cnt/3):10));
-			continue;
-		}
 		//syslog(LOG_NOTICE,"threc(%"PRIu32") - sending ...",rec->packetid);
-		pthread_mutex_lock(&(rec->mutex));	// make helgrind happy
-		if (tcptowrite(fd,rec->obuff,rec->odataleng,1000)!=(int32_t)(rec->odataleng)) {
-			syslog(LOG_WARNING,"tcp send error: %s",strerr(errno));
-			disconnect = 1;
-			pthread_mutex_unlock(&(rec->mutex));
-			pthread_mutex_unlock(&fdlock);
-			sleep(1+((cnt<30)?(cnt/3):10));
-			continue;
-		}
-		rec->rcvd = 0;
-		rec->sent = 1;
-		pthread_mutex_unlock(&(rec->mutex));	// make helgrind happy
-		master_stats_add(MASTER_BYTESSENT,rec->odataleng);
-		master_stats_inc(MASTER_PACKETSSENT);
-		lastwrite = time(NULL);
-		pthread_mutex_unlock(&fdlock);
+		fs_send_packet(rec);
 		// syslog(LOG_NOTICE,"master: lock: %"PRIu32,rec->packetid);
 		pthread_mutex_lock(&(rec->mutex));
 		while (rec->rcvd==0) {
@@ -697,6 +784,10 @@ const uint8_t* fs_sendandreceive_any(threc *rec,uint32_t *received_cmd,uint32_t
 		*answer_leng = rec->idataleng;
 		// syslog(LOG_NOTICE,"master: unlocked: %"PRIu32,rec->packetid);
 		// syslog(LOG_NOTICE,"master: command_info: %"PRIu32" ; reccmd: %"PRIu32,command_info,rec->cmd);
+		if (rec->status==2) {	// session lost
+			pthread_mutex_unlock(&(rec->mutex));
+			return NULL;
+		}
 		if (rec->status!=0) {
 			pthread_mutex_unlock(&(rec->mutex));
 			sleep(1+((cnt<30)?(cnt/3):10));
@@ -1097,6 +1188,7 @@ int fs_connect(uint8_t oninit,struct connect_args_t *cargs) {
 		}
 	} while (i==4);
 	masterversion = get32bit(&rptr);
+	mastercacheflag = 0;
 	if (masterversion < VERSION2INT(2,1,7)) {
 		if (oninit) {
 			fprintf(stderr,"incompatible mfsmaster version\n");
@@ -1772,6 +1864,8 @@ void fs_init_threads(uint32_t retries) {
 	pthread_mutex_init(&reclock,NULL);
 	pthread_mutex_init(&fdlock,NULL);
 	pthread_mutex_init(&aflock,NULL);
+	pthread_mutex_init(&sendqlock,NULL);
+	zassert(pthread_key_create(&threckey,fs_free_threc));
 	pthread_attr_init(&thattr);
 	pthread_attr_setstacksize(&thattr,0x100000);
 	pthread_create(&rpthid,&thattr,fs_receive_thread,NULL);
@@ -1788,6 +1882,8 @@ void fs_term(void) {
 	pthread_mutex_unlock(&fdlock);
 	pthread_join(npthid,NULL);
 	pthread_join(rpthid,NULL);
+	zassert(pthread_key_delete(threckey));
+	pthread_mutex_destroy(&sendqlock);
 	pthread_mutex_destroy(&aflock);
 	pthread_mutex_destroy(&fdlock);
 	pthread_mutex_destroy(&reclock);
@@ -2632,7 +2728,8 @@ uint8_t fs_getdir(uint32_t inode,uint32_t uid,uint32_t gid,const uint8_t **dbuff
 }
 */
 
-uint8_t fs_readdir(uint32_t inode,uint32_t uid,uint32_t gids,uint32_t *gid,uint8_t wantattr,uint8_t addtocache,const uint8_t **dbuff,uint32_t *dbuffsize) {
+// nedgeid - in: handle returned by previous call (0 - from the beginning) ; out: handle of the next page (0 - no more entries)
+uint8_t fs_readdir(uint32_t inode,uint32_t uid,uint32_t gids,uint32_t *gid,uint8_t wantattr,uint8_t addtocache,uint32_t maxentries,uint64_t *nedgeid,const uint8_t **dbuff,uint32_t *dbuffsize) {
 	uint8_t *wptr;
 	const uint8_t *rptr;
 	uint32_t i;
@@ -2677,18 +2774,28 @@ uint8_t fs_readdir(uint32_t inode,uint32_t uid,uint32_t gids,uint32_t *gid,uint8
 	}
 	put8bit(&wptr,flags);
 	if (packetver>=1) {
-		put32bit(&wptr,0xFFFFFFFFU);
-		put64bit(&wptr,0);
+		put32bit(&wptr,maxentries);
+		put64bit(&wptr,*nedgeid);
 	}
 	rptr = fs_sendandreceive(rec,MATOCL_FUSE_READDIR,&i);
 	if (rptr==NULL) {
 		ret = ERROR_IO;
 	} else if (i==1) {
 		ret = rptr[0];
+	} else if (packetver>=1 && i<8) {
+		pthread_mutex_lock(&fdlock);
+		disconnect = 1;
+		pthread_mutex_unlock(&fdlock);
+		ret = ERROR_IO;
 	} else {
-		if (packetver>=1) { // skip 'read-next' handler
-			rptr+=8;
+		if (packetver>=1) { // 'read-next' handler
+			*nedgeid = get64bit(&rptr);
+			if (*nedgeid>=UINT64_C(0x7FFFFFFFFFFFFFFF)) {
+				*nedgeid = 0;
+			}
 			i-=8;
+		} else {
+			*nedgeid = 0;
 		}
 		*dbuff = rptr;
 		*dbuffsize = i;
@@ -2906,7 +3013,7 @@ uint8_t fs_release(uint32_t inode) {
 }
 */
 
-uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint8_t canmodatime,uint8_t *csdataver,uint64_t *length,uint64_t *chunkid,uint32_t *version,const uint8_t **csdata,uint32_t *csdatasize) {
+uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint8_t canmodatime,uint8_t *csdataver,uint8_t *cacheok,uint64_t *length,uint64_t *chunkid,uint32_t *version,const uint8_t **csdata,uint32_t *csdatasize) {
 	uint8_t *wptr;
 	const uint8_t *rptr;
 	uint32_t i;
@@ -2915,7 +3022,13 @@ uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint8_t canmodatime,uint8_t *c
 
 	*csdata = NULL;
 	*csdatasize = 0;
+	*cacheok = 0;
 
+	// masters without cache support treat any nonzero value as 'update atime' - such master never confirms the flag,
+	// so until it is confirmed the flag is sent only together with a request that updates atime anyway
+	if ((canmodatime&0x7F)==0 && mastercacheflag==0) {
+		canmodatime = 0;
+	}
 	if (masterversion>VERSION2INT(3,0,3)) {
 		wptr = fs_createpacket(rec,CLTOMA_FUSE_READ_CHUNK,9);
 	} else {
@@ -2937,6 +3050,11 @@ uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint8_t canmodatime,uint8_t *c
 	} else {
 		if (i&1) {
 			*csdataver = get8bit(&rptr);
+			*cacheok = ((*csdataver)&0x80)?1:0;
+			*csdataver &= 0x7F;
+			if (*cacheok) {
+				mastercacheflag = 1;
+			}
 			if (i<21 || ((*csdataver)==1 && ((i-21)%10)!=0) || ((*csdataver)==2 && ((i-21)%14)!=0)) {
 				ret = ERROR_IO;
 			} else {
@@ -72,6 +72,9 @@
 
 #define READDIR_BUFFSIZE 50000
 
+// entries fetched from master in one request - the next page is prefetched while the current one is being consumed
+#define READDIR_PAGE_ENTRIES 10000
+
 #define MAX_FILE_SIZE (int64_t)(MFS_MAX_FILE_SIZE)
 
 #define PKGVERSION ((VERSMAJ)*1000000+(VERSMID)*10000+((VERSMIN)>>1)*100+(RELEASE))
@@ -126,14 +129,22 @@ typedef struct _sinfo {
 	pthread_mutex_t lock;
 } sinfo;
 
+typedef struct _dirpage {
+	uint8_t *data;
+	uint32_t size;
+	uint64_t offset;	// readdir offset of the first entry in this page
+	void *dcache;
+	struct _dirpage *next;
+} dirpage;
+
 typedef struct _dirbuf {
 	int wasread;
 	int dataformat;
 	uid_t uid;
 	gid_t gid;
-	const uint8_t *p;
-	size_t size;
-	void *dcache;
+	dirpage *pages,*lastpage;
+	uint64_t size;		// size of all pages read so far
+	uint64_t nedgeid;	// master handle of the next page (0 - whole directory has been read)
 	pthread_mutex_t lock;
 } dirbuf;
 
@@ -288,9 +299,7 @@ void mfs_statsptr_init(void) {
 	{
 		void *rd;
 		rd = stats_get_subnode(s,"readdir",0,1);
-		if (usedircache) {
-			statsptr[OP_GETDIR_FULL] = stats_get_subnode(rd,"with_attrs",0,1);
-		}
+		statsptr[OP_GETDIR_FULL] = stats_get_subnode(rd,"with_attrs",0,1);
 		statsptr[OP_GETDIR_SMALL] = stats_get_subnode(rd,"without_attrs",0,1);
 	}
 }
@@ -2005,9 +2014,10 @@ void mfs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 		dirinfo = malloc(sizeof(dirbuf));
 		pthread_mutex_init(&(dirinfo->lock),NULL);
 		pthread_mutex_lock(&(dirinfo->lock));	// make valgrind happy
-		dirinfo->p = NULL;
+		dirinfo->pages = NULL;
+		dirinfo->lastpage = NULL;
 		dirinfo->size = 0;
-		dirinfo->dcache = NULL;
+		dirinfo->nedgeid = 0;
 		dirinfo->wasread = 0;
 		pthread_mutex_unlock(&(dirinfo->lock));	// make valgrind happy
 		fi->fh = (unsigned long)dirinfo;
@@ -2020,6 +2030,116 @@ void mfs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 	}
 }
 
+static void mfs_dirbuf_clear(dirbuf *dirinfo) {
+	dirpage *dp,*ndp;
+	for (dp = dirinfo->pages ; dp ; dp = ndp) {
+		ndp = dp->next;
+		if (dp->dcache) {
+			dcache_release(dp->dcache);
+		}
+		if (dp->data) {
+			free(dp->data);
+		}
+		free(dp);
+	}
+	dirinfo->pages = NULL;
+	dirinfo->lastpage = NULL;
+	dirinfo->size = 0;
+	dirinfo->nedgeid = 0;
+}
+
+static uint8_t mfs_dirbuf_readdir(const struct fuse_ctx *ctx,fuse_ino_t ino,uint8_t wantattr,uint32_t maxentries,uint64_t *nedgeid,const uint8_t **dbuff,uint32_t *dsize) {
+	uint8_t status;
+	groups *gids;
+
+	if (full_permissions) {
+		gids = groups_get(ctx->pid,ctx->uid,ctx->gid);
+		status = fs_readdir(ino,ctx->uid,gids->gidcnt,gids->gidtab,wantattr,0,maxentries,nedgeid,dbuff,dsize);
+		groups_rel(gids);
+	} else {
+		uint32_t gidtmp = ctx->gid;
+		status = fs_readdir(ino,ctx->uid,1,&gidtmp,wantattr,0,maxentries,nedgeid,dbuff,dsize);
+	}
+	return status;
+}
+
+// gets next page of directory from master (first one if nothing has been read yet) - returns errno
+static int mfs_dirbuf_fetch(dirbuf *dirinfo,const struct fuse_ctx *ctx,fuse_ino_t ino,uint8_t wantattr) {
+	const uint8_t *dbuff,*ptr,*eptr;
+	uint32_t dsize,ecnt;
+	uint64_t nedgeid;
+	uint8_t status;
+	dirpage *dp;
+
+	nedgeid = dirinfo->nedgeid;
+	if (dirinfo->pages==NULL) {
+		dirinfo->dataformat = wantattr;
+		status = mfs_dirbuf_readdir(ctx,ino,dirinfo->dataformat,READDIR_PAGE_ENTRIES,&nedgeid,&dbuff,&dsize);
+		if (status==ERROR_EACCES && dirinfo->dataformat) {
+			dirinfo->dataformat = 0;
+			nedgeid = 0;
+			status = mfs_dirbuf_readdir(ctx,ino,dirinfo->dataformat,READDIR_PAGE_ENTRIES,&nedgeid,&dbuff,&dsize);
+		}
+		if (status==STATUS_OK && nedgeid==0) {
+			// older masters do not return handle of the next page - if page is full then read the whole directory at once
+			ptr = dbuff;
+			eptr = dbuff+dsize;
+			ecnt = 0;
+			while (ptr<eptr) {
+				ptr += ptr[0]+((dirinfo->dataformat)?40:6);
+				ecnt++;
+			}
+			if (ecnt>=READDIR_PAGE_ENTRIES) {
+				status = mfs_dirbuf_readdir(ctx,ino,dirinfo->dataformat,0xFFFFFFFF,&nedgeid,&dbuff,&dsize);
+			}
+		}
+		if (status==STATUS_OK) {
+			if (dirinfo->dataformat) {
+				mfs_stats_inc(OP_GETDIR_FULL);
+			} else {
+				mfs_stats_inc(OP_GETDIR_SMALL);
+			}
+		}
+	} else {
+		status = mfs_dirbuf_readdir(ctx,ino,dirinfo->dataformat,READDIR_PAGE_ENTRIES,&nedgeid,&dbuff,&dsize);
+	}
+	status = mfs_errorconv(status);
+	if (status!=0) {
+		return status;
+	}
+	dp = malloc(sizeof(dirpage));
+	if (dp==NULL) {
+		return EINVAL;
+	}
+	if (dsize>0) {
+		dp->data = malloc(dsize);
+		if (dp->data==NULL) {
+			free(dp);
+			return EINVAL;
+		}
+		memcpy(dp->data,dbuff,dsize);
+	} else {
+		dp->data = NULL;
+	}
+	dp->size = dsize;
+	dp->offset = dirinfo->size;
+	if (usedircache && dirinfo->dataformat==1 && dsize>0) {
+		dp->dcache = dcache_new(ctx,ino,dp->data,dp->size);
+	} else {
+		dp->dcache = NULL;
+	}
+	dp->next = NULL;
+	if (dirinfo->lastpage) {
+		dirinfo->lastpage->next = dp;
+	} else {
+		dirinfo->pages = dp;
+	}
+	dirinfo->lastpage = dp;
+	dirinfo->size += dsize;
+	dirinfo->nedgeid = nedgeid;
+	return 0;
+}
+
 void mfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi) {
 	int status;
         dirbuf *dirinfo = (dirbuf *)((unsigned long)(fi->fh));
@@ -2031,9 +2151,10 @@ void mfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct
 	uint8_t nleng;
 	uint32_t inode;
 	uint8_t type;
+	off_t noff;
+	dirpage *dp;
 	struct stat stbuf;
 	struct fuse_ctx ctx;
-	groups *gids;
 
 	ctx = *(fuse_req_ctx(req));
 	mfs_stats_inc(OP_READDIR);
@@ -2048,144 +2169,81 @@ void mfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct
 	}
 	pthread_mutex_lock(&(dirinfo->lock));
 	if (dirinfo->wasread==0 || (dirinfo->wasread==1 && off==0)) {
-		const uint8_t *dbuff;
-		uint32_t dsize;
-		uint8_t needscopy;
-/*
-		if (newdircache) {
-			status = dir_cache_getdirdata(ino,&dsize,&dbuff);
-			if (status==1) {	// got dir from new cache
-				mfs_stats_inc(OP_GETDIR_CACHED);
-				needscopy = 0;
-				dirinfo->dataformat = 0;
-				status = 0;
-			} else {
-				status = fs_getdir_plus(ino,ctx.uid,ctx.gid,1,&dbuff,&dsize);
-				if (status==0) {
-					mfs_stats_inc(OP_GETDIR_FULL);
-					dir_cache_newdirdata(ino,dsize,dbuff);
-				}
-				needscopy = 1;
-				dirinfo->dataformat = 1;
-			}
-		} else 
-*/
-		if (usedircache) {
-			uint8_t df;
-			df = 1;
-			if (full_permissions) {
-				gids = groups_get(ctx.pid,ctx.uid,ctx.gid);
-				status = fs_readdir(ino,ctx.uid,gids->gidcnt,gids->gidtab,1,0,&dbuff,&dsize);
-				if (status==ERROR_EACCES) {
-					df = 0;
-					status = fs_readdir(ino,ctx.uid,gids->gidcnt,gids->gidtab,0,0,&dbuff,&dsize);
-				}
-				groups_rel(gids);
-			} else {
-				uint32_t gidtmp = ctx.gid;
-				status = fs_readdir(ino,ctx.uid,1,&gidtmp,1,0,&dbuff,&dsize);
-				if (status==ERROR_EACCES) {
-					df = 0;
-					status = fs_readdir(ino,ctx.uid,1,&gidtmp,0,0,&dbuff,&dsize);
-				}
-			}
-			if (status==0) {
-				if (df) {
-					mfs_stats_inc(OP_GETDIR_FULL);
-				} else {
-					mfs_stats_inc(OP_GETDIR_SMALL);
-				}
-			}
-			needscopy = 1;
-			dirinfo->dataformat = df;
-		} else {
-			if (full_permissions) {
-				gids = groups_get(ctx.pid,ctx.uid,ctx.gid);
-				status = fs_readdir(ino,ctx.uid,gids->gidcnt,gids->gidtab,0,0,&dbuff,&dsize);
-				groups_rel(gids);
-			} else {
-				uint32_t gidtmp = ctx.gid;
-				status = fs_readdir(ino,ctx.uid,1,&gidtmp,0,0,&dbuff,&dsize);
-			}
-			if (status==0) {
-				mfs_stats_inc(OP_GETDIR_SMALL);
-			}
-			needscopy = 1;
-			dirinfo->dataformat = 0;
-		}
-		status = mfs_errorconv(status);
+		mfs_dirbuf_clear(dirinfo);
+		status = mfs_dirbuf_fetch(dirinfo,&ctx,ino,usedircache);
 		if (status!=0) {
 			oplog_printf(&ctx,"readdir (%lu,%llu,%llu): %s",(unsigned long int)ino,(unsigned long long int)size,(unsigned long long int)off,strerr(status));
 			fuse_reply_err(req, status);
 			pthread_mutex_unlock(&(dirinfo->lock));
 			return;
 		}
-		if (dirinfo->dcache) {
-			dcache_release(dirinfo->dcache);
-			dirinfo->dcache = NULL;
-		}
-		if (dirinfo->p) {
-			free((uint8_t*)(dirinfo->p));
-			dirinfo->p = NULL;
-		}
-		if (needscopy) {
-			dirinfo->p = malloc(dsize);
-			if (dirinfo->p == NULL) {
-				oplog_printf(&ctx,"readdir (%lu,%llu,%llu): %s",(unsigned long int)ino,(unsigned long long int)size,(unsigned long long int)off,strerr(EINVAL));
-				fuse_reply_err(req,EINVAL);
-				pthread_mutex_unlock(&(dirinfo->lock));
-				return;
-			}
-			memcpy((uint8_t*)(dirinfo->p),dbuff,dsize);
-		} else {
-			dirinfo->p = dbuff;
-		}
-		dirinfo->size = dsize;
-		if (usedircache && dirinfo->dataformat==1) {
-			dirinfo->dcache = dcache_new(&ctx,ino,dirinfo->p,dirinfo->size);
-		}
 	}
 	dirinfo->wasread=1;
+	while ((uint64_t)off>=dirinfo->size && dirinfo->nedgeid!=0) {	// next page has not been prefetched
+		status = mfs_dirbuf_fetch(dirinfo,&ctx,ino,dirinfo->dataformat);
+		if (status!=0) {
+			oplog_printf(&ctx,"readdir (%lu,%llu,%llu): %s",(unsigned long int)ino,(unsigned long long int)size,(unsigned long long int)off,strerr(status));
+			fuse_reply_err(req, status);
+			pthread_mutex_unlock(&(dirinfo->lock));
+			return;
+		}
+	}
 
-	if (off>=(off_t)(dirinfo->size)) {
+	if ((uint64_t)off>=dirinfo->size) {
 		oplog_printf(&ctx,"readdir (%lu,%llu,%llu): OK (no data)",(unsigned long int)ino,(unsigned long long int)size,(unsigned long long int)off);
 		fuse_reply_buf(req, NULL, 0);
 	} else {
 		if (size>READDIR_BUFFSIZE) {
 			size=READDIR_BUFFSIZE;
 		}
-		ptr = dirinfo->p+off;
-		eptr = dirinfo->p+dirinfo->size;
+		dp = dirinfo->pages;
+		while (dp && (uint64_t)off>=dp->offset+dp->size) {
+			dp = dp->next;
+		}
 		opos = 0;
 		end = 0;
 
-		while (ptr<eptr && end==0) {
-			nleng = ptr[0];
-			ptr++;
-			memcpy(name,ptr,nleng);
-			name[nleng]=0;
-			ptr+=nleng;
-			off+=nleng+((dirinfo->dataformat)?40:6);
-			if (ptr+5<=eptr) {
-				inode = get32bit(&ptr);
-				if (dirinfo->dataformat) {
-					mfs_attr_to_stat(inode,ptr,&stbuf);
-					ptr+=35;
+		while (dp && end==0) {
+			ptr = dp->data+(off-dp->offset);
+			eptr = dp->data+dp->size;
+			while (ptr<eptr && end==0) {
+				nleng = ptr[0];
+				ptr++;
+				memcpy(name,ptr,nleng);
+				name[nleng]=0;
+				ptr+=nleng;
+				noff = off+nleng+((dirinfo->dataformat)?40:6);
+				if (ptr+5<=eptr) {
+					inode = get32bit(&ptr);
+					if (dirinfo->dataformat) {
+						mfs_attr_to_stat(inode,ptr,&stbuf);
+						ptr+=35;
+					} else {
+						type = get8bit(&ptr);
+						mfs_type_to_stat(inode,type,&stbuf);
+					}
+					oleng = fuse_add_direntry(req, buffer + opos, size - opos, name, &stbuf, noff);
+					if (opos+oleng>size) {
+						end=1;
+					} else {
+						opos+=oleng;
+						off = noff;
+					}
 				} else {
-					type = get8bit(&ptr);
-					mfs_type_to_stat(inode,type,&stbuf);
-				}
-				oleng = fuse_add_direntry(req, buffer + opos, size - opos, name, &stbuf, off);
-				if (opos+oleng>size) {
 					end=1;
-				} else {
-					opos+=oleng;
 				}
 			}
+			dp = dp->next;
 		}
 
 		oplog_printf(&ctx,"readdir (%lu,%llu,%llu): OK (%lu)",(unsigned long int)ino,(unsigned long long int)size,(unsigned long long int)off,(unsigned long int)opos);
 		fuse_reply_buf(req,buffer,opos);
+		// application is already reading the last page - get the next one from master before the kernel asks for it
+		if (dirinfo->nedgeid!=0 && dirinfo->lastpage!=NULL && (uint64_t)off>=dirinfo->lastpage->offset) {
+			if (mfs_dirbuf_fetch(dirinfo,&ctx,ino,dirinfo->dataformat)!=0 && debug_mode) {
+				fprintf(stderr,"readdir (%lu): next page prefetch failed\n",(unsigned long int)ino);
+			}
+		}
 	}
 	pthread_mutex_unlock(&(dirinfo->lock));
 }
@@ -2202,14 +2260,9 @@ void mfs_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
 		fprintf(stderr,"releasedir (%lu)\n",(unsigned long int)ino);
 	}
 	pthread_mutex_lock(&(dirinfo->lock));
+	mfs_dirbuf_clear(dirinfo);
 	pthread_mutex_unlock(&(dirinfo->lock));
 	pthread_mutex_destroy(&(dirinfo->lock));
-	if (dirinfo->dcache) {
-		dcache_release(dirinfo->dcache);
-	}
-	if (dirinfo->p) {
-		free((uint8_t*)(dirinfo->p));
-	}
 	free(dirinfo);
 	fi->fh = 0;
 	oplog_printf(&ctx,"releasedir (%lu): OK",(unsigned long int)ino);
@@ -2692,6 +2745,7 @@ void mfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fus
 	struct iovec *iov;
 	uint32_t iovcnt;
 	void *buffptr;
+	void *rdata;
 	int err;
 	struct fuse_ctx ctx;
 
@@ -2873,6 +2927,14 @@ void mfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fus
 */
 	ssize = size;
 	err = read_data(fileinfo->data,off,&ssize,&buffptr,&iov,&iovcnt);
+	rdata = fileinfo->data;
+#ifdef FREEBSD_EARLY_RELEASE_BUG_WORKAROUND
+	fileinfo->ops_in_progress--;
+	fileinfo->lastuse = monotonic_seconds();
+#endif
+	// returned buffers stay locked in 'readdata' until read_data_free_buff, so reply (copying data to the kernel) can be sent
+	// without file lock - other threads can read the same file in the meantime (kernel read ahead sends many requests at once)
+	pthread_mutex_unlock(&(fileinfo->lock));
 
 	if (err!=0) {
 		if (debug_mode) {
@@ -2889,12 +2951,7 @@ void mfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fus
 		fuse_reply_iov(req,iov,iovcnt);
 	}
 //	read_data_freebuff(fileinfo->data);
-	read_data_free_buff(fileinfo->data,buffptr,iov);
-#ifdef FREEBSD_EARLY_RELEASE_BUG_WORKAROUND
-	fileinfo->ops_in_progress--;
-	fileinfo->lastuse = monotonic_seconds();
-#endif
-	pthread_mutex_unlock(&(fileinfo->lock));
+	read_data_free_buff(rdata,buffptr,iov);
 }
 
 void mfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi) {
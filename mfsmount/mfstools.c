@@ -3904,9 +3904,10 @@ void usage(int f) {
 			print_numberformat_options();
 			break;
 		case MFSMAKESNAPSHOT:
-			fprintf(stderr,"make snapshot (lazy copy)\n\nusage: mfsmakesnapshot [-op] src [src ...] dst\n");
+			fprintf(stderr,"make snapshot (lazy copy)\n\nusage: mfsmakesnapshot [-ocl] src [src ...] dst\n");
 			fprintf(stderr,"-o - allow to overwrite existing objects\n");
 			fprintf(stderr,"-c - 'cp' mode for attributes (create objects using current uid,gid,umask etc.)\n");
+			fprintf(stderr,"-l - lazy mode (return immediately - contents of directories are copied by master in the background or on first access)\n");
 			break;
 		case MFSRMSNAPSHOT:
 			fprintf(stderr,"remove snapshot (quick rm -r)\n\nusage: mfsrmsnapshot [-f] name [name ...]\n");
@@ -4164,7 +4165,7 @@ int main(int argc,char **argv) {
 	// parse options
 	switch (f) {
 	case MFSMAKESNAPSHOT:
-		while ((ch=getopt(argc,argv,"oc"))!=-1) {
+		while ((ch=getopt(argc,argv,"ocl"))!=-1) {
 			switch(ch) {
 			case 'o':
 				snapmode |= SNAPSHOT_MODE_CAN_OVERWRITE;
@@ -4172,6 +4173,9 @@ int main(int argc,char **argv) {
 			case 'c':
 				snapmode |= SNAPSHOT_MODE_CPLIKE_ATTR;
 				break;
+			case 'l':
+				snapmode |= SNAPSHOT_MODE_LAZY;
+				break;
 			}
 		}
 		argc -= optind;
@@ -54,6 +54,7 @@
 #include "clocks.h"
 #include "portable.h"
 #include "readdata.h"
+#include "diskcache.h"
 #include "MFSCommunication.h"
 
 #define CHUNKSERVER_ACTIVITY_TIMEOUT 2.0
@@ -75,6 +76,16 @@
 
 #define READAHEAD_MAX 4
 
+// independent read patterns tracked per inode (sequential, backward or strided readers)
+#define READAHEAD_STREAMS 8
+#define READAHEAD_HISTORY 16
+#define READAHEAD_STREAM_TIMEOUT 10.0
+// window is at least (consumption rate * fetch latency * factor)
+#define READAHEAD_LATENCY_FACTOR 2.0
+// window is requested in that many parts
+#define READAHEAD_PIECES 4
+#define READAHEAD_MAX_REQUESTS 64
+
 /*
 typedef struct cblock_s {
 	uint8_t data[MFSBLOCKSIZE];
@@ -150,6 +161,7 @@ typedef struct rrequest_s {
 	uint32_t rleng;
 	uint32_t currentpos;
 	uint32_t chindx;
+	double created;
 	double modified;
 	uint8_t refresh;
 	uint8_t mode;
@@ -159,9 +171,23 @@ typedef struct rrequest_s {
 	struct rrequest_s *next,**prev;
 } rrequest;
 
+enum {RA_SEQ,RA_BACKWARD,RA_STRIDE};
+
+typedef struct rastream_s {
+	uint64_t laststart;	// last read in this stream
+	uint64_t lastend;
+	uint64_t stride;	// distance between consecutive reads (RA_STRIDE only)
+	uint32_t lastsize;
+	uint32_t seqdata;
+	uint8_t kind;
+	uint8_t readahead;	// read-ahead level (0 - off)
+	uint8_t hits;
+	double lasttime;	// 0.0 - unused
+	double rate;		// observed consumption rate (bytes per second)
+} rastream;
+
 typedef struct inodedata_s {
 	uint32_t inode;
-	uint32_t seqdata;
 	uint64_t fleng;
 	int status;
 	uint16_t closewaiting;
@@ -170,8 +196,11 @@ typedef struct inodedata_s {
 	uint8_t flengisvalid;
 	uint8_t inqueue;
 	uint8_t canmodatime;
-	uint8_t readahead;
-	uint64_t lastoffset;
+	uint8_t rahistpos;
+	uint8_t rahistcnt;
+	uint64_t rahist[READAHEAD_HISTORY];	// recent read offsets (used to detect strides)
+	rastream streams[READAHEAD_STREAMS];
+	double fetchlatency;
 //	double mreq_time;
 //	uint32_t mreq_chindx;
 //	uint64_t mreq_chunkid;
@@ -194,6 +223,7 @@ typedef struct mreqcache_s {
 	uint64_t chunkid;
 	uint32_t version;
 	uint8_t csdataver;
+	uint8_t cacheok;
 	uint32_t csdatasize;
 	uint8_t *csdata;
 //	uint32_t csdatabuffsize;
@@ -271,7 +301,7 @@ static inline void read_invalidate_masterdata(uint32_t inode,uint32_t chindx) {
 	zassert(pthread_mutex_unlock(&mreq_cache_lock));
 }
 
-static inline uint8_t read_get_masterdata(inodedata *ind,cspri chain[100],uint16_t *chainelements,uint32_t chindx,uint64_t *mfleng,uint64_t *chunkid,uint32_t *version) {
+static inline uint8_t read_get_masterdata(inodedata *ind,cspri chain[100],uint16_t *chainelements,uint32_t chindx,uint64_t *mfleng,uint64_t *chunkid,uint32_t *version,uint8_t *cacheok) {
 	uint32_t hash;
 	mreqcache *mrc,**mrcp;
 	const uint8_t *csdata;
@@ -301,11 +331,13 @@ static inline uint8_t read_get_masterdata(inodedata *ind,cspri chain[100],uint16
 					zassert(pthread_mutex_unlock(&mreq_cache_lock));
 					*chunkid = 0;
 					*version = 0;
+					*cacheok = 0;
 					*chainelements = 0;
 					return mrc->status;
 				}
 				*chunkid = mrc->chunkid;
 				*version = mrc->version;
+				*cacheok = mrc->cacheok;
 				if (mrc->csdata && mrc->csdatasize>0) {
 					*chainelements = csorder_sort(chain,mrc->csdataver,mrc->csdata,mrc->csdatasize,0);
 				} else {
@@ -316,6 +348,7 @@ static inline uint8_t read_get_masterdata(inodedata *ind,cspri chain[100],uint16
 			} else if (mrc->state==MR_READY && mrc->status==STATUS_OK && flengisvalid) {
 				*chunkid = mrc->chunkid;
 				*version = mrc->version;
+				*cacheok = mrc->cacheok;
 				if (mrc->csdata && mrc->csdatasize>0) {
 					*chainelements = csorder_sort(chain,mrc->csdataver,mrc->csdata,mrc->csdatasize,0);
 				} else {
@@ -362,7 +395,10 @@ static inline uint8_t read_get_masterdata(inodedata *ind,cspri chain[100],uint16
 		ind->canmodatime = 1;
 	}
 	zassert(pthread_mutex_unlock(&(ind->lock)));
-	mrc->status = fs_readchunk(inode,chindx,canmodatime,&(mrc->csdataver),mfleng,&(mrc->chunkid),&(mrc->version),&csdata,&(mrc->csdatasize));
+	if (disk_cache_enabled()) {
+		canmodatime |= 0x80;
+	}
+	mrc->status = fs_readchunk(inode,chindx,canmodatime,&(mrc->csdataver),&(mrc->cacheok),mfleng,&(mrc->chunkid),&(mrc->version),&csdata,&(mrc->csdatasize));
 	if (mrc->status==STATUS_OK) {
 		if (mrc->csdatasize>0) {
 			mrc->csdata = malloc(mrc->csdatasize);
@@ -391,11 +427,13 @@ static inline uint8_t read_get_masterdata(inodedata *ind,cspri chain[100],uint16
 		zassert(pthread_mutex_unlock(&mreq_cache_lock));
 		*chunkid = 0;
 		*version = 0;
+		*cacheok = 0;
 		*chainelements = 0;
 		return mrc->status;
 	}
 	*chunkid = mrc->chunkid;
 	*version = mrc->version;
+	*cacheok = mrc->cacheok;
 	if (mrc->csdata && mrc->csdatasize>0) {
 		*chainelements = csorder_sort(chain,mrc->csdataver,mrc->csdata,mrc->csdatasize,0);
 	} else {
@@ -476,6 +514,11 @@ void read_job_end(rrequest *rreq,int status,uint32_t delay) {
 	if (rreq->mode==FILLED) {
 		rreq->mode = READY;
 		ind->trycnt = 0;
+		if (ind->fetchlatency==0.0) {
+			ind->fetchlatency = rreq->modified - rreq->created;
+		} else {
+			ind->fetchlatency = 0.875 * ind->fetchlatency + 0.125 * (rreq->modified - rreq->created);
+		}
 	} else {
 		if (rreq->mode==BREAK) {
 			breakmode = 1;
@@ -638,6 +681,8 @@ void* read_worker(void *arg) {
 	uint32_t inode;
 	uint32_t trycnt;
 	uint32_t rleng;
+	uint32_t cachepos;
+	uint8_t cacheok;
 
 	uint32_t reccmd;
 	uint32_t recleng;
@@ -748,7 +793,7 @@ void* read_worker(void *arg) {
 			continue;
 		}
 
-		rdstatus = read_get_masterdata(ind,chain,&chainelements,chindx,&mfleng,&chunkid,&version); // unlocks (ind->lock)
+		rdstatus = read_get_masterdata(ind,chain,&chainelements,chindx,&mfleng,&chunkid,&version,&cacheok); // unlocks (ind->lock)
 
 #if 0
 		now = monotonic_seconds();
@@ -866,6 +911,45 @@ void* read_worker(void *arg) {
 			continue;
 		}
 
+		if (cacheok) { // try local disk cache first - fetch from chunkserver only what is missing
+			zassert(pthread_mutex_lock(&(ind->lock)));
+			if (rreq->offset > mfleng) {
+				rreq->rleng = 0;
+			} else if ((rreq->offset + rreq->leng) > mfleng) {
+				rreq->rleng = mfleng - rreq->offset;
+			} else {
+				rreq->rleng = rreq->leng;
+			}
+			rleng = rreq->rleng;
+			currentpos = rreq->currentpos;
+			zassert(pthread_mutex_unlock(&(ind->lock)));
+			if (currentpos<rleng) {
+				currentpos += disk_cache_read(chunkid,version,(rreq->offset+currentpos)&MFSCHUNKMASK,rleng-currentpos,rreq->data+currentpos);
+			}
+			zassert(pthread_mutex_lock(&(ind->lock)));
+			if (rreq->mode!=BUSY || ind->closing) {
+				rreq->currentpos = 0;
+				zassert(pthread_mutex_unlock(&(ind->lock)));
+				read_job_end(rreq,0,0);
+				continue;
+			}
+			rreq->currentpos = currentpos;
+			if (currentpos>=rleng) {
+				rreq->mode = FILLED;
+#ifdef RDEBUG
+				fprintf(stderr,"%.6lf: readworker (rreq: %"PRIu64":%"PRIu64"/%"PRIu32") inode: %"PRIu32" (from disk cache)\n",monotonic_seconds(),rreq->offset,rreq->offset+rreq->leng,rreq->leng,inode);
+#endif
+				rreq->modified = monotonic_seconds();
+				if (rreq->waiting>0) {
+					zassert(pthread_cond_broadcast(&(rreq->cond)));
+				}
+				zassert(pthread_mutex_unlock(&(ind->lock)));
+				read_job_end(rreq,0,0);
+				continue;
+			}
+			zassert(pthread_mutex_unlock(&(ind->lock)));
+		}
+
 #if 0
 		if (csdata!=NULL && csdatasize>0) {
 			zassert(pthread_mutex_lock(&(ind->lock))); // csdata may point to ind->mreq_csdata
@@ -1020,6 +1104,7 @@ void* read_worker(void *arg) {
 
 		reccmd = 0; // makes gcc happy
 		recleng = 0; // makes gcc happy
+		cachepos = 0; // makes gcc happy
 
 		do {
 			now = monotonic_seconds();
@@ -1095,6 +1180,7 @@ void* read_worker(void *arg) {
 					put32bit(&wptr,version);
 					put32bit(&wptr,(rreq->offset+currentpos) & MFSCHUNKMASK);
 					put32bit(&wptr,rreq->rleng-currentpos);
+					cachepos = currentpos;
 					sent = 0;
 					reqsend = 1;
 				} else {
@@ -1339,6 +1425,9 @@ void* read_worker(void *arg) {
 								break;
 							}
 							gotstatus = 1;
+							if (cacheok && currentpos>cachepos) {
+								disk_cache_write(chunkid,version,(rreq->offset+cachepos) & MFSCHUNKMASK,currentpos-cachepos,rreq->data+cachepos,(rreq->offset+currentpos>=mfleng)?1:0);
+							}
 						} else if (reccmd==CSTOCL_READ_DATA) {
 							rptr = recvbuff;
 							recchunkid = get64bit(&rptr);
@@ -1571,7 +1660,8 @@ rrequest* read_new_request(inodedata *ind,uint64_t *offset,uint64_t blockend) {
 	rreq->ind = ind;
 	rreq->pipe[0] = pfd[0];
 	rreq->pipe[1] = pfd[1];
-	rreq->modified = monotonic_seconds();
+	rreq->created = monotonic_seconds();
+	rreq->modified = rreq->created;
 	rreq->waitingworker = 0;
 	rreq->offset = chunkoffset;
 	rreq->leng = chunkleng;
@@ -1656,6 +1746,322 @@ int read_data_offset_cmp(const void *aa,const void *bb) {
 	return (a<b)?-1:(a>b)?1:0;
 }
 
+/* read-ahead engine */
+
+typedef struct rabudget_s {
+	uint64_t bytes;
+	uint32_t reqs;
+} rabudget;
+
+static inline rastream* read_ra_stream_new(inodedata *ind,double now) {
+	rastream *st,*lru;
+	uint32_t i;
+
+	lru = ind->streams;
+	for (i=0 ; i<READAHEAD_STREAMS ; i++) {
+		st = ind->streams+i;
+		if (st->lasttime==0.0 || st->lasttime+READAHEAD_STREAM_TIMEOUT<now) {
+			lru = st;
+			break;
+		}
+		if (st->lasttime < lru->lasttime) {
+			lru = st;
+		}
+	}
+	memset(lru,0,sizeof(rastream));
+	lru->kind = RA_SEQ;
+	return lru;
+}
+
+static inline void read_ra_stream_hit(rastream *st,uint64_t offset,uint32_t size,double now) {
+	double dt;
+
+	dt = now - st->lasttime;
+	if (st->lasttime>0.0 && dt>0.0) {
+		if (st->rate==0.0) {
+			st->rate = size / dt;
+		} else {
+			st->rate = 0.75 * st->rate + 0.25 * (size / dt);
+		}
+	}
+	st->laststart = offset;
+	st->lastend = offset + size;
+	st->lastsize = size;
+	st->lasttime = now;
+}
+
+// sequential and backward streams gain levels the same way as the old single-stream read-ahead did
+static inline void read_ra_stream_level(rastream *st,uint32_t size) {
+	if (st->readahead<READAHEAD_MAX) {
+		if (st->seqdata>=readahead_trigger) {
+			st->readahead++;
+			st->seqdata = 0;
+		}
+		st->seqdata += size;
+	}
+}
+
+/* assign read to a stream (find continued one, detect stride or start a new one) */
+static rastream* read_ra_update(inodedata *ind,uint64_t offset,uint32_t size,double now) {
+	rastream *st;
+	uint64_t tol,d,prev;
+	uint32_t i,j,k,n;
+
+	tol = readahead/2;
+	for (i=0 ; i<READAHEAD_STREAMS ; i++) {
+		st = ind->streams+i;
+		if (st->lasttime==0.0) {
+			continue;
+		}
+		if (st->lasttime+READAHEAD_STREAM_TIMEOUT<now) {
+			st->lasttime = 0.0;
+			continue;
+		}
+		if (offset==st->lastend) { // exactly sequential
+			if (st->kind!=RA_SEQ) {
+				st->kind = RA_SEQ;
+				st->seqdata = 0;
+			}
+			read_ra_stream_level(st,size);
+			read_ra_stream_hit(st,offset,size,now);
+			return st;
+		}
+		if (st->kind==RA_SEQ && offset+tol >= st->lastend && offset <= st->lastend+tol) { // almost sequential (reordered requests)
+			read_ra_stream_hit(st,offset,size,now);
+			return st;
+		}
+		if ((st->kind==RA_BACKWARD || st->readahead==0) && offset+size <= st->laststart && offset+size+tol >= st->laststart) { // backward scan
+			if (st->kind!=RA_BACKWARD) {
+				st->kind = RA_BACKWARD;
+				st->seqdata = 0;
+			}
+			read_ra_stream_level(st,size);
+			read_ra_stream_hit(st,offset,size,now);
+			return st;
+		}
+		if (st->kind==RA_STRIDE && offset+st->lastsize >= st->laststart+st->stride && offset <= st->laststart+st->stride+st->lastsize) {
+			st->stride = offset - st->laststart;
+			st->hits++;
+			if (st->hits>=2 && st->readahead<READAHEAD_MAX) {
+				st->readahead++;
+				st->hits = 0;
+			}
+			read_ra_stream_hit(st,offset,size,now);
+			return st;
+		}
+	}
+	// stride detection - look for two earlier reads at the same distance (newest first, so the shortest stride wins)
+	st = NULL;
+	for (n=1 ; n<=ind->rahistcnt && st==NULL ; n++) {
+		i = (ind->rahistpos + READAHEAD_HISTORY - n) % READAHEAD_HISTORY;
+		if (ind->rahist[i] >= offset) {
+			continue;
+		}
+		d = offset - ind->rahist[i];
+		if (d <= size || ind->rahist[i] < d) {
+			continue;
+		}
+		prev = ind->rahist[i] - d;
+		for (k=0 ; k<ind->rahistcnt ; k++) {
+			if (ind->rahist[k]+size >= prev && ind->rahist[k] <= prev+size) {
+				for (j=0 ; j<READAHEAD_STREAMS && st==NULL ; j++) {
+					if (ind->streams[j].lasttime>0.0 && ind->streams[j].laststart==ind->rahist[i] && ind->streams[j].readahead==0) {
+						st = ind->streams+j;
+					}
+				}
+				if (st==NULL) {
+					st = read_ra_stream_new(ind,now);
+				}
+				st->kind = RA_STRIDE;
+				st->stride = d;
+				st->readahead = 1;
+				st->hits = 0;
+				break;
+			}
+		}
+	}
+	if (st==NULL) {
+		st = read_ra_stream_new(ind,now);
+		if (offset==0) { // begin with read-ahead turned on
+			st->readahead = 1;
+		}
+	}
+	read_ra_stream_hit(st,offset,size,now);
+	ind->rahist[ind->rahistpos] = offset;
+	ind->rahistpos = (ind->rahistpos+1) % READAHEAD_HISTORY;
+	if (ind->rahistcnt<READAHEAD_HISTORY) {
+		ind->rahistcnt++;
+	}
+	return st;
+}
+
+/* window size - based on read-ahead level and observed consumption rate and fetch latency */
+static inline uint64_t read_ra_window(inodedata *ind,rastream *st) {
+	uint64_t w,maxw;
+	double bdp;
+
+	w = readahead * (1<<((st->readahead-1)*2));
+	maxw = ((uint64_t)readahead) << ((READAHEAD_MAX-1)*2);
+	if (maxw > maxreadaheadsize/4) {
+		maxw = maxreadaheadsize/4;
+	}
+	bdp = st->rate * ind->fetchlatency * READAHEAD_LATENCY_FACTOR;
+	if (bdp >= maxw) {
+		w = maxw;
+	} else if (bdp > w) {
+		w = bdp;
+	}
+	if (w > maxw) {
+		w = maxw;
+	}
+	if (w < readahead) {
+		w = readahead;
+	}
+	return w;
+}
+
+/* data requested by read-ahead of any stream - do not free such requests */
+static inline uint8_t read_ra_wanted(inodedata *ind,rrequest *rreq,double now) {
+	rastream *st;
+	uint64_t w,lo,hi;
+	uint32_t i;
+
+	for (i=0 ; i<READAHEAD_STREAMS ; i++) {
+		st = ind->streams+i;
+		if (st->lasttime==0.0 || st->readahead==0 || st->lasttime+READAHEAD_STREAM_TIMEOUT<now) {
+			continue;
+		}
+		w = read_ra_window(ind,st);
+		switch (st->kind) {
+		case RA_BACKWARD:
+			lo = (st->laststart>w)?st->laststart-w:0;
+			hi = st->lastend;
+			break;
+		case RA_STRIDE:
+			lo = st->laststart;
+			hi = st->laststart + ((1<<st->readahead)+1) * st->stride;
+			break;
+		default:
+			lo = st->laststart;
+			hi = st->lastend + w;
+		}
+		if (rreq->offset < hi && rreq->offset+rreq->leng > lo) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static inline uint64_t read_ra_covered_end(inodedata *ind,uint64_t pos) {
+	rrequest *rreq;
+	uint8_t found;
+
+	do {
+		found = 0;
+		for (rreq = ind->reqhead ; rreq ; rreq=rreq->next) {
+			if (rreq->mode!=BREAK && rreq->mode!=FREE && rreq->offset<=pos && rreq->offset+rreq->leng>pos) {
+				pos = rreq->offset+rreq->leng;
+				found = 1;
+			}
+		}
+	} while (found);
+	return pos;
+}
+
+static inline uint64_t read_ra_covered_start(inodedata *ind,uint64_t pos) {
+	rrequest *rreq;
+	uint8_t found;
+
+	do {
+		found = 0;
+		for (rreq = ind->reqhead ; rreq ; rreq=rreq->next) {
+			if (rreq->mode!=BREAK && rreq->mode!=FREE && rreq->offset<pos && rreq->offset+rreq->leng>=pos) {
+				pos = rreq->offset;
+				found = 1;
+			}
+		}
+	} while (found);
+	return pos;
+}
+
+/* request not covered parts of given range (also in next chunks) in parts not bigger than 'piece' */
+static void read_ra_request(inodedata *ind,uint64_t from,uint64_t to,uint64_t piece,rabudget *b) {
+	rrequest *rreq;
+	uint64_t end;
+
+	if (to > ind->fleng) {
+		to = ind->fleng;
+	}
+	while (from < to) {
+		from = read_ra_covered_end(ind,from);
+		if (from >= to) {
+			return;
+		}
+		end = to;
+		for (rreq = ind->reqhead ; rreq ; rreq=rreq->next) {
+			if (rreq->mode!=BREAK && rreq->mode!=FREE && rreq->offset>from && rreq->offset<end) {
+				end = rreq->offset;
+			}
+		}
+		if (end - from > piece) {
+			end = from + piece;
+		}
+		while (from < end) {
+			if (b->reqs==0 || b->bytes < end - from) {
+				return;
+			}
+#ifdef RDEBUG
+			fprintf(stderr,"%.6lf: read_data: inode: %"PRIu32" add new read-ahead rreq (%"PRIu64":%"PRIu64"/%"PRIu64")\n",monotonic_seconds(),ind->inode,from,end,end-from);
+#endif
+			rreq = read_new_request(ind,&from,end);
+			if (rreq==NULL) {
+				return;
+			}
+			b->bytes -= rreq->leng;
+			b->reqs--;
+		}
+	}
+}
+
+static void read_ra_prefetch(inodedata *ind,rastream *st,uint64_t rbuffsize,uint32_t reqno) {
+	rabudget b;
+	uint64_t window,piece,pos,from;
+	uint32_t n,depth;
+
+	if (st->readahead==0 || ind->flengisvalid==0 || rbuffsize>=maxreadaheadsize || reqno>=READAHEAD_MAX_REQUESTS) {
+		return;
+	}
+	b.bytes = maxreadaheadsize - rbuffsize;
+	b.reqs = READAHEAD_MAX_REQUESTS - reqno;
+	window = read_ra_window(ind,st);
+	piece = window / READAHEAD_PIECES;
+	if (piece < readahead) {
+		piece = readahead;
+	}
+	switch (st->kind) {
+	case RA_SEQ:
+		pos = read_ra_covered_end(ind,st->lastend);
+		if (pos - st->lastend < window/2) {
+			read_ra_request(ind,pos,st->lastend+window,piece,&b);
+		}
+		break;
+	case RA_BACKWARD:
+		pos = read_ra_covered_start(ind,st->laststart);
+		if (st->laststart - pos < window/2) {
+			from = (st->laststart>window)?st->laststart-window:0;
+			read_ra_request(ind,from,pos,piece,&b);
+		}
+		break;
+	case RA_STRIDE:
+		depth = 1<<st->readahead;
+		for (n=1 ; n<=depth && n*(uint64_t)(st->lastsize)<=window ; n++) {
+			from = st->laststart + n * st->stride;
+			read_ra_request(ind,from,from+st->lastsize,piece,&b);
+		}
+		break;
+	}
+}
+
 // return list of rreq
 int read_data(void *vid, uint64_t offset, uint32_t *size, void **vrhead,struct iovec **iov,uint32_t *iovcnt) {
 	inodedata *ind = (inodedata*)vid;
@@ -1667,8 +2073,9 @@ int read_data(void *vid, uint64_t offset, uint32_t *size, void **vrhead,struct i
 	uint64_t addoffset;
 	uint32_t cnt;
 	uint32_t edges,i,reqno;
-	uint8_t added,raok;
+	uint8_t added;
 	uint64_t *etab,*ranges;
+	rastream *st;
 	int status;
 	double now;
 
@@ -1694,35 +2101,18 @@ int read_data(void *vid, uint64_t offset, uint32_t *size, void **vrhead,struct i
 #endif
 
 	if (ind->status==0 && ind->closing==0) {
-		if (offset==ind->lastoffset) {
-			if (offset==0) { // begin with read-ahead turned on
-				ind->readahead = 1;
-				ind->seqdata = 0;
-			} else if (ind->readahead<READAHEAD_MAX) {
-				if (ind->seqdata>=readahead_trigger) {
-					ind->readahead++;
-					ind->seqdata = 0;
-				}
-			}
-		} else {
-			if (offset+(readahead/2) < ind->lastoffset || ind->lastoffset+(readahead/2) < offset) {
-				if (ind->readahead>0) {
-					ind->readahead--;
-				}
-				ind->seqdata = 0;
-			}
-		}
-		if (ind->readahead > 1 && reqbufftotalsize >= (maxreadaheadsize / 2) + ((maxreadaheadsize * 1) / (ind->readahead * 2))) {
-			ind->readahead--;
-			ind->seqdata = 0;
+		now = monotonic_seconds();
+		st = read_ra_update(ind,offset,*size,now);
+		if (st->readahead > 1 && rbuffsize >= (maxreadaheadsize / 2) + ((maxreadaheadsize * 1) / (st->readahead * 2))) {
+			st->readahead--;
+			st->seqdata = 0;
 		}
 #ifdef RDEBUG
-		fprintf(stderr,"%.6lf: read_data: inode: %"PRIu32" seqdata: %"PRIu32" offset: %"PRIu64" ind->lastoffset: %"PRIu64" ind->readahead: %u reqbufftotalsize:%"PRIu64"\n",monotonic_seconds(),ind->inode,ind->seqdata,offset,ind->lastoffset,ind->readahead,rbuffsize);
+		fprintf(stderr,"%.6lf: read_data: inode: %"PRIu32" offset: %"PRIu64" stream: %u kind: %u stride: %"PRIu64" seqdata: %"PRIu32" readahead: %u rate: %.0lf latency: %.6lf reqbufftotalsize:%"PRIu64"\n",monotonic_seconds(),ind->inode,offset,(unsigned)(st-ind->streams),st->kind,st->stride,st->seqdata,st->readahead,st->rate,ind->fetchlatency,rbuffsize);
 #endif
 
 		firstbyte = offset;
 		lastbyte = offset + (*size);
-		now = monotonic_seconds();
 
 		// cleanup unused requests
 		reqno = 0;
@@ -1745,7 +2135,7 @@ int read_data(void *vid, uint64_t offset, uint32_t *size, void **vrhead,struct i
 #endif
 				read_rreq_not_needed(rreq);
 				reqno--;
-			} else if ((lastbyte <= rreq->offset || firstbyte >= rreq->offset+rreq->leng) && reqno>3) {
+			} else if ((lastbyte <= rreq->offset || firstbyte >= rreq->offset+rreq->leng) && (reqno>READAHEAD_MAX_REQUESTS || (reqno>3 && read_ra_wanted(ind,rreq,now)==0))) {
 #ifdef RDEBUG
 				fprintf(stderr,"%.6lf: read_data: inode: %"PRIu32" - too many requests: free rreq (%"PRIu64":%"PRIu64"/%"PRIu32" ; lcnt:%u ; mode:%s)\n",monotonic_seconds(),ind->inode,rreq->offset,rreq->offset+rreq->leng,rreq->leng,rreq->lcnt,read_data_modename(rreq->mode));
 #endif
@@ -1823,54 +2213,6 @@ int read_data(void *vid, uint64_t offset, uint32_t *size, void **vrhead,struct i
 						rtail = &(rl->next);
 						rreq->lcnt++;
 						added = 1;
-						if (ind->readahead && ind->flengisvalid && i==edges-2) {
-							// request next block of data
-							if (rreq->next==NULL && rbuffsize<maxreadaheadsize) {
-								uint64_t blockstart,blockend;
-								blockstart = rreq->offset+rreq->leng;
-								blockend = blockstart + (readahead * (1<<((ind->readahead-1)*2)));
-								raok = 1;
-								for (rreqn = ind->reqhead ; rreqn && raok ; rreqn=rreqn->next) {
-									if (rreq->mode!=BREAK && rreq->mode!=FREE) {
-										if (!(blockend <= rreq->offset || blockstart >= rreq->offset+rreq->leng)) {
-											raok = 0;
-										}
-									}
-								}
-								if (raok) {
-#ifdef RDEBUG
-									fprintf(stderr,"%.6lf: read_data: inode: %"PRIu32" (middle of existing block) add new read-ahead rreq (%"PRIu64":%"PRIu64"/%"PRId64")\n",monotonic_seconds(),ind->inode,blockstart,blockend,blockend-blockstart);
-#endif
-									if (blockend<=ind->fleng) {
-										read_new_request(ind,&blockstart,blockend);
-									} else if (blockstart<ind->fleng) {
-										read_new_request(ind,&blockstart,ind->fleng);
-									}
-								// and another one if necessary
-									if ((blockstart % MFSCHUNKSIZE) == 0 && rreq->next!=NULL && rreq->next->next==NULL && rbuffsize<maxreadaheadsize) {
-										blockend = blockstart + (readahead * (1<<((ind->readahead-1)*2)));
-										raok = 1;
-										for (rreqn = ind->reqhead ; rreqn && raok ; rreqn=rreqn->next) {
-											if (rreq->mode!=BREAK && rreq->mode!=FREE) {
-												if (!(blockend <= rreq->offset || blockstart >= rreq->offset+rreq->leng)) {
-													raok = 0;
-												}
-											}
-										}
-										if (raok) {
-#ifdef RDEBUG
-											fprintf(stderr,"%.6lf: read_data: inode: %"PRIu32" (middle of existing block) add new extra read-ahead rreq (%"PRIu64":%"PRIu64"/%"PRId64")\n",monotonic_seconds(),ind->inode,blockstart,blockend,blockend-blockstart);
-#endif
-											if (blockend<=ind->fleng) {
-												read_new_request(ind,&blockstart,blockend);
-											} else if (blockstart<ind->fleng) {
-												read_new_request(ind,&blockstart,ind->fleng);
-											}
-										}
-									}
-								}
-							}
-						}
 					}
 				}
 			}
@@ -1878,6 +2220,7 @@ int read_data(void *vid, uint64_t offset, uint32_t *size, void **vrhead,struct i
 				addoffset = etab[i];
 				while (addoffset < etab[i+1]) {
 					rreq = read_new_request(ind,&addoffset,etab[i+1]);
+					reqno++;
 					rl = malloc(sizeof(rlist));
 					passert(rl);
 					rl->rreq = rreq;
@@ -1887,32 +2230,12 @@ int read_data(void *vid, uint64_t offset, uint32_t *size, void **vrhead,struct i
 					*rtail = rl;
 					rtail = &(rl->next);
 					rreq->lcnt++;
-					if (addoffset==etab[i+1] && ind->readahead && ind->flengisvalid && rbuffsize<maxreadaheadsize && i==edges-2) {
-						uint64_t blockend;
-						blockend = etab[i+1] + (readahead * (1<<((ind->readahead-1)*2)))/2;
-						raok = 1;
-						for (rreqn = ind->reqhead ; rreqn && raok ; rreqn=rreqn->next) {
-							if (rreq->mode!=BREAK && rreq->mode!=FREE) {
-								if (!(blockend <= rreq->offset || addoffset >= rreq->offset+rreq->leng)) {
-									raok = 0;
-								}
-							}
-						}
-						if (raok) {
-#ifdef RDEBUG
-							fprintf(stderr,"%.6lf: read_data: inode: %"PRIu32" (after new block) add new read-ahead rreq (%"PRIu64":%"PRIu64"/%"PRId64")\n",monotonic_seconds(),ind->inode,etab[i+1],blockend,blockend-etab[i+1]);
-#endif
-							if (blockend<=ind->fleng) {
-								(void)read_new_request(ind,&addoffset,blockend);
-							} else if (lastbyte<ind->fleng) {
-								(void)read_new_request(ind,&addoffset,ind->fleng);
-							}
-						}
-					}
 				}
 			}
 		}
 
+		read_ra_prefetch(ind,st,rbuffsize,reqno);
+
 #if 0
 		rreq = ind->reqhead;
 		while (rreq && lastbyte>firstbyte) {
@@ -2109,10 +2432,6 @@ int read_data(void *vid, uint64_t offset, uint32_t *size, void **vrhead,struct i
 	}
 
 	if (ind->status==0 && ind->closing==0 && cnt>0) {
-		ind->lastoffset = offset + (*size);
-		if (ind->readahead<READAHEAD_MAX) {
-			ind->seqdata += (*size);
-		}
 		*iov = malloc(sizeof(struct iovec)*cnt);
 		passert(*iov);
 		cnt = 0;
@@ -2159,7 +2478,8 @@ void read_data_free_buff(void *vid,void *vrhead,struct iovec *iov) {
 		rln = rl->next;
 		rreq = rl->rreq;
 		rreq->lcnt--;
-		if (rreq->lcnt==0 && rreq->mode==FREE) {
+		// replies are sent without file lock, so file may be already closing - then release idle buffers here
+		if (rreq->lcnt==0 && (rreq->mode==FREE || (ind->closing && (rreq->mode==READY || rreq->mode==NEW)))) {
 			*(rreq->prev) = rreq->next;
 			if (rreq->next) {
 				rreq->next->prev = rreq->prev;
@@ -2420,14 +2740,15 @@ void* read_data_new(uint32_t inode) {
 	passert(ind);
 	ind->inode = inode;
 	ind->flengisvalid = 0;
-	ind->seqdata = 0;
 	ind->fleng = 0;
 	ind->status = 0;
 	ind->trycnt = 0;
 	ind->inqueue = 0;
 	ind->canmodatime = 1;
-	ind->readahead = 0;
-	ind->lastoffset = 0;
+	ind->rahistpos = 0;
+	ind->rahistcnt = 0;
+	memset(ind->streams,0,sizeof(ind->streams));
+	ind->fetchlatency = 0.0;
 	ind->closewaiting = 0;
 	ind->closing = 0;
 //	ind->mreq_time = 0.0;
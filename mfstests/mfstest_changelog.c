@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ *
+ * This file is part of MooseFS.
+ *
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ *
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "changelog.h"
+#include "binlog.h"
+#include "crc.h"
+
+#include "mfstest.h"
+
+#define OPCOUNT (CHLOP_COUNT-1)
+#define RECSIZE 4096
+
+/* minimal master environment for changelog.c */
+
+static uint64_t version;
+static uint8_t binarymode;
+static void (*reloadfn)(void);
+static void (*termfn)(void);
+
+static uint8_t lastrec[RECSIZE];
+static uint32_t lastleng;
+static uint64_t lastversion;
+
+uint64_t meta_version_inc(void) {
+	return version++;
+}
+
+uint64_t meta_version(void) {
+	return version;
+}
+
+uint32_t main_time(void) {
+	return 1500000000;
+}
+
+int main_minthread_create(pthread_t *th,uint8_t detached,void *(*fn)(void *),void *arg) {
+	(void)detached;
+	return (pthread_create(th,NULL,fn,arg)==0)?0:-1;
+}
+
+void main_reload_register(void (*fun)(void)) {
+	reloadfn = fun;
+}
+
+void main_destruct_register(void (*fun)(void)) {
+	termfn = fun;
+}
+
+void matomlserv_broadcast_logstring(uint64_t v,uint8_t *logstr,uint32_t logstrsize) {
+	lastversion = v;
+	lastleng = (logstrsize<=RECSIZE)?logstrsize:0;
+	memcpy(lastrec,logstr,lastleng);
+}
+
+void matomlserv_broadcast_logrotate(void) {
+}
+
+uint8_t cfg_getuint8(const char *name,uint8_t def) {
+	if (strcmp(name,"CHANGELOG_BINARY")==0) {
+		return binarymode;
+	}
+	return def;
+}
+
+uint16_t cfg_getuint16(const char *name,uint16_t def) {
+	if (strcmp(name,"CHANGELOG_PRESERVE_SECONDS")==0) {
+		return 0;
+	}
+	return def;
+}
+
+uint32_t cfg_getuint32(const char *name,uint32_t def) {
+	(void)name;
+	return def;
+}
+
+/* every operation with its text form as it was produced by changelog() */
+
+static const uint8_t tname1[] = "a,b(c)%\001";
+static const char tname1esc[] = "a%2Cb%28c%29%25%01";
+static const uint8_t tname2[] = "file.txt";
+
+#define TS 1234567890U
+#define TI 4000000000U
+#define TQ UINT64_C(0xFEDCBA9876543210)
+
+static void changelog_test_emit(uint8_t opcode,char *legacy,uint32_t size) {
+	switch (opcode) {
+		case CHLOP_ACCESS:
+			changelog_op(opcode,TS,TI);
+			snprintf(legacy,size,"%"PRIu32"|ACCESS(%"PRIu32")",TS,TI);
+			break;
+		case CHLOP_ATTR:
+			changelog_op(opcode,TS,TI,(uint16_t)0xFFFF,1U,2U,TS+1,TS+2);
+			snprintf(legacy,size,"%"PRIu32"|ATTR(%"PRIu32",%"PRIu16",%"PRIu32",%"PRIu32",%"PRIu32",%"PRIu32")",TS,TI,(uint16_t)0xFFFF,1U,2U,TS+1,TS+2);
+			break;
+		case CHLOP_CREATE:
+			changelog_op(opcode,TS,1U,(uint32_t)(sizeof(tname1)-1),tname1,(uint8_t)255,(uint16_t)0755,(uint16_t)022,1000U,TI,0U,77U);
+			snprintf(legacy,size,"%"PRIu32"|CREATE(%"PRIu32",%s,%"PRIu8",%"PRIu16",%"PRIu16",%"PRIu32",%"PRIu32",%"PRIu32"):%"PRIu32,TS,1U,tname1esc,(uint8_t)255,(uint16_t)0755,(uint16_t)022,1000U,TI,0U,77U);
+			break;
+		case CHLOP_UNLINK:
+			changelog_op(opcode,TS,1U,(uint32_t)(sizeof(tname2)-1),tname2,TI);
+			snprintf(legacy,size,"%"PRIu32"|UNLINK(%"PRIu32",%s):%"PRIu32,TS,1U,(const char*)tname2,TI);
+			break;
+		case CHLOP_MOVE:
+			changelog_op(opcode,TS,1U,(uint32_t)(sizeof(tname1)-1),tname1,2U,(uint32_t)(sizeof(tname2)-1),tname2,TI);
+			snprintf(legacy,size,"%"PRIu32"|MOVE(%"PRIu32",%s,%"PRIu32",%s):%"PRIu32,TS,1U,tname1esc,2U,(const char*)tname2,TI);
+			break;
+		case CHLOP_LINK:
+			changelog_op(opcode,TS,TI,2U,(uint32_t)0,tname2);
+			snprintf(legacy,size,"%"PRIu32"|LINK(%"PRIu32",%"PRIu32",%s)",TS,TI,2U,"");
+			break;
+		case CHLOP_LENGTH:
+			changelog_op(opcode,TS,TI,TQ,1);
+			snprintf(legacy,size,"%"PRIu32"|LENGTH(%"PRIu32",%"PRIu64",%u)",TS,TI,TQ,1);
+			break;
+		case CHLOP_WRITE:
+			changelog_op(opcode,TS,TI,12U,(uint8_t)1,0,TQ);
+			snprintf(legacy,size,"%"PRIu32"|WRITE(%"PRIu32",%"PRIu32",%"PRIu8",%u):%"PRIu64,TS,TI,12U,(uint8_t)1,0,TQ);
+			break;
+		case CHLOP_UNLOCK:
+			changelog_op(opcode,TS,TQ);
+			snprintf(legacy,size,"%"PRIu32"|UNLOCK(%"PRIu64")",TS,TQ);
+			break;
+		case CHLOP_TRUNC:
+			changelog_op(opcode,TS,TI,3U,TQ);
+			snprintf(legacy,size,"%"PRIu32"|TRUNC(%"PRIu32",%"PRIu32"):%"PRIu64,TS,TI,3U,TQ);
+			break;
+		case CHLOP_ACQUIRE:
+			changelog_op(opcode,TS,5U,TI);
+			snprintf(legacy,size,"%"PRIu32"|ACQUIRE(%"PRIu32",%"PRIu32")",TS,5U,TI);
+			break;
+		case CHLOP_RELEASE:
+			changelog_op(opcode,TS,5U,TI);
+			snprintf(legacy,size,"%"PRIu32"|RELEASE(%"PRIu32",%"PRIu32")",TS,5U,TI);
+			break;
+		case CHLOP_INCVERSION:
+			changelog_op(opcode,TS,TQ);
+			snprintf(legacy,size,"%"PRIu32"|INCVERSION(%"PRIu64")",TS,TQ);
+			break;
+		case CHLOP_CHUNKADD:
+			changelog_op(opcode,TS,TQ,TI,TS+3);
+			snprintf(legacy,size,"%"PRIu32"|CHUNKADD(%"PRIu64",%"PRIu32",%"PRIu32")",TS,TQ,TI,TS+3);
+			break;
+		case CHLOP_CHUNKDEL:
+			changelog_op(opcode,TS,TQ,TI);
+			snprintf(legacy,size,"%"PRIu32"|CHUNKDEL(%"PRIu64",%"PRIu32")",TS,TQ,TI);
+			break;
+		default:
+			legacy[0] = 0;
+	}
+}
+
+int main(void) {
+	static uint8_t records[2*OPCOUNT][RECSIZE];
+	static uint32_t recleng[2*OPCOUNT];
+	char legacy[RECSIZE],text[RECSIZE];
+	char tmpdir[] = "/tmp/mfstest_changelog.XXXXXX";
+	uint8_t buff[RECSIZE];
+	uint64_t v,validsize;
+	uint32_t leng,cnt;
+	uint8_t opcode;
+	long pos;
+	FILE *fd;
+	int r;
+
+	mfstest_init();
+	mycrc32_init();
+
+	if (mkdtemp(tmpdir)==NULL || chdir(tmpdir)<0) {
+		printf("can't create temporary directory\n");
+		return 1;
+	}
+
+	binarymode = 1;
+	version = 1;
+	changelog_init();
+
+	mfstest_start(changelog_op_binary);
+	for (opcode=1 ; opcode<CHLOP_COUNT ; opcode++) {
+		lastleng = 0;
+		changelog_test_emit(opcode,legacy,RECSIZE);
+		mfstest_assert_uint64_eq(lastversion,opcode);
+		mfstest_assert_uint8_eq(CHLOP_ISBINARY(lastrec),1);
+		mfstest_assert_uint8_eq(lastrec[0],opcode);
+		mfstest_assert_int32_eq(changelog_bin_check(lastrec,lastleng),0);
+		mfstest_assert_int32_eq(changelog_bin_check(lastrec,lastleng-1),-1);
+		mfstest_assert_int32_eq(changelog_bin_check(lastrec,lastleng+1),-1);
+		leng = changelog_bin_to_text(lastrec,lastleng,text,RECSIZE);
+		mfstest_assert_uint32_eq(leng,strlen(legacy)+1);
+		if (strcmp(text,legacy)!=0) {
+			printf("opcode %"PRIu8": '%s' != '%s'\n",opcode,text,legacy);
+		}
+		mfstest_assert_int32_eq(strcmp(text,legacy),0);
+		// text must not be produced when it does not fit into the buffer
+		mfstest_assert_uint32_eq(changelog_bin_to_text(lastrec,lastleng,text,strlen(legacy)),0);
+		memcpy(records[opcode-1],lastrec,lastleng);
+		recleng[opcode-1] = lastleng;
+	}
+	lastrec[0] = CHLOP_COUNT;
+	mfstest_assert_int32_eq(changelog_bin_check(lastrec,lastleng),-1);
+	mfstest_end();
+
+	// text setting - records sent to metaloggers must be exactly the legacy lines
+	binarymode = 0;
+	reloadfn();
+
+	mfstest_start(changelog_op_text);
+	for (opcode=1 ; opcode<CHLOP_COUNT ; opcode++) {
+		lastleng = 0;
+		changelog_test_emit(opcode,legacy,RECSIZE);
+		mfstest_assert_uint64_eq(lastversion,OPCOUNT+opcode);
+		mfstest_assert_uint8_eq(CHLOP_ISBINARY(lastrec),0);
+		mfstest_assert_uint32_eq(lastleng,strlen(legacy)+1);
+		lastrec[RECSIZE-1] = 0;
+		mfstest_assert_int32_eq(strcmp((char*)lastrec,legacy),0);
+		memcpy(records[OPCOUNT+opcode-1],lastrec,lastleng);
+		recleng[OPCOUNT+opcode-1] = lastleng;
+	}
+	mfstest_end();
+
+	termfn();
+
+	// format of file is chosen when it is created, so all records above went to one binary file
+	mfstest_start(changelog_file);
+	fd = fopen("changelog.0.mfs","r+b");
+	mfstest_assert_int32_eq(fd!=NULL,1);
+	if (fd!=NULL) {
+		mfstest_assert_int32_eq(binlog_isbinary(fileno(fd)),1);
+		fseek(fd,BINLOG_HEADER_SIZE,SEEK_SET);
+		cnt = 0;
+		while ((r=binlog_readrecord(fd,&v,buff,RECSIZE,&leng))==1 && cnt<2*OPCOUNT) {
+			mfstest_assert_uint64_eq(v,cnt+1);
+			mfstest_assert_uint32_eq(leng,recleng[cnt]);
+			mfstest_assert_int32_eq(memcmp(buff,records[cnt],leng),0);
+			cnt++;
+		}
+		mfstest_assert_int32_eq(r,0);
+		mfstest_assert_uint32_eq(cnt,2*OPCOUNT);
+		mfstest_assert_uint64_eq(binlog_findfirstversion(fileno(fd)),1);
+		mfstest_assert_uint64_eq(binlog_findlastversion(fileno(fd),&validsize),2*OPCOUNT);
+
+		// damage one byte of the second record data - crc has to catch it
+		pos = BINLOG_HEADER_SIZE + (recleng[0]+BINLOG_RECORD_OVERHEAD) + 12;
+		fseek(fd,pos,SEEK_SET);
+		buff[0] = records[1][0] ^ 0x40;
+		fwrite(buff,1,1,fd);
+		fflush(fd);
+		fseek(fd,BINLOG_HEADER_SIZE,SEEK_SET);
+		mfstest_assert_int32_eq(binlog_readrecord(fd,&v,buff,RECSIZE,&leng),1);
+		mfstest_assert_uint64_eq(v,1);
+		mfstest_assert_int32_eq(binlog_readrecord(fd,&v,buff,RECSIZE,&leng),-1);
+		fclose(fd);
+	}
+	mfstest_end();
+
+	unlink("changelog.0.mfs");
+	if (chdir("/")==0) {
+		rmdir(tmpdir);
+	}
+
+	mfstest_return();
+}
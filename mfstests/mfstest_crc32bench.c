@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clocks.h"
+#include "crc.h"
+
+#include "mfstest.h"
+
+#define BENCH_BLOCKSIZE 65536
+#define BENCH_BLOCKS 256
+#define BENCH_COMBINES 1000000
+
+uint32_t simple_pseudo_random(void) {
+	static uint32_t u=1249853491;
+	static uint32_t v=3456394786;
+
+	v = 36969*(v & 65535) + (v >> 16);
+	u = 18000*(u & 65535) + (u >> 16);
+
+	return (v << 16) + u;
+}
+
+static double crc_bench(const uint8_t *buff,uint32_t *res) {
+	double st;
+	uint32_t i,crc;
+
+	crc = 0;
+	st = monotonic_seconds();
+	for (i=0 ; i<BENCH_BLOCKS ; i++) {
+		crc ^= mycrc32(0,buff+(i%16)*BENCH_BLOCKSIZE,BENCH_BLOCKSIZE);
+	}
+	*res = crc;
+	return monotonic_seconds()-st;
+}
+
+static double combine_bench(uint32_t *res) {
+	double st;
+	uint32_t i,crc;
+
+	crc = 0;
+	st = monotonic_seconds();
+	for (i=0 ; i<BENCH_COMBINES ; i++) {
+		crc = mycrc32_combine(crc,i,(i*2654435761U)&0xFFFFF);
+	}
+	*res = crc;
+	return monotonic_seconds()-st;
+}
+
+int main(void) {
+	uint8_t *buff;
+	uint32_t i,j,s,l,crc1,crc2;
+	uint8_t hw;
+	double swtime,hwtime;
+
+	mfstest_init();
+
+	mycrc32_init();
+
+	mfstest_start(crc32bench);
+
+	buff = malloc(16*BENCH_BLOCKSIZE+64);
+	if (buff==NULL) {
+		return 99;
+	}
+	for (i=0 ; i<16*BENCH_BLOCKSIZE+64 ; i++) {
+		buff[i] = simple_pseudo_random();
+	}
+
+	hw = mycrc32_hwaccel(1);
+	printf("accelerated kernel: %s\n",hw?mycrc32_kernel():"not available");
+
+	printf("mycrc32 - accelerated vs table (lengths 0..1100, all alignments)\n");
+
+	for (l=0 ; l<=1100 ; l++) {
+		for (i=0 ; i<16 ; i+=5) {
+			s = simple_pseudo_random();
+			mycrc32_hwaccel(0);
+			crc1 = mycrc32(s,buff+i,l);
+			mycrc32_hwaccel(1);
+			crc2 = mycrc32(s,buff+i,l);
+			mfstest_assert_uint32_eq(crc1,crc2);
+		}
+	}
+
+	printf("mycrc32_combine - accelerated vs table\n");
+
+	for (j=0 ; j<2000 ; j++) {
+		s = simple_pseudo_random();
+		l = (j<64)?j:simple_pseudo_random()>>(j%32);
+		mycrc32_hwaccel(0);
+		crc1 = mycrc32_combine(s,j,l);
+		mycrc32_hwaccel(1);
+		crc2 = mycrc32_combine(s,j,l);
+		mfstest_assert_uint32_eq(crc1,crc2);
+	}
+
+	printf("mycrc32 speed\n");
+
+	mycrc32_hwaccel(0);
+	crc_bench(buff,&crc1);
+	swtime = crc_bench(buff,&crc1);
+	mycrc32_hwaccel(1);
+	crc_bench(buff,&crc2);
+	hwtime = crc_bench(buff,&crc2);
+	mfstest_assert_uint32_eq(crc1,crc2);
+	printf("block 64k ; %s: %.2lfMB/s ; %s: %.2lfMB/s ; speedup: %.2lf\n","slicing-by-8",BENCH_BLOCKS/(16.0*swtime),mycrc32_kernel(),BENCH_BLOCKS/(16.0*hwtime),swtime/hwtime);
+
+	printf("mycrc32_combine speed\n");
+
+	mycrc32_hwaccel(0);
+	swtime = combine_bench(&crc1);
+	mycrc32_hwaccel(1);
+	hwtime = combine_bench(&crc2);
+	mfstest_assert_uint32_eq(crc1,crc2);
+	printf("combine ; table: %.2lfM/s ; %s: %.2lfM/s ; speedup: %.2lf\n",BENCH_COMBINES/(1000000.0*swtime),mycrc32_kernel(),BENCH_COMBINES/(1000000.0*hwtime),swtime/hwtime);
+
+	free(buff);
+
+	mfstest_end();
+	mfstest_return();
+}
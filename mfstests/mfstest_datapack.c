@@ -89,6 +89,33 @@ int main(void) {
 		mfstest_assert_uint8_eq(rp[i],((15-i)*0x10)+i);
 	}
 	mfstest_end();
+
+	wp = (uint8_t*)buff;
+	putvar64bit(&wp,0x7F);
+	putvar64bit(&wp,0x80);
+	putvar64bit(&wp,0x3FFF);
+	mfstest_start(putvarbit);
+	mfstest_assert_uint32_eq(wp-(uint8_t*)buff,5);
+	rp = (uint8_t*)buff;
+	mfstest_assert_uint8_eq(rp[0],0x7F);
+	mfstest_assert_uint8_eq(rp[1],0x80);
+	mfstest_assert_uint8_eq(rp[2],0x01);
+	mfstest_assert_uint8_eq(rp[3],0xFF);
+	mfstest_assert_uint8_eq(rp[4],0x7F);
+	mfstest_end();
+
+	wp = (uint8_t*)buff;
+	putvar64bit(&wp,0);
+	putvar64bit(&wp,0xFFFFFFFFFFFFFFFFULL);
+	putvar64bit(&wp,0x12345);
+	mfstest_start(getvarbit);
+	mfstest_assert_uint32_eq(wp-(uint8_t*)buff,14);
+	rp = (uint8_t*)buff;
+	mfstest_assert_uint64_eq(getvar64bit(&rp),0);
+	mfstest_assert_uint64_eq(getvar64bit(&rp),0xFFFFFFFFFFFFFFFFULL);
+	mfstest_assert_uint64_eq(getvar64bit(&rp),0x12345);
+	mfstest_assert_uint32_eq(rp-(uint8_t*)buff,14);
+	mfstest_end();
 	mfstest_return();
 }
 
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2015 Jakub Kruszona-Zawadzki, Core Technology Sp. z o.o.
+ * 
+ * This file is part of MooseFS.
+ * 
+ * MooseFS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2 (only).
+ * 
+ * MooseFS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with MooseFS; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clocks.h"
+#include "gf256.h"
+
+#include "mfstest.h"
+
+#define BENCH_BLOCKSIZE 65536
+#define BENCH_BLOCKS 256
+#define BENCH_SOURCES 8
+#define TEST_MAXLENG 600
+
+uint32_t simple_pseudo_random(void) {
+	static uint32_t u=1249853491;
+	static uint32_t v=3456394786;
+
+	v = 36969*(v & 65535) + (v >> 16);
+	u = 18000*(u & 65535) + (u >> 16);
+
+	return (v << 16) + u;
+}
+
+static uint8_t reference_mul(uint8_t a,uint8_t b) {
+	uint16_t x;
+	uint8_t r;
+
+	x = a;
+	r = 0;
+	while (b) {
+		if (b&1) {
+			r ^= x;
+		}
+		x <<= 1;
+		if (x&0x100) {
+			x ^= 0x11D;
+		}
+		b >>= 1;
+	}
+	return r;
+}
+
+static double xor_bench(uint8_t *dst,const uint8_t *buff) {
+	double st;
+	uint32_t i;
+
+	st = monotonic_seconds();
+	for (i=0 ; i<BENCH_BLOCKS ; i++) {
+		gf256_xor(dst,buff+(i%BENCH_SOURCES)*BENCH_BLOCKSIZE,BENCH_BLOCKSIZE);
+	}
+	return monotonic_seconds()-st;
+}
+
+static double xormulti_bench(uint8_t *dst,const uint8_t * const *srcs) {
+	double st;
+	uint32_t i;
+
+	st = monotonic_seconds();
+	for (i=0 ; i<BENCH_BLOCKS/BENCH_SOURCES ; i++) {
+		gf256_xormulti(dst,srcs,BENCH_SOURCES,BENCH_BLOCKSIZE);
+	}
+	return monotonic_seconds()-st;
+}
+
+static double muladd_bench(uint8_t *dst,const uint8_t *buff) {
+	double st;
+	uint32_t i;
+
+	st = monotonic_seconds();
+	for (i=0 ; i<BENCH_BLOCKS ; i++) {
+		gf256_muladd(dst,buff+(i%BENCH_SOURCES)*BENCH_BLOCKSIZE,i|2,BENCH_BLOCKSIZE);
+	}
+	return monotonic_seconds()-st;
+}
+
+int main(void) {
+	uint8_t *buff,*dst,*exp;
+	const uint8_t *srcs[BENCH_SOURCES+1];
+	uint32_t a,b,i,l,n,o,errors;
+	uint8_t c,level,inuse;
+	double xortime,multitime,mtime;
+
+	mfstest_init();
+
+	gf256_init();
+
+	mfstest_start(gf256);
+
+	buff = malloc(BENCH_SOURCES*BENCH_BLOCKSIZE+64);
+	dst = malloc(BENCH_BLOCKSIZE+64);
+	exp = malloc(BENCH_BLOCKSIZE+64);
+	if (buff==NULL || dst==NULL || exp==NULL) {
+		return 99;
+	}
+	for (i=0 ; i<BENCH_SOURCES*BENCH_BLOCKSIZE+64 ; i++) {
+		buff[i] = simple_pseudo_random();
+	}
+
+	printf("gf256_mul / gf256_inv - table vs reference\n");
+
+	errors = 0;
+	for (a=0 ; a<256 ; a++) {
+		for (b=0 ; b<256 ; b++) {
+			if (gf256_mul(a,b)!=reference_mul(a,b)) {
+				errors++;
+			}
+		}
+	}
+	mfstest_assert_uint32_eq(errors,0);
+	for (a=1 ; a<256 ; a++) {
+		mfstest_assert_uint8_eq(gf256_mul(a,gf256_inv(a)),1);
+	}
+
+	for (level=0 ; level<255 ; level++) {
+		inuse = gf256_hwaccel(level);
+		if (inuse<level) {
+			break;
+		}
+		printf("kernel %s - xor / xormulti / muladd vs reference (lengths 0..%u, all alignments)\n",gf256_kernel(),TEST_MAXLENG);
+		for (l=0 ; l<=TEST_MAXLENG ; l++) {
+			for (o=0 ; o<8 ; o+=3) {
+				errors = 0;
+
+				memcpy(dst+o,buff+BENCH_BLOCKSIZE,l);
+				memcpy(exp+o,buff+BENCH_BLOCKSIZE,l);
+				gf256_xor(dst+o,buff+o+1,l);
+				for (i=0 ; i<l ; i++) {
+					exp[o+i] ^= buff[o+1+i];
+				}
+				errors += (memcmp(dst+o,exp+o,l)!=0);
+
+				n = 1+(l%BENCH_SOURCES);
+				for (i=0 ; i<n ; i++) {
+					srcs[i] = buff+i*BENCH_BLOCKSIZE+((o+i)&7);
+				}
+				gf256_xormulti(dst+o,srcs,n,l);
+				for (i=0 ; i<l ; i++) {
+					exp[o+i] = srcs[0][i];
+					for (a=1 ; a<n ; a++) {
+						exp[o+i] ^= srcs[a][i];
+					}
+				}
+				errors += (memcmp(dst+o,exp+o,l)!=0);
+
+				c = simple_pseudo_random();
+				gf256_muladd(dst+o,buff+2*BENCH_BLOCKSIZE+o+5,c,l);
+				for (i=0 ; i<l ; i++) {
+					exp[o+i] ^= reference_mul(c,buff[2*BENCH_BLOCKSIZE+o+5+i]);
+				}
+				errors += (memcmp(dst+o,exp+o,l)!=0);
+
+				mfstest_assert_uint32_eq(errors,0);
+			}
+		}
+	}
+
+	printf("speed (block 64k, xormulti with %u sources)\n",BENCH_SOURCES);
+
+	for (i=0 ; i<BENCH_SOURCES ; i++) {
+		srcs[i] = buff+i*BENCH_BLOCKSIZE;
+	}
+	for (level=0 ; level<255 ; level++) {
+		inuse = gf256_hwaccel(level);
+		if (inuse<level) {
+			break;
+		}
+		memset(dst,0,BENCH_BLOCKSIZE);
+		xor_bench(dst,buff);
+		xortime = xor_bench(dst,buff);
+		xormulti_bench(dst,srcs);
+		multitime = xormulti_bench(dst,srcs);
+		muladd_bench(dst,buff);
+		mtime = muladd_bench(dst,buff);
+		printf("%-12s ; xor: %.2lfMB/s ; xormulti: %.2lfMB/s ; muladd: %.2lfMB/s\n",gf256_kernel(),BENCH_BLOCKS/(16.0*xortime),BENCH_BLOCKS/(16.0*multitime),BENCH_BLOCKS/(16.0*mtime));
+	}
+
+	gf256_hwaccel(255);
+
+	free(buff);
+	free(dst);
+	free(exp);
+
+	mfstest_end();
+	mfstest_return();
+}